@@ -0,0 +1,177 @@
+#include "DepthMapCache.h"
+
+#include <cstring>
+#include <iostream>
+
+bool DepthMapCache::Views::operator==(const Views &o) const
+{
+	// Bitwise, as the same inputs give the same floats; a light moved back to where it was is a miss, which is safe
+	return key == o.key && models.size() == o.models.size() &&
+		   memcmp(light.values, o.light.values, sizeof(light.values)) == 0 &&
+		   (models.empty() || memcmp(&models[0], &o.models[0], models.size() * sizeof(Matrix4)) == 0);
+}
+
+DepthMapCache::DepthMapCache()
+{
+	valid = false;
+	drawn.key = current.key = 0;
+
+	ResetCounters();
+}
+
+void DepthMapCache::Begin(const Matrix4 &light, unsigned int key)
+{
+	current.light = light;
+	current.key = key;
+	current.models.clear();
+}
+
+void DepthMapCache::AddModel(const Matrix4 &model)
+{
+	current.models.push_back(model);
+}
+
+void DepthMapCache::AddModels(const std::vector<Matrix4> &models)
+{
+	current.models.insert(current.models.end(), models.begin(), models.end());
+}
+
+bool DepthMapCache::End()
+{
+	if (valid && current == drawn)
+	{
+		++hits;
+		return false;
+	}
+
+	// Swapped rather than copied; Begin clears what's left in current
+	drawn.models.swap(current.models);
+	drawn.light = current.light;
+	drawn.key = current.key;
+	valid = true;
+
+	++misses;
+	return true;
+}
+
+void DepthMapCache::Invalidate()
+{
+	valid = false;
+}
+
+void DepthMapCache::ResetCounters()
+{
+	hits = 0;
+	misses = 0;
+}
+
+void DepthMapCache::PrintStats(const std::string &name) const
+{
+	unsigned int frames = hits + misses;
+
+	std::cout << name << " depth maps: " << hits << " of " << frames << " frames served from the cache";
+
+	if (frames > 0)
+	{
+		std::cout << " (" << 100.0f * hits / frames << "%)";
+	}
+	std::cout << std::endl;
+}
+
+bool DepthMapCache::Check()
+{
+	DepthMapCache cache;
+	bool passed = true;
+
+	Matrix4 light = Matrix4::Perspective(0.1f, 10.0f, 1.0f, 25.0f) *
+					Matrix4::BuildViewMatrix(Vector3(0.0f, 0.5f, 1.0f), Vector3(0.0f, 0.0f, 0.0f));
+	Matrix4 moved = Matrix4::Perspective(0.1f, 10.0f, 1.0f, 25.0f) *
+					Matrix4::BuildViewMatrix(Vector3(0.009f, 0.5f, 1.0f), Vector3(0.0f, 0.0f, 0.0f));
+
+	std::vector<Matrix4> grid(9);
+
+	for (unsigned int i = 0; i < grid.size(); ++i)
+	{
+		grid[i] = Matrix4::Translation(Vector3((i % 3) * 0.5f, 0.0f, (i / 3) * 0.5f));
+	}
+
+	std::vector<Matrix4> nudged = grid;
+	nudged[4] = Matrix4::Translation(Vector3(0.5f, 0.01f, 0.5f));
+
+	/*
+	 * A frame each: the light, the key, the models, whether the cache is
+	 * invalidated first, and whether the maps should be drawn
+	 */
+	struct Frame
+	{
+		const Matrix4 *					light;
+		unsigned int					key;
+		const std::vector<Matrix4> *	models;
+		bool							invalidate;
+		bool							draw;
+	};
+
+	const Frame frames[] =
+	{
+		{ &light, 0, &grid, false, true },		// nothing drawn yet
+		{ &light, 0, &grid, false, false },
+		{ &light, 0, &grid, false, false },
+		{ &moved, 0, &grid, false, true },		// the light moved
+		{ &moved, 0, &grid, false, false },
+		{ &moved, 0, &nudged, false, true },	// one of the meshes moved
+		{ &moved, 0, &nudged, false, false },
+		{ &moved, 1, &nudged, false, true },	// another mesh, or more layers
+		{ &moved, 1, &nudged, true, true },		// the maps were lost
+		{ &moved, 1, &nudged, false, false },
+	};
+	const unsigned int numFrames = sizeof(frames) / sizeof(frames[0]);
+
+	unsigned int kept = 0;
+
+	for (unsigned int f = 0; f < numFrames; ++f)
+	{
+		if (frames[f].invalidate)
+		{
+			cache.Invalidate();
+		}
+
+		cache.Begin(*frames[f].light, frames[f].key);
+		cache.AddModels(*frames[f].models);
+
+		bool draw = cache.End();
+		kept += frames[f].draw ? 0 : 1;
+
+		if (draw != frames[f].draw)
+		{
+			std::cout << "DepthMapCache::Check: Frame " << f << (draw ? " drew" : " kept")
+					  << " the maps, expected it to " << (frames[f].draw ? "draw" : "keep") << " them" << std::endl;
+			passed = false;
+		}
+	}
+
+	// A mesh left out has to count as a change, even though the ones drawn haven't moved
+	cache.Begin(light, 1);
+	cache.AddModels(nudged);
+	cache.End();
+
+	cache.Begin(light, 1);
+	cache.AddModels(std::vector<Matrix4>(nudged.begin(), nudged.end() - 1));
+
+	if (!cache.End())
+	{
+		std::cout << "DepthMapCache::Check: Dropping a mesh didn't draw the maps" << std::endl;
+		passed = false;
+	}
+
+	if (cache.GetHits() != kept || cache.GetHits() + cache.GetMisses() != numFrames + 2)
+	{
+		std::cout << "DepthMapCache::Check: Counted " << cache.GetHits() << " hits and " << cache.GetMisses()
+				  << " misses, expected " << kept << " hits" << std::endl;
+		passed = false;
+	}
+
+	cache.PrintStats("DepthMapCache::Check");
+	std::cout << "DepthMapCache::Check: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+ * Works out whether depth maps drawn from a light can be kept from the last
+ * frame they were drawn in, rather than drawn again.
+ *
+ * Every frame, the views are described by what they'd be drawn from: the
+ * light's view projection matrix, the model matrix of every mesh drawn into
+ * them, and a key standing for everything else that changes what ends up in
+ * them (which mesh, the frame of its animation, the layers drawn). If all of
+ * that is what the maps were last drawn from, they still hold the same depths.
+ *
+ * Nothing in it touches OpenGL, so it can be checked without a context. The
+ * maps themselves have to be kept between frames by whoever draws them, and
+ * anything that loses or overwrites them has to Invalidate it.
+ */
+#include <vector>
+#include <string>
+
+#include "Matrix4.h"
+
+class DepthMapCache
+{
+public:
+	DepthMapCache();
+
+	// Starts describing this frame's views
+	void Begin(const Matrix4 &light, unsigned int key);
+
+	void AddModel(const Matrix4 &model);
+	void AddModels(const std::vector<Matrix4> &models);
+
+	/*
+	 * Whether the views described since Begin differ from the ones the maps
+	 * were last drawn from, in which case they're taken to be drawn this frame
+	 */
+	bool End();
+
+	// The maps are gone, or hold something else; the next frame draws them whatever it describes
+	void Invalidate();
+
+	// Frames the maps were kept through, and frames they had to be drawn in
+	unsigned int GetHits() const	{ return hits; }
+	unsigned int GetMisses() const	{ return misses; }
+
+	void ResetCounters();
+	void PrintStats(const std::string &name) const;
+
+	// Runs frames of a moving light and changing meshes through a cache, checking which it keeps
+	static bool Check();
+
+protected:
+	struct Views
+	{
+		bool operator==(const Views &o) const;
+
+		Matrix4					light;
+		unsigned int			key;
+		std::vector<Matrix4>	models;
+	};
+
+	Views	drawn;		// What the maps hold, if valid
+	Views	current;	// What this frame's are described as
+	bool	valid;
+
+	unsigned int	hits;
+	unsigned int	misses;
+};
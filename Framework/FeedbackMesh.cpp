@@ -0,0 +1,136 @@
+#include "FeedbackMesh.h"
+
+#include "GLStateCache.h"
+
+// A vec3 position then a vec2 texCoord, as the vertex array reads them
+#define FEEDBACKMESH_VERTEX_FLOATS	5
+
+const char *FeedbackMesh::varyings[FEEDBACKMESH_VARYINGS] = { "feedbackPosition", "feedbackTexCoord" };
+
+FeedbackMesh::FeedbackMesh()
+{
+	glGenTransformFeedbacks(1, &feedback);
+	glGenBuffers(1, &buffer);
+
+	maxVertices = 0;
+	captured = false;
+
+	query = 0;
+	pending = false;
+	counting = false;
+
+	// The attributes point at the buffer object itself, so Reserve can grow it without setting them up again
+	GLStateCache::Get().BindVertexArray(arrayObject);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	GLsizei stride = FEEDBACKMESH_VERTEX_FLOATS * sizeof(float);
+
+	glVertexAttribPointer(VERTEX_BUFFER, 3, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(VERTEX_BUFFER);
+
+	glVertexAttribPointer(TEXTURE_BUFFER, 2, GL_FLOAT, GL_FALSE, stride, (const GLvoid*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(TEXTURE_BUFFER);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+FeedbackMesh::~FeedbackMesh()
+{
+	glDeleteTransformFeedbacks(1, &feedback);
+	glDeleteBuffers(1, &buffer);
+
+	if (query)
+	{
+		glDeleteQueries(1, &query);
+	}
+}
+
+void FeedbackMesh::Reserve(unsigned int vertices)
+{
+	if (vertices <= maxVertices)
+	{
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices * FEEDBACKMESH_VERTEX_FLOATS * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The feedback object keeps which buffer it writes to, bound again for the new storage's size
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+	maxVertices = vertices;
+	captured = false;
+}
+
+void FeedbackMesh::BeginCapture(GLenum primitive)
+{
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+
+	// Only one count is asked for at a time; captures while it's on its way back go uncounted
+	counting = !pending;
+
+	if (counting)
+	{
+		if (!query)
+		{
+			glGenQueries(1, &query);
+		}
+
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+	}
+
+	glBeginTransformFeedback(primitive);
+	type = primitive;
+}
+
+void FeedbackMesh::EndCapture()
+{
+	glEndTransformFeedback();
+
+	if (counting)
+	{
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		pending = true;
+		counting = false;
+	}
+
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	captured = true;
+}
+
+void FeedbackMesh::Draw()
+{
+	if (!captured)
+	{
+		return;
+	}
+
+	BindForDraw();
+	glDrawTransformFeedback(type, feedback);
+}
+
+bool FeedbackMesh::CollectPrimitivesWritten(unsigned int &primitives)
+{
+	if (!pending)
+	{
+		return false;
+	}
+
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (!available)
+	{
+		return false;
+	}
+
+	GLuint written = 0;
+	glGetQueryObjectuiv(query, GL_QUERY_RESULT, &written);
+	pending = false;
+
+	primitives = written;
+	return true;
+}
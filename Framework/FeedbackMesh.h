@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * A mesh whose vertices are written by a shader, through transform feedback,
+ * and drawn straight from where they were written, so how many there are
+ * never has to come back to the CPU before the mesh can be drawn.
+ *
+ * The program writing them captures FEEDBACKMESH_VARYINGS outputs for each
+ * vertex, named in FeedbackMesh::varyings: a vec3 position and a vec2
+ * texCoord (Shader::SetFeedbackVaryings, before it's linked). The vertex
+ * array reads them back as the position and texCoord attributes, so any
+ * shader that draws a mesh draws this one.
+ *
+ * How many primitives each capture wrote is asked of the GPU too, and picked
+ * up when it's got that far, a frame or so later, as GPUTimer picks up its
+ * timings, so nothing waits on it.
+ */
+#include "Mesh.h"
+
+#define FEEDBACKMESH_VARYINGS	2
+
+class FeedbackMesh : public Mesh
+{
+public:
+	FeedbackMesh();
+	~FeedbackMesh();
+
+	// Makes room for this many vertices, throwing away what's been written if it has to grow
+	void Reserve(unsigned int vertices);
+	unsigned int GetMaxVertices() const		{ return maxVertices; }
+
+	/*
+	 * What the program in use draws between these becomes the mesh, as
+	 * primitive (GL_POINTS, GL_LINES or GL_TRIANGLES, whatever the last stage
+	 * puts out). Anything past maxVertices is dropped.
+	 */
+	void BeginCapture(GLenum primitive);
+	void EndCapture();
+
+	// Draws whatever the last capture wrote, or nothing before the first
+	virtual void Draw();
+
+	// The primitives written by the last capture to come back, if one has since this was last asked
+	bool CollectPrimitivesWritten(unsigned int &primitives);
+
+	static const char *varyings[FEEDBACKMESH_VARYINGS];
+
+protected:
+	GLuint			feedback;
+	GLuint			buffer;
+	unsigned int	maxVertices;
+	bool			captured;
+
+	GLuint			query;		// Made on first use
+	bool			pending;
+	bool			counting;
+};
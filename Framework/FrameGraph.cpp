@@ -0,0 +1,605 @@
+#include "FrameGraph.h"
+
+#include <iostream>
+#include <iomanip>
+
+#include "Common.h"
+
+static const char * FormatName(RenderTargetFormat format)
+{
+	switch (format)
+	{
+	case RENDERTARGET_DEPTH24_STENCIL8:	return "D24S8";
+	case RENDERTARGET_DEPTH24:			return "D24";
+	default:							return "RGBA8";
+	}
+}
+
+FrameGraph::FrameGraph()
+{
+	Reset();
+}
+
+void FrameGraph::Reset()
+{
+	passes.clear();
+	targets.clear();
+	slots.clear();
+	compiled = false;
+	currentPass = -1;
+}
+
+unsigned int FrameGraph::AddTarget(const std::string &name, const RenderTargetDesc &desc, GLuint *binding)
+{
+	Target target;
+	target.name = name;
+	target.desc = desc;
+	target.binding = binding;
+	target.imported = false;
+	target.output = false;
+
+	targets.push_back(target);
+	compiled = false;
+
+	return (unsigned int)targets.size() - 1;
+}
+
+unsigned int FrameGraph::Import(const std::string &name, bool output)
+{
+	unsigned int target = AddTarget(name, RenderTargetDesc());
+
+	targets[target].imported = true;
+	targets[target].output = output;
+
+	return target;
+}
+
+unsigned int FrameGraph::AddPass(const std::string &name, const PassFunction &function)
+{
+	Pass pass;
+	pass.name = name;
+	pass.function = function;
+	pass.sideEffect = false;
+
+	passes.push_back(pass);
+	compiled = false;
+
+	return (unsigned int)passes.size() - 1;
+}
+
+void FrameGraph::Read(unsigned int pass, unsigned int target)
+{
+	Access access = { target, FRAMEGRAPH_WRITE };
+	passes[pass].reads.push_back(access);
+	compiled = false;
+}
+
+void FrameGraph::Write(unsigned int pass, unsigned int target, int flags)
+{
+	Access access = { target, flags };
+	passes[pass].writes.push_back(access);
+	compiled = false;
+}
+
+void FrameGraph::SetSideEffect(unsigned int pass)
+{
+	passes[pass].sideEffect = true;
+	compiled = false;
+}
+
+bool FrameGraph::Compile()
+{
+	compiled = false;
+
+	if (!Validate())
+	{
+		return false;
+	}
+
+	Cull();
+	PlanLifetimes();
+	PlanClearsAndBarriers();
+
+	compiled = true;
+	return true;
+}
+
+bool FrameGraph::Validate()
+{
+	bool valid = true;
+	std::vector<bool> written(targets.size(), false);
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		const Pass &pass = passes[p];
+
+		for (unsigned int r = 0; r < pass.reads.size(); ++r)
+		{
+			const Target &target = targets[pass.reads[r].target];
+
+			if (!target.imported && !written[pass.reads[r].target])
+			{
+				std::cout << "FrameGraph: " << pass.name << " reads " << target.name
+						  << ", which no earlier pass writes" << std::endl;
+				valid = false;
+			}
+
+			for (unsigned int w = 0; w < pass.writes.size(); ++w)
+			{
+				if (pass.writes[w].target == pass.reads[r].target)
+				{
+					std::cout << "FrameGraph: " << pass.name << " reads " << target.name
+							  << " while it's drawing into it" << std::endl;
+					valid = false;
+				}
+			}
+		}
+
+		for (unsigned int w = 0; w < pass.writes.size(); ++w)
+		{
+			written[pass.writes[w].target] = true;
+		}
+	}
+
+	return valid;
+}
+
+void FrameGraph::Cull()
+{
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		targets[t].refCount = targets[t].output ? 1 : 0;
+	}
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		Pass &pass = passes[p];
+
+		pass.culled = false;
+		pass.refCount = (unsigned int)pass.writes.size() + (pass.sideEffect ? 1 : 0);
+
+		for (unsigned int r = 0; r < pass.reads.size(); ++r)
+		{
+			++targets[pass.reads[r].target].refCount;
+		}
+	}
+
+	// Every pass nobody needs drops its reads, which can leave other targets
+	// unread in turn, and so on back up the frame
+	std::vector<unsigned int> unread;
+	std::vector<unsigned int> unneeded;
+
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		if (targets[t].refCount == 0)
+		{
+			unread.push_back(t);
+		}
+	}
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		if (passes[p].refCount == 0)
+		{
+			unneeded.push_back(p);
+		}
+	}
+
+	while (!unread.empty() || !unneeded.empty())
+	{
+		if (!unread.empty())
+		{
+			unsigned int t = unread.back();
+			unread.pop_back();
+
+			for (unsigned int p = 0; p < passes.size(); ++p)
+			{
+				for (unsigned int w = 0; w < passes[p].writes.size(); ++w)
+				{
+					if (passes[p].writes[w].target == t && passes[p].refCount > 0 && --passes[p].refCount == 0)
+					{
+						unneeded.push_back(p);
+					}
+				}
+			}
+			continue;
+		}
+
+		Pass &pass = passes[unneeded.back()];
+		unneeded.pop_back();
+
+		if (pass.culled)
+		{
+			continue;
+		}
+		pass.culled = true;
+
+		for (unsigned int r = 0; r < pass.reads.size(); ++r)
+		{
+			if (--targets[pass.reads[r].target].refCount == 0)
+			{
+				unread.push_back(pass.reads[r].target);
+			}
+		}
+	}
+}
+
+void FrameGraph::PlanLifetimes()
+{
+	slots.clear();
+
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		targets[t].first = -1;
+		targets[t].last = -1;
+		targets[t].slot = -1;
+	}
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		if (passes[p].culled)
+		{
+			continue;
+		}
+
+		for (int list = 0; list < 2; ++list)
+		{
+			const std::vector<Access> &accesses = list ? passes[p].writes : passes[p].reads;
+
+			for (unsigned int a = 0; a < accesses.size(); ++a)
+			{
+				Target &target = targets[accesses[a].target];
+
+				if (target.first < 0)
+				{
+					target.first = p;
+				}
+				target.last = p;
+			}
+		}
+	}
+
+	// Each target takes the texture most recently freed up with the same
+	// description, or a new one. Targets that start in a pass are given
+	// theirs before the ones that end in it give theirs up.
+	std::vector<int> freeSlots;
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		for (unsigned int t = 0; t < targets.size(); ++t)
+		{
+			Target &target = targets[t];
+
+			if (target.imported || target.first != (int)p)
+			{
+				continue;
+			}
+
+			for (int f = (int)freeSlots.size() - 1; f >= 0; --f)
+			{
+				const RenderTargetDesc &desc = slots[freeSlots[f]].desc;
+
+				if (!(desc < target.desc) && !(target.desc < desc))
+				{
+					target.slot = freeSlots[f];
+					freeSlots.erase(freeSlots.begin() + f);
+					break;
+				}
+			}
+
+			if (target.slot < 0)
+			{
+				Slot slot;
+				slot.desc = target.desc;
+				slot.texture = 0;
+				slot.last = -1;
+
+				target.slot = (int)slots.size();
+				slots.push_back(slot);
+			}
+
+			slots[target.slot].last = target.last;
+		}
+
+		for (unsigned int t = 0; t < targets.size(); ++t)
+		{
+			if (!targets[t].imported && targets[t].last == (int)p)
+			{
+				freeSlots.push_back(targets[t].slot);
+			}
+		}
+	}
+}
+
+void FrameGraph::PlanClearsAndBarriers()
+{
+	std::vector<bool> written(targets.size(), false);
+	std::vector<bool> imageWritten(targets.size(), false);
+
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		targets[t].clearPass = -1;
+	}
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		Pass &pass = passes[p];
+		pass.barrier = false;
+
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		// One barrier covers everything image stores have written so far
+		for (unsigned int r = 0; r < pass.reads.size(); ++r)
+		{
+			if (imageWritten[pass.reads[r].target])
+			{
+				pass.barrier = true;
+			}
+		}
+
+		if (pass.barrier)
+		{
+			imageWritten.assign(targets.size(), false);
+		}
+
+		for (unsigned int w = 0; w < pass.writes.size(); ++w)
+		{
+			unsigned int t = pass.writes[w].target;
+
+			if (!written[t] && (pass.writes[w].flags & FRAMEGRAPH_CLEAR))
+			{
+				targets[t].clearPass = p;
+			}
+
+			written[t] = true;
+			imageWritten[t] = (pass.writes[w].flags & FRAMEGRAPH_IMAGE) != 0;
+		}
+	}
+}
+
+void FrameGraph::Execute(RenderTargetPool &pool)
+{
+	if (!compiled)
+	{
+		std::cout << "FrameGraph::Execute: The graph hasn't been compiled!" << std::endl;
+		return;
+	}
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		Pass &pass = passes[p];
+
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (unsigned int t = 0; t < targets.size(); ++t)
+		{
+			Target &target = targets[t];
+
+			if (target.imported || target.first != (int)p)
+			{
+				continue;
+			}
+
+			Slot &slot = slots[target.slot];
+
+			if (!slot.texture)
+			{
+				slot.texture = pool.Acquire(slot.desc);
+			}
+
+			if (target.binding)
+			{
+				*target.binding = slot.texture;
+			}
+		}
+
+		// Only image stores can need one, and they're only there with EXT_shader_image_load_store
+		if (pass.barrier && glMemoryBarrierEXT)
+		{
+			glMemoryBarrierEXT(GL_TEXTURE_FETCH_BARRIER_BIT_EXT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT_EXT |
+							   GL_FRAMEBUFFER_BARRIER_BIT_EXT);
+		}
+
+		currentPass = p;
+
+		if (pass.function)
+		{
+			pass.function();
+		}
+
+		currentPass = -1;
+
+		for (unsigned int t = 0; t < targets.size(); ++t)
+		{
+			Target &target = targets[t];
+
+			if (target.imported || target.last != (int)p)
+			{
+				continue;
+			}
+
+			if (target.binding)
+			{
+				*target.binding = 0;
+			}
+
+			if (slots[target.slot].last == (int)p)
+			{
+				pool.Release(slots[target.slot].texture);
+			}
+		}
+	}
+}
+
+bool FrameGraph::NeedsClear(unsigned int target) const
+{
+	return currentPass >= 0 && targets[target].clearPass == currentPass;
+}
+
+unsigned int FrameGraph::GetNumCulled() const
+{
+	unsigned int culled = 0;
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		culled += passes[p].culled ? 1 : 0;
+	}
+	return culled;
+}
+
+int FrameGraph::FindPass(const std::string &name) const
+{
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		if (passes[p].name == name)
+		{
+			return (int)p;
+		}
+	}
+	return -1;
+}
+
+int FrameGraph::FindTarget(const std::string &name) const
+{
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		if (targets[t].name == name)
+		{
+			return (int)t;
+		}
+	}
+	return -1;
+}
+
+size_t FrameGraph::GetBytes() const
+{
+	size_t bytes = 0;
+
+	for (unsigned int s = 0; s < slots.size(); ++s)
+	{
+		bytes += RenderTargetPool::GetBytes(slots[s].desc);
+	}
+	return bytes;
+}
+
+size_t FrameGraph::GetUnaliasedBytes() const
+{
+	size_t bytes = 0;
+
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		if (!targets[t].imported && targets[t].first >= 0)
+		{
+			bytes += RenderTargetPool::GetBytes(targets[t].desc);
+		}
+	}
+	return bytes;
+}
+
+void FrameGraph::Dump(std::ostream &out) const
+{
+	if (!compiled)
+	{
+		out << "FrameGraph: not compiled" << std::endl;
+		return;
+	}
+
+	const float mb = 1.0f / (1024.0f * 1024.0f);
+
+	out << "FrameGraph: " << passes.size() << " passes (" << GetNumCulled() << " culled), "
+		<< targets.size() << " targets" << std::endl;
+
+	for (unsigned int p = 0; p < passes.size(); ++p)
+	{
+		const Pass &pass = passes[p];
+
+		out << "  " << std::setw(2) << p << " " << pass.name;
+
+		if (pass.culled)
+		{
+			out << " (culled)" << std::endl;
+			continue;
+		}
+		out << (pass.barrier ? " (memory barrier first)" : "") << std::endl;
+
+		if (!pass.reads.empty())
+		{
+			out << "       reads ";
+
+			for (unsigned int r = 0; r < pass.reads.size(); ++r)
+			{
+				out << (r ? ", " : "") << targets[pass.reads[r].target].name;
+			}
+			out << std::endl;
+		}
+
+		if (!pass.writes.empty())
+		{
+			out << "       writes ";
+
+			for (unsigned int w = 0; w < pass.writes.size(); ++w)
+			{
+				const Access &write = pass.writes[w];
+				const Target &target = targets[write.target];
+
+				out << (w ? ", " : "") << target.name;
+
+				if (target.clearPass == (int)p)
+				{
+					out << " (cleared)";
+				}
+				else if (write.flags & FRAMEGRAPH_CLEAR)
+				{
+					out << " (clear dropped)";
+				}
+
+				if (write.flags & FRAMEGRAPH_IMAGE)
+				{
+					out << " (image)";
+				}
+			}
+			out << std::endl;
+		}
+	}
+
+	out << "  targets:" << std::endl;
+
+	for (unsigned int t = 0; t < targets.size(); ++t)
+	{
+		const Target &target = targets[t];
+
+		out << "    " << target.name;
+
+		if (target.imported)
+		{
+			out << " (imported" << (target.output ? ", output)" : ")") << std::endl;
+			continue;
+		}
+
+		out << " " << target.desc.width << "x" << target.desc.height;
+
+		if (target.desc.IsArray())
+		{
+			out << "x" << target.desc.layers;
+		}
+
+		out << " " << FormatName(target.desc.format) << (target.desc.usage == RENDERTARGET_SHADOW ? " shadow" : "");
+
+		if (target.first < 0)
+		{
+			out << ", unused" << std::endl;
+			continue;
+		}
+
+		out << ", passes " << target.first << "-" << target.last << ", texture " << target.slot << std::endl;
+	}
+
+	out << "  " << slots.size() << " textures, " << GetBytes() * mb << " MB (" << GetUnaliasedBytes() * mb
+		<< " MB without sharing)" << std::endl;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+/*
+ * A frame's passes, and the render targets each one reads and writes,
+ * declared up front so the frame can be planned before any of it is drawn.
+ *
+ * Passes are declared in the order they should run, each with the targets it
+ * samples (Read) and draws into (Write). Compile then:
+ *
+ *  - checks that every target read was written by an earlier pass, or was
+ *    imported (made outside the graph, like the back buffer), and that no
+ *    pass samples a target it's also drawing into;
+ *  - culls every pass whose writes nothing goes on to read, working back
+ *    from the outputs, so a target only some passes need (the SSS blurs,
+ *    the transmittance depth maps) costs nothing when they're switched off;
+ *  - works out each target's lifetime, from the first pass that touches it
+ *    to the last, and packs targets with the same description whose
+ *    lifetimes don't overlap onto the same texture;
+ *  - keeps only the clears that matter: a write asking for a clear gets one
+ *    if it's the first write of the target's lifetime, and not if an earlier
+ *    pass has already put something there;
+ *  - notes where a pass reads what was last written as an image (by a
+ *    compute shader, say) and so needs a memory barrier first. Plain render
+ *    to texture then sampling is ordered by OpenGL itself, and needs none.
+ *
+ * None of that touches OpenGL, so a graph can be built, compiled and dumped
+ * without a context. Execute runs the passes that survived, taking each
+ * texture from a RenderTargetPool before its first pass and giving it back
+ * after its last, and writing it into the variable the target was bound to
+ * for the pass code to use.
+ */
+#include <string>
+#include <vector>
+#include <ostream>
+#include <functional>
+
+#include "RenderTargetPool.h"
+
+// How a pass writes a target
+#define FRAMEGRAPH_WRITE		0
+#define FRAMEGRAPH_CLEAR		1	// Wants it cleared first, if nothing's been drawn into it yet
+#define FRAMEGRAPH_IMAGE		2	// With image stores, so readers need a memory barrier
+
+class FrameGraph
+{
+public:
+	typedef std::function<void()> PassFunction;
+
+	FrameGraph();
+
+	// Throws every pass and target away, ready to declare another frame
+	void Reset();
+
+	/*
+	 * A target made by the graph, whose texture is written into *binding
+	 * (if there is one) for as long as it's alive, and zeroed after
+	 */
+	unsigned int AddTarget(const std::string &name, const RenderTargetDesc &desc, GLuint *binding = NULL);
+
+	// A texture, or the back buffer, that lives outside the graph. Outputs are never culled
+	unsigned int Import(const std::string &name, bool output = false);
+
+	// Passes run in the order they're added
+	unsigned int AddPass(const std::string &name, const PassFunction &function);
+
+	void Read(unsigned int pass, unsigned int target);
+	void Write(unsigned int pass, unsigned int target, int flags = FRAMEGRAPH_WRITE);
+
+	// A pass that has to run even though nothing reads what it writes
+	void SetSideEffect(unsigned int pass);
+
+	// Validates, culls and plans the frame. Returns false, printing why, if it doesn't add up
+	bool Compile();
+
+	// Runs the passes left after culling. Compile first
+	void Execute(RenderTargetPool &pool);
+
+	// While a pass is running, whether it should clear a target it writes
+	bool NeedsClear(unsigned int target) const;
+
+	bool IsCompiled() const							{ return compiled; }
+	bool IsCulled(unsigned int pass) const			{ return passes[pass].culled; }
+	unsigned int GetNumPasses() const				{ return (unsigned int)passes.size(); }
+	unsigned int GetNumCulled() const;
+	unsigned int GetNumTextures() const				{ return (unsigned int)slots.size(); }
+
+	// Finds a pass or target by name, or returns -1
+	int FindPass(const std::string &name) const;
+	int FindTarget(const std::string &name) const;
+
+	// Bytes in the textures the frame uses, and what it'd take without sharing any
+	size_t GetBytes() const;
+	size_t GetUnaliasedBytes() const;
+
+	// Prints the compiled schedule: each pass's reads, writes, clears and barriers, then each target's lifetime
+	void Dump(std::ostream &out) const;
+
+protected:
+	struct Access
+	{
+		unsigned int	target;
+		int				flags;
+	};
+
+	struct Pass
+	{
+		std::string			name;
+		PassFunction		function;
+		std::vector<Access>	reads;
+		std::vector<Access>	writes;
+		bool				sideEffect;
+		bool				culled;
+		bool				barrier;	// Needs a memory barrier before it runs
+		unsigned int		refCount;
+	};
+
+	struct Target
+	{
+		std::string			name;
+		RenderTargetDesc	desc;
+		GLuint *			binding;
+		bool				imported;
+		bool				output;
+		unsigned int		refCount;
+		int					first;		// First and last passes left after culling to touch it, -1 if none
+		int					last;
+		int					slot;		// Which texture it's given
+		int					clearPass;	// Pass that clears it, if any
+	};
+
+	struct Slot
+	{
+		RenderTargetDesc	desc;
+		GLuint				texture;
+		int					last;		// Last pass any of its targets is used in
+	};
+
+	bool Validate();
+	void Cull();
+	void PlanLifetimes();
+	void PlanClearsAndBarriers();
+
+	std::vector<Pass>	passes;
+	std::vector<Target>	targets;
+	std::vector<Slot>	slots;
+
+	bool				compiled;
+	int					currentPass;
+};
@@ -0,0 +1,452 @@
+#include "GLStateCache.h"
+
+#include <iostream>
+
+GLStateFunctions GLStateFunctions::OpenGL()
+{
+	GLStateFunctions functions;
+	functions.ActiveTexture = glActiveTexture;
+	functions.BindTexture = glBindTexture;
+	functions.TexParameterf = glTexParameterf;
+	functions.UseProgram = glUseProgram;
+	functions.BindVertexArray = glBindVertexArray;
+	functions.BindFramebuffer = glBindFramebuffer;
+	functions.Viewport = glViewport;
+	functions.Enable = glEnable;
+	functions.Disable = glDisable;
+	functions.StencilFunc = glStencilFunc;
+	functions.StencilOp = glStencilOp;
+	functions.DepthFunc = glDepthFunc;
+	functions.DepthMask = glDepthMask;
+	functions.CullFace = glCullFace;
+
+	return functions;
+}
+
+GLStateCache::GLStateCache(const GLStateFunctions &functions) : gl(functions)
+{
+	BeginFrame();
+}
+
+GLStateCache & GLStateCache::Get()
+{
+	// Made on first use, which is after the renderer has initialised GLEW
+	static GLStateCache cache(GLStateFunctions::OpenGL());
+	return cache;
+}
+
+void GLStateCache::BeginFrame()
+{
+	Invalidate();
+
+	issued = 0;
+	elided = 0;
+}
+
+void GLStateCache::Invalidate()
+{
+	activeUnitKnown = false;
+
+	for (int t = 0; t < GLSTATECACHE_TEXTURE_TARGETS; ++t)
+	{
+		for (int i = 0; i < GLSTATECACHE_TEXTURE_UNITS; ++i)
+		{
+			textureKnown[t][i] = false;
+		}
+	}
+
+	programKnown = false;
+	vertexArrayKnown = false;
+	framebufferKnown = false;
+	viewportKnown = false;
+	stencilFuncKnown = false;
+	stencilOpKnown = false;
+	depthFuncKnown = false;
+	depthMaskKnown = false;
+	cullFaceKnown = false;
+
+	caps.clear();
+
+	// Anisotropy belongs to the texture, not the context, so it's still right
+}
+
+void GLStateCache::SetActiveUnit(unsigned int unit)
+{
+	GLuint value = unit;
+
+	if (Changes(activeUnit, activeUnitKnown, value))
+	{
+		gl.ActiveTexture(GL_TEXTURE0 + unit);
+	}
+}
+
+void GLStateCache::BindTexture(unsigned int unit, GLuint texture)
+{
+	BindTarget(0, GL_TEXTURE_2D, unit, texture);
+}
+
+void GLStateCache::BindTexture(GLuint texture)
+{
+	BindTarget(0, GL_TEXTURE_2D, texture);
+}
+
+void GLStateCache::BindTextureArray(unsigned int unit, GLuint texture)
+{
+	BindTarget(1, GL_TEXTURE_2D_ARRAY, unit, texture);
+}
+
+void GLStateCache::BindTextureArray(GLuint texture)
+{
+	BindTarget(1, GL_TEXTURE_2D_ARRAY, texture);
+}
+
+void GLStateCache::BindTarget(unsigned int target, GLenum glTarget, unsigned int unit, GLuint texture)
+{
+	if (unit >= GLSTATECACHE_TEXTURE_UNITS)
+	{
+		SetActiveUnit(unit);
+		gl.BindTexture(glTarget, texture);
+		++issued;
+		return;
+	}
+
+	// Already there, so neither the unit switch nor the bind is needed
+	if (textureKnown[target][unit] && textures[target][unit] == texture)
+	{
+		elided += 2;
+		return;
+	}
+
+	SetActiveUnit(unit);
+	Changes(textures[target][unit], textureKnown[target][unit], texture);
+	gl.BindTexture(glTarget, texture);
+}
+
+void GLStateCache::BindTarget(unsigned int target, GLenum glTarget, GLuint texture)
+{
+	if (activeUnitKnown)
+	{
+		BindTarget(target, glTarget, activeUnit, texture);
+		return;
+	}
+
+	// Some unit's changed, but there's no telling which
+	gl.BindTexture(glTarget, texture);
+	++issued;
+
+	for (int i = 0; i < GLSTATECACHE_TEXTURE_UNITS; ++i)
+	{
+		textureKnown[target][i] = false;
+	}
+}
+
+void GLStateCache::SetAnisotropy(unsigned int unit, GLuint texture, float value)
+{
+	std::map<GLuint, float>::iterator i = anisotropy.find(texture);
+
+	if (i != anisotropy.end() && i->second == value)
+	{
+		++elided;
+		return;
+	}
+
+	BindTexture(unit, texture);
+	gl.TexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, value);
+	++issued;
+
+	anisotropy[texture] = value;
+}
+
+void GLStateCache::UseProgram(GLuint value)
+{
+	if (Changes(program, programKnown, value))
+	{
+		gl.UseProgram(value);
+	}
+}
+
+void GLStateCache::BindVertexArray(GLuint value)
+{
+	if (Changes(vertexArray, vertexArrayKnown, value))
+	{
+		gl.BindVertexArray(value);
+	}
+}
+
+void GLStateCache::BindFramebuffer(GLuint value)
+{
+	if (Changes(framebuffer, framebufferKnown, value))
+	{
+		gl.BindFramebuffer(GL_FRAMEBUFFER, value);
+	}
+}
+
+void GLStateCache::Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	ViewportState value = { x, y, width, height };
+
+	if (Changes(viewport, viewportKnown, value))
+	{
+		gl.Viewport(x, y, width, height);
+	}
+}
+
+void GLStateCache::SetCap(GLenum cap, bool enabled)
+{
+	std::map<GLenum, bool>::iterator i = caps.find(cap);
+
+	if (i != caps.end() && i->second == enabled)
+	{
+		++elided;
+		return;
+	}
+
+	caps[cap] = enabled;
+	++issued;
+
+	if (enabled)
+	{
+		gl.Enable(cap);
+	}
+	else
+	{
+		gl.Disable(cap);
+	}
+}
+
+void GLStateCache::Enable(GLenum cap)
+{
+	SetCap(cap, true);
+}
+
+void GLStateCache::Disable(GLenum cap)
+{
+	SetCap(cap, false);
+}
+
+void GLStateCache::StencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+	StencilState value = { func, (GLuint)ref, mask };
+
+	if (Changes(stencilFunc, stencilFuncKnown, value))
+	{
+		gl.StencilFunc(func, ref, mask);
+	}
+}
+
+void GLStateCache::StencilOp(GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+	StencilState value = { sfail, dpfail, dppass };
+
+	if (Changes(stencilOp, stencilOpKnown, value))
+	{
+		gl.StencilOp(sfail, dpfail, dppass);
+	}
+}
+
+void GLStateCache::DepthFunc(GLenum value)
+{
+	if (Changes(depthFunc, depthFuncKnown, value))
+	{
+		gl.DepthFunc(value);
+	}
+}
+
+void GLStateCache::DepthMask(GLboolean value)
+{
+	if (Changes(depthMask, depthMaskKnown, value))
+	{
+		gl.DepthMask(value);
+	}
+}
+
+void GLStateCache::CullFace(GLenum value)
+{
+	if (Changes(cullFace, cullFaceKnown, value))
+	{
+		gl.CullFace(value);
+	}
+}
+
+void GLStateCache::ForgetTexture(GLuint texture)
+{
+	// Deleting a bound texture binds 0 in its place
+	for (int t = 0; t < GLSTATECACHE_TEXTURE_TARGETS; ++t)
+	{
+		for (int i = 0; i < GLSTATECACHE_TEXTURE_UNITS; ++i)
+		{
+			if (textureKnown[t][i] && textures[t][i] == texture)
+			{
+				textures[t][i] = 0;
+			}
+		}
+	}
+
+	anisotropy.erase(texture);
+}
+
+void GLStateCache::ForgetProgram(GLuint value)
+{
+	// A program in use is only deleted once it's replaced, so don't count on either
+	if (programKnown && program == value)
+	{
+		programKnown = false;
+	}
+}
+
+void GLStateCache::ForgetVertexArray(GLuint value)
+{
+	if (vertexArrayKnown && vertexArray == value)
+	{
+		vertexArray = 0;
+	}
+}
+
+void GLStateCache::ForgetFramebuffer(GLuint value)
+{
+	if (framebufferKnown && framebuffer == value)
+	{
+		framebuffer = 0;
+	}
+}
+
+void GLStateCache::PrintStats(const std::string &name) const
+{
+	std::cout << name << " GL state: " << issued << " calls made, " << elided << " dropped as redundant" << std::endl;
+}
+
+/*
+ * A stand in for the GL entry points the cache uses, which keeps the state
+ * they'd have set and counts the calls that get through
+ */
+namespace
+{
+	struct MockGL
+	{
+		unsigned int	calls;
+		GLenum			activeUnit;
+		GLuint			textures[GLSTATECACHE_TEXTURE_UNITS];
+		GLuint			program;
+		GLuint			vertexArray;
+		GLuint			framebuffer;
+		GLint			viewport[4];
+		bool			depthTest;
+		bool			stencilTest;
+		GLenum			stencilFunc;
+		GLint			stencilRef;
+		float			anisotropy;
+	};
+
+	MockGL mock;
+
+	void GLAPIENTRY MockActiveTexture(GLenum texture)				{ ++mock.calls; mock.activeUnit = texture - GL_TEXTURE0; }
+	void GLAPIENTRY MockBindTexture(GLenum, GLuint texture)			{ ++mock.calls; mock.textures[mock.activeUnit] = texture; }
+	void GLAPIENTRY MockTexParameterf(GLenum, GLenum, GLfloat param)	{ ++mock.calls; mock.anisotropy = param; }
+	void GLAPIENTRY MockUseProgram(GLuint program)					{ ++mock.calls; mock.program = program; }
+	void GLAPIENTRY MockBindVertexArray(GLuint array)				{ ++mock.calls; mock.vertexArray = array; }
+	void GLAPIENTRY MockBindFramebuffer(GLenum, GLuint framebuffer)	{ ++mock.calls; mock.framebuffer = framebuffer; }
+	void GLAPIENTRY MockViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		++mock.calls;
+		mock.viewport[0] = x;
+		mock.viewport[1] = y;
+		mock.viewport[2] = width;
+		mock.viewport[3] = height;
+	}
+	void GLAPIENTRY MockEnable(GLenum cap)		{ ++mock.calls; (cap == GL_DEPTH_TEST ? mock.depthTest : mock.stencilTest) = true; }
+	void GLAPIENTRY MockDisable(GLenum cap)		{ ++mock.calls; (cap == GL_DEPTH_TEST ? mock.depthTest : mock.stencilTest) = false; }
+	void GLAPIENTRY MockStencilFunc(GLenum func, GLint ref, GLuint)	{ ++mock.calls; mock.stencilFunc = func; mock.stencilRef = ref; }
+	void GLAPIENTRY MockStencilOp(GLenum, GLenum, GLenum)			{ ++mock.calls; }
+	void GLAPIENTRY MockDepthFunc(GLenum)							{ ++mock.calls; }
+	void GLAPIENTRY MockDepthMask(GLboolean)						{ ++mock.calls; }
+	void GLAPIENTRY MockCullFace(GLenum)							{ ++mock.calls; }
+}
+
+bool GLStateCache::Check()
+{
+	GLStateFunctions functions;
+	functions.ActiveTexture = MockActiveTexture;
+	functions.BindTexture = MockBindTexture;
+	functions.TexParameterf = MockTexParameterf;
+	functions.UseProgram = MockUseProgram;
+	functions.BindVertexArray = MockBindVertexArray;
+	functions.BindFramebuffer = MockBindFramebuffer;
+	functions.Viewport = MockViewport;
+	functions.Enable = MockEnable;
+	functions.Disable = MockDisable;
+	functions.StencilFunc = MockStencilFunc;
+	functions.StencilOp = MockStencilOp;
+	functions.DepthFunc = MockDepthFunc;
+	functions.DepthMask = MockDepthMask;
+	functions.CullFace = MockCullFace;
+
+	mock = MockGL();
+
+	GLStateCache cache(functions);
+	bool passed = true;
+
+	// Two frames of a pass drawing the 9 meshes the way Mesh::Draw does, then a full screen quad
+	for (int frame = 0; frame < 2; ++frame)
+	{
+		cache.BeginFrame();
+		unsigned int callsBefore = mock.calls;
+
+		cache.BindFramebuffer(3);
+		cache.Viewport(0, 0, 1900, 1024);
+		cache.Enable(GL_DEPTH_TEST);
+		cache.Enable(GL_STENCIL_TEST);
+		cache.StencilFunc(GL_ALWAYS, 1, ~0u);
+		cache.UseProgram(7);
+
+		for (int mesh = 0; mesh < 9; ++mesh)
+		{
+			cache.BindTexture(0, 20);
+			cache.BindTexture(1, 21);
+			cache.BindTexture(11, 22);
+			cache.SetAnisotropy(11, 22, 8.0f);
+			cache.BindVertexArray(30);
+		}
+
+		// The pass set up and the first mesh, then nothing for the other 8; the anisotropy sticks to the texture
+		unsigned int expected = 6 + 2 + 2 + (frame == 0 ? 3 : 2) + 1;
+		unsigned int calls = mock.calls - callsBefore;
+
+		if (calls != expected || cache.GetIssued() != calls)
+		{
+			std::cout << "GLStateCache::Check: Frame " << frame << " made " << calls << " GL calls, counted "
+					  << cache.GetIssued() << ", expected " << expected << std::endl;
+			passed = false;
+		}
+
+		cache.BindFramebuffer(0);
+		cache.Disable(GL_STENCIL_TEST);
+		cache.BindTexture(0, 40);
+		cache.BindVertexArray(31);
+	}
+
+	// What the mock was left with has to be what was last asked for
+	bool matches = mock.framebuffer == 0 && !mock.stencilTest && mock.depthTest && mock.program == 7 &&
+				   mock.textures[0] == 40 && mock.textures[1] == 21 && mock.textures[11] == 22 &&
+				   mock.vertexArray == 31 && mock.viewport[2] == 1900 && mock.stencilRef == 1 && mock.anisotropy == 8.0f;
+
+	// Binding to the active unit, and a deleted texture's name coming back, both have to get through
+	cache.BindTexture(5, 50);
+	cache.BindTexture(51);
+	matches &= mock.activeUnit == 5 && mock.textures[5] == 51;
+
+	cache.ForgetTexture(51);
+	unsigned int callsBefore = mock.calls;
+	cache.BindTexture(5, 51);
+	matches &= mock.calls == callsBefore + 1 && mock.textures[5] == 51;
+
+	if (!matches)
+	{
+		std::cout << "GLStateCache::Check: The mock's state doesn't match what was asked for!" << std::endl;
+		passed = false;
+	}
+
+	cache.PrintStats("GLStateCache::Check");
+	std::cout << "GLStateCache::Check: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+/*
+ * A shadow copy of the bits of OpenGL state a frame sets over and over: the
+ * texture bound to each unit, the program, vertex array, frame buffer and
+ * viewport, and the depth, stencil and culling state. Asking for what's
+ * already set makes no GL call.
+ *
+ * It only knows about what went through it, so during a frame everything
+ * that changes that state has to. BeginFrame forgets the lot, so what was
+ * done behind its back between frames (SOIL loading textures, a resize)
+ * can't leave it out of step. A texture, program, vertex array or frame
+ * buffer that may still be bound has to be forgotten when it's deleted, or
+ * a new one given the same name would look like it was already bound.
+ *
+ * The GL calls go through a GLStateFunctions table, which is OpenGL's own
+ * for the shared cache, so it can be run against a mock without a context.
+ */
+#include <map>
+#include <string>
+
+#include "GL/glew.h"
+
+// Units whose bindings are shadowed; binds to any above go straight through
+#define GLSTATECACHE_TEXTURE_UNITS	16
+
+// Binding points shadowed on each unit: 2D textures, and 2D array textures
+#define GLSTATECACHE_TEXTURE_TARGETS	2
+
+// The OpenGL entry points the cache calls
+struct GLStateFunctions
+{
+	void (GLAPIENTRY *ActiveTexture)(GLenum texture);
+	void (GLAPIENTRY *BindTexture)(GLenum target, GLuint texture);
+	void (GLAPIENTRY *TexParameterf)(GLenum target, GLenum pname, GLfloat param);
+	void (GLAPIENTRY *UseProgram)(GLuint program);
+	void (GLAPIENTRY *BindVertexArray)(GLuint array);
+	void (GLAPIENTRY *BindFramebuffer)(GLenum target, GLuint framebuffer);
+	void (GLAPIENTRY *Viewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+	void (GLAPIENTRY *Enable)(GLenum cap);
+	void (GLAPIENTRY *Disable)(GLenum cap);
+	void (GLAPIENTRY *StencilFunc)(GLenum func, GLint ref, GLuint mask);
+	void (GLAPIENTRY *StencilOp)(GLenum sfail, GLenum dpfail, GLenum dppass);
+	void (GLAPIENTRY *DepthFunc)(GLenum func);
+	void (GLAPIENTRY *DepthMask)(GLboolean flag);
+	void (GLAPIENTRY *CullFace)(GLenum mode);
+
+	// The context's own. GLEW has to have been initialised
+	static GLStateFunctions OpenGL();
+};
+
+class GLStateCache
+{
+public:
+	GLStateCache(const GLStateFunctions &functions);
+
+	// The cache the renderers and meshes share, calling OpenGL. Only once there's a context
+	static GLStateCache & Get();
+
+	// Forgets all the state and zeroes the counters. Call at the start of every frame
+	void BeginFrame();
+	void Invalidate();
+
+	// Binds a 2D texture to a unit, only making it active if the texture isn't already there
+	void BindTexture(unsigned int unit, GLuint texture);
+
+	// Binds a 2D texture to whichever unit is active, to set it up
+	void BindTexture(GLuint texture);
+
+	// The same for 2D array textures, which have a binding point of their own on each unit
+	void BindTextureArray(unsigned int unit, GLuint texture);
+	void BindTextureArray(GLuint texture);
+
+	// Sets a texture's anisotropic filtering, binding it to unit first if it needs setting
+	void SetAnisotropy(unsigned int unit, GLuint texture, float anisotropy);
+
+	void UseProgram(GLuint program);
+	void BindVertexArray(GLuint array);
+	void BindFramebuffer(GLuint framebuffer);
+	void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+	void Enable(GLenum cap);
+	void Disable(GLenum cap);
+	void StencilFunc(GLenum func, GLint ref, GLuint mask);
+	void StencilOp(GLenum sfail, GLenum dpfail, GLenum dppass);
+	void DepthFunc(GLenum func);
+	void DepthMask(GLboolean flag);
+	void CullFace(GLenum mode);
+
+	// For objects about to be deleted
+	void ForgetTexture(GLuint texture);
+	void ForgetProgram(GLuint program);
+	void ForgetVertexArray(GLuint array);
+	void ForgetFramebuffer(GLuint framebuffer);
+
+	// GL calls made, and ones dropped as redundant, since BeginFrame
+	unsigned int GetIssued() const	{ return issued; }
+	unsigned int GetElided() const	{ return elided; }
+
+	void PrintStats(const std::string &name) const;
+
+	// Runs a frame's worth of state changes against a mock GL, checking the calls it lets through
+	static bool Check();
+
+protected:
+	struct ViewportState
+	{
+		bool operator==(const ViewportState &o) const	{ return x == o.x && y == o.y && width == o.width && height == o.height; }
+
+		GLint	x, y;
+		GLsizei	width, height;
+	};
+
+	struct StencilState
+	{
+		bool operator==(const StencilState &o) const	{ return a == o.a && b == o.b && c == o.c; }
+
+		GLuint	a, b, c;	// Function, reference and mask, or the three ops
+	};
+
+	// Whether a shadowed value needs setting, counting the call either way
+	template <class T>
+	bool Changes(T &shadow, bool &known, const T &value)
+	{
+		if (known && shadow == value)
+		{
+			++elided;
+			return false;
+		}
+		shadow = value;
+		known = true;
+		++issued;
+		return true;
+	}
+
+	void SetCap(GLenum cap, bool enabled);
+	void SetActiveUnit(unsigned int unit);
+
+	// target is an index into the shadowed binding points, glTarget the binding point itself
+	void BindTarget(unsigned int target, GLenum glTarget, unsigned int unit, GLuint texture);
+	void BindTarget(unsigned int target, GLenum glTarget, GLuint texture);
+
+	GLStateFunctions gl;
+
+	unsigned int	issued;
+	unsigned int	elided;
+
+	// Each value's only used if its known flag is set, which Invalidate clears
+	GLuint			activeUnit;
+	GLuint			textures[GLSTATECACHE_TEXTURE_TARGETS][GLSTATECACHE_TEXTURE_UNITS];
+	GLuint			program;
+	GLuint			vertexArray;
+	GLuint			framebuffer;
+	ViewportState	viewport;
+	StencilState	stencilFunc;
+	StencilState	stencilOp;
+	GLenum			depthFunc;
+	GLboolean		depthMask;
+	GLenum			cullFace;
+
+	bool			activeUnitKnown;
+	bool			textureKnown[GLSTATECACHE_TEXTURE_TARGETS][GLSTATECACHE_TEXTURE_UNITS];
+	bool			programKnown;
+	bool			vertexArrayKnown;
+	bool			framebufferKnown;
+	bool			viewportKnown;
+	bool			stencilFuncKnown;
+	bool			stencilOpKnown;
+	bool			depthFuncKnown;
+	bool			depthMaskKnown;
+	bool			cullFaceKnown;
+
+	std::map<GLenum, bool>	caps;			// Enabled or not, for the caps that have been set
+	std::map<GLuint, float>	anisotropy;		// For the textures it's been set on
+};
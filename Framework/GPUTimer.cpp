@@ -0,0 +1,116 @@
+#include "GPUTimer.h"
+
+#include <iostream>
+
+GPUTimer::GPUTimer(const std::string &name, const std::string &modeA, const std::string &modeB, unsigned int samples)
+	: name(name), samples(samples)
+{
+	modes[0] = modeA;
+	modes[1] = modeB;
+
+	query = 0;
+	timing = false;
+	pending = false;
+	pendingMode = 0;
+
+	Reset();
+}
+
+GPUTimer::~GPUTimer()
+{
+	if (query)
+	{
+		glDeleteQueries(1, &query);
+	}
+}
+
+bool GPUTimer::Begin(int mode)
+{
+	if (timing)
+	{
+		return true;
+	}
+
+	if (!Collect())
+	{
+		return false;
+	}
+
+	if (!query)
+	{
+		glGenQueries(1, &query);
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	timing = true;
+	pending = true;
+	pendingMode = mode;
+
+	return true;
+}
+
+void GPUTimer::End()
+{
+	if (timing)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		timing = false;
+	}
+}
+
+void GPUTimer::Reset()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		time[i] = 0.0;
+		count[i] = 0;
+	}
+
+	// Whatever's still to come back was timed before the change
+	pendingMode = -1;
+}
+
+bool GPUTimer::Collect()
+{
+	if (!pending)
+	{
+		return true;
+	}
+
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (!available)
+	{
+		return false;
+	}
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+	pending = false;
+
+	int mode = pendingMode;
+
+	if (mode < 0)
+	{
+		return true;
+	}
+
+	time[mode] += elapsed / 1000000.0;
+
+	if (++count[mode] == samples)
+	{
+		std::cout << name << ": " << modes[mode] << " " << time[mode] / count[mode] << " ms a frame";
+
+		if (count[1 - mode] > 0)
+		{
+			std::cout << ", against " << time[1 - mode] / count[1 - mode] << " ms for " << modes[1 - mode];
+		}
+		std::cout << std::endl;
+
+		time[mode] = 0.0;
+		count[mode] = 0;
+	}
+
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+ * Times a stretch of GL commands on the GPU, for comparing two ways of doing
+ * the same thing. Each timing is put down as one of two modes, and once a
+ * mode has a number of them their average is printed, against the other
+ * mode's if it has any.
+ *
+ * Results are only picked up when the GPU has got that far, a frame or so
+ * after the commands were sent, so nothing waits on them. Until then Begin
+ * doesn't start another timing. Only one timer can be running at a time,
+ * as OpenGL only has the one elapsed time query running.
+ */
+#include <string>
+
+#include "GL/glew.h"
+
+// Timings averaged before they're printed
+#define GPUTIMER_SAMPLES	100
+
+class GPUTimer
+{
+public:
+	// modeA and modeB name the two ways of doing what's being timed
+	GPUTimer(const std::string &name, const std::string &modeA, const std::string &modeB,
+			 unsigned int samples = GPUTIMER_SAMPLES);
+	~GPUTimer();
+
+	// Starts timing in mode 0 or 1, unless the last timing hasn't come back. Carries on if it's already timing
+	bool Begin(int mode);
+	void End();
+
+	// Throws the timings so far away, for when something other than the mode has changed what's timed
+	void Reset();
+
+	void SetName(const std::string &n)	{ name = n; }
+	bool IsTiming() const				{ return timing; }
+
+protected:
+	// Picks up the last timing if it's ready, and returns whether it was
+	bool Collect();
+
+	std::string		name;
+	std::string		modes[2];
+	unsigned int	samples;
+
+	GLuint			query;		// Made on first use, when there's a context
+	bool			timing;
+	bool			pending;
+	int				pendingMode;	// -1 if it's to be thrown away
+
+	double			time[2];
+	unsigned int	count[2];
+};
@@ -54,6 +54,10 @@ HeightMap::HeightMap(std::string name)
 		}
 	}
 
+#ifdef HEIGHTMAP_USE_MESH_OPTIMISER
+	MeshOptimiser::OptimiseVertexCache(indices, numIndices, numVertices);
+#endif
+
 	GenerateNormals();
 	GenerateTangents();
 
@@ -5,6 +5,7 @@
 #include <fstream>
 
 #include "..\Framework\Mesh.h"
+#include "..\Framework\MeshOptimiser.h"
 
 #define RAW_WIDTH 257
 #define RAW_HEIGHT 257
@@ -15,6 +16,10 @@
 #define HEIGHTMAP_TEX_X 1.0f / 16.0f
 #define HEIGHTMAP_TEX_Z 1.0f / 16.0f
 
+// Reorders the terrain triangles for the post transform vertex cache. The
+// vertices stay in grid order, as getGroundPos looks them up by position.
+#define HEIGHTMAP_USE_MESH_OPTIMISER
+
 class HeightMap : public Mesh
 {
 public:
@@ -0,0 +1,58 @@
+#include "InstanceBuffer.h"
+
+#include "VertexFormat.h"
+
+InstanceBuffer::InstanceBuffer()
+{
+	glGenBuffers(1, &buffer);
+	numInstances = 0;
+	capacity = 0;
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+	glDeleteBuffers(1, &buffer);
+}
+
+void InstanceBuffer::Update(const Matrix4 *matrices, unsigned int count)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	if (count > capacity)
+	{
+		glBufferData(GL_ARRAY_BUFFER, count * sizeof(Matrix4), matrices, GL_DYNAMIC_DRAW);
+		capacity = count;
+	}
+	else if (count > 0)
+	{
+		// Orphan the old storage first, so this doesn't wait on draws still reading it
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Matrix4), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(Matrix4), matrices);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	numInstances = count;
+}
+
+void InstanceBuffer::Update(const std::vector<Matrix4> &matrices)
+{
+	Update(matrices.empty() ? NULL : &matrices[0], (unsigned int)matrices.size());
+}
+
+void InstanceBuffer::SetAttribPointers() const
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	// Matrix4 is column major, so each column is four floats in a row
+	for (int column = 0; column < 4; ++column)
+	{
+		GLuint location = INSTANCE_MATRIX_ATTRIBUTE + column;
+
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix4), (const GLvoid*)(column * 4 * sizeof(float)));
+		glVertexAttribDivisor(location, 1);
+		glEnableVertexAttribArray(location);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * The model matrices of every copy of a mesh drawn in one instanced draw call.
+ *
+ * A mesh given the buffer (Mesh::SetInstanceBuffer) reads it through four
+ * attributes from INSTANCE_MATRIX_ATTRIBUTE, one column of the matrix each,
+ * which move on once per instance rather than once per vertex. Shaders take
+ * it as 'in mat4 instanceMatrix', and use it in place of modelMatrix while
+ * their useInstancing uniform is set, as it is for every instanced draw.
+ *
+ * The vertex arrays point at the buffer object itself, so Update can upload
+ * a different number of matrices every frame without setting them up again.
+ */
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "Matrix4.h"
+
+class InstanceBuffer
+{
+public:
+	InstanceBuffer();
+	~InstanceBuffer();
+
+	// Replaces the matrices, growing the buffer if there are more than it has room for
+	void Update(const Matrix4 *matrices, unsigned int count);
+	void Update(const std::vector<Matrix4> &matrices);
+
+	// Sets up the instance attributes on the currently bound vertex array
+	void SetAttribPointers() const;
+
+	GLuint GetBuffer() const				{ return buffer; }
+	unsigned int GetNumInstances() const	{ return numInstances; }
+
+protected:
+	GLuint			buffer;
+	unsigned int	numInstances;
+	unsigned int	capacity;
+};
@@ -0,0 +1,143 @@
+#include "JobPool.h"
+
+// Set on the workers, and on a caller while it runs its share of the chunks
+static thread_local bool insideJob = false;
+
+JobPool & JobPool::Get()
+{
+	static JobPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+	return pool;
+}
+
+JobPool::JobPool(unsigned int numWorkers)
+{
+	quit = false;
+	generation = 0;
+	busyWorkers = 0;
+
+	job = NULL;
+	jobCount = 0;
+	jobGrain = 1;
+	numChunks = 0;
+	nextChunk = 0;
+
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		workers.push_back(std::thread(&JobPool::WorkerLoop, this, i + 1));
+	}
+}
+
+JobPool::~JobPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		workers[i].join();
+	}
+}
+
+unsigned int JobPool::GetGrain(unsigned int count, unsigned int minimum) const
+{
+	unsigned int grain = (count + GetNumThreads() - 1) / GetNumThreads();
+	return grain > minimum ? grain : minimum;
+}
+
+void JobPool::ParallelFor(unsigned int count, unsigned int grain, const RangeFunction &f)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	if (grain == 0)
+	{
+		grain = 1;
+	}
+
+	unsigned int chunks = (count + grain - 1) / grain;
+
+	// Not worth waking anyone up for, or we're already inside a job
+	if (workers.empty() || chunks == 1 || insideJob)
+	{
+		f(0, count, 0);
+		return;
+	}
+
+	std::lock_guard<std::mutex> submit(submitMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		job = &f;
+		jobCount = count;
+		jobGrain = grain;
+		numChunks = chunks;
+		nextChunk = 0;
+		busyWorkers = (unsigned int)workers.size();
+		++generation;
+	}
+	wake.notify_all();
+
+	insideJob = true;
+	RunChunks(0);
+	insideJob = false;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busyWorkers == 0; });
+
+	job = NULL;
+}
+
+void JobPool::WorkerLoop(unsigned int thread)
+{
+	insideJob = true;
+
+	unsigned int seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+
+			if (quit)
+			{
+				return;
+			}
+
+			seen = generation;
+		}
+
+		RunChunks(thread);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (--busyWorkers == 0)
+		{
+			done.notify_one();
+		}
+	}
+}
+
+void JobPool::RunChunks(unsigned int thread)
+{
+	for (;;)
+	{
+		unsigned int chunk = nextChunk++;
+
+		if (chunk >= numChunks)
+		{
+			return;
+		}
+
+		unsigned int begin = chunk * jobGrain;
+		unsigned int end = (begin + jobGrain < jobCount) ? begin + jobGrain : jobCount;
+
+		(*job)(begin, end, thread);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+ * A fixed pool of worker threads for data parallel loops. ParallelFor splits
+ * a range into chunks, which the workers and the calling thread take in turn
+ * until they're all done, and only returns once every chunk has finished.
+ *
+ * Each chunk is told which thread is running it (0 is always the calling
+ * thread), so a loop can give every thread its own scratch or accumulation
+ * buffer instead of sharing one. A ParallelFor started from inside another
+ * one just runs inline on the current thread, as thread 0.
+ */
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+class JobPool
+{
+public:
+	typedef std::function<void(unsigned int begin, unsigned int end, unsigned int thread)> RangeFunction;
+
+	// The shared pool, with a worker for every hardware thread bar the caller's
+	static JobPool & Get();
+
+	// Threads that can run chunks at once, including the calling thread
+	unsigned int GetNumThreads() const		{ return (unsigned int)workers.size() + 1; }
+
+	// Runs f over [0, count) in chunks of grain elements, and waits for them all
+	void ParallelFor(unsigned int count, unsigned int grain, const RangeFunction &f);
+
+	// A grain that gives each thread about one chunk, but none smaller than minimum
+	unsigned int GetGrain(unsigned int count, unsigned int minimum) const;
+
+protected:
+	JobPool(unsigned int numWorkers);
+	~JobPool();
+
+	// Not copyable, the threads belong to one pool only
+	JobPool(const JobPool &);
+	JobPool & operator=(const JobPool &);
+
+	void WorkerLoop(unsigned int thread);
+	void RunChunks(unsigned int thread);
+
+	std::vector<std::thread> workers;
+
+	std::mutex submitMutex;		// One ParallelFor at a time
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	bool quit;
+	unsigned int generation;
+	unsigned int busyWorkers;
+
+	const RangeFunction *job;
+	unsigned int jobCount;
+	unsigned int jobGrain;
+	unsigned int numChunks;
+	std::atomic<unsigned int> nextChunk;
+};
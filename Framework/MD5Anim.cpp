@@ -1,6 +1,7 @@
 #include "MD5Anim.h"
 
 MD5Anim::MD5Anim(std::string filename)	{
+	this->filename = filename;
 	numAnimatedComponents = 0;
 	frameRate	= 0;
 	numJoints	= 0;
@@ -9,7 +10,28 @@ MD5Anim::MD5Anim(std::string filename)	{
 	bounds		= NULL;
 	frames		= NULL;
 
+#ifdef MD5_USE_CACHE
+	//If there's a valid cache next to the file, the text never needs parsing
+	if(MD5Cache::ReadAnim(filename, *this)) {
+		return;
+	}
+
+	if(LoadMD5Anim(filename) && !MD5Cache::WriteAnim(filename, *this)) {
+		std::cout << "MD5Anim Couldn't write anim cache for " << filename << std::endl;
+	}
+#else
 	LoadMD5Anim(filename);
+#endif
+}
+
+MD5Anim::MD5Anim(void)	{
+	numAnimatedComponents = 0;
+	frameRate	= 0;
+	numJoints	= 0;
+	numFrames	= 0;
+	joints		= NULL;
+	bounds		= NULL;
+	frames		= NULL;
 }
 
 /*
@@ -23,13 +45,13 @@ MD5Anim::~MD5Anim(void)	{
 /************************************************************************/
 /*                                                                      */
 /************************************************************************/
-void MD5Anim::LoadMD5Anim( std::string filename )	{
+bool MD5Anim::LoadMD5Anim( std::string filename )	{
 	//The MD5Anim is human readable, and stores its data in an easily
 	//traversable way, so we can simply stream data from the file
 	std::ifstream f(filename,std::ios::in);	
 
 	if(!f) {	//Opening the file has failed :(
-		return;
+		return false;
 	}
 
 	//We have our MD5 file handle!
@@ -108,7 +130,9 @@ void MD5Anim::LoadMD5Anim( std::string filename )	{
 	//
 	if(numLoadedFrames != numFrames || numLoadedJoints != numJoints || numLoadedBounds != numFrames) {
 		std::cout << "MD5Anim file has incorrect data..." << std::endl;
+		return false;
 	}
+	return true;
 }
 
 /*
@@ -307,13 +331,46 @@ void	MD5Anim::TransformSkeleton(MD5Skeleton &skel, unsigned int frameNum) {
 	to the required transforms to represent the desired frame of animation
 	*/
 
-	if(frameNum > numFrames) {	//This probably shouldn't ever happen!
+	if(frameNum >= numFrames) {	//This probably shouldn't ever happen!
 		return;
 	}
 
+	//Grab a reference to the frame data for the relevant frame, with the
+	//baseframe joints already transformed to the animation pose
+	MD5Frame&frame = GetDecodedFrame(frameNum);
+
+	BuildSkeleton(skel, frame.positions, frame.orientations);
+}
+
+/*
+Works out the local pose of every joint for a frame, the first time it's 
+needed. Every MD5Mesh playing this animation shares the result, so the
+baseframe and deltas only ever have to be picked apart once per frame.
+*/
+MD5Frame&	MD5Anim::GetDecodedFrame(unsigned int frameNum) {
 	//Grab a reference to the frame data for the relevant frame
 	MD5Frame&frame = frames[frameNum];
 
+	if(frame.positions) {	//Already decoded
+		return frame;
+	}
+
+	frame.positions		= new Vector3[numJoints];
+	frame.orientations	= new Quaternion[numJoints];
+
+	DecodeFrame(frameNum, frame.positions, frame.orientations);
+
+	return frame;
+}
+
+/*
+Applies a frame's deltas to the baseframe, giving the local pose of every
+joint in that frame.
+*/
+void	MD5Anim::DecodeFrame(unsigned int frameNum, Vector3 *positions, Quaternion *orientations) const {
+	//Grab a reference to the frame data for the relevant frame
+	const MD5Frame&frame = frames[frameNum];
+
 	//For each joint in the animation
 	for(unsigned int i = 0; i < numJoints; ++i) {
 		//Grab COPIES of the position and orientation of the baseframe joint
@@ -371,9 +428,72 @@ void	MD5Anim::TransformSkeleton(MD5Skeleton &skel, unsigned int frameNum) {
 		animQuat.GenerateW(); //We only get updated x,y,z so must generate W again...
 		animQuat.Normalise(); //And we should probably normalise it, too, to keep to unit length
 
-		//now we have a copy of the baseframe joint transformed to the animation pose, we can start
-		//applying it to the input skeleton.
+		positions[i]	= animPos;
+		orientations[i]	= animQuat;
+	}
+}
+
+//Transforms the passed in skeleton to the pose msec milliseconds into the
+//animation, interpolating between frames
+void	MD5Anim::SampleSkeleton(MD5Skeleton &skel, float msec) {
+	if(numFrames == 0 || frameRate == 0) {
+		return;
+	}
+
+	//Keep the blended pose around between calls, rather than hitting the
+	//heap for every skeleton sampled
+	samplePositions.resize(numJoints);
+	sampleOrientations.resize(numJoints);
+
+	SampleLocalPose(msec, &samplePositions[0], &sampleOrientations[0]);
+	BuildSkeleton(skel, &samplePositions[0], &sampleOrientations[0]);
+}
 
+/*
+Works out which two frames msec falls between, and how far between them it
+is, and blends their decoded local poses. Positions can just be lerped, but
+orientations have to be slerped to keep them turning at a steady rate.
+*/
+void	MD5Anim::SampleLocalPose(float msec, Vector3 *positions, Quaternion *orientations) {
+	if(numFrames == 0 || frameRate == 0) {
+		return;
+	}
+
+	//How many frames in we are, wrapped back into the animation
+	float	frameTime	= fmod((msec * frameRate) / 1000.0f, (float)numFrames);
+
+	if(frameTime < 0.0f) {
+		frameTime += numFrames;
+	}
+
+	unsigned int	from	= min((unsigned int)frameTime, numFrames - 1);
+	unsigned int	to		= (from + 1) % numFrames;
+	float			t		= frameTime - from;
+
+	MD5Frame &fromFrame	= GetDecodedFrame(from);
+
+	//Right on a frame, so there's nothing to blend
+	if(t <= 0.0f || to == from) {
+		memcpy((void*)positions,	 fromFrame.positions,	 numJoints * sizeof(Vector3));
+		memcpy((void*)orientations, fromFrame.orientations, numJoints * sizeof(Quaternion));
+		return;
+	}
+
+	MD5Frame &toFrame	= GetDecodedFrame(to);
+
+	for(unsigned int i = 0; i < numJoints; ++i) {
+		positions[i]	= fromFrame.positions[i] + ((toFrame.positions[i] - fromFrame.positions[i]) * t);
+		orientations[i]	= Quaternion::Slerp(fromFrame.orientations[i], toFrame.orientations[i], t);
+	}
+}
+
+/*
+Applies a local pose to the passed in skeleton's joints, and builds their 
+world transforms. Parents always come before their children in an MD5 
+hierarchy, so by the time a joint is reached its parent's transform is done.
+*/
+void	MD5Anim::BuildSkeleton(MD5Skeleton &skel, const Vector3 *positions, const Quaternion *orientations) const {
+	for(unsigned int i = 0; i < numJoints; ++i) {
 		//First, let's get a reference to the skeleton joint equating to the current baseframe joint
 		MD5Joint &skelJoint = skel.joints[i];
 
@@ -382,15 +502,15 @@ void	MD5Anim::TransformSkeleton(MD5Skeleton &skel, unsigned int frameNum) {
 
 		//We'll set its position and orientation to the transformed baseframe variables
 
-		skelJoint.position		= animPos;
-		skelJoint.orientation	= animQuat;	
+		skelJoint.position		= positions[i];
+		skelJoint.orientation	= orientations[i];	
 
 		//Now to set the local transform of the current joint. We start by turning the orientation
 		//quaternion into a Matrix4, then we set the resulting matrix translation to the
 		//transformed baseframe position
 
-		skelJoint.transform		= animQuat.ToMatrix();
-		skelJoint.transform.SetPositionVector(animPos);
+		skelJoint.transform		= orientations[i].ToMatrix();
+		skelJoint.transform.SetPositionVector(positions[i]);
 
 		//If the joint has no parent (determined by a negative parent variable) we need to 
 		//transform the joint's transform to the correct rotation, using the conversion matrix
@@ -21,6 +21,7 @@ _-_-_-_-_-_-_-""  ""
 
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "../Framework/quaternion.h"
 #include "../Framework/Vector3.h"
@@ -112,12 +113,21 @@ by the flags variable of the MD5AnimJoint
 struct MD5Frame {
 	float* components;
 
+	//The local pose of every joint once the components have been applied to
+	//the baseframe. Decoded the first time the frame is sampled, then kept.
+	Vector3*	positions;
+	Quaternion*	orientations;
+
 	MD5Frame::MD5Frame() {
-		components = NULL;
+		components	 = NULL;
+		positions	 = NULL;
+		orientations = NULL;
 	}
 
 	~MD5Frame() {
 		delete[] components;
+		delete[] positions;
+		delete[] orientations;
 	};
 };
 
@@ -132,6 +142,11 @@ and a baseFrame.
 */
 class MD5Anim	{
 public:
+	//MD5Cache reads and writes our loaded data directly
+	friend class MD5Cache;
+	//MD5PoseCache's benchmark times the old, decode every time, path
+	friend class MD5PoseCache;
+
 	//Constructor takes in a filename to load the MD5Anim data from
 	MD5Anim(std::string filename);
 	~MD5Anim(void);
@@ -140,15 +155,39 @@ public:
 	//orientations for the desired frame
 	void	TransformSkeleton(MD5Skeleton &skel,  unsigned int frame);
 
+	//Transforms the passed in skeleton to the pose msec milliseconds into the
+	//animation, which loops. Positions are lerped and orientations slerped
+	//between the two frames either side, the last frame blending back into
+	//the first.
+	void	SampleSkeleton(MD5Skeleton &skel, float msec);
+
+	//Interpolates the local pose msec milliseconds into the animation, as
+	//above, into arrays of numJoints positions and orientations
+	void	SampleLocalPose(float msec, Vector3 *positions, Quaternion *orientations);
+
+	//Sets the passed in skeleton's joints to a local pose, and works out 
+	//their transforms down the hierarchy
+	void	BuildSkeleton(MD5Skeleton &skel, const Vector3 *positions, const Quaternion *orientations) const;
+
 	//Returns the framerate
 	unsigned int	GetFrameRate() {return frameRate;}
 	//Returns the number of frames of animation
 	unsigned int	GetNumFrames() {return numFrames;}
+	//Returns the name of the file the animation was loaded from
+	const std::string&	GetFilename() {return filename;}
+	//Returns the number of joints the animation moves
+	unsigned int	GetNumJoints() {return numJoints;}
+	//Returns how many msec it takes to get through every frame, and back to the first
+	float			GetLength() {return frameRate ? (numFrames * 1000.0f) / frameRate : 0.0f;}
 
 protected:
+	//An empty MD5Anim, for MD5Cache to fill in
+	MD5Anim(void);
+
 	//Helper function used by the constructor to load in an MD5Anim from the 
-	//relevent file
-	void	LoadMD5Anim(std::string filename);
+	//relevent file. Returns false if the file was missing or had the wrong
+	//amount of data in it
+	bool	LoadMD5Anim(std::string filename);
 
 	//Helper function for LoadMD5Anim to load in the joints
 	void	LoadMD5AnimHierarchy(std::ifstream &from, unsigned int &count);
@@ -162,6 +201,14 @@ protected:
 	//Helper function for LoadMD5Anim to load in animation frames
 	void	LoadMD5AnimFrame(std::ifstream &from, unsigned int &count);
 
+	//Returns the frame, with its local pose decoded from the baseframe and
+	//components if that's not been done yet. Not thread safe!
+	MD5Frame&	GetDecodedFrame(unsigned int frameNum);
+
+	//Applies a frame's components to the baseframe, giving its local pose
+	void	DecodeFrame(unsigned int frameNum, Vector3 *positions, Quaternion *orientations) const;
+
+	std::string		filename;		//File this animation was loaded from
 	unsigned int	frameRate;		//Required framerate of this animation
 	unsigned int	numJoints;		//Number of joints in this animation
 	unsigned int	numFrames;		//Number of frames in this animation
@@ -171,4 +218,7 @@ protected:
 	MD5Bounds*		bounds;			//Array of bounding boxes for this animation
 	MD5Frame*		frames;			//Array of individual frames for this animation
 	MD5BaseFrame	baseFrame;		//BaseFrame for this animation
+
+	std::vector<Vector3>	samplePositions;	//Scratch space for SampleSkeleton
+	std::vector<Quaternion>	sampleOrientations;
 };
\ No newline at end of file
@@ -0,0 +1,657 @@
+#include "MD5Cache.h"
+
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "MD5Mesh.h"
+#include "MD5Anim.h"
+#include "MeshCache.h"
+#include "GameTimer.h"
+
+// Walks a mapped cache a block at a time, each block padded to 4 bytes
+struct MD5CacheReader
+{
+	const char *data;
+	const char *end;
+
+	// Returns NULL if the file is too short to hold count of them
+	template <class T> const T * Read(unsigned int count)
+	{
+		size_t size = count * sizeof(T);
+
+		if (size > (size_t)(end - data))
+		{
+			return NULL;
+		}
+
+		const T *block = (const T*)data;
+		size_t padded = (size + 3) & ~(size_t)3;
+
+		data = (padded > (size_t)(end - data)) ? end : data + padded;
+		return block;
+	}
+};
+
+static void WriteBlock(std::ofstream &f, const void *data, size_t size)
+{
+	static const char padding[4] = { 0, 0, 0, 0 };
+
+	f.write((const char*)data, size);
+	f.write(padding, ((size + 3) & ~(size_t)3) - size);
+}
+
+static bool WriteHeader(std::ofstream &f, const std::string &source, unsigned int magic)
+{
+	MD5CacheHeader header;
+	header.magic = magic;
+	header.version = MD5CACHE_VERSION;
+
+	if (!MappedFile::GetFileInfo(source, header.sourceSize, header.sourceTime))
+	{
+		return false;
+	}
+
+	header.sourceHash = MeshCache::HashFile(source);
+
+	WriteBlock(f, &header, sizeof(MD5CacheHeader));
+	return true;
+}
+
+// Don't leave a half written cache behind
+static bool FinishWriting(std::ofstream &f, const std::string &cacheName)
+{
+	f.close();
+
+	if (f.fail())
+	{
+		remove(cacheName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool MD5Cache::Open(const std::string &source, unsigned int magic, MappedFile &file)
+{
+	return MeshCache::OpenFile(source, GetCacheName(source), magic, MD5CACHE_VERSION, sizeof(MD5CacheHeader), file);
+}
+
+bool MD5Cache::ReadMesh(const std::string &source, MD5Mesh &into)
+{
+	MappedFile file;
+
+	if (!Open(source, MD5CACHE_MESH_MAGIC, file))
+	{
+		return false;
+	}
+
+	MD5CacheReader reader = { file.GetData() + sizeof(MD5CacheHeader), file.GetData() + file.GetSize() };
+
+	const MD5CacheMeshHeader *header = reader.Read<MD5CacheMeshHeader>(1);
+
+	if (!header)
+	{
+		return false;
+	}
+
+	// Find every block first, so a truncated cache leaves the mesh untouched
+	std::vector<const MD5CacheJoint*> joints(header->numJoints);
+	std::vector<const char*> names(header->numJoints);
+
+	for (unsigned int i = 0; i < header->numJoints; ++i)
+	{
+		joints[i] = reader.Read<MD5CacheJoint>(1);
+		names[i] = joints[i] ? reader.Read<char>(joints[i]->nameLength) : NULL;
+
+		if (!names[i])
+		{
+			return false;
+		}
+	}
+
+	std::vector<const MD5CacheSubMeshHeader*> subHeaders(header->numSubMeshes);
+	std::vector<const char*> shaders(header->numSubMeshes);
+	std::vector<const MD5Vert*> verts(header->numSubMeshes);
+	std::vector<const MD5Tri*> tris(header->numSubMeshes);
+	std::vector<const MD5Weight*> weights(header->numSubMeshes);
+
+	for (unsigned int i = 0; i < header->numSubMeshes; ++i)
+	{
+		const MD5CacheSubMeshHeader *sub = subHeaders[i] = reader.Read<MD5CacheSubMeshHeader>(1);
+
+		if (!sub || !(shaders[i] = reader.Read<char>(sub->shaderLength)) || !(verts[i] = reader.Read<MD5Vert>(sub->numVerts)) ||
+			!(tris[i] = reader.Read<MD5Tri>(sub->numTris)) || !(weights[i] = reader.Read<MD5Weight>(sub->numWeights)))
+		{
+			return false;
+		}
+	}
+
+	// Joints are rebuilt just as LoadMD5Joints builds them, from the same numbers
+	into.bindPose.numJoints = header->numJoints;
+	into.bindPose.joints = new MD5Joint[header->numJoints];
+	into.jointNames.reserve(header->numJoints);
+
+	for (unsigned int i = 0; i < header->numJoints; ++i)
+	{
+		const MD5CacheJoint &from = *joints[i];
+		MD5Joint &joint = into.bindPose.joints[i];
+
+		into.jointNames.push_back(std::string(names[i], from.nameLength));
+
+		joint.name = &into.jointNames.back();
+		joint.parent = from.parent;
+		joint.position = Vector3(from.position[0], from.position[1], from.position[2]);
+		joint.orientation = Quaternion(from.orientation[0], from.orientation[1], from.orientation[2], from.orientation[3]);
+
+		joint.transform = joint.orientation.ToMatrix();
+		joint.transform.SetPositionVector(joint.position);
+		joint.transform = MD5Mesh::conversionMatrix * joint.transform;
+	}
+
+	into.numSubMeshes = header->numSubMeshes;
+	into.subMeshes = new MD5SubMesh[header->numSubMeshes];
+
+	for (unsigned int i = 0; i < header->numSubMeshes; ++i)
+	{
+		const MD5CacheSubMeshHeader &sub = *subHeaders[i];
+		MD5SubMesh &m = into.subMeshes[i];
+
+		m.numverts = sub.numVerts;
+		m.numtris = sub.numTris;
+		m.numweights = sub.numWeights;
+
+		m.verts = new MD5Vert[sub.numVerts];
+		m.tris = new MD5Tri[sub.numTris];
+		m.weights = new MD5Weight[sub.numWeights];
+
+		memcpy((void*)m.verts, verts[i], sub.numVerts * sizeof(MD5Vert));
+		memcpy((void*)m.tris, tris[i], sub.numTris * sizeof(MD5Tri));
+		memcpy((void*)m.weights, weights[i], sub.numWeights * sizeof(MD5Weight));
+
+		m.shader = std::string(shaders[i], sub.shaderLength);
+
+		if (!m.shader.empty())
+		{
+			into.LoadShaderProxy(m.shader, m);
+		}
+	}
+
+	return true;
+}
+
+bool MD5Cache::WriteMesh(const std::string &source, const MD5Mesh &from)
+{
+	std::string cacheName = GetCacheName(source);
+	std::ofstream f(cacheName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if (!f || !WriteHeader(f, source, MD5CACHE_MESH_MAGIC))
+	{
+		return false;
+	}
+
+	MD5CacheMeshHeader header;
+	header.numJoints = from.bindPose.numJoints;
+	header.numSubMeshes = from.numSubMeshes;
+
+	WriteBlock(f, &header, sizeof(MD5CacheMeshHeader));
+
+	for (int i = 0; i < from.bindPose.numJoints; ++i)
+	{
+		const MD5Joint &joint = from.bindPose.joints[i];
+		const std::string &name = from.jointNames[i];
+
+		MD5CacheJoint cached;
+		cached.parent = joint.parent;
+		cached.position[0] = joint.position.x;
+		cached.position[1] = joint.position.y;
+		cached.position[2] = joint.position.z;
+		cached.orientation[0] = joint.orientation.x;
+		cached.orientation[1] = joint.orientation.y;
+		cached.orientation[2] = joint.orientation.z;
+		cached.orientation[3] = joint.orientation.w;
+		cached.nameLength = (unsigned int)name.size();
+
+		WriteBlock(f, &cached, sizeof(MD5CacheJoint));
+		WriteBlock(f, name.data(), name.size());
+	}
+
+	for (unsigned int i = 0; i < from.numSubMeshes; ++i)
+	{
+		const MD5SubMesh &m = from.subMeshes[i];
+
+		MD5CacheSubMeshHeader sub;
+		sub.numVerts = m.numverts;
+		sub.numTris = m.numtris;
+		sub.numWeights = m.numweights;
+		sub.shaderLength = (unsigned int)m.shader.size();
+
+		WriteBlock(f, &sub, sizeof(MD5CacheSubMeshHeader));
+		WriteBlock(f, m.shader.data(), m.shader.size());
+		WriteBlock(f, m.verts, m.numverts * sizeof(MD5Vert));
+		WriteBlock(f, m.tris, m.numtris * sizeof(MD5Tri));
+		WriteBlock(f, m.weights, m.numweights * sizeof(MD5Weight));
+	}
+
+	return FinishWriting(f, cacheName);
+}
+
+bool MD5Cache::ReadAnim(const std::string &source, MD5Anim &into)
+{
+	MappedFile file;
+
+	if (!Open(source, MD5CACHE_ANIM_MAGIC, file))
+	{
+		return false;
+	}
+
+	MD5CacheReader reader = { file.GetData() + sizeof(MD5CacheHeader), file.GetData() + file.GetSize() };
+
+	const MD5CacheAnimHeader *header = reader.Read<MD5CacheAnimHeader>(1);
+
+	if (!header)
+	{
+		return false;
+	}
+
+	std::vector<const MD5CacheAnimJoint*> joints(header->numJoints);
+	std::vector<const char*> names(header->numJoints);
+
+	for (unsigned int i = 0; i < header->numJoints; ++i)
+	{
+		joints[i] = reader.Read<MD5CacheAnimJoint>(1);
+		names[i] = joints[i] ? reader.Read<char>(joints[i]->nameLength) : NULL;
+
+		if (!names[i])
+		{
+			return false;
+		}
+	}
+
+	unsigned int numComponents = header->numAnimatedComponents;
+
+	const MD5Bounds *bounds = reader.Read<MD5Bounds>(header->numFrames);
+	const Vector3 *positions = reader.Read<Vector3>(header->numJoints);
+	const Quaternion *orientations = reader.Read<Quaternion>(header->numJoints);
+
+	const float *values = NULL;
+	const float *minimum = NULL;
+	const float *step = NULL;
+	const unsigned short *quantised = NULL;
+
+	if (header->frameEncoding == MD5CACHE_FRAMES_FLOAT)
+	{
+		values = reader.Read<float>(header->numFrames * numComponents);
+	}
+	else if (header->frameEncoding == MD5CACHE_FRAMES_QUANTISED)
+	{
+		minimum = reader.Read<float>(numComponents);
+		step = reader.Read<float>(numComponents);
+		quantised = reader.Read<unsigned short>(header->numFrames * numComponents);
+	}
+
+	if (!bounds || !positions || !orientations || !(values || (minimum && step && quantised)))
+	{
+		return false;
+	}
+
+	into.frameRate = header->frameRate;
+	into.numJoints = header->numJoints;
+	into.numFrames = header->numFrames;
+	into.numAnimatedComponents = numComponents;
+
+	into.joints = new MD5AnimJoint[header->numJoints];
+
+	for (unsigned int i = 0; i < header->numJoints; ++i)
+	{
+		into.joints[i].name = std::string(names[i], joints[i]->nameLength);
+		into.joints[i].parent = joints[i]->parent;
+		into.joints[i].flags = joints[i]->flags;
+		into.joints[i].frameIndex = joints[i]->frameIndex;
+	}
+
+	into.bounds = new MD5Bounds[header->numFrames];
+	memcpy((void*)into.bounds, bounds, header->numFrames * sizeof(MD5Bounds));
+
+	into.baseFrame.positions = new Vector3[header->numJoints];
+	into.baseFrame.orientations = new Quaternion[header->numJoints];
+	memcpy((void*)into.baseFrame.positions, positions, header->numJoints * sizeof(Vector3));
+	memcpy((void*)into.baseFrame.orientations, orientations, header->numJoints * sizeof(Quaternion));
+
+	into.frames = new MD5Frame[header->numFrames];
+
+	for (unsigned int i = 0; i < header->numFrames; ++i)
+	{
+		float *components = into.frames[i].components = new float[numComponents];
+
+		if (values)
+		{
+			memcpy(components, values + i * numComponents, numComponents * sizeof(float));
+			continue;
+		}
+
+		const unsigned short *q = quantised + i * numComponents;
+
+		for (unsigned int c = 0; c < numComponents; ++c)
+		{
+			components[c] = minimum[c] + q[c] * step[c];
+		}
+	}
+
+	return true;
+}
+
+bool MD5Cache::WriteAnim(const std::string &source, const MD5Anim &from)
+{
+	// An anim without a base frame or with missing frames can't be played, so isn't worth keeping
+	if (!from.baseFrame.positions || !from.baseFrame.orientations)
+	{
+		return false;
+	}
+
+	unsigned int numComponents = from.numAnimatedComponents;
+
+	for (unsigned int i = 0; i < from.numFrames; ++i)
+	{
+		if (!from.frames[i].components)
+		{
+			return false;
+		}
+	}
+
+	std::string cacheName = GetCacheName(source);
+	std::ofstream f(cacheName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if (!f || !WriteHeader(f, source, MD5CACHE_ANIM_MAGIC))
+	{
+		return false;
+	}
+
+	MD5CacheAnimHeader header;
+	header.frameRate = from.frameRate;
+	header.numJoints = from.numJoints;
+	header.numFrames = from.numFrames;
+	header.numAnimatedComponents = numComponents;
+	header.padding = 0;
+
+#ifdef MD5CACHE_QUANTISE_FRAMES
+	header.frameEncoding = MD5CACHE_FRAMES_QUANTISED;
+#else
+	header.frameEncoding = MD5CACHE_FRAMES_FLOAT;
+#endif
+
+	WriteBlock(f, &header, sizeof(MD5CacheAnimHeader));
+
+	for (unsigned int i = 0; i < from.numJoints; ++i)
+	{
+		const MD5AnimJoint &joint = from.joints[i];
+
+		MD5CacheAnimJoint cached;
+		cached.parent = joint.parent;
+		cached.flags = joint.flags;
+		cached.frameIndex = joint.frameIndex;
+		cached.nameLength = (unsigned int)joint.name.size();
+
+		WriteBlock(f, &cached, sizeof(MD5CacheAnimJoint));
+		WriteBlock(f, joint.name.data(), joint.name.size());
+	}
+
+	WriteBlock(f, from.bounds, from.numFrames * sizeof(MD5Bounds));
+	WriteBlock(f, from.baseFrame.positions, from.numJoints * sizeof(Vector3));
+	WriteBlock(f, from.baseFrame.orientations, from.numJoints * sizeof(Quaternion));
+
+	if (header.frameEncoding == MD5CACHE_FRAMES_FLOAT)
+	{
+		for (unsigned int i = 0; i < from.numFrames; ++i)
+		{
+			WriteBlock(f, from.frames[i].components, numComponents * sizeof(float));
+		}
+
+		return FinishWriting(f, cacheName);
+	}
+
+	// Each component gets its own range, over every frame of the animation
+	std::vector<float> minimum(numComponents, 0.0f);
+	std::vector<float> step(numComponents, 0.0f);
+
+	for (unsigned int c = 0; c < numComponents; ++c)
+	{
+		float low = from.numFrames ? from.frames[0].components[c] : 0.0f;
+		float high = low;
+
+		for (unsigned int i = 1; i < from.numFrames; ++i)
+		{
+			float value = from.frames[i].components[c];
+
+			low = (value < low) ? value : low;
+			high = (value > high) ? value : high;
+		}
+
+		minimum[c] = low;
+		step[c] = (high - low) / 65535.0f;
+	}
+
+	std::vector<unsigned short> quantised(from.numFrames * numComponents);
+
+	for (unsigned int i = 0; i < from.numFrames; ++i)
+	{
+		for (unsigned int c = 0; c < numComponents; ++c)
+		{
+			float q = (step[c] > 0.0f) ? (from.frames[i].components[c] - minimum[c]) / step[c] : 0.0f;
+			q = floorf(q + 0.5f);
+
+			quantised[i * numComponents + c] = (unsigned short)(q < 0.0f ? 0.0f : (q > 65535.0f ? 65535.0f : q));
+		}
+	}
+
+	WriteBlock(f, minimum.empty() ? NULL : &minimum[0], numComponents * sizeof(float));
+	WriteBlock(f, step.empty() ? NULL : &step[0], numComponents * sizeof(float));
+	WriteBlock(f, quantised.empty() ? NULL : &quantised[0], quantised.size() * sizeof(unsigned short));
+
+	return FinishWriting(f, cacheName);
+}
+
+bool MD5Cache::CompareMesh(const std::string &source)
+{
+	GameTimer timer;
+
+	MD5Mesh text;
+	float start = timer.GetMS();
+
+	if (!text.ParseMD5Mesh(source))
+	{
+		std::cout << "MD5Cache::CompareMesh Can't parse " << source << std::endl;
+		return false;
+	}
+
+	float textTime = timer.GetMS() - start;
+
+	if (!WriteMesh(source, text))
+	{
+		std::cout << "MD5Cache::CompareMesh Can't write the cache of " << source << std::endl;
+		return false;
+	}
+
+	MD5Mesh cached;
+	start = timer.GetMS();
+
+	if (!ReadMesh(source, cached))
+	{
+		std::cout << "MD5Cache::CompareMesh Can't read the cache of " << source << std::endl;
+		return false;
+	}
+
+	float cacheTime = timer.GetMS() - start;
+
+	unsigned int differences = 0;
+
+	if (text.bindPose.numJoints != cached.bindPose.numJoints || text.numSubMeshes != cached.numSubMeshes)
+	{
+		std::cout << "MD5Cache::CompareMesh " << source << ": joint or submesh counts differ" << std::endl;
+		return false;
+	}
+
+	for (int i = 0; i < text.bindPose.numJoints; ++i)
+	{
+		const MD5Joint &a = text.bindPose.joints[i];
+		const MD5Joint &b = cached.bindPose.joints[i];
+
+		if (*a.name != *b.name || a.parent != b.parent || memcmp(&a.position, &b.position, sizeof(Vector3)) ||
+			memcmp(&a.orientation, &b.orientation, sizeof(Quaternion)) || memcmp(a.transform.values, b.transform.values, sizeof(float) * 16))
+		{
+			++differences;
+		}
+	}
+
+	for (unsigned int i = 0; i < text.numSubMeshes; ++i)
+	{
+		const MD5SubMesh &a = text.subMeshes[i];
+		const MD5SubMesh &b = cached.subMeshes[i];
+
+		if (a.numverts != b.numverts || a.numtris != b.numtris || a.numweights != b.numweights || a.shader != b.shader ||
+			memcmp(a.verts, b.verts, a.numverts * sizeof(MD5Vert)) || memcmp(a.tris, b.tris, a.numtris * sizeof(MD5Tri)) ||
+			memcmp(a.weights, b.weights, a.numweights * sizeof(MD5Weight)))
+		{
+			++differences;
+		}
+	}
+
+	// Nothing was made into Meshes, so nothing else owns the proxies' textures
+	for (unsigned int i = 0; i < text.numSubMeshes; ++i)
+	{
+		glDeleteTextures(1, &text.subMeshes[i].texIndex);
+		glDeleteTextures(1, &cached.subMeshes[i].texIndex);
+#ifdef MD5_USE_TANGENTS_BUMPMAPS
+		glDeleteTextures(1, &text.subMeshes[i].bumpIndex);
+		glDeleteTextures(1, &cached.subMeshes[i].bumpIndex);
+#endif
+	}
+
+	std::cout << "MD5Cache::CompareMesh " << source << ": " << text.bindPose.numJoints << " joints, " << text.numSubMeshes
+			  << " submeshes, text " << textTime << "ms, cache " << cacheTime << "ms, "
+			  << (differences ? "DIFFERENT" : "identical") << std::endl;
+
+	return differences == 0;
+}
+
+bool MD5Cache::CompareAnim(const std::string &source)
+{
+	GameTimer timer;
+
+	MD5Anim text;
+	float start = timer.GetMS();
+
+	if (!text.LoadMD5Anim(source))
+	{
+		std::cout << "MD5Cache::CompareAnim Can't parse " << source << std::endl;
+		return false;
+	}
+
+	float textTime = timer.GetMS() - start;
+
+	if (!WriteAnim(source, text))
+	{
+		std::cout << "MD5Cache::CompareAnim Can't write the cache of " << source << std::endl;
+		return false;
+	}
+
+	MD5Anim cached;
+	start = timer.GetMS();
+
+	if (!ReadAnim(source, cached))
+	{
+		std::cout << "MD5Cache::CompareAnim Can't read the cache of " << source << std::endl;
+		return false;
+	}
+
+	float cacheTime = timer.GetMS() - start;
+
+	if (text.frameRate != cached.frameRate || text.numJoints != cached.numJoints || text.numFrames != cached.numFrames ||
+		text.numAnimatedComponents != cached.numAnimatedComponents)
+	{
+		std::cout << "MD5Cache::CompareAnim " << source << ": counts differ" << std::endl;
+		return false;
+	}
+
+	unsigned int differences = 0;
+
+	for (unsigned int i = 0; i < text.numJoints; ++i)
+	{
+		const MD5AnimJoint &a = text.joints[i];
+		const MD5AnimJoint &b = cached.joints[i];
+
+		if (a.name != b.name || a.parent != b.parent || a.flags != b.flags || a.frameIndex != b.frameIndex)
+		{
+			++differences;
+		}
+	}
+
+	if (memcmp(text.bounds, cached.bounds, text.numFrames * sizeof(MD5Bounds)) ||
+		memcmp(text.baseFrame.positions, cached.baseFrame.positions, text.numJoints * sizeof(Vector3)) ||
+		memcmp(text.baseFrame.orientations, cached.baseFrame.orientations, text.numJoints * sizeof(Quaternion)))
+	{
+		++differences;
+	}
+
+	// Quantised components may each be up to half a step out, the step being their range over 65535
+	float maxError = 0.0f;
+
+	for (unsigned int c = 0; c < text.numAnimatedComponents; ++c)
+	{
+		float low = text.numFrames ? text.frames[0].components[c] : 0.0f;
+		float high = low;
+
+		for (unsigned int i = 1; i < text.numFrames; ++i)
+		{
+			low = min(low, text.frames[i].components[c]);
+			high = max(high, text.frames[i].components[c]);
+		}
+
+		float tolerance = 0.0f;
+
+#ifdef MD5CACHE_QUANTISE_FRAMES
+		tolerance = (high - low) / 65535.0f * 0.5f + max(fabs(low), fabs(high)) * 1e-6f;
+#endif
+
+		for (unsigned int i = 0; i < text.numFrames; ++i)
+		{
+			float error = fabs(text.frames[i].components[c] - cached.frames[i].components[c]);
+			maxError = max(maxError, error);
+
+			if (error > tolerance)
+			{
+				++differences;
+			}
+		}
+	}
+
+	// How far that moves the joints, once they're posed and put through the hierarchy
+	MD5Skeleton a;
+	MD5Skeleton b;
+	a.numJoints = b.numJoints = text.numJoints;
+	a.joints = new MD5Joint[text.numJoints];
+	b.joints = new MD5Joint[text.numJoints];
+
+	float maxJointError = 0.0f;
+
+	for (unsigned int i = 0; i < text.numFrames; ++i)
+	{
+		text.TransformSkeleton(a, i);
+		cached.TransformSkeleton(b, i);
+
+		for (unsigned int j = 0; j < text.numJoints; ++j)
+		{
+			Vector3 d = a.joints[j].transform.GetPositionVector() - b.joints[j].transform.GetPositionVector();
+			maxJointError = max(maxJointError, max(fabs(d.x), max(fabs(d.y), fabs(d.z))));
+		}
+	}
+
+	std::cout << "MD5Cache::CompareAnim " << source << ": " << text.numFrames << " frames of " << text.numAnimatedComponents
+			  << " components, text " << textTime << "ms, cache " << cacheTime << "ms, largest component error "
+			  << maxError << ", largest joint error " << maxJointError << (differences ? ", DIFFERENT" : "") << std::endl;
+
+	return differences == 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+ * Versioned binary copies of MD5Mesh and MD5Anim files, stored next to the
+ * text file they were converted from (bob.md5mesh -> bob.md5mesh.cache), and
+ * checked against it the same way as a MeshCache. The text files stay the
+ * source of truth; a cache is just thrown away and written again whenever
+ * its source changes.
+ *
+ * A mesh cache holds the joints, and each submesh's verts, tris and weights
+ * exactly as they're kept in memory, so they come out of the mapped file with
+ * one memcpy each. An anim cache holds the hierarchy, bounds and base frame
+ * the same way. Its frames are quantised: each animated component is stored
+ * as 16 bits between its smallest and largest value over the animation,
+ * which for a joint position a metre across is under a hundredth of a
+ * millimetre out. Undefine MD5CACHE_QUANTISE_FRAMES to store plain floats.
+ */
+#include <string>
+
+#include "MappedFile.h"
+#include "MeshCache.h"
+
+#define MD5CACHE_MESH_MAGIC		0x4D35444D	// "MD5M"
+#define MD5CACHE_ANIM_MAGIC		0x4135444D	// "MD5A"
+#define MD5CACHE_VERSION		1
+#define MD5CACHE_EXTENSION		".cache"
+
+#define MD5CACHE_QUANTISE_FRAMES
+
+// How an anim cache's frames are stored
+#define MD5CACHE_FRAMES_FLOAT		0
+#define MD5CACHE_FRAMES_QUANTISED	1
+
+class MD5Mesh;
+class MD5Anim;
+
+// Nothing MD5 specific in it, it's checked by MeshCache::OpenFile
+typedef CacheHeader MD5CacheHeader;
+
+struct MD5CacheMeshHeader
+{
+	unsigned int numJoints;
+	unsigned int numSubMeshes;
+};
+
+// Followed by nameLength characters, padded to 4 bytes
+struct MD5CacheJoint
+{
+	int				parent;
+	float			position[3];
+	float			orientation[4];
+	unsigned int	nameLength;
+};
+
+// Followed by the shader name, then the verts, tris and weights
+struct MD5CacheSubMeshHeader
+{
+	unsigned int numVerts;
+	unsigned int numTris;
+	unsigned int numWeights;
+	unsigned int shaderLength;
+};
+
+struct MD5CacheAnimHeader
+{
+	unsigned int frameRate;
+	unsigned int numJoints;
+	unsigned int numFrames;
+	unsigned int numAnimatedComponents;
+	unsigned int frameEncoding;
+	unsigned int padding;
+};
+
+// Followed by nameLength characters, padded to 4 bytes
+struct MD5CacheAnimJoint
+{
+	int				parent;
+	int				flags;
+	int				frameIndex;
+	unsigned int	nameLength;
+};
+
+class MD5Cache
+{
+public:
+	/*
+	 * Fill a freshly constructed MD5Mesh or MD5Anim from the cache of the
+	 * given source file, returning false if there's no valid cache. A mesh
+	 * still needs its current skeleton and Meshes making afterwards, just as
+	 * after parsing the text.
+	 */
+	static bool ReadMesh(const std::string &source, MD5Mesh &into);
+	static bool ReadAnim(const std::string &source, MD5Anim &into);
+
+	// Write the cache of a mesh or anim that's just been parsed from the given source file
+	static bool WriteMesh(const std::string &source, const MD5Mesh &from);
+	static bool WriteAnim(const std::string &source, const MD5Anim &from);
+
+	static std::string GetCacheName(const std::string &source) { return source + MD5CACHE_EXTENSION; }
+
+	/*
+	 * Parse the text file, write its cache and read it back, and check that
+	 * everything matches: exactly, apart from quantised anim frames, which
+	 * must be within half a step of the text. Also prints how long the text
+	 * and the cache each took to load. Returns false if anything differed.
+	 */
+	static bool CompareMesh(const std::string &source);
+	static bool CompareAnim(const std::string &source);
+
+protected:
+	// Maps a cache and checks it was written from the current source file
+	static bool Open(const std::string &source, unsigned int magic, MappedFile &file);
+};
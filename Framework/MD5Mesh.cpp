@@ -1,4 +1,9 @@
 #include "MD5Mesh.h"
+#include "NormalGenerator.h"
+#include "MD5PoseCache.h"
+
+#include <sstream>
+
 /*
 http://www.modwiki.net/wiki/MD5MESH_%28file_format%29
 */
@@ -26,6 +31,10 @@ MD5Mesh::MD5Mesh() {
 	subMeshes		 = NULL;
 	currentAnim		 = NULL;
 	frameTime	     = 0.0f;
+	animTime		 = 0.0f;
+	poseCache		 = NULL;
+	gpuSkinning		 = false;
+	paletteBuffer	 = 0;
 }
 
 MD5Mesh::~MD5Mesh(void)	{
@@ -35,6 +44,11 @@ MD5Mesh::~MD5Mesh(void)	{
 	}
 
 	delete[]subMeshes; //Clean up our heap!
+
+	if(!skinningBuffers.empty()) {
+		glDeleteBuffers(skinningBuffers.size(), &skinningBuffers[0]);
+	}
+	glDeleteBuffers(1, &paletteBuffer);
 }
 
 /*
@@ -46,12 +60,44 @@ automatically be used by this overloaded function. Once 'this' has been drawn,
 all of the children of 'this' will be drawn
 */
 void MD5Mesh::Draw() {
+	BindPalette();
+
 	Mesh::Draw();
 	for(unsigned int i = 0; i < children.size(); ++i) {
 		children[i]->Draw();
 	}
 };
 
+void MD5Mesh::DrawInstanced(GLuint numInstances) {
+	BindPalette();
+
+	Mesh::DrawInstanced(numInstances);
+	for(unsigned int i = 0; i < children.size(); ++i) {
+		children[i]->DrawInstanced(numInstances);
+	}
+}
+
+void MD5Mesh::SetInstanceBuffer(const InstanceBuffer *buffer) {
+	Mesh::SetInstanceBuffer(buffer);
+	for(unsigned int i = 0; i < children.size(); ++i) {
+		children[i]->SetInstanceBuffer(buffer);
+	}
+}
+
+void MD5Mesh::BindPalette() {
+	//Skinning shaders read the palette from a uniform block, so point whatever's bound at it
+	if(gpuSkinning) {
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+
+		GLuint block = glGetUniformBlockIndex(program, "JointPalette");
+		if(block != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program, block, MD5_PALETTE_BINDING);
+		}
+		glBindBufferBase(GL_UNIFORM_BUFFER, MD5_PALETTE_BINDING, paletteBuffer);
+	}
+}
+
 /*
 This function loads in the texture filenames for the current MD5Mesh.
 
@@ -118,6 +164,52 @@ Loads MD5Mesh data in from a file with the given filename. Returns false if this
 otherwise returns true.
 */
 bool	MD5Mesh::LoadMD5Mesh(std::string filename)	{
+#ifdef MD5_USE_CACHE
+	/*
+	If there's a valid cache next to the MD5Mesh file, the joints and submeshes
+	come straight out of it, and the text is never parsed. Otherwise we parse
+	the text, and write the cache for next time.
+	*/
+	bool loaded = MD5Cache::ReadMesh(filename, *this);
+
+	if(!loaded) {
+		loaded = ParseMD5Mesh(filename);
+
+		if(loaded && !MD5Cache::WriteMesh(filename, *this)) {
+			std::cout << "MD5Mesh::LoadMD5Mesh Couldn't write mesh cache for " << filename << std::endl;
+		}
+	}
+#else
+	bool loaded = ParseMD5Mesh(filename);
+#endif
+
+	if(!loaded) {
+		return false;
+	}
+
+	/*
+	Now we have a 'bind pose' skeleton, which is handy. What we're also going to do is mempy
+	this skeleton, so we have a 'scratch' skeleton we can pass around to MD5Anims to modify it,
+	without losing the ability to draw the mesh in the bind pose.
+	*/
+
+	currentSkeleton.numJoints = bindPose.numJoints;
+	currentSkeleton.joints = new MD5Joint[bindPose.numJoints];
+
+	//Don't bother doing any file parsing, just memcpy the joints straight into the currentSkeleton!
+	memcpy((void*)currentSkeleton.joints,(void*)bindPose.joints,sizeof(MD5Joint)*bindPose.numJoints);
+
+	//Everything is OK! let's create our submeshes :)
+	CreateMeshes();
+
+	return true;
+}
+
+/*
+Parses the joints and submeshes of an MD5Mesh file. Returns false if the file
+couldn't be opened, or didn't have as many joints or submeshes as it said.
+*/
+bool	MD5Mesh::ParseMD5Mesh(std::string filename)	{
 	std::ifstream f(filename,std::ios::in);	//MD5 files are text based, so don't make it an ios::binary ifstream...
 
 	if(!f) {
@@ -165,6 +257,9 @@ bool	MD5Mesh::LoadMD5Mesh(std::string filename)	{
 			std::cout << "Expecting file to have " << numExpectedJoints << " joints" << std::endl;
 			//grab enough space for this number of joints
 			bindPose.joints = new MD5Joint[numExpectedJoints];
+
+			//Joints point at their names, so the names must never be moved
+			jointNames.reserve(numExpectedJoints);
 		}
 		else if(currentLine.find(MD5_NUMMESHES_TAG) != std::string::npos) {
 			f >> numExpectedMeshes; //load in the number of submeshes held in this md5mesh
@@ -187,18 +282,6 @@ bool	MD5Mesh::LoadMD5Mesh(std::string filename)	{
 	//If we get to here, we've loaded in everything from the file, so we can close it
 	f.close();
 
-	/*
-	Now we have a 'bind pose' skeleton, which is handy. What we're also going to do is mempy
-	this skeleton, so we have a 'scratch' skeleton we can pass around to MD5Anims to modify it,
-	without losing the ability to draw the mesh in the bind pose.
-	*/
-
-	currentSkeleton.numJoints = bindPose.numJoints;
-	currentSkeleton.joints = new MD5Joint[bindPose.numJoints];
-
-	//Don't bother doing any file parsing, just memcpy the joints straight into the currentSkeleton!
-	memcpy((void*)currentSkeleton.joints,(void*)bindPose.joints,sizeof(MD5Joint)*bindPose.numJoints);
-
 	//If what we've loaded in does not equal what we /should/ have loaded in, we'll output an error
 	//
 	if(numLoadedJoints != numExpectedJoints) {
@@ -211,9 +294,6 @@ bool	MD5Mesh::LoadMD5Mesh(std::string filename)	{
 		return false;
 	}
 
-	//Everything is OK! let's create our submeshes :)
-	CreateMeshes();
-
 	return true;
 }
 
@@ -332,6 +412,7 @@ void MD5Mesh::LoadMD5SubMesh( std::ifstream &from, int &count )	{
 			//If the line is a shader, we let the LoadShaderProxy function handle it
 			std::string shaderName;
 			from >> shaderName;
+			m.shader = shaderName;	//Kept for MD5Cache, which needs to load the proxy too
 			LoadShaderProxy(shaderName,m);
 		}
 		else if(tempLine == MD5_SUBMESH_NUMVERTS) {
@@ -453,6 +534,19 @@ void MD5Mesh::CreateMeshes()	{
 			target->indices[(j*3)+2] = subMesh.tris[j].a;
 		}
 
+#ifdef MD5_USE_MESH_OPTIMISER
+		/*
+		Skinning writes vertex j of the Mesh from MD5Vert j of the submesh, so
+		reordering the vertices for fetch locality just means reordering the 
+		MD5Verts the same way. The weights they point to don't move.
+		*/
+		MeshOptimiser::OptimiseVertexCache(target->indices, target->numIndices, target->numVertices);
+
+		std::vector<unsigned int> remap;
+		MeshOptimiser::OptimiseVertexFetch(target->indices, target->numIndices, target->numVertices, remap);
+		MeshOptimiser::RemapArray(subMesh.verts, subMesh.numverts, remap);
+#endif
+
 		//If we added 'this' as a child of itself, we'd create an infinite loop
 		//in the MD5Mesh::Draw function...that's not very good.
 		if(target != this) {
@@ -465,6 +559,21 @@ void MD5Mesh::CreateMeshes()	{
 
 	//Once all of the submeshes are created, we should skin the mesh into the bindpose
 	SkinVertices(bindPose);
+
+#ifdef MD5_USE_FAST_SKINNING
+	/*
+	That first skin went through the reference loop and generated the bind pose 
+	normals and tangents, which MD5Skinning keeps from now on, in joint space.
+	*/
+	skinning.Clear();
+	for(unsigned int i = 0; i < numSubMeshes; ++i) {
+		MD5Mesh*target		= this;
+		if(i != 0) {
+			target = (MD5Mesh*)children.at(i-1);
+		}
+		skinning.AddSubMesh(subMeshes[i], bindPose, target->normals, target->tangents);
+	}
+#endif
 }
 
 /*
@@ -472,6 +581,33 @@ Skins each vertex by its weightings, producing a final skinned mesh in the passe
 skeleton pose. 
 */
 void	MD5Mesh::SkinVertices(MD5Skeleton &skel) {
+	//On the GPU, the vertex buffers never change - just the palette
+	if(gpuSkinning) {
+		MD5Skinning::BuildPalette(skel, &bindPose, gpuPalette);
+
+		glBindBuffer(GL_UNIFORM_BUFFER, paletteBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, gpuPalette.size()*sizeof(float), (void*)&gpuPalette[0]);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		return;
+	}
+
+#ifdef MD5_USE_FAST_SKINNING
+	//Once CreateMeshes has batched the weights, the palette path takes over
+	if(skinning.GetNumSubMeshes() == numSubMeshes) {
+		skinning.SetPose(skel);
+
+		for(unsigned int i = 0; i < numSubMeshes; ++i) {
+			MD5Mesh*target		= this;
+			if(i != 0) {
+				target = (MD5Mesh*)children.at(i-1);
+			}
+
+			skinning.Skin(i, target->vertices, target->normals, target->tangents);
+			target->RebufferData();
+		}
+		return;
+	}
+#endif
 	//For each submesh, we want to transform a position for each vertex
 	for(unsigned int i = 0; i < numSubMeshes; ++i) {
 		MD5SubMesh& subMesh = subMeshes[i];	//Get a reference to the current submesh
@@ -537,6 +673,196 @@ void	MD5Mesh::SkinVertices(MD5Skeleton &skel) {
 	}
 }
 
+/*
+Runs the NormalGenerator benchmark over the skinned vertices of each submesh,
+picking out the targets just as SkinVertices does.
+*/
+bool	MD5Mesh::BenchmarkNormals(int iterations) {
+	bool passed = true;
+
+	for(unsigned int i = 0; i < numSubMeshes; ++i) {
+		MD5Mesh*target		= this;
+		if(i != 0) {
+			target = (MD5Mesh*)children.at(i-1);
+		}
+
+		std::stringstream name;
+		name << "MD5Mesh submesh " << i;
+
+		passed &= NormalGenerator::Benchmark(name.str(), target->vertices, target->textureCoords, target->numVertices,
+											 target->indices, target->numIndices, iterations);
+	}
+	return passed;
+}
+
+/*
+Converts every submesh to the GPU skinning attributes, and adds them to the
+submesh's VAO, or takes them away again.
+*/
+bool	MD5Mesh::SetGPUSkinning(bool enabled) {
+	if(enabled == gpuSkinning) {
+		return true;
+	}
+
+	if(enabled) {
+		//The palette lives in a uniform block, which needs GL 3.1
+		if(!GLEW_VERSION_3_1 && !GLEW_ARB_uniform_buffer_object) {
+			std::cout << "MD5Mesh: GPU skinning needs uniform buffer objects" << std::endl;
+			return false;
+		}
+
+		vector<MD5GPUSkinningVertices> converted(numSubMeshes);
+
+		for(unsigned int i = 0; i < numSubMeshes; ++i) {
+			if(!MD5Skinning::BuildGPUVertices(subMeshes[i], bindPose, converted[i])) {
+				return false;
+			}
+
+			if(converted[i].numTruncated > 0) {
+				std::cout << "MD5Mesh: submesh " << i << " has " << converted[i].numTruncated << " vertices with more than " 
+					<< MD5SKINNING_GPU_WEIGHTS << " weights, which lose their lightest ones" << std::endl;
+			}
+		}
+
+		//The palette skins from the bind pose, so that's what the vertex buffers need to hold
+		SkinVertices(bindPose);
+
+		skinningBuffers.resize(numSubMeshes*2);
+		glGenBuffers(skinningBuffers.size(), &skinningBuffers[0]);
+
+		for(unsigned int i = 0; i < numSubMeshes; ++i) {
+			MD5Mesh*target		= this;
+			if(i != 0) {
+				target = (MD5Mesh*)children.at(i-1);
+			}
+
+			GLStateCache::Get().BindVertexArray(target->arrayObject);
+
+			//Joint indices stay integers, so they go through glVertexAttribIPointer
+			glBindBuffer(GL_ARRAY_BUFFER, skinningBuffers[i*2]);
+			glBufferData(GL_ARRAY_BUFFER, converted[i].joints.size(), &converted[i].joints[0], GL_STATIC_DRAW);
+			glVertexAttribIPointer(JOINT_INDEX_ATTRIBUTE, MD5SKINNING_GPU_WEIGHTS, GL_UNSIGNED_BYTE, 0, 0);
+			glEnableVertexAttribArray(JOINT_INDEX_ATTRIBUTE);
+
+			//One anchor per weight, each its own attribute location
+			glBindBuffer(GL_ARRAY_BUFFER, skinningBuffers[(i*2)+1]);
+			glBufferData(GL_ARRAY_BUFFER, converted[i].anchors.size()*sizeof(Vector4), &converted[i].anchors[0], GL_STATIC_DRAW);
+
+			for(int k = 0; k < MD5SKINNING_GPU_WEIGHTS; ++k) {
+				glVertexAttribPointer(JOINT_ANCHOR_ATTRIBUTE + k, 4, GL_FLOAT, GL_FALSE, 
+					MD5SKINNING_GPU_WEIGHTS*sizeof(Vector4), (const GLvoid*)(k*sizeof(Vector4)));
+				glEnableVertexAttribArray(JOINT_ANCHOR_ATTRIBUTE + k);
+			}
+
+			GLStateCache::Get().BindVertexArray(0);
+		}
+
+		glGenBuffers(1, &paletteBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, paletteBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, MD5SKINNING_GPU_JOINTS*12*sizeof(float), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	else{
+		for(unsigned int i = 0; i < numSubMeshes; ++i) {
+			MD5Mesh*target		= this;
+			if(i != 0) {
+				target = (MD5Mesh*)children.at(i-1);
+			}
+
+			GLStateCache::Get().BindVertexArray(target->arrayObject);
+			glDisableVertexAttribArray(JOINT_INDEX_ATTRIBUTE);
+			for(int k = 0; k < MD5SKINNING_GPU_WEIGHTS; ++k) {
+				glDisableVertexAttribArray(JOINT_ANCHOR_ATTRIBUTE + k);
+			}
+			GLStateCache::Get().BindVertexArray(0);
+		}
+
+		glDeleteBuffers(skinningBuffers.size(), &skinningBuffers[0]);
+		glDeleteBuffers(1, &paletteBuffer);
+
+		skinningBuffers.clear();
+		paletteBuffer = 0;
+	}
+
+	gpuSkinning = enabled;
+
+	//Put the mesh back in its current pose, whichever way it's skinned now
+	SkinVertices(currentSkeleton);
+	return true;
+}
+
+/*
+Compares the two skinning paths on a scratch copy of the skeleton, so the 
+mesh is left in whatever pose it was in.
+*/
+bool	MD5Mesh::CompareSkinning(float tolerance) {
+	MD5Skeleton skel;
+	skel.numJoints	= currentSkeleton.numJoints;
+	skel.joints		= new MD5Joint[currentSkeleton.numJoints];
+	memcpy((void*)skel.joints,(void*)currentSkeleton.joints,sizeof(MD5Joint)*currentSkeleton.numJoints);
+
+	vector<MD5GPUSkinningVertices> converted(numSubMeshes);
+
+	for(unsigned int i = 0; i < numSubMeshes; ++i) {
+		if(!MD5Skinning::BuildGPUVertices(subMeshes[i], bindPose, converted[i])) {
+			return false;
+		}
+	}
+
+	unsigned int numFrames		= currentAnim ? currentAnim->GetNumFrames() : 1;
+	float		 maxError		= 0.0f;
+	float		 truncatedError	= 0.0f;	//Vertices that lost weights aren't expected to match
+
+	vector<float>	palette;
+	vector<Vector3>	reference;
+	vector<Vector3>	gpu;
+
+	for(unsigned int frame = 0; frame < numFrames; ++frame) {
+		if(currentAnim) {
+			currentAnim->TransformSkeleton(skel, frame);
+		}
+
+		MD5Skinning::BuildPalette(skel, &bindPose, palette);
+
+		for(unsigned int i = 0; i < numSubMeshes; ++i) {
+			reference.resize(subMeshes[i].numverts);
+			gpu.resize(subMeshes[i].numverts);
+
+			MD5Skinning::SkinReference(subMeshes[i], skel, &reference[0]);
+			MD5Skinning::SkinGPUVertices(converted[i], palette, &gpu[0]);
+
+			for(int j = 0; j < subMeshes[i].numverts; ++j) {
+				Vector3 d	= gpu[j] - reference[j];
+				float error = max(fabs(d.x), max(fabs(d.y), fabs(d.z)));
+
+				if(subMeshes[i].verts[j].weightElements > MD5SKINNING_GPU_WEIGHTS) {
+					truncatedError = max(truncatedError, error);
+				}
+				else{
+					maxError = max(maxError, error);
+				}
+			}
+		}
+	}
+
+	bool passed = maxError <= tolerance;
+
+	unsigned int numTruncated = 0;
+	for(unsigned int i = 0; i < numSubMeshes; ++i) {
+		numTruncated += converted[i].numTruncated;
+	}
+
+	std::cout << "MD5Mesh::CompareSkinning " << numFrames << " frames, " << numSubMeshes << " submeshes: max position error "
+		<< maxError << (passed ? "" : " FAILED");
+	if(numTruncated > 0) {
+		std::cout << " (" << numTruncated << " vertices with more than " << MD5SKINNING_GPU_WEIGHTS 
+			<< " weights, up to " << truncatedError << " out)";
+	}
+	std::cout << std::endl;
+
+	return passed;
+}
+
 /*
 Rebuffers the vertex data on the graphics card. Now you know why we always keep hold of
 our vertex data in system memory! This function is actually entirely covered in the 
@@ -572,10 +898,8 @@ void MD5Mesh::RebufferData()	{
 	}
 #endif
 
-	if(indices) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferObject[INDEX_BUFFER]);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, numVertices*sizeof(unsigned int), (void*)indices);
-	}
+	//Skinning never touches the indices, so there's no need to send them again - 
+	//and this used to send numVertices of them, rather than numIndices!
 }
 
 /*
@@ -614,16 +938,15 @@ void MD5Mesh::DrawSkeleton()	{
 	}
 
 	//You should know what this all does by now, except we combine it with the draw operations in a single function
-	glBindVertexArray(skeletonArray);
+	GLStateCache::Get().BindVertexArray(skeletonArray);
 	glBindBuffer(GL_ARRAY_BUFFER, skeletonBuffer);
 	glBufferData(GL_ARRAY_BUFFER, bindPose.numJoints*sizeof(Vector3)*2, skeletonVertices, GL_STREAM_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0); 
 	glEnableVertexAttribArray(0);
 
-	glBindVertexArray(skeletonArray);
+	GLStateCache::Get().BindVertexArray(skeletonArray);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GLStateCache::Get().BindTexture(0, 0);
 
 	//Draws the array twice, once as points, and once as lines. glLineWidth may or may not actually do anything
 	//as it is deprecated functionality in OGL 3.2. 
@@ -634,9 +957,10 @@ void MD5Mesh::DrawSkeleton()	{
 	glPointSize(1.0f);
 	glLineWidth(1.0f);
 
-	glBindVertexArray(0);
+	GLStateCache::Get().BindVertexArray(0);
 
 	//Delete the VBO and VAO, and the heap memory we allocated earlier
+	GLStateCache::Get().ForgetVertexArray(skeletonArray);
 	glDeleteVertexArrays(1, &skeletonArray);
 	glDeleteBuffers(1, &skeletonBuffer);
 	delete[]skeletonVertices;
@@ -660,6 +984,7 @@ void	MD5Mesh::PlayAnim(std::string name)	{
 	currentAnim		 = NULL;
 	currentAnimFrame = 0;
 	frameTime		 = 0.0f;
+	animTime		 = 0.0f;
 
 	//Go through the map and find the animation by its filename
 
@@ -677,6 +1002,23 @@ should be applied to the skeleton, and reskins the vertices.
 void	MD5Mesh::UpdateAnim(float msec) {
 	//If we actually have an animation...
 	if(currentAnim) {
+#ifdef MD5_INTERPOLATE_ANIMS
+		//Every update lands somewhere new between frames, so there's always
+		//a new pose. Keep the clock inside the anim, so it doesn't lose 
+		//precision the longer it plays.
+		if(currentAnim->GetLength() <= 0.0f) {
+			return;
+		}
+		animTime = fmod(animTime + msec, currentAnim->GetLength());
+
+		if(poseCache) {
+			poseCache->Pose(currentSkeleton, *currentAnim, animTime);
+		}
+		else{
+			currentAnim->SampleSkeleton(currentSkeleton, animTime);
+		}
+		SkinVertices(currentSkeleton);
+#else
 		frameTime -= msec;
 
 		bool reskin = false;
@@ -694,5 +1036,6 @@ void	MD5Mesh::UpdateAnim(float msec) {
 			currentAnim->TransformSkeleton(currentSkeleton,currentAnimFrame-1);
 			SkinVertices(currentSkeleton);	
 		}
+#endif
 	}
 }
\ No newline at end of file
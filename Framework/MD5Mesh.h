@@ -45,6 +45,42 @@ time lighting tutorial, uncomment both MD5_USE_NORMALS and MD5_USE_TANGENTS_BUMP
 #define MD5_USE_NORMALS
 #define MD5_USE_TANGENTS_BUMPMAPS
 
+/*
+With MD5_USE_MESH_OPTIMISER defined, each submesh's triangles are reordered for
+the post transform vertex cache, and its MD5Verts into the order the triangles
+use them (see MeshOptimiser).
+*/
+#define MD5_USE_MESH_OPTIMISER
+
+/*
+With MD5_USE_FAST_SKINNING defined, SkinVertices uses MD5Skinning's joint
+palette and batched, multithreaded weights instead of the per weight Matrix4
+loop, and skins the bind pose normals and tangents rather than regenerating
+them from the skinned triangles every time (see MD5Skinning).
+*/
+#define MD5_USE_FAST_SKINNING
+
+/*
+Uniform block binding point the joint palette goes to, when a mesh is being
+skinned in the vertex shader (see MD5Mesh::SetGPUSkinning)
+*/
+#define MD5_PALETTE_BINDING	0
+
+/*
+With MD5_USE_CACHE defined, the first load of an MD5Mesh or MD5Anim writes a
+binary copy of it next to the text file (see MD5Cache), and later loads map
+that instead of parsing the text again.
+*/
+#define MD5_USE_CACHE
+
+/*
+With MD5_INTERPOLATE_ANIMS defined, UpdateAnim samples the current animation
+at the exact time it's reached, blending between frames, rather than 
+snapping to whole frames. Meshes given an MD5PoseCache share their sampled
+poses with every other mesh at the same point in the same animation.
+*/
+#define MD5_INTERPOLATE_ANIMS
+
 #include <fstream>
 #include <string>
 #include <map>
@@ -56,6 +92,9 @@ time lighting tutorial, uncomment both MD5_USE_NORMALS and MD5_USE_TANGENTS_BUMP
 
 #include "Mesh.h"
 #include "MD5Anim.h"
+#include "MeshOptimiser.h"
+#include "MD5Skinning.h"
+#include "MD5Cache.h"
 
 
 /*
@@ -185,6 +224,8 @@ struct MD5SubMesh {
 	MD5Weight*	weights;	//Pointer to array of MD5Weights of this MD5SubMesh
 	MD5Vert*	verts;		//Pointer to array of MD5Verts of this MD5SubMesh
 
+	string		shader;		//Name of the 'shader' this MD5SubMesh uses, as in the file
+
 	MD5SubMesh() {
 		texIndex	= 0;
 #ifdef	MD5_USE_TANGENTS_BUMPMAPS
@@ -207,6 +248,7 @@ struct MD5SubMesh {
 
 //Let the compiler know we should compile MD5Anim along with this class
 class MD5Anim;
+class MD5PoseCache;
 
 
 /*
@@ -225,6 +267,9 @@ public:
 	//we give it permission to fiddle with our internals. LOL etc.
 	friend class MD5Anim;
 
+	//MD5Cache reads and writes our loaded data directly, too
+	friend class MD5Cache;
+
 
 	MD5Mesh(void);
 	~MD5Mesh(void);
@@ -241,6 +286,13 @@ public:
 	*/
 	virtual void Draw();
 
+	/*
+	As Draw, but numInstances copies of each submesh, placed by the instance
+	buffer's matrices. Every copy is in the same pose.
+	*/
+	virtual void DrawInstanced(GLuint numInstances);
+	virtual void SetInstanceBuffer(const InstanceBuffer *buffer);
+
 	/*
 	Draws the underlying skeleton of the MD5Mesh, in its current pose. Points
 	represent joints, lines represent the parent / child hierarchy - forming
@@ -266,8 +318,56 @@ public:
 	applied MD5Anim.
 	*/
 	void	UpdateAnim(float msec);	
+
+	/*
+	Has UpdateAnim take its poses from a cache shared with other meshes (see
+	MD5PoseCache), or sample them itself if NULL. The cache must outlive
+	this mesh, or be unset first.
+	*/
+	void	SetPoseCache(MD5PoseCache *cache)	{ poseCache = cache; }
+
+	/*
+	Times the NormalGenerator against Mesh's scalar loops on each submesh, 
+	as skinned in the current pose. Returns false if any submesh's normals
+	or tangents came out of tolerance.
+	*/
+	bool	BenchmarkNormals(int iterations = 10);
+
+	/*
+	Switches between skinning on the CPU, and skinning in the vertex shader. 
+	On the GPU, each submesh gets static joint index and weighted anchor 
+	attributes (see MD5Skinning::BuildGPUVertices), the vertex buffers keep
+	the bind pose, and only the joint palette is uploaded when the skeleton
+	moves. Every pass that draws the mesh then needs a skinning shader, like
+	skinningVert.glsl. Returns false if the mesh can't be skinned on the GPU,
+	in which case it stays on the CPU.
+	*/
+	bool	SetGPUSkinning(bool enabled);
+	bool	UsesGPUSkinning()	{ return gpuSkinning; }
+
+	/*
+	Skins each frame of the current animation (or just the current pose, 
+	without one) with both the CPU reference loop and MD5Skinning's copy of
+	the skinning shader, and checks every position matches to within the
+	tolerance. Vertices with more weights than the shader takes are only
+	reported, as they're not meant to match. Returns false if any others 
+	didn't.
+	*/
+	bool	CompareSkinning(float tolerance = MD5SKINNING_GPU_TOLERANCE);
 				
 protected:	
+	/*
+	Points the program in use at this mesh's joint palette, if it's skinned
+	on the GPU.
+	*/
+	void	BindPalette();
+
+	/*
+	Parses the text of an MD5Mesh file into the joints and submeshes, which
+	LoadMD5Mesh uses when there's no cache to read instead.
+	*/
+	bool	ParseMD5Mesh(std::string filename);
+
 	/*
 	Helper function used by LoadMD5Mesh to load in the joints for this mesh
 	from an MD5Mesh file.
@@ -327,7 +427,17 @@ protected:
 	MD5SubMesh*		subMeshes;			//array of MD5SubMeshes
 	MD5Anim*		currentAnim;		//pointer to current active anim
 
+	MD5Skinning		skinning;			//Batched weights of every submesh, and the joint palette
+
+	bool			gpuSkinning;		//Skinned in the vertex shader?
+	GLuint			paletteBuffer;		//Uniform buffer of the GPU joint palette
+	vector<GLuint>	skinningBuffers;	//Joint index and anchor VBOs of each submesh
+	vector<float>	gpuPalette;			//Palette last uploaded to paletteBuffer
+
 	float	frameTime;					//How many msec until next frame change
+	float	animTime;					//How many msec into the current anim we are
+
+	MD5PoseCache*	poseCache;			//Shared poses, if there are any
 
 	std::map<std::string, MD5Anim*>	animations;	//map of anims for this mesh
 
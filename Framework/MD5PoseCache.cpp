@@ -0,0 +1,304 @@
+#include "MD5PoseCache.h"
+
+#include <cmath>
+#include <iostream>
+
+#include "MD5Anim.h"
+#include "GameTimer.h"
+
+MD5PoseCache::MD5PoseCache(unsigned int subFrames)
+{
+	this->subFrames = max(subFrames, 1u);
+	frame = 0;
+	numPoses = 0;
+	numSampled = 0;
+	numShared = 0;
+}
+
+MD5PoseCache::~MD5PoseCache()
+{
+	for (unsigned int i = 0; i < poses.size(); ++i)
+	{
+		delete poses[i];
+	}
+}
+
+void MD5PoseCache::BeginFrame()
+{
+	for (std::map<std::string, SampleMap>::iterator a = lookup.begin(); a != lookup.end(); ++a)
+	{
+		SampleMap::iterator i = a->second.begin();
+
+		while (i != a->second.end())
+		{
+			if (poses[i->second]->lastUsed != frame)
+			{
+				freePoses.push_back(i->second);
+				a->second.erase(i++);
+				--numPoses;
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	++frame;
+}
+
+void MD5PoseCache::Clear()
+{
+	for (std::map<std::string, SampleMap>::iterator a = lookup.begin(); a != lookup.end(); ++a)
+	{
+		for (SampleMap::iterator i = a->second.begin(); i != a->second.end(); ++i)
+		{
+			freePoses.push_back(i->second);
+		}
+	}
+	lookup.clear();
+	numPoses = 0;
+}
+
+unsigned int MD5PoseCache::GetSample(MD5Anim &anim, float msec) const
+{
+	unsigned int numSamples = anim.GetNumFrames() * subFrames;
+
+	if (numSamples == 0)
+	{
+		return 0;
+	}
+
+	float sample = fmod(floor((msec * anim.GetFrameRate() * subFrames) / 1000.0f + 0.5f), (float)numSamples);
+
+	if (sample < 0.0f)
+	{
+		sample += numSamples;
+	}
+
+	return (unsigned int)sample % numSamples;
+}
+
+const MD5SharedPose & MD5PoseCache::GetPose(MD5Anim &anim, float msec)
+{
+	unsigned int sample = GetSample(anim, msec);
+
+	SampleMap &samples = lookup[anim.GetFilename()];
+	SampleMap::iterator i = samples.find(sample);
+
+	if (i != samples.end())
+	{
+		MD5SharedPose &pose = *poses[i->second];
+		pose.lastUsed = frame;
+		++numShared;
+		return pose;
+	}
+
+	unsigned int index;
+
+	if (freePoses.empty())
+	{
+		index = (unsigned int)poses.size();
+		poses.push_back(new MD5SharedPose());
+	}
+	else
+	{
+		index = freePoses.back();
+		freePoses.pop_back();
+	}
+
+	MD5SharedPose &pose = *poses[index];
+	MD5Skeleton &skel = pose.skeleton;
+
+	if (skel.numJoints != (int)anim.GetNumJoints())
+	{
+		delete[] skel.joints;
+		skel.numJoints = anim.GetNumJoints();
+		skel.joints = new MD5Joint[skel.numJoints];
+
+		for (int j = 0; j < skel.numJoints; ++j)
+		{
+			skel.joints[j].name = NULL;
+		}
+	}
+
+	pose.sample = sample;
+	pose.lastUsed = frame;
+
+	// Sampled at exactly the snapped time, so it doesn't matter which instance asked first
+	anim.SampleSkeleton(skel, (pose.sample * 1000.0f) / (anim.GetFrameRate() * subFrames));
+
+	samples.insert(std::make_pair(sample, index));
+	++numPoses;
+	++numSampled;
+
+	return pose;
+}
+
+void MD5PoseCache::Pose(MD5Skeleton &skel, MD5Anim &anim, float msec)
+{
+	CopyPose(GetPose(anim, msec).skeleton, skel);
+}
+
+void MD5PoseCache::CopyPose(const MD5Skeleton &from, MD5Skeleton &to)
+{
+	int numJoints = min(from.numJoints, to.numJoints);
+
+	for (int i = 0; i < numJoints; ++i)
+	{
+		MD5Joint &joint = to.joints[i];
+
+		joint.parent = from.joints[i].parent;
+		joint.position = from.joints[i].position;
+		joint.orientation = from.joints[i].orientation;
+		joint.transform = from.joints[i].transform;
+	}
+}
+
+// Largest difference between any element of two skeletons' joint transforms
+static float PoseError(const MD5Skeleton &a, const MD5Skeleton &b)
+{
+	float error = 0.0f;
+
+	for (int i = 0; i < a.numJoints; ++i)
+	{
+		for (int j = 0; j < 16; ++j)
+		{
+			error = max(error, fabs(a.joints[i].transform.values[j] - b.joints[i].transform.values[j]));
+		}
+	}
+	return error;
+}
+
+bool MD5PoseCache::Benchmark(MD5Anim &anim, unsigned int numInstances, unsigned int numClocks, int frames)
+{
+	unsigned int numJoints = anim.GetNumJoints();
+	unsigned int numFrames = anim.GetNumFrames();
+
+	if (numJoints == 0 || numFrames == 0 || anim.GetFrameRate() == 0 || numInstances == 0)
+	{
+		std::cout << "MD5PoseCache::Benchmark needs an animation with some frames" << std::endl;
+		return false;
+	}
+
+	numClocks = max(min(numClocks, numInstances), 1u);
+
+	MD5Skeleton *skeletons = new MD5Skeleton[numInstances];
+
+	for (unsigned int i = 0; i < numInstances; ++i)
+	{
+		skeletons[i].numJoints = numJoints;
+		skeletons[i].joints = new MD5Joint[numJoints];
+	}
+
+	// Each group of instances starts at its own, arbitrary, point in the animation
+	std::vector<float> clocks(numInstances);
+
+	for (unsigned int i = 0; i < numInstances; ++i)
+	{
+		clocks[i] = ((i % numClocks) * anim.GetLength()) / numClocks + (i % numClocks) * 7.3f;
+	}
+
+	const float frameMsec = 1000.0f / 60.0f;
+
+	std::vector<Vector3> positions(numJoints);
+	std::vector<Quaternion> orientations(numJoints);
+
+	// Every frame decoded up front, so the cached paths aren't timing that
+	for (unsigned int f = 0; f < numFrames; ++f)
+	{
+		anim.GetDecodedFrame(f);
+	}
+
+	/*
+	 * 0 - decoding the nearest whole frame for every instance, as
+	 *     TransformSkeleton used to
+	 * 1 - TransformSkeleton on the nearest whole frame, decoded once
+	 * 2 - SampleSkeleton, interpolated, for every instance
+	 * 3 - a pose cache, interpolated and shared
+	 */
+	float times[4];
+	MD5PoseCache cache;
+
+	for (int path = 0; path < 4; ++path)
+	{
+		GameTimer timer;
+		float start = timer.GetMS();
+
+		for (int f = 0; f < frames; ++f)
+		{
+			float elapsed = f * frameMsec;
+
+			if (path == 3)
+			{
+				cache.BeginFrame();
+			}
+
+			for (unsigned int i = 0; i < numInstances; ++i)
+			{
+				float msec = clocks[i] + elapsed;
+				unsigned int whole = (unsigned int)((msec * anim.GetFrameRate()) / 1000.0f) % numFrames;
+
+				switch (path)
+				{
+				case 0:
+					anim.DecodeFrame(whole, &positions[0], &orientations[0]);
+					anim.BuildSkeleton(skeletons[i], &positions[0], &orientations[0]);
+					break;
+				case 1:
+					anim.TransformSkeleton(skeletons[i], whole);
+					break;
+				case 2:
+					anim.SampleSkeleton(skeletons[i], msec);
+					break;
+				default:
+					cache.Pose(skeletons[i], anim, msec);
+					break;
+				}
+			}
+		}
+		times[path] = (timer.GetMS() - start) / frames;
+	}
+
+	// Every instance's shared pose should be exactly what sampling at its snapped time gives
+	MD5Skeleton check;
+	check.numJoints = numJoints;
+	check.joints = new MD5Joint[numJoints];
+
+	float sharedError = 0.0f;
+	float lastElapsed = (frames - 1) * frameMsec;
+
+	for (unsigned int i = 0; i < numInstances; ++i)
+	{
+		unsigned int sample = cache.GetSample(anim, clocks[i] + lastElapsed);
+
+		anim.SampleSkeleton(check, (sample * 1000.0f) / (anim.GetFrameRate() * cache.subFrames));
+		sharedError = max(sharedError, PoseError(check, skeletons[i]));
+	}
+
+	// And sampling right on a frame should give that frame
+	float frameError = 0.0f;
+
+	for (unsigned int f = 0; f < numFrames; ++f)
+	{
+		anim.TransformSkeleton(skeletons[0], f);
+		anim.SampleSkeleton(check, (f * 1000.0f) / anim.GetFrameRate());
+		frameError = max(frameError, PoseError(check, skeletons[0]));
+	}
+
+	delete[] skeletons;
+
+	bool passed = (sharedError == 0.0f) && (frameError < 1e-4f);
+
+	std::cout << "MD5PoseCache::Benchmark " << numInstances << " instances on " << numClocks << " clocks, "
+			  << numJoints << " joints, " << numFrames << " frames at " << anim.GetFrameRate() << "fps" << std::endl;
+	std::cout << "  whole frames: decoded per instance " << times[0] << " ms/frame, decoded once "
+			  << times[1] << " ms/frame (" << times[0] / times[1] << "x)" << std::endl;
+	std::cout << "  interpolated: per instance " << times[2] << " ms/frame, shared " << times[3] << " ms/frame ("
+			  << times[2] / times[3] << "x), " << cache.GetNumPoses() << " poses cached, "
+			  << cache.GetNumShared() * 100.0f / (cache.GetNumShared() + cache.GetNumSampled()) << "% shared" << std::endl;
+	std::cout << "  shared pose error " << sharedError << ", whole frame sampling error " << frameError
+			  << (passed ? " (passed)" : " (FAILED)") << std::endl;
+
+	return passed;
+}
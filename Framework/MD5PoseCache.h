@@ -0,0 +1,97 @@
+#pragma once
+
+/*
+ * Lets any number of MD5Mesh instances playing the same animation share one
+ * sampled pose, instead of each one interpolating and walking the hierarchy
+ * for itself. Every MD5Mesh loads its own copy of its anims, so anims are
+ * told apart by the file they came from, not by which MD5Anim they are.
+ *
+ * Times are snapped to the nearest 1 / subFrames of an animation frame, and a
+ * pose is sampled (with MD5Anim::SampleSkeleton) the first time anything asks
+ * for a given (anim, snapped time) in a frame; everything else asking for the
+ * same one just copies its joints. Instances whose clocks are a little apart
+ * still land on the same pose, at the cost of their motion being stepped to
+ * subFrames times the animation's frame rate, which is already more steps a
+ * second than the screen shows for any sensible animation.
+ *
+ * Call BeginFrame once per rendered frame. Poses nothing asked for in the
+ * frame before are recycled then, so the cache only ever holds what's
+ * actually being drawn. Not thread safe.
+ */
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MD5Mesh.h"
+
+// Poses per animation frame
+#define MD5POSECACHE_SUBFRAMES	4
+
+class MD5Anim;
+
+struct MD5SharedPose
+{
+	unsigned int	sample;		// Which subframe of the animation this is
+	unsigned int	lastUsed;	// Frame it was last asked for in
+	MD5Skeleton		skeleton;	// The joints, with no names
+};
+
+class MD5PoseCache
+{
+public:
+	MD5PoseCache(unsigned int subFrames = MD5POSECACHE_SUBFRAMES);
+	~MD5PoseCache();
+
+	// Starts a new frame, recycling any pose nothing asked for in the last one
+	void BeginFrame();
+
+	// Throws every pose away
+	void Clear();
+
+	// The pose of anim msec milliseconds in, snapped to the nearest subframe
+	const MD5SharedPose & GetPose(MD5Anim &anim, float msec);
+
+	// Copies that pose into a skeleton with as many joints as the anim
+	void Pose(MD5Skeleton &skel, MD5Anim &anim, float msec);
+
+	// Which subframe of anim msec milliseconds is nearest to, looping
+	unsigned int GetSample(MD5Anim &anim, float msec) const;
+
+	// Copies the parents, local pose and transforms of one skeleton's joints to another's
+	static void CopyPose(const MD5Skeleton &from, MD5Skeleton &to);
+
+	unsigned int GetNumPoses() const	{ return numPoses; }
+
+	// Poses sampled, and poses copied out of the cache instead, since the last ResetStats
+	unsigned int GetNumSampled() const	{ return numSampled; }
+	unsigned int GetNumShared() const	{ return numShared; }
+	void ResetStats()					{ numSampled = numShared = 0; }
+
+	/*
+	 * Poses numInstances skeletons a frame with anim, and prints how long a
+	 * frame takes with TransformSkeleton on the nearest whole frame (what
+	 * MD5Mesh::UpdateAnim does without MD5_INTERPOLATE_ANIMS), SampleSkeleton
+	 * for every instance, and a pose cache. The instances' clocks are split
+	 * between numClocks start times, so numInstances / numClocks share each
+	 * pose. Also checks that sampling on a whole frame gives the same pose as
+	 * TransformSkeleton, and that each instance's shared pose is the one
+	 * SampleSkeleton gives at its snapped time. Returns false if they didn't
+	 * match.
+	 */
+	static bool Benchmark(MD5Anim &anim, unsigned int numInstances = 1000, unsigned int numClocks = 16, int frames = 100);
+
+protected:
+	// Index in poses of each cached subframe of an anim
+	typedef std::map<unsigned int, unsigned int> SampleMap;
+
+	unsigned int						subFrames;
+	unsigned int						frame;
+
+	std::map<std::string, SampleMap>	lookup;		// Cached poses of each anim file
+	std::vector<MD5SharedPose *>		poses;		// Every pose allocated, cached or not
+	std::vector<unsigned int>			freePoses;	// Poses ready to be reused
+	unsigned int						numPoses;	// Poses in lookup
+
+	unsigned int						numSampled;
+	unsigned int						numShared;
+};
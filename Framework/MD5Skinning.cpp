@@ -0,0 +1,711 @@
+#include "MD5Skinning.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+#include "MD5Mesh.h"
+#include "JobPool.h"
+#include "GameTimer.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define MD5SKINNING_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+void MD5Skinning::AddSubMesh(const MD5SubMesh &subMesh, const MD5Skeleton &bindPose,
+							 const Vector3 *bindNormals, const Vector3 *bindTangents)
+{
+	subMeshes.push_back(MD5SkinningSubMesh());
+	MD5SkinningSubMesh &m = subMeshes.back();
+
+	m.numVertices = subMesh.numverts;
+
+	std::vector<unsigned int> order(m.numVertices);
+
+	for (unsigned int j = 0; j < m.numVertices; ++j)
+	{
+		order[j] = j;
+	}
+
+	for (unsigned int j = 0; j < m.numVertices; j += MD5SKINNING_SORT_WINDOW)
+	{
+		unsigned int end = (j + MD5SKINNING_SORT_WINDOW < m.numVertices) ? j + MD5SKINNING_SORT_WINDOW : m.numVertices;
+
+		std::stable_sort(order.begin() + j, order.begin() + end, [&](unsigned int a, unsigned int b)
+		{
+			return subMesh.verts[a].weightElements < subMesh.verts[b].weightElements;
+		});
+	}
+
+	unsigned int numBatches = (m.numVertices + MD5SKINNING_LANES - 1) / MD5SKINNING_LANES;
+	unsigned int numSlots = 0;
+
+	// A batch needs as many slots as its vertex with the most weights
+	m.batchStart.resize(numBatches + 1);
+	m.lanes.assign(numBatches * MD5SKINNING_LANES, ~0u);
+
+	for (unsigned int b = 0; b < numBatches; ++b)
+	{
+		m.batchStart[b] = numSlots;
+
+		unsigned int most = 0;
+
+		for (unsigned int j = b * MD5SKINNING_LANES; j < (b + 1) * MD5SKINNING_LANES && j < m.numVertices; ++j)
+		{
+			unsigned int count = subMesh.verts[order[j]].weightElements;
+			most = (count > most) ? count : most;
+
+			m.lanes[j] = order[j];
+		}
+		numSlots += most;
+	}
+	m.batchStart[numBatches] = numSlots;
+
+	// Padding is a zero weight on joint 0, at the origin
+	unsigned int numLanes = numSlots * MD5SKINNING_LANES;
+
+	m.joints.assign(numLanes, 0);
+	m.weights.assign(numLanes, 0.0f);
+
+	for (int k = 0; k < 3; ++k)
+	{
+		m.anchors[k].assign(numLanes, 0.0f);
+
+		if (bindNormals)
+		{
+			m.normals[k].assign(numLanes, 0.0f);
+		}
+
+		if (bindTangents)
+		{
+			m.tangents[k].assign(numLanes, 0.0f);
+		}
+	}
+
+	for (unsigned int l = 0; l < m.numVertices; ++l)
+	{
+		unsigned int j = order[l];
+		const MD5Vert &vert = subMesh.verts[j];
+		unsigned int batch = l / MD5SKINNING_LANES;
+		unsigned int lane = l % MD5SKINNING_LANES;
+
+		for (int w = 0; w < vert.weightElements; ++w)
+		{
+			const MD5Weight &weight = subMesh.weights[vert.weightIndex + w];
+			const float *joint = bindPose.joints[weight.jointIndex].transform.values;
+
+			unsigned int i = (m.batchStart[batch] + w) * MD5SKINNING_LANES + lane;
+
+			m.joints[i] = weight.jointIndex * 12;
+			m.weights[i] = weight.weightValue;
+			m.anchors[0][i] = weight.position.x;
+			m.anchors[1][i] = weight.position.y;
+			m.anchors[2][i] = weight.position.z;
+
+			// Joint transforms are rigid, so the transpose of the rotation takes us into joint space
+			if (bindNormals)
+			{
+				const Vector3 &n = bindNormals[j];
+
+				m.normals[0][i] = joint[0] * n.x + joint[1] * n.y + joint[2] * n.z;
+				m.normals[1][i] = joint[4] * n.x + joint[5] * n.y + joint[6] * n.z;
+				m.normals[2][i] = joint[8] * n.x + joint[9] * n.y + joint[10] * n.z;
+			}
+
+			if (bindTangents)
+			{
+				const Vector3 &t = bindTangents[j];
+
+				m.tangents[0][i] = joint[0] * t.x + joint[1] * t.y + joint[2] * t.z;
+				m.tangents[1][i] = joint[4] * t.x + joint[5] * t.y + joint[6] * t.z;
+				m.tangents[2][i] = joint[8] * t.x + joint[9] * t.y + joint[10] * t.z;
+			}
+		}
+	}
+}
+
+void MD5Skinning::Clear()
+{
+	subMeshes.clear();
+	palette.clear();
+}
+
+void MD5Skinning::SetPose(const MD5Skeleton &skeleton)
+{
+	BuildPalette(skeleton, NULL, palette);
+}
+
+void MD5Skinning::Skin(unsigned int subMesh, Vector3 *vertices, Vector3 *normals, Vector3 *tangents, bool threaded) const
+{
+	const MD5SkinningSubMesh &m = subMeshes[subMesh];
+
+	// Only skin what AddSubMesh was given the bind pose of
+	if (m.normals[0].empty())
+	{
+		normals = NULL;
+	}
+
+	if (m.tangents[0].empty())
+	{
+		tangents = NULL;
+	}
+
+	JobPool &pool = JobPool::Get();
+
+	unsigned int numBatches = (unsigned int)m.batchStart.size() - 1;
+	unsigned int grain = threaded ? pool.GetGrain(numBatches, MD5SKINNING_GRAIN) : numBatches + 1;
+
+	pool.ParallelFor(numBatches, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		SkinBatches(m, begin, end, vertices, normals, tangents);
+	});
+}
+
+#ifdef MD5SKINNING_USE_SSE
+
+// Vector3::Normalise on each lane
+static void NormaliseLanes(__m128 &x, __m128 &y, __m128 &z)
+{
+	__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+	__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), length);
+	__m128 mask = _mm_cmpneq_ps(length, _mm_setzero_ps());
+
+	x = _mm_or_ps(_mm_and_ps(mask, _mm_mul_ps(x, inverse)), _mm_andnot_ps(mask, x));
+	y = _mm_or_ps(_mm_and_ps(mask, _mm_mul_ps(y, inverse)), _mm_andnot_ps(mask, y));
+	z = _mm_or_ps(_mm_and_ps(mask, _mm_mul_ps(z, inverse)), _mm_andnot_ps(mask, z));
+}
+
+static void StoreLanes(Vector3 *into, const unsigned int *vertex, __m128 x, __m128 y, __m128 z)
+{
+	float lanes[3][MD5SKINNING_LANES];
+
+	_mm_storeu_ps(lanes[0], x);
+	_mm_storeu_ps(lanes[1], y);
+	_mm_storeu_ps(lanes[2], z);
+
+	for (unsigned int j = 0; j < MD5SKINNING_LANES && vertex[j] != ~0u; ++j)
+	{
+		Vector3 &v = into[vertex[j]];
+		v.x = lanes[0][j];
+		v.y = lanes[1][j];
+		v.z = lanes[2][j];
+	}
+}
+
+// Rotates (and translates, with the fourth column) a joint space vector by each lane's matrix, and weights it
+static void AddTransformed(__m128 *into, const __m128 (*c)[4], const float *x, const float *y, const float *z,
+						   __m128 w, bool translate)
+{
+	__m128 vx = _mm_loadu_ps(x);
+	__m128 vy = _mm_loadu_ps(y);
+	__m128 vz = _mm_loadu_ps(z);
+
+	// Matrix4 * Vector3, term for term, minus the divide by a w of 1
+	for (int r = 0; r < 3; ++r)
+	{
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, c[r][0]), _mm_mul_ps(vy, c[r][1])), _mm_mul_ps(vz, c[r][2]));
+
+		if (translate)
+		{
+			v = _mm_add_ps(v, c[r][3]);
+		}
+
+		into[r] = _mm_add_ps(into[r], _mm_mul_ps(v, w));
+	}
+}
+
+void MD5Skinning::SkinBatches(const MD5SkinningSubMesh &m, unsigned int begin, unsigned int end,
+							  Vector3 *vertices, Vector3 *normals, Vector3 *tangents) const
+{
+	const float *p = &palette[0];
+
+	for (unsigned int b = begin; b < end; ++b)
+	{
+		__m128 v[3], n[3], t[3];
+
+		for (int k = 0; k < 3; ++k)
+		{
+			v[k] = n[k] = t[k] = _mm_setzero_ps();
+		}
+
+		for (unsigned int s = m.batchStart[b]; s < m.batchStart[b + 1]; ++s)
+		{
+			unsigned int i = s * MD5SKINNING_LANES;
+			const unsigned int *joint = &m.joints[i];
+
+			/*
+			 * Each lane's matrix row comes in as a register, and transposing
+			 * four of them gives one register per column, across the lanes
+			 */
+			__m128 c[3][4];
+
+			for (int r = 0; r < 3; ++r)
+			{
+				c[r][0] = _mm_loadu_ps(p + joint[0] + r * 4);
+				c[r][1] = _mm_loadu_ps(p + joint[1] + r * 4);
+				c[r][2] = _mm_loadu_ps(p + joint[2] + r * 4);
+				c[r][3] = _mm_loadu_ps(p + joint[3] + r * 4);
+
+				_MM_TRANSPOSE4_PS(c[r][0], c[r][1], c[r][2], c[r][3]);
+			}
+
+			__m128 w = _mm_loadu_ps(&m.weights[i]);
+
+			AddTransformed(v, c, &m.anchors[0][i], &m.anchors[1][i], &m.anchors[2][i], w, true);
+
+			if (normals)
+			{
+				AddTransformed(n, c, &m.normals[0][i], &m.normals[1][i], &m.normals[2][i], w, false);
+			}
+
+			if (tangents)
+			{
+				AddTransformed(t, c, &m.tangents[0][i], &m.tangents[1][i], &m.tangents[2][i], w, false);
+			}
+		}
+
+		const unsigned int *vertex = &m.lanes[b * MD5SKINNING_LANES];
+
+		StoreLanes(vertices, vertex, v[0], v[1], v[2]);
+
+		if (normals)
+		{
+			NormaliseLanes(n[0], n[1], n[2]);
+			StoreLanes(normals, vertex, n[0], n[1], n[2]);
+		}
+
+		if (tangents)
+		{
+			NormaliseLanes(t[0], t[1], t[2]);
+			StoreLanes(tangents, vertex, t[0], t[1], t[2]);
+		}
+	}
+}
+
+#else
+
+// Rotates a joint space vector by a palette matrix, and adds it on with the given weight
+static void AddRotated(Vector3 &into, const float *m, float x, float y, float z, float weight)
+{
+	into.x += (x * m[0] + y * m[1] + z * m[2]) * weight;
+	into.y += (x * m[4] + y * m[5] + z * m[6]) * weight;
+	into.z += (x * m[8] + y * m[9] + z * m[10]) * weight;
+}
+
+void MD5Skinning::SkinBatches(const MD5SkinningSubMesh &m, unsigned int begin, unsigned int end,
+							  Vector3 *vertices, Vector3 *normals, Vector3 *tangents) const
+{
+	for (unsigned int b = begin; b < end; ++b)
+	{
+		const unsigned int *vertex = &m.lanes[b * MD5SKINNING_LANES];
+
+		for (unsigned int j = 0; j < MD5SKINNING_LANES && vertex[j] != ~0u; ++j)
+		{
+			Vector3 v, n, t;
+
+			for (unsigned int s = m.batchStart[b]; s < m.batchStart[b + 1]; ++s)
+			{
+				unsigned int i = s * MD5SKINNING_LANES + j;
+				const float *matrix = &palette[m.joints[i]];
+				float w = m.weights[i];
+
+				float x = m.anchors[0][i];
+				float y = m.anchors[1][i];
+				float z = m.anchors[2][i];
+
+				v.x += (x * matrix[0] + y * matrix[1] + z * matrix[2]  + matrix[3])  * w;
+				v.y += (x * matrix[4] + y * matrix[5] + z * matrix[6]  + matrix[7])  * w;
+				v.z += (x * matrix[8] + y * matrix[9] + z * matrix[10] + matrix[11]) * w;
+
+				if (normals)
+				{
+					AddRotated(n, matrix, m.normals[0][i], m.normals[1][i], m.normals[2][i], w);
+				}
+
+				if (tangents)
+				{
+					AddRotated(t, matrix, m.tangents[0][i], m.tangents[1][i], m.tangents[2][i], w);
+				}
+			}
+
+			vertices[vertex[j]] = v;
+
+			if (normals)
+			{
+				n.Normalise();
+				normals[vertex[j]] = n;
+			}
+
+			if (tangents)
+			{
+				t.Normalise();
+				tangents[vertex[j]] = t;
+			}
+		}
+	}
+}
+
+#endif
+
+void MD5Skinning::SkinReference(const MD5SubMesh &subMesh, const MD5Skeleton &skeleton, Vector3 *vertices)
+{
+	for (int j = 0; j < subMesh.numverts; ++j)
+	{
+		vertices[j].ToZero();
+
+		for (int k = 0; k < subMesh.verts[j].weightElements; ++k)
+		{
+			const MD5Weight &weight = subMesh.weights[subMesh.verts[j].weightIndex + k];
+			const MD5Joint &joint = skeleton.joints[weight.jointIndex];
+
+			vertices[j] += ((joint.transform * weight.position) * weight.weightValue);
+		}
+	}
+}
+
+bool MD5Skinning::BuildGPUVertices(const MD5SubMesh &subMesh, const MD5Skeleton &bindPose, MD5GPUSkinningVertices &into)
+{
+	if (bindPose.numJoints > MD5SKINNING_GPU_JOINTS)
+	{
+		std::cout << "MD5Skinning: " << bindPose.numJoints << " joints is more than the GPU path's "
+				  << MD5SKINNING_GPU_JOINTS << std::endl;
+		return false;
+	}
+
+	into.numVertices = subMesh.numverts;
+	into.numTruncated = 0;
+	into.joints.assign(into.numVertices * MD5SKINNING_GPU_WEIGHTS, 0);
+	into.anchors.assign(into.numVertices * MD5SKINNING_GPU_WEIGHTS, Vector4(0.0f, 0.0f, 0.0f, 0.0f));
+
+	std::vector<int> order;
+
+	for (unsigned int j = 0; j < into.numVertices; ++j)
+	{
+		const MD5Vert &vert = subMesh.verts[j];
+
+		order.resize(vert.weightElements);
+
+		for (int k = 0; k < vert.weightElements; ++k)
+		{
+			order[k] = vert.weightIndex + k;
+		}
+
+		// Too many weights, so keep the heaviest, and scale them back up to a total of one
+		int count = vert.weightElements;
+		float scale = 1.0f;
+
+		if (count > MD5SKINNING_GPU_WEIGHTS)
+		{
+			std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+			{
+				return subMesh.weights[a].weightValue > subMesh.weights[b].weightValue;
+			});
+
+			count = MD5SKINNING_GPU_WEIGHTS;
+
+			float kept = 0.0f;
+			float total = 0.0f;
+
+			for (int k = 0; k < vert.weightElements; ++k)
+			{
+				float w = subMesh.weights[order[k]].weightValue;
+
+				total += w;
+				kept += (k < count) ? w : 0.0f;
+			}
+
+			scale = (kept > 0.0f) ? total / kept : 1.0f;
+			++into.numTruncated;
+		}
+
+		for (int k = 0; k < count; ++k)
+		{
+			const MD5Weight &weight = subMesh.weights[order[k]];
+			Vector3 anchor = bindPose.joints[weight.jointIndex].transform * weight.position;
+			float w = weight.weightValue * scale;
+
+			into.joints[j * MD5SKINNING_GPU_WEIGHTS + k] = (unsigned char)weight.jointIndex;
+			into.anchors[j * MD5SKINNING_GPU_WEIGHTS + k] = Vector4(anchor.x * w, anchor.y * w, anchor.z * w, w);
+		}
+	}
+	return true;
+}
+
+void MD5Skinning::BuildPalette(const MD5Skeleton &skeleton, const MD5Skeleton *bindPose, std::vector<float> &into)
+{
+	into.resize(skeleton.numJoints * 12);
+
+	for (int i = 0; i < skeleton.numJoints; ++i)
+	{
+		Matrix4 transform = skeleton.joints[i].transform;
+
+		// Joint transforms are rigid, so the inverse is the transposed rotation, and the translation rotated back
+		if (bindPose)
+		{
+			const float *b = bindPose->joints[i].transform.values;
+			Matrix4 inverse;
+
+			for (int r = 0; r < 3; ++r)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					inverse.values[c * 4 + r] = b[r * 4 + c];
+				}
+				inverse.values[12 + r] = -(b[r * 4] * b[12] + b[r * 4 + 1] * b[13] + b[r * 4 + 2] * b[14]);
+			}
+
+			transform = transform * inverse;
+		}
+
+		const float *m = transform.values;
+		float *row = &into[i * 12];
+
+		// Rows of the matrix, which Matrix4 keeps in columns
+		for (int r = 0; r < 3; ++r)
+		{
+			row[r * 4]     = m[r];
+			row[r * 4 + 1] = m[r + 4];
+			row[r * 4 + 2] = m[r + 8];
+			row[r * 4 + 3] = m[r + 12];
+		}
+	}
+}
+
+void MD5Skinning::SkinGPUVertices(const MD5GPUSkinningVertices &from, const std::vector<float> &palette, Vector3 *vertices)
+{
+	for (unsigned int j = 0; j < from.numVertices; ++j)
+	{
+		Vector3 v;
+
+		for (int k = 0; k < MD5SKINNING_GPU_WEIGHTS; ++k)
+		{
+			const Vector4 &a = from.anchors[j * MD5SKINNING_GPU_WEIGHTS + k];
+			const float *row = &palette[from.joints[j * MD5SKINNING_GPU_WEIGHTS + k] * 12];
+
+			v.x += row[0] * a.x + row[1] * a.y + row[2]  * a.z + row[3]  * a.w;
+			v.y += row[4] * a.x + row[5] * a.y + row[6]  * a.z + row[7]  * a.w;
+			v.z += row[8] * a.x + row[9] * a.y + row[10] * a.z + row[11] * a.w;
+		}
+
+		vertices[j] = v;
+	}
+}
+
+static float RandomFloat(float minimum, float maximum)
+{
+	return minimum + (maximum - minimum) * (rand() / (float)RAND_MAX);
+}
+
+static Vector3 RandomVector(float extent)
+{
+	return Vector3(RandomFloat(-extent, extent), RandomFloat(-extent, extent), RandomFloat(-extent, extent));
+}
+
+bool MD5Skinning::Benchmark(unsigned int numVertices, unsigned int numJoints, int iterations)
+{
+	srand(1);
+
+	// A skeleton of random rigid transforms
+	MD5Skeleton skeleton;
+	skeleton.numJoints = numJoints;
+	skeleton.joints = new MD5Joint[numJoints];
+
+	for (unsigned int i = 0; i < numJoints; ++i)
+	{
+		Vector3 axis = RandomVector(1.0f);
+		axis.Normalise();
+
+		skeleton.joints[i].name = NULL;
+		skeleton.joints[i].parent = -1;
+		skeleton.joints[i].transform = Matrix4::Rotation(RandomFloat(0.0f, 360.0f), axis);
+		skeleton.joints[i].transform.SetPositionVector(RandomVector(10.0f));
+	}
+
+	// Vertices with one to four weights, as an MD5 exporter would give
+	MD5SubMesh subMesh;
+	subMesh.numverts = numVertices;
+	subMesh.numtris = 0;
+	subMesh.numweights = 0;
+	subMesh.verts = new MD5Vert[numVertices];
+	subMesh.weights = new MD5Weight[numVertices * 4];
+
+	for (unsigned int j = 0; j < numVertices; ++j)
+	{
+		MD5Vert &vert = subMesh.verts[j];
+		vert.vertIndex = j;
+		vert.weightIndex = subMesh.numweights;
+		vert.weightElements = 1 + rand() % 4;
+
+		float total = 0.0f;
+		float values[4];
+
+		for (int k = 0; k < vert.weightElements; ++k)
+		{
+			values[k] = RandomFloat(0.1f, 1.0f);
+			total += values[k];
+		}
+
+		for (int k = 0; k < vert.weightElements; ++k)
+		{
+			MD5Weight &weight = subMesh.weights[subMesh.numweights++];
+			weight.weightIndex = vert.weightIndex + k;
+			weight.jointIndex = rand() % numJoints;
+			weight.weightValue = values[k] / total;
+			weight.position = RandomVector(1.0f);
+		}
+	}
+
+	// A strip of triangles over the vertices, so the reference path has something to regenerate normals from
+	std::vector<unsigned int> indices;
+	std::vector<Vector2> textureCoords(numVertices);
+
+	for (unsigned int j = 0; j + 2 < numVertices; ++j)
+	{
+		indices.push_back(j);
+		indices.push_back(j + 1);
+		indices.push_back(j + 2);
+	}
+
+	std::vector<Vector3> bindNormals(numVertices);
+
+	for (unsigned int j = 0; j < numVertices; ++j)
+	{
+		textureCoords[j] = Vector2(RandomFloat(0.0f, 1.0f), RandomFloat(0.0f, 1.0f));
+
+		bindNormals[j] = RandomVector(1.0f);
+		bindNormals[j].Normalise();
+	}
+
+	MD5Skinning skinning;
+	skinning.AddSubMesh(subMesh, skeleton, &bindNormals[0], &bindNormals[0]);
+	skinning.SetPose(skeleton);
+
+	std::vector<Vector3> reference(numVertices);
+	std::vector<Vector3> vertices(numVertices);
+	std::vector<Vector3> normals(numVertices);
+	std::vector<Vector3> tangents(numVertices);
+
+	/*
+	 * Positions on their own through the reference loop and one thread, then
+	 * positions with normals and tangents: regenerated for the reference, and
+	 * skinned from the bind pose on one thread and on the JobPool.
+	 */
+	GameTimer timer;
+	float times[5];
+
+	for (int path = 0; path < 5; ++path)
+	{
+		float start = timer.GetMS();
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			switch (path)
+			{
+			case 0:
+				SkinReference(subMesh, skeleton, &reference[0]);
+				break;
+			case 1:
+				skinning.Skin(0, &vertices[0], NULL, NULL, false);
+				break;
+			case 2:
+				SkinReference(subMesh, skeleton, &reference[0]);
+				Mesh::GenerateNormals(&reference[0], numVertices, &indices[0], (unsigned int)indices.size(), &normals[0]);
+				Mesh::GenerateTangents(&reference[0], &textureCoords[0], numVertices, &indices[0], (unsigned int)indices.size(), &tangents[0]);
+				break;
+			default:
+				skinning.Skin(0, &vertices[0], &normals[0], &tangents[0], path == 4);
+				break;
+			}
+		}
+		times[path] = (timer.GetMS() - start) / iterations;
+	}
+
+	// Positions should match exactly, and skinning in the bind pose should give back the bind normals
+	unsigned int identical = 0;
+	float positionError = 0.0f;
+	float normalError = 0.0f;
+
+	for (unsigned int j = 0; j < numVertices; ++j)
+	{
+		Vector3 d = vertices[j] - reference[j];
+		float e = max(fabs(d.x), max(fabs(d.y), fabs(d.z)));
+		positionError = max(positionError, e);
+
+		if (e == 0.0f)
+		{
+			++identical;
+		}
+
+		Vector3 n = normals[j] - bindNormals[j];
+		normalError = max(normalError, max(fabs(n.x), max(fabs(n.y), fabs(n.z))));
+	}
+
+	unsigned int numBatches = (unsigned int)skinning.subMeshes[0].batchStart.size() - 1;
+	float usedSlots = subMesh.numweights / (float)(skinning.subMeshes[0].batchStart[numBatches] * MD5SKINNING_LANES);
+
+	/*
+	 * The GPU path, skinned into a second random pose, against the reference
+	 * loop; and what each path sends to graphics memory every frame
+	 */
+	MD5Skeleton pose;
+	pose.numJoints = numJoints;
+	pose.joints = new MD5Joint[numJoints];
+
+	for (unsigned int i = 0; i < numJoints; ++i)
+	{
+		Vector3 axis = RandomVector(1.0f);
+		axis.Normalise();
+
+		pose.joints[i] = skeleton.joints[i];
+		pose.joints[i].transform = Matrix4::Rotation(RandomFloat(0.0f, 360.0f), axis);
+		pose.joints[i].transform.SetPositionVector(RandomVector(10.0f));
+	}
+
+	float gpuError = 0.0f;
+
+	if (numJoints <= MD5SKINNING_GPU_JOINTS)
+	{
+		MD5GPUSkinningVertices gpuVertices;
+		std::vector<float> gpuPalette;
+
+		BuildGPUVertices(subMesh, skeleton, gpuVertices);
+		BuildPalette(pose, &skeleton, gpuPalette);
+		SkinGPUVertices(gpuVertices, gpuPalette, &vertices[0]);
+		SkinReference(subMesh, pose, &reference[0]);
+
+		for (unsigned int j = 0; j < numVertices; ++j)
+		{
+			Vector3 d = vertices[j] - reference[j];
+			gpuError = max(gpuError, max(fabs(d.x), max(fabs(d.y), fabs(d.z))));
+		}
+	}
+
+	unsigned int cpuUpload = numVertices * sizeof(Vector3) * 3;
+	unsigned int gpuUpload = numJoints * 12 * sizeof(float);
+
+	bool passed = (identical == numVertices) && (normalError < 1e-4f) && (gpuError < MD5SKINNING_GPU_TOLERANCE);
+
+#ifdef MD5SKINNING_USE_SSE
+	const char *name = "SSE";
+#else
+	const char *name = "scalar";
+#endif
+
+	std::cout << "MD5Skinning::Benchmark " << numVertices << " vertices, " << numJoints << " joints, "
+			  << subMesh.numweights << " weights (" << usedSlots * 100.0f << "% of batch slots used)" << std::endl;
+	std::cout << "  positions: reference " << numVertices / (times[0] * 1000.0f) << " M vertices/s, " << name << " "
+			  << numVertices / (times[1] * 1000.0f) << " M vertices/s (" << times[0] / times[1] << "x)" << std::endl;
+	std::cout << "  with normals and tangents: regenerated " << numVertices / (times[2] * 1000.0f) << " M vertices/s, "
+			  << name << " " << numVertices / (times[3] * 1000.0f) << " M vertices/s (" << times[2] / times[3] << "x), "
+			  << JobPool::Get().GetNumThreads() << " threads " << numVertices / (times[4] * 1000.0f) << " M vertices/s ("
+			  << times[2] / times[4] << "x)" << std::endl;
+	std::cout << "  positions bit identical " << identical << " / " << numVertices << " (max error " << positionError
+			  << "), bind pose normal error " << normalError << std::endl;
+	std::cout << "  GPU path: max position error " << gpuError << ", uploads " << gpuUpload / 1024.0f
+			  << "KB/frame of palette instead of " << cpuUpload / 1024.0f << "KB/frame of vertices"
+			  << (passed ? "" : " FAILED") << std::endl;
+
+	return passed;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+/*
+ * A faster replacement for the skinning loop in MD5Mesh::SkinVertices.
+ *
+ * Each frame the skeleton's joint transforms are flattened into a palette of
+ * 3x4 affine matrices, which skips the w row and perspective divide that
+ * Matrix4 * Vector3 does for every weight. Weights are laid out in batches of
+ * MD5SKINNING_LANES vertices, one slot per weight, structure of arrays style:
+ * slot k of a batch holds the k'th weight of each of its vertices, so one SSE
+ * register works on a whole batch at a time. Vertices with fewer weights than
+ * the rest of their batch are padded with weights of zero; to keep that down,
+ * vertices with similar numbers of weights are batched together. Batches are
+ * split across the JobPool.
+ *
+ * Rather than regenerating normals and tangents from the skinned triangles,
+ * the bind pose normal and tangent of each vertex are moved into the space of
+ * each of its weights' joints, and are skinned by the joints' rotations just
+ * like the anchors are. That's the same thing Doom 3 does, and it's close to,
+ * but not quite the same as, regenerating them.
+ *
+ * Positions come out bit for bit the same as the original loop.
+ *
+ * For skinning in the vertex shader instead, BuildGPUVertices turns each
+ * vertex's weights into static attributes: up to MD5SKINNING_GPU_WEIGHTS joint
+ * indices, and an anchor per weight. The anchors are moved into the bind pose
+ * and premultiplied by their weight, with the weight in w, so the palette
+ * BuildPalette makes from the bind pose's inverse is all that changes from one
+ * frame to the next, and the bind pose normals and tangents already in the
+ * Mesh's buffers can be rotated by it. SkinGPUVertices does on the CPU what
+ * the shader does, so the two paths can be compared without reading anything
+ * back from the GPU.
+ */
+#include <vector>
+
+#include "Vector2.h"
+#include "Vector3.h"
+#include "Vector4.h"
+
+// Vertices per batch, the width of an SSE register
+#define MD5SKINNING_LANES	4
+
+// Fewest batches worth handing to another thread
+#define MD5SKINNING_GRAIN	256
+
+/*
+ * Vertices are sorted by their number of weights within windows this big
+ * before being put into batches, so there's less padding, without scattering
+ * the writes all over the vertex array.
+ */
+#define MD5SKINNING_SORT_WINDOW	64
+
+// Weights per vertex the GPU path keeps; any more, and the smallest are dropped
+#define MD5SKINNING_GPU_WEIGHTS	4
+
+// Most joints the GPU path can index, with one byte per joint index
+#define MD5SKINNING_GPU_JOINTS	256
+
+// Largest distance a GPU skinned position may be from the reference loop's
+#define MD5SKINNING_GPU_TOLERANCE	1e-3f
+
+struct MD5SubMesh;
+struct MD5Skeleton;
+
+struct MD5SkinningSubMesh
+{
+	unsigned int				numVertices;
+	std::vector<unsigned int>	batchStart;		// First slot of each batch, plus one past the last batch
+	std::vector<unsigned int>	lanes;			// Vertex of each lane of each batch, ~0 for none
+
+	// MD5SKINNING_LANES entries per slot
+	std::vector<unsigned int>	joints;			// Offset of the joint's matrix in the palette
+	std::vector<float>			weights;
+	std::vector<float>			anchors[3];		// x, y and z of the anchor positions
+	std::vector<float>			normals[3];		// Bind pose normals, in joint space
+	std::vector<float>			tangents[3];	// Bind pose tangents, in joint space
+};
+
+struct MD5GPUSkinningVertices
+{
+	unsigned int				numVertices;
+	unsigned int				numTruncated;	// Vertices that had more than MD5SKINNING_GPU_WEIGHTS weights
+
+	// MD5SKINNING_GPU_WEIGHTS entries per vertex, unused ones with a weight of zero
+	std::vector<unsigned char>	joints;
+	std::vector<Vector4>		anchors;		// Bind pose anchor times its weight, and the weight
+};
+
+class MD5Skinning
+{
+public:
+	unsigned int GetNumSubMeshes() const		{ return (unsigned int)subMeshes.size(); }
+
+	/*
+	 * Lays out a submesh's weights in batches. The bind pose normals and
+	 * tangents are optional, and are only skinned if they were given here.
+	 */
+	void AddSubMesh(const MD5SubMesh &subMesh, const MD5Skeleton &bindPose,
+					const Vector3 *bindNormals, const Vector3 *bindTangents);
+
+	void Clear();
+
+	// Builds the palette from the joints of a skeleton
+	void SetPose(const MD5Skeleton &skeleton);
+
+	// Skins a submesh in the current pose. normals and tangents can be NULL
+	void Skin(unsigned int subMesh, Vector3 *vertices, Vector3 *normals, Vector3 *tangents, bool threaded = true) const;
+
+	// The loop MD5Mesh::SkinVertices runs without MD5_USE_FAST_SKINNING
+	static void SkinReference(const MD5SubMesh &subMesh, const MD5Skeleton &skeleton, Vector3 *vertices);
+
+	/*
+	 * Converts a submesh's weights into static vertex attributes for the
+	 * skinning shader. Returns false if the skeleton has too many joints.
+	 */
+	static bool BuildGPUVertices(const MD5SubMesh &subMesh, const MD5Skeleton &bindPose, MD5GPUSkinningVertices &into);
+
+	/*
+	 * Flattens each joint's transform into 3x4 rows, as SetPose does. Given a
+	 * bind pose, each joint's bind pose is undone first, which is the palette
+	 * the GPU path needs.
+	 */
+	static void BuildPalette(const MD5Skeleton &skeleton, const MD5Skeleton *bindPose, std::vector<float> &into);
+
+	// What the skinning shader does to the GPU vertices, with the same sums in the same order
+	static void SkinGPUVertices(const MD5GPUSkinningVertices &from, const std::vector<float> &palette, Vector3 *vertices);
+
+	/*
+	 * Skins a made up mesh, with no GL context needed, and prints how many
+	 * vertices per second get through the reference loop plus normal and
+	 * tangent regeneration, and the palette path on one thread and on the
+	 * JobPool. Also checks the positions against the reference loop, and that
+	 * the bind pose normals survive the trip through joint space, and how far
+	 * the GPU path's positions are from the reference. Returns false if
+	 * anything didn't match.
+	 */
+	static bool Benchmark(unsigned int numVertices = 100000, unsigned int numJoints = 64, int iterations = 20);
+
+protected:
+	void SkinBatches(const MD5SkinningSubMesh &m, unsigned int begin, unsigned int end,
+					 Vector3 *vertices, Vector3 *normals, Vector3 *tangents) const;
+
+	std::vector<MD5SkinningSubMesh>	subMeshes;
+	std::vector<float>				palette;	// 12 floats per joint, a 3x4 matrix in rows
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * Read-only memory mapping of a whole file. Used by the loaders that want to
+ * walk a file in place (mesh caches, the OBJ tokenizer) instead of streaming
+ * it through an ifstream.
+ */
+#include <string>
+#include "Windows.h"
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string &filename);
+	void Close();
+
+	bool IsOpen() const				{ return data != NULL; }
+	const char * GetData() const	{ return data; }
+	size_t GetSize() const			{ return size; }
+
+	// Size and last write time of a file, without opening it
+	static bool GetFileInfo(const std::string &filename, unsigned long long &size, unsigned long long &time);
+
+protected:
+	// Not copyable, the handles belong to one instance only
+	MappedFile(const MappedFile &);
+	MappedFile & operator=(const MappedFile &);
+
+	HANDLE file;
+	HANDLE mapping;
+
+	const char *data;
+	size_t size;
+};
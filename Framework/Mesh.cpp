@@ -1,4 +1,5 @@
 #include "Mesh.h"
+#include "NormalGenerator.h"
 
 Mesh::Mesh()
 {
@@ -26,10 +27,21 @@ Mesh::Mesh()
 	bumpTexture3 = 0;
 
 	type = GL_TRIANGLES;
+
+	instanceBuffer = NULL;
 }
 
 Mesh::~Mesh()
 {
+	GLStateCache &state = GLStateCache::Get();
+	state.ForgetVertexArray(arrayObject);
+	state.ForgetTexture(texture);
+	state.ForgetTexture(texture2);
+	state.ForgetTexture(texture3);
+	state.ForgetTexture(bumpTexture);
+	state.ForgetTexture(bumpTexture2);
+	state.ForgetTexture(bumpTexture3);
+
 	glDeleteVertexArrays(1, &arrayObject);
 	glDeleteVertexArrays(MAX_BUFFER, bufferObject);
 
@@ -144,7 +156,13 @@ Mesh * Mesh::GenerateQuad(float texCoordScale)
 
 void Mesh::BufferData ()
 {
-	glBindVertexArray(arrayObject);
+	if (format.IsInterleaved())
+	{
+		BufferInterleavedData();
+		return;
+	}
+
+	GLStateCache::Get().BindVertexArray(arrayObject);
 	glGenBuffers(1, &bufferObject[VERTEX_BUFFER]);
 	glBindBuffer(GL_ARRAY_BUFFER, bufferObject[VERTEX_BUFFER]);
 	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof (Vector3), vertices, GL_STATIC_DRAW);
@@ -194,63 +212,135 @@ void Mesh::BufferData ()
 		glEnableVertexAttribArray(TANGENT_BUFFER);
 	}
 
-	glBindVertexArray(0);
+	GLStateCache::Get().BindVertexArray(0);
+}
+
+void Mesh::BufferInterleavedData()
+{
+	// 10:10:10:2 vertex attributes need GL 3.3, so fall back to shorts on a plain 3.2 context
+	if (format.UsesPackedNormals() && !GLEW_VERSION_3_3 && !GLEW_ARB_vertex_type_2_10_10_10_rev)
+	{
+		format.SetPackedNormals(false);
+	}
+
+	if (format.QuantisesPositions() && !format.HasBounds())
+	{
+		format.FitBounds(vertices, numVertices);
+	}
+
+	GLuint stride = format.Layout(colours != NULL, textureCoords != NULL, normals != NULL, tangents != NULL);
+
+	unsigned char *data = new unsigned char[numVertices * stride];
+	format.Pack(data, numVertices, vertices, colours, textureCoords, normals, tangents);
+
+	GLStateCache::Get().BindVertexArray(arrayObject);
+	glGenBuffers(1, &bufferObject[VERTEX_BUFFER]);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferObject[VERTEX_BUFFER]);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * stride, data, GL_STATIC_DRAW);
+	format.SetAttribPointers();
+
+	delete[] data;
+
+	if (indices)
+	{
+		glGenBuffers(1, &bufferObject[INDEX_BUFFER]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferObject[INDEX_BUFFER]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), indices, GL_STATIC_DRAW);
+	}
+
+	GLStateCache::Get().BindVertexArray(0);
 }
 
 void Mesh::Draw()
 {
+	BindForDraw();
+
+	if (bufferObject[INDEX_BUFFER])
+	{
+		glDrawElements(type, numIndices, GL_UNSIGNED_INT, 0);
+	}
+	else
+	{
+		glDrawArrays(type, 0, numVertices);
+	}
+}
+
+void Mesh::DrawInstanced(GLuint numInstances)
+{
+	BindForDraw();
+
+	if (bufferObject[INDEX_BUFFER])
+	{
+		glDrawElementsInstanced(type, numIndices, GL_UNSIGNED_INT, 0, numInstances);
+	}
+	else
+	{
+		glDrawArraysInstanced(type, 0, numVertices, numInstances);
+	}
+}
+
+void Mesh::SetInstanceBuffer(const InstanceBuffer *buffer)
+{
+	if (buffer == instanceBuffer)
+	{
+		return;
+	}
+
+	GLStateCache::Get().BindVertexArray(arrayObject);
+
+	if (buffer)
+	{
+		buffer->SetAttribPointers();
+	}
+	else
+	{
+		for (int column = 0; column < 4; ++column)
+		{
+			glDisableVertexAttribArray(INSTANCE_MATRIX_ATTRIBUTE + column);
+		}
+	}
+
+	instanceBuffer = buffer;
+}
+
+void Mesh::BindForDraw()
+{
+	// Only what isn't bound already gets bound; the textures and vertex array are left bound after
+	GLStateCache &state = GLStateCache::Get();
+
 	// Texture on texture unit 0
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	//glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 8.0f);
+	state.BindTexture(0, texture);
 
 	// Bumpmap on texture unit 1
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, bumpTexture);
+	state.BindTexture(1, bumpTexture);
 
-	// Second texture on texture unit 11
+	// Second texture on texture unit 11, its anisotropy only set the first time
 	if (texture2)
 	{
-		glActiveTexture(GL_TEXTURE11);
-		glBindTexture(GL_TEXTURE_2D, texture2);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 8.0f);
+		state.BindTexture(11, texture2);
+		state.SetAnisotropy(11, texture2, 8.0f);
 	}
 
 	// Third texture on texture unit 12
 	if (texture3)
 	{
-		glActiveTexture(GL_TEXTURE12);
-		glBindTexture(GL_TEXTURE_2D, texture3);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 8.0f);
+		state.BindTexture(12, texture3);
+		state.SetAnisotropy(12, texture3, 8.0f);
 	}
 
 	// Second bump texture on texture unit 13
 	if (bumpTexture2)
 	{
-		glActiveTexture(GL_TEXTURE13);
-		glBindTexture(GL_TEXTURE_2D, bumpTexture2);
+		state.BindTexture(13, bumpTexture2);
 	}
 
 	// Third bump texture on texture unit 14
 	if (bumpTexture3)
 	{
-		glActiveTexture(GL_TEXTURE14);
-		glBindTexture(GL_TEXTURE_2D, bumpTexture3);
+		state.BindTexture(14, bumpTexture3);
 	}
 
-	glBindVertexArray(arrayObject);
-	
-	if (bufferObject[INDEX_BUFFER])
-	{
-		glDrawElements(type, numIndices, GL_UNSIGNED_INT, 0);
-	}
-	else
-	{
-		glDrawArrays(type, 0, numVertices);
-	}
-	
-	glBindVertexArray(0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	state.BindVertexArray(arrayObject);
 }
 
 void Mesh::GenerateNormals()
@@ -260,6 +350,20 @@ void Mesh::GenerateNormals()
 		normals = new Vector3[numVertices];
 	}
 
+	GenerateNormals(vertices, numVertices, indices, numIndices, normals);
+}
+
+void Mesh::GenerateNormals(const Vector3 *vertices, GLuint numVertices, const unsigned int *indices, GLuint numIndices, Vector3 *normals)
+{
+#ifdef MESH_USE_FAST_NORMALS
+	NormalGenerator::GenerateNormals(vertices, numVertices, indices, numIndices, normals);
+#else
+	GenerateNormalsReference(vertices, numVertices, indices, numIndices, normals);
+#endif
+}
+
+void Mesh::GenerateNormalsReference(const Vector3 *vertices, GLuint numVertices, const unsigned int *indices, GLuint numIndices, Vector3 *normals)
+{
 	for (GLuint i = 0; i < numVertices; ++i)
 	{
 		normals[i] = Vector3();
@@ -286,9 +390,9 @@ void Mesh::GenerateNormals()
 	{
 		for (GLuint i = 0; i < numVertices; i+=3)
 		{
-			Vector3 &a = vertices[i];
-			Vector3 &b = vertices[i+1];
-			Vector3 &c = vertices[i+2];
+			const Vector3 &a = vertices[i];
+			const Vector3 &b = vertices[i+1];
+			const Vector3 &c = vertices[i+2];
 
 			Vector3 normal = Vector3::Cross(b - a, c - a);
 
@@ -316,6 +420,22 @@ void Mesh::GenerateTangents()
 		tangents = new Vector3[numVertices];
 	}
 
+	GenerateTangents(vertices, textureCoords, numVertices, indices, numIndices, tangents);
+}
+
+void Mesh::GenerateTangents(const Vector3 *vertices, const Vector2 *textureCoords, GLuint numVertices,
+							const unsigned int *indices, GLuint numIndices, Vector3 *tangents)
+{
+#ifdef MESH_USE_FAST_NORMALS
+	NormalGenerator::GenerateTangents(vertices, textureCoords, numVertices, indices, numIndices, tangents);
+#else
+	GenerateTangentsReference(vertices, textureCoords, numVertices, indices, numIndices, tangents);
+#endif
+}
+
+void Mesh::GenerateTangentsReference(const Vector3 *vertices, const Vector2 *textureCoords, GLuint numVertices,
+									 const unsigned int *indices, GLuint numIndices, Vector3 *tangents)
+{
 	for (GLuint i = 0; i < numVertices; ++i)
 	{
 		tangents[i] = Vector3();
@@ -1,16 +1,14 @@
 #pragma once
 #include "OGLRenderer.h"
+#include "VertexFormat.h"
+#include "InstanceBuffer.h"
 
-enum MeshBuffer
-{
-	VERTEX_BUFFER,
-	COLOUR_BUFFER,
-	TEXTURE_BUFFER,
-	NORMAL_BUFFER,
-	TANGENT_BUFFER,
-	INDEX_BUFFER,
-	MAX_BUFFER
-};
+/*
+With MESH_USE_FAST_NORMALS defined, normals and tangents are generated by the
+NormalGenerator's SIMD and multithreaded path. Comment it out to go back to the
+plain scalar loops, which are kept either way as the reference to check against.
+*/
+#define MESH_USE_FAST_NORMALS
 
 class Mesh
 {
@@ -20,6 +18,12 @@ public:
 
 	virtual void Draw();
 
+	// Draws numInstances copies at once, each with its own model matrix from the instance buffer
+	virtual void DrawInstanced(GLuint numInstances);
+
+	// Points the vertex array at an instance buffer's matrices. The buffer isn't owned by the mesh
+	virtual void SetInstanceBuffer(const InstanceBuffer *buffer);
+
 	static Mesh * GenerateTriangle();
 	static Mesh * GenerateQuad();
 	static Mesh * GenerateQuad(float texCoordScale);
@@ -42,18 +46,40 @@ public:
 	void SetBumpMap3(GLuint tex)	{ bumpTexture3 = tex; }
 	GLuint GetBumpMap3()			{ return bumpTexture3; }
 
+	// Layout to use for the vertex buffers; only takes effect on the next BufferData
+	void SetVertexFormat(const VertexFormat &f)	{ format = f; }
+	const VertexFormat & GetVertexFormat()		{ return format; }
+
+	// Multiply onto the model matrix, to undo position quantisation (identity otherwise)
+	Matrix4 GetDequantMatrix()					{ return format.GetDequantMatrix(); }
+	float GetDequantScale()						{ return format.GetDequantScale(); }
+
 	unsigned int GetNumVertices()	{ return numVertices; }
 	Vector3 * GetVertices()			{ return vertices; }
 	Vector3 * GetNormals()			{ return normals; }
 
+	// Normal and tangent generation on plain arrays, so loaders can run it without a GL context
+	static void GenerateNormals(const Vector3 *vertices, GLuint numVertices, const unsigned int *indices, GLuint numIndices, Vector3 *normals);
+	static void GenerateTangents(const Vector3 *vertices, const Vector2 *textureCoords, GLuint numVertices,
+								 const unsigned int *indices, GLuint numIndices, Vector3 *tangents);
+
+	// The original single threaded scalar loops
+	static void GenerateNormalsReference(const Vector3 *vertices, GLuint numVertices, const unsigned int *indices, GLuint numIndices, Vector3 *normals);
+	static void GenerateTangentsReference(const Vector3 *vertices, const Vector2 *textureCoords, GLuint numVertices,
+										  const unsigned int *indices, GLuint numIndices, Vector3 *tangents);
+
 protected:
 	void BufferData();
+	void BufferInterleavedData();
+
+	// Binds the textures and vertex array, ready for either draw
+	void BindForDraw();
 
 	float *colors;
 
 	void GenerateNormals();
 	void GenerateTangents();
-	Vector3 GenerateTangent(const Vector3 &a, const Vector3 &b,	const Vector3 &c,
+	static Vector3 GenerateTangent(const Vector3 &a, const Vector3 &b,	const Vector3 &c,
 							const Vector2 &ta, const Vector2 &tb, const Vector2 &tc);
 
 	Vector3 *vertices;
@@ -77,4 +103,8 @@ protected:
 	unsigned int *indices;
 
 	GLuint type;
+
+	VertexFormat format;
+
+	const InstanceBuffer *instanceBuffer;
 };
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "MeshCache.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstddef>
+
+bool MeshCache::Open(const std::string &source, unsigned int buildFlags)
+{
+	subMeshes.clear();
+
+	if (!OpenFile(source, GetCacheName(source), MESHCACHE_MAGIC, MESHCACHE_VERSION, sizeof(MeshCacheHeader), file))
+	{
+		return false;
+	}
+
+	const char *data = file.GetData();
+	const char *end = data + file.GetSize();
+
+	const MeshCacheHeader &header = *(const MeshCacheHeader*)data;
+
+	if (header.buildFlags != buildFlags)
+	{
+		file.Close();
+		return false;
+	}
+
+	unsigned int numSubMeshes = header.numSubMeshes;
+
+	data += sizeof(MeshCacheHeader);
+
+	for (unsigned int i = 0; i < numSubMeshes; ++i)
+	{
+		if (data + sizeof(MeshCacheSubMeshHeader) > end)
+		{
+			subMeshes.clear();
+			file.Close();
+			return false;
+		}
+
+		const MeshCacheSubMeshHeader &subHeader = *(const MeshCacheSubMeshHeader*)data;
+		data += sizeof(MeshCacheSubMeshHeader);
+
+		size_t size = subHeader.numVertices * sizeof(Vector3);
+
+		if (subHeader.attributes & MESHCACHE_TEXCOORDS)	size += subHeader.numVertices * sizeof(Vector2);
+		if (subHeader.attributes & MESHCACHE_NORMALS)	size += subHeader.numVertices * sizeof(Vector3);
+		if (subHeader.attributes & MESHCACHE_TANGENTS)	size += subHeader.numVertices * sizeof(Vector3);
+		if (subHeader.attributes & MESHCACHE_INDICES)	size += subHeader.numIndices * sizeof(unsigned int);
+
+		// Truncated file
+		if (data + size > end)
+		{
+			subMeshes.clear();
+			file.Close();
+			return false;
+		}
+
+		MeshCacheSubMesh subMesh;
+		subMesh.numVertices = subHeader.numVertices;
+		subMesh.numIndices = 0;
+		subMesh.textureCoords = NULL;
+		subMesh.normals = NULL;
+		subMesh.tangents = NULL;
+		subMesh.indices = NULL;
+
+		subMesh.vertices = (const Vector3*)data;
+		data += subHeader.numVertices * sizeof(Vector3);
+
+		if (subHeader.attributes & MESHCACHE_TEXCOORDS)
+		{
+			subMesh.textureCoords = (const Vector2*)data;
+			data += subHeader.numVertices * sizeof(Vector2);
+		}
+
+		if (subHeader.attributes & MESHCACHE_NORMALS)
+		{
+			subMesh.normals = (const Vector3*)data;
+			data += subHeader.numVertices * sizeof(Vector3);
+		}
+
+		if (subHeader.attributes & MESHCACHE_TANGENTS)
+		{
+			subMesh.tangents = (const Vector3*)data;
+			data += subHeader.numVertices * sizeof(Vector3);
+		}
+
+		if (subHeader.attributes & MESHCACHE_INDICES)
+		{
+			subMesh.numIndices = subHeader.numIndices;
+			subMesh.indices = (const unsigned int*)data;
+			data += subHeader.numIndices * sizeof(unsigned int);
+		}
+
+		subMeshes.push_back(subMesh);
+	}
+
+	return true;
+}
+
+bool MeshCache::Write(const std::string &source, const std::vector<MeshCacheSubMesh> &subMeshes, unsigned int buildFlags)
+{
+	MeshCacheHeader header;
+	header.cache.magic = MESHCACHE_MAGIC;
+	header.cache.version = MESHCACHE_VERSION;
+	header.numSubMeshes = subMeshes.size();
+	header.buildFlags = buildFlags;
+
+	if (!MappedFile::GetFileInfo(source, header.cache.sourceSize, header.cache.sourceTime))
+	{
+		return false;
+	}
+
+	header.cache.sourceHash = HashFile(source);
+
+	std::string cacheName = GetCacheName(source);
+	std::ofstream f(cacheName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if (!f)
+	{
+		return false;
+	}
+
+	f.write((const char*)&header, sizeof(MeshCacheHeader));
+
+	for (unsigned int i = 0; i < subMeshes.size(); ++i)
+	{
+		const MeshCacheSubMesh &subMesh = subMeshes[i];
+
+		MeshCacheSubMeshHeader subHeader;
+		subHeader.numVertices = subMesh.numVertices;
+		subHeader.numIndices = subMesh.indices ? subMesh.numIndices : 0;
+		subHeader.attributes = 0;
+
+		if (subMesh.textureCoords)	subHeader.attributes |= MESHCACHE_TEXCOORDS;
+		if (subMesh.normals)		subHeader.attributes |= MESHCACHE_NORMALS;
+		if (subMesh.tangents)		subHeader.attributes |= MESHCACHE_TANGENTS;
+		if (subMesh.indices)		subHeader.attributes |= MESHCACHE_INDICES;
+
+		f.write((const char*)&subHeader, sizeof(MeshCacheSubMeshHeader));
+		f.write((const char*)subMesh.vertices, subMesh.numVertices * sizeof(Vector3));
+
+		if (subMesh.textureCoords)	f.write((const char*)subMesh.textureCoords, subMesh.numVertices * sizeof(Vector2));
+		if (subMesh.normals)		f.write((const char*)subMesh.normals, subMesh.numVertices * sizeof(Vector3));
+		if (subMesh.tangents)		f.write((const char*)subMesh.tangents, subMesh.numVertices * sizeof(Vector3));
+		if (subMesh.indices)		f.write((const char*)subMesh.indices, subMesh.numIndices * sizeof(unsigned int));
+	}
+
+	f.close();
+
+	// Don't leave a half written cache behind
+	if (f.fail())
+	{
+		remove(cacheName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+unsigned long long MeshCache::HashFile(const std::string &filename)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	MappedFile source;
+
+	if (!source.Open(filename))
+	{
+		return hash;
+	}
+
+	const unsigned char *data = (const unsigned char*)source.GetData();
+
+	for (size_t i = 0; i < source.GetSize(); ++i)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+bool MeshCache::OpenFile(const std::string &source, const std::string &cacheName, unsigned int magic,
+	unsigned int version, size_t headerSize, MappedFile &file)
+{
+	unsigned long long sourceSize;
+	unsigned long long sourceTime;
+	unsigned long long sourceHash = 0;
+	bool hashed = false;
+
+	// No source, nothing to validate the cache against
+	if (!MappedFile::GetFileInfo(source, sourceSize, sourceTime))
+	{
+		return false;
+	}
+
+	// Goes round a second time if the source time had to be written back
+	while (true)
+	{
+		if (!file.Open(cacheName))
+		{
+			return false;
+		}
+
+		const CacheHeader &header = *(const CacheHeader*)file.GetData();
+
+		if (file.GetSize() < headerSize || header.magic != magic || header.version != version || header.sourceSize != sourceSize)
+		{
+			file.Close();
+			return false;
+		}
+
+		if (header.sourceTime == sourceTime)
+		{
+			return true;
+		}
+
+		// A changed timestamp alone doesn't mean a changed file
+		if (!hashed)
+		{
+			sourceHash = HashFile(source);
+		}
+
+		if (header.sourceHash != sourceHash)
+		{
+			file.Close();
+			return false;
+		}
+
+		// The time couldn't be stored, but the contents still match
+		if (hashed)
+		{
+			return true;
+		}
+
+		// Same contents, so store the new time and the next launch won't hash the source again
+		hashed = true;
+		file.Close();
+		WriteSourceTime(cacheName, sourceTime);
+	}
+}
+
+bool MeshCache::WriteSourceTime(const std::string &cacheName, unsigned long long sourceTime)
+{
+	std::fstream f(cacheName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+
+	if (!f)
+	{
+		return false;
+	}
+
+	f.seekp(offsetof(CacheHeader, sourceTime));
+	f.write((const char*)&sourceTime, sizeof(sourceTime));
+
+	return f.good();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+/*
+ * Versioned binary cache of fully built mesh data, stored next to the source
+ * file it was built from (head.obj -> head.obj.cache). The cache is memory
+ * mapped and its arrays are used in place, so loading it costs one map and a
+ * copy per attribute instead of a text parse.
+ *
+ * A cache is only accepted if it was written from the same source file: the
+ * source size and last write time are stored in the header, and if the time
+ * has changed (e.g. a fresh checkout) the source is hashed and compared
+ * against the stored hash before the cache is thrown away. If the hash
+ * matches, the new time is written back, so only the first launch after the
+ * change pays for the hash. The loader's build settings that change what's in
+ * the cache are stored too, and a cache written with other settings is thrown
+ * away.
+ */
+#include <string>
+#include <vector>
+
+#include "Vector3.h"
+#include "Vector2.h"
+#include "MappedFile.h"
+
+#define MESHCACHE_MAGIC			0x48534D43	// "CMSH"
+#define MESHCACHE_VERSION		6
+#define MESHCACHE_EXTENSION		".cache"
+
+// Which optional arrays follow the vertices of a submesh
+#define MESHCACHE_TEXCOORDS		1
+#define MESHCACHE_NORMALS		2
+#define MESHCACHE_TANGENTS		4
+#define MESHCACHE_INDICES		8
+
+// Build settings of the loader that wrote a cache
+#define MESHCACHE_BUILD_NORMALS		1
+#define MESHCACHE_BUILD_TANGENTS	2
+#define MESHCACHE_BUILD_OPTIMISED	4
+
+// What a cache file starts with: its format, and the source file it was built from
+struct CacheHeader
+{
+	unsigned int		magic;
+	unsigned int		version;
+	unsigned long long	sourceSize;
+	unsigned long long	sourceTime;
+	unsigned long long	sourceHash;
+};
+
+struct MeshCacheHeader
+{
+	CacheHeader			cache;
+	unsigned int		numSubMeshes;
+	unsigned int		buildFlags;
+};
+
+struct MeshCacheSubMeshHeader
+{
+	unsigned int numVertices;
+	unsigned int numIndices;
+	unsigned int attributes;
+};
+
+/*
+ * View of one submesh's arrays. When read back from a cache the pointers
+ * point straight into the mapped file; attributes that aren't present are NULL.
+ */
+struct MeshCacheSubMesh
+{
+	unsigned int	numVertices;
+	unsigned int	numIndices;
+	const Vector3	*vertices;
+	const Vector2	*textureCoords;
+	const Vector3	*normals;
+	const Vector3	*tangents;
+	const unsigned int *indices;
+};
+
+class MeshCache
+{
+public:
+	MeshCache() { };
+	~MeshCache(void) { };
+
+	// Maps and validates the cache of the given source file, written with the given MESHCACHE_BUILD_ flags
+	bool Open(const std::string &source, unsigned int buildFlags);
+
+	unsigned int GetNumSubMeshes() const					{ return subMeshes.size(); }
+	const MeshCacheSubMesh & GetSubMesh(unsigned int i) const	{ return subMeshes[i]; }
+
+	// Writes the cache for the given source file
+	static bool Write(const std::string &source, const std::vector<MeshCacheSubMesh> &subMeshes, unsigned int buildFlags);
+
+	static std::string GetCacheName(const std::string &source) { return source + MESHCACHE_EXTENSION; }
+
+	// 64 bit FNV-1a hash of a file's contents
+	static unsigned long long HashFile(const std::string &filename);
+
+	/*
+	 * Maps cacheName into file if it starts with a CacheHeader of the given
+	 * magic and version, built from source as it is now, and is at least
+	 * headerSize bytes long. Writes the new source time back if only that has
+	 * changed, then checks the header again from the new mapping.
+	 */
+	static bool OpenFile(const std::string &source, const std::string &cacheName, unsigned int magic,
+		unsigned int version, size_t headerSize, MappedFile &file);
+
+protected:
+	// Overwrites the source time in the header of a cache that isn't mapped, once its hash has matched
+	static bool WriteSourceTime(const std::string &cacheName, unsigned long long sourceTime);
+
+	MappedFile file;
+	std::vector<MeshCacheSubMesh> subMeshes;
+};
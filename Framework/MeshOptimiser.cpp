@@ -0,0 +1,380 @@
+#include "MeshOptimiser.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Scoring constants from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+#define CACHE_DECAY_POWER		1.5f
+#define LAST_TRIANGLE_SCORE		0.75f
+#define VALENCE_BOOST_SCALE		2.0f
+#define VALENCE_BOOST_POWER		0.5f
+
+static float VertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+	// No triangles left to draw with this vertex, so it isn't worth anything
+	if (remainingTriangles == 0)
+	{
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+
+	if (cachePosition >= 0)
+	{
+		// The last triangle's vertices get a fixed score, so the next triangle doesn't just reuse its edge
+		if (cachePosition < 3)
+		{
+			score = LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			const float scale = 1.0f / (MESHOPTIMISER_CACHE_SIZE - 3);
+			score = powf(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+		}
+	}
+
+	// Vertices with few triangles left get a boost, to finish them off and avoid leaving lone triangles behind
+	score += VALENCE_BOOST_SCALE * powf((float)remainingTriangles, -VALENCE_BOOST_POWER);
+
+	return score;
+}
+
+void MeshOptimiser::OptimiseVertexCache(unsigned int *indices, unsigned int numIndices, unsigned int numVertices)
+{
+	unsigned int numTriangles = numIndices / 3;
+
+	if (numTriangles == 0)
+	{
+		return;
+	}
+
+	// Triangles using each vertex, as one flat array with an offset per vertex
+	std::vector<unsigned int> remaining(numVertices, 0);
+	std::vector<unsigned int> offsets(numVertices, 0);
+	std::vector<unsigned int> adjacency(numTriangles * 3);
+
+	for (unsigned int i = 0; i < numTriangles * 3; ++i)
+	{
+		++remaining[indices[i]];
+	}
+
+	for (unsigned int i = 1; i < numVertices; ++i)
+	{
+		offsets[i] = offsets[i - 1] + remaining[i - 1];
+	}
+
+	std::vector<unsigned int> filled(numVertices, 0);
+
+	for (unsigned int i = 0; i < numTriangles * 3; ++i)
+	{
+		unsigned int v = indices[i];
+		adjacency[offsets[v] + filled[v]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> vertexScores(numVertices);
+
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		vertexScores[i] = VertexScore(-1, remaining[i]);
+	}
+
+	std::vector<float> triangleScores(numTriangles);
+	std::vector<bool> emitted(numTriangles, false);
+
+	int best = 0;
+
+	for (unsigned int i = 0; i < numTriangles; ++i)
+	{
+		const unsigned int *tri = &indices[i * 3];
+		triangleScores[i] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+
+		if (triangleScores[i] > triangleScores[best])
+		{
+			best = i;
+		}
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(numTriangles * 3);
+
+	unsigned int cache[MESHOPTIMISER_CACHE_SIZE + 3];
+	unsigned int cacheCount = 0;
+	unsigned int nextUnemitted = 0;
+
+	for (unsigned int emittedCount = 0; emittedCount < numTriangles; ++emittedCount)
+	{
+		// Nothing left around the cached vertices, so start again from the next triangle not yet drawn
+		if (best < 0)
+		{
+			while (emitted[nextUnemitted])
+			{
+				++nextUnemitted;
+			}
+			best = nextUnemitted;
+		}
+
+		const unsigned int *tri = &indices[best * 3];
+
+		output.push_back(tri[0]);
+		output.push_back(tri[1]);
+		output.push_back(tri[2]);
+		emitted[best] = true;
+
+		// Take the triangle out of its vertices' adjacency lists
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = tri[k];
+			unsigned int *list = &adjacency[offsets[v]];
+
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+			{
+				if (list[j] == (unsigned int)best)
+				{
+					list[j] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			--remaining[v];
+		}
+
+		// The triangle's vertices move to the front of the cache, pushing the rest back
+		unsigned int newCache[MESHOPTIMISER_CACHE_SIZE + 3];
+		unsigned int newCount = 0;
+
+		newCache[newCount++] = tri[0];
+		newCache[newCount++] = tri[1];
+		newCache[newCount++] = tri[2];
+
+		for (unsigned int i = 0; i < cacheCount; ++i)
+		{
+			unsigned int v = cache[i];
+
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+			{
+				newCache[newCount++] = v;
+			}
+		}
+
+		for (unsigned int i = 0; i < newCount; ++i)
+		{
+			unsigned int v = newCache[i];
+			cachePosition[v] = (i < MESHOPTIMISER_CACHE_SIZE) ? (int)i : -1;
+			vertexScores[v] = VertexScore(cachePosition[v], remaining[v]);
+		}
+
+		cacheCount = (newCount < MESHOPTIMISER_CACHE_SIZE) ? newCount : MESHOPTIMISER_CACHE_SIZE;
+		memcpy(cache, newCache, cacheCount * sizeof(unsigned int));
+
+		// Rescore the triangles around the cache, and pick the best of them for next time
+		best = -1;
+		float bestScore = -1.0f;
+
+		for (unsigned int i = 0; i < newCount; ++i)
+		{
+			unsigned int v = newCache[i];
+			const unsigned int *list = &adjacency[offsets[v]];
+
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+			{
+				unsigned int t = list[j];
+				const unsigned int *other = &indices[t * 3];
+
+				triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+
+				if (i < cacheCount && triangleScores[t] > bestScore)
+				{
+					best = t;
+					bestScore = triangleScores[t];
+				}
+			}
+		}
+	}
+
+	memcpy(indices, &output[0], output.size() * sizeof(unsigned int));
+}
+
+void MeshOptimiser::OptimiseOverdraw(unsigned int *indices, unsigned int numIndices, const Vector3 *vertices,
+									 unsigned int numVertices, float threshold)
+{
+	unsigned int numTriangles = numIndices / 3;
+
+	if (numTriangles == 0)
+	{
+		return;
+	}
+
+	VertexCacheStats before = AnalyseVertexCache(indices, numIndices, numVertices);
+
+	// A new cluster starts wherever a triangle misses on all three vertices
+	std::vector<unsigned int> clusterStarts;
+	std::vector<unsigned int> cacheTime(numVertices, 0);
+	unsigned int time = MESHOPTIMISER_FIFO_SIZE + 1;
+
+	for (unsigned int i = 0; i < numTriangles; ++i)
+	{
+		unsigned int misses = 0;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = indices[i * 3 + k];
+
+			if (time - cacheTime[v] > MESHOPTIMISER_FIFO_SIZE)
+			{
+				cacheTime[v] = time++;
+				++misses;
+			}
+		}
+
+		if (misses == 3 || i == 0)
+		{
+			clusterStarts.push_back(i);
+		}
+	}
+
+	if (clusterStarts.size() < 2)
+	{
+		return;
+	}
+
+	Vector3 meshCentre;
+
+	for (unsigned int i = 0; i < numIndices; ++i)
+	{
+		meshCentre += vertices[indices[i]];
+	}
+	meshCentre = meshCentre * (1.0f / numIndices);
+
+	/*
+	 * Each cluster is scored by how far its area weighted normal points away
+	 * from the mesh centre, measured from the cluster's centroid.
+	 */
+	std::vector<std::pair<float, unsigned int> > order(clusterStarts.size());
+
+	for (unsigned int c = 0; c < clusterStarts.size(); ++c)
+	{
+		unsigned int start = clusterStarts[c];
+		unsigned int end = (c + 1 < clusterStarts.size()) ? clusterStarts[c + 1] : numTriangles;
+
+		Vector3 centroid;
+		Vector3 normal;
+		float area = 0.0f;
+
+		for (unsigned int t = start; t < end; ++t)
+		{
+			const Vector3 &a = vertices[indices[t * 3]];
+			const Vector3 &b = vertices[indices[t * 3 + 1]];
+			const Vector3 &d = vertices[indices[t * 3 + 2]];
+
+			Vector3 cross = Vector3::Cross(b - a, d - a);
+			float triangleArea = cross.Length();
+
+			centroid += (a + b + d) * (triangleArea / 3.0f);
+			normal += cross;
+			area += triangleArea;
+		}
+
+		if (area > 0.0f)
+		{
+			centroid = centroid * (1.0f / area);
+		}
+		normal.Normalise();
+
+		order[c] = std::make_pair(-Vector3::Dot(centroid - meshCentre, normal), c);
+	}
+
+	std::stable_sort(order.begin(), order.end());
+
+	std::vector<unsigned int> output;
+	output.reserve(numTriangles * 3);
+
+	for (unsigned int i = 0; i < order.size(); ++i)
+	{
+		unsigned int c = order[i].second;
+		unsigned int start = clusterStarts[c];
+		unsigned int end = (c + 1 < clusterStarts.size()) ? clusterStarts[c + 1] : numTriangles;
+
+		output.insert(output.end(), indices + start * 3, indices + end * 3);
+	}
+
+	VertexCacheStats after = AnalyseVertexCache(&output[0], numTriangles * 3, numVertices);
+
+	if (after.acmr <= before.acmr * threshold)
+	{
+		memcpy(indices, &output[0], output.size() * sizeof(unsigned int));
+	}
+}
+
+void MeshOptimiser::OptimiseVertexFetch(unsigned int *indices, unsigned int numIndices, unsigned int numVertices,
+										std::vector<unsigned int> &remap)
+{
+	const unsigned int unused = ~0u;
+
+	remap.assign(numVertices, unused);
+	unsigned int next = 0;
+
+	for (unsigned int i = 0; i < numIndices; ++i)
+	{
+		unsigned int &v = indices[i];
+
+		if (remap[v] == unused)
+		{
+			remap[v] = next++;
+		}
+		v = remap[v];
+	}
+
+	// Vertices no triangle uses go on the end, so every array keeps its size
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		if (remap[i] == unused)
+		{
+			remap[i] = next++;
+		}
+	}
+}
+
+VertexCacheStats MeshOptimiser::AnalyseVertexCache(const unsigned int *indices, unsigned int numIndices,
+												   unsigned int numVertices, unsigned int cacheSize)
+{
+	VertexCacheStats stats;
+	stats.misses = 0;
+	stats.acmr = 0.0f;
+	stats.atvr = 0.0f;
+
+	// A vertex is in the FIFO if it went in within the last cacheSize insertions
+	std::vector<unsigned int> cacheTime(numVertices, 0);
+	std::vector<bool> referenced(numVertices, false);
+	unsigned int time = cacheSize + 1;
+	unsigned int numReferenced = 0;
+
+	for (unsigned int i = 0; i < numIndices; ++i)
+	{
+		unsigned int v = indices[i];
+
+		if (time - cacheTime[v] > cacheSize)
+		{
+			cacheTime[v] = time++;
+			++stats.misses;
+		}
+
+		if (!referenced[v])
+		{
+			referenced[v] = true;
+			++numReferenced;
+		}
+	}
+
+	if (numIndices >= 3)
+	{
+		stats.acmr = stats.misses / (float)(numIndices / 3);
+	}
+
+	if (numReferenced > 0)
+	{
+		stats.atvr = stats.misses / (float)numReferenced;
+	}
+
+	return stats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+ * Load time index and vertex reordering for indexed triangle lists. None of
+ * these functions touch OpenGL, they only shuffle arrays in place, so any mesh
+ * with an index buffer can opt in before it calls BufferData.
+ *
+ * The usual order is OptimiseVertexCache, then (optionally) OptimiseOverdraw,
+ * then OptimiseVertexFetch, which renumbers the vertices into the order the
+ * indices first use them, and returns the remap to apply to every attribute
+ * array with RemapArray.
+ */
+#include <vector>
+
+#include "Vector3.h"
+
+// Size of the LRU cache the vertex cache optimiser models
+#define MESHOPTIMISER_CACHE_SIZE		32
+
+// Size of the FIFO cache used when reporting ACMR and ATVR
+#define MESHOPTIMISER_FIFO_SIZE			16
+
+struct VertexCacheStats
+{
+	unsigned int	misses;
+	float			acmr;	// Average cache misses per triangle, 0.5 is the best possible
+	float			atvr;	// Average transformed vertices per referenced vertex, 1.0 is the best possible
+};
+
+class MeshOptimiser
+{
+public:
+	// Reorders triangles for post transform cache hits (Tom Forsyth's linear speed algorithm)
+	static void OptimiseVertexCache(unsigned int *indices, unsigned int numIndices, unsigned int numVertices);
+
+	/*
+	 * Splits the triangle order into clusters where the cache starts over, and
+	 * draws the clusters facing away from the mesh centre first, so they
+	 * occlude more of what comes after. The new order is only kept if its ACMR
+	 * is within threshold times the current one.
+	 */
+	static void OptimiseOverdraw(unsigned int *indices, unsigned int numIndices, const Vector3 *vertices,
+								 unsigned int numVertices, float threshold = 1.05f);
+
+	// Renumbers vertices in order of first use; remap[old] is the new index of each vertex
+	static void OptimiseVertexFetch(unsigned int *indices, unsigned int numIndices, unsigned int numVertices,
+									std::vector<unsigned int> &remap);
+
+	// Moves each element of an attribute array to where the remap says it now lives
+	template <class T>
+	static void RemapArray(T *data, unsigned int numVertices, const std::vector<unsigned int> &remap)
+	{
+		std::vector<T> copy(data, data + numVertices);
+
+		for (unsigned int i = 0; i < numVertices; ++i)
+		{
+			data[remap[i]] = copy[i];
+		}
+	}
+
+	// Simulates a FIFO post transform cache over the index list
+	static VertexCacheStats AnalyseVertexCache(const unsigned int *indices, unsigned int numIndices,
+											   unsigned int numVertices, unsigned int cacheSize = MESHOPTIMISER_FIFO_SIZE);
+};
@@ -0,0 +1,417 @@
+#include "NormalGenerator.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include "Mesh.h"
+#include "JobPool.h"
+#include "GameTimer.h"
+
+#if defined(NORMALGENERATOR_USE_SSE) || defined(NORMALGENERATOR_USE_AVX)
+#include <immintrin.h>
+
+/*
+ * Four consecutive Vector3s are three registers of x0 y0 z0 x1 / y1 z1 x2 y2 /
+ * z2 x3 y3 z3, which a handful of shuffles turn into x0..x3, y0..y3, z0..z3
+ * and back again.
+ */
+static void LoadVector3x4(const float *f, __m128 &x, __m128 &y, __m128 &z)
+{
+	__m128 a = _mm_loadu_ps(f);
+	__m128 b = _mm_loadu_ps(f + 4);
+	__m128 c = _mm_loadu_ps(f + 8);
+
+	x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+static void StoreVector3x4(float *f, __m128 x, __m128 y, __m128 z)
+{
+	_mm_storeu_ps(f,     _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+#endif
+
+#if defined(NORMALGENERATOR_USE_AVX)
+
+struct SimdFloat
+{
+	typedef __m256 Type;
+	enum { WIDTH = 8 };
+
+	// Two lots of four, one in each half of the registers
+	static void LoadVector3s(const float *f, Type &x, Type &y, Type &z)
+	{
+		__m128 lx, ly, lz, hx, hy, hz;
+		LoadVector3x4(f, lx, ly, lz);
+		LoadVector3x4(f + 12, hx, hy, hz);
+
+		x = _mm256_insertf128_ps(_mm256_castps128_ps256(lx), hx, 1);
+		y = _mm256_insertf128_ps(_mm256_castps128_ps256(ly), hy, 1);
+		z = _mm256_insertf128_ps(_mm256_castps128_ps256(lz), hz, 1);
+	}
+
+	static void StoreVector3s(float *f, Type x, Type y, Type z)
+	{
+		StoreVector3x4(f, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+		StoreVector3x4(f + 12, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+	}
+
+	static Type Splat(float f)					{ return _mm256_set1_ps(f); }
+	static Type Add(Type a, Type b)				{ return _mm256_add_ps(a, b); }
+	static Type Mul(Type a, Type b)				{ return _mm256_mul_ps(a, b); }
+	static Type Div(Type a, Type b)				{ return _mm256_div_ps(a, b); }
+	static Type Sqrt(Type a)					{ return _mm256_sqrt_ps(a); }
+
+	// test != 0 ? a : b, per lane
+	static Type SelectNonZero(Type test, Type a, Type b)
+	{
+		return _mm256_blendv_ps(b, a, _mm256_cmp_ps(test, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+	}
+};
+
+#elif defined(NORMALGENERATOR_USE_SSE)
+
+struct SimdFloat
+{
+	typedef __m128 Type;
+	enum { WIDTH = 4 };
+
+	static void LoadVector3s(const float *f, Type &x, Type &y, Type &z)		{ LoadVector3x4(f, x, y, z); }
+	static void StoreVector3s(float *f, Type x, Type y, Type z)				{ StoreVector3x4(f, x, y, z); }
+
+	static Type Splat(float f)					{ return _mm_set1_ps(f); }
+	static Type Add(Type a, Type b)				{ return _mm_add_ps(a, b); }
+	static Type Mul(Type a, Type b)				{ return _mm_mul_ps(a, b); }
+	static Type Div(Type a, Type b)				{ return _mm_div_ps(a, b); }
+	static Type Sqrt(Type a)					{ return _mm_sqrt_ps(a); }
+
+	static Type SelectNonZero(Type test, Type a, Type b)
+	{
+		Type mask = _mm_cmpneq_ps(test, _mm_setzero_ps());
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+};
+
+#else
+
+struct SimdFloat
+{
+	typedef float Type;
+	enum { WIDTH = 1 };
+
+	static void LoadVector3s(const float *f, Type &x, Type &y, Type &z)		{ x = f[0]; y = f[1]; z = f[2]; }
+	static void StoreVector3s(float *f, Type x, Type y, Type z)				{ f[0] = x; f[1] = y; f[2] = z; }
+
+	static Type Splat(float f)					{ return f; }
+	static Type Add(Type a, Type b)				{ return a + b; }
+	static Type Mul(Type a, Type b)				{ return a * b; }
+	static Type Div(Type a, Type b)				{ return a / b; }
+	static Type Sqrt(Type a)					{ return sqrtf(a); }
+
+	static Type SelectNonZero(Type test, Type a, Type b)
+	{
+		return (test != 0.0f) ? a : b;
+	}
+};
+
+#endif
+
+typedef SimdFloat::Type SimdType;
+
+/*
+ * The triangle loops stay one triangle at a time: gathering corners into
+ * registers by index and scattering the results back costs more than the few
+ * multiplies it would save, so these match Mesh's loops, minus the clearing
+ * and normalising.
+ */
+static void AccumulateNormals(const Vector3 *vertices, const Vector2 *, const unsigned int *indices,
+							  unsigned int begin, unsigned int end, Vector3 *into)
+{
+	for (unsigned int t = begin; t < end; ++t)
+	{
+		unsigned int a = indices ? indices[t * 3]     : t * 3;
+		unsigned int b = indices ? indices[t * 3 + 1] : t * 3 + 1;
+		unsigned int c = indices ? indices[t * 3 + 2] : t * 3 + 2;
+
+		Vector3 normal = Vector3::Cross(vertices[b] - vertices[a], vertices[c] - vertices[a]);
+
+		into[a] += normal;
+		into[b] += normal;
+		into[c] += normal;
+	}
+}
+
+static void AccumulateTangents(const Vector3 *vertices, const Vector2 *textureCoords, const unsigned int *indices,
+							   unsigned int begin, unsigned int end, Vector3 *into)
+{
+	for (unsigned int t = begin; t < end; ++t)
+	{
+		unsigned int a = indices ? indices[t * 3]     : t * 3;
+		unsigned int b = indices ? indices[t * 3 + 1] : t * 3 + 1;
+		unsigned int c = indices ? indices[t * 3 + 2] : t * 3 + 2;
+
+		Vector2 coord1 = textureCoords[b] - textureCoords[a];
+		Vector2 coord2 = textureCoords[c] - textureCoords[a];
+
+		Vector3 vertex1 = vertices[b] - vertices[a];
+		Vector3 vertex2 = vertices[c] - vertices[a];
+
+		Vector3 axis = Vector3(vertex1 * coord2.y - vertex2 * coord1.y);
+
+		float factor = 1.0f / (coord1.x * coord2.y - coord2.x * coord1.y);
+
+		Vector3 tangent = axis * factor;
+
+		into[a] += tangent;
+		into[b] += tangent;
+		into[c] += tangent;
+	}
+}
+
+/*
+ * Vector3::Normalise on a range of vectors, leaving zero length ones alone.
+ * The vectors are contiguous, so whole registers of them go through in
+ * structure of arrays form, with the same sums in the same order as Normalise.
+ */
+static void NormaliseRange(Vector3 *vectors, unsigned int begin, unsigned int end)
+{
+	unsigned int i = begin;
+
+	for (; i + SimdFloat::WIDTH <= end; i += SimdFloat::WIDTH)
+	{
+		float *f = &vectors[i].x;
+
+		SimdType x, y, z;
+		SimdFloat::LoadVector3s(f, x, y, z);
+
+		SimdType length = SimdFloat::Sqrt(SimdFloat::Add(SimdFloat::Add(SimdFloat::Mul(x, x), SimdFloat::Mul(y, y)),
+														 SimdFloat::Mul(z, z)));
+		SimdType inverse = SimdFloat::Div(SimdFloat::Splat(1.0f), length);
+
+		SimdFloat::StoreVector3s(f, SimdFloat::SelectNonZero(length, SimdFloat::Mul(x, inverse), x),
+									SimdFloat::SelectNonZero(length, SimdFloat::Mul(y, inverse), y),
+									SimdFloat::SelectNonZero(length, SimdFloat::Mul(z, inverse), z));
+	}
+
+	for (; i < end; ++i)
+	{
+		vectors[i].Normalise();
+	}
+}
+
+typedef void (*TriangleFunction)(const Vector3 *, const Vector2 *, const unsigned int *, unsigned int, unsigned int, Vector3 *);
+
+static void GenerateVectors(TriangleFunction accumulate, const Vector3 *vertices, const Vector2 *textureCoords,
+							unsigned int numVertices, const unsigned int *indices, unsigned int numIndices,
+							Vector3 *into, bool threaded)
+{
+	JobPool &pool = JobPool::Get();
+
+	unsigned int numTriangles = (indices ? numIndices : numVertices) / 3;
+	unsigned int triangleGrain = threaded ? pool.GetGrain(numTriangles, NORMALGENERATOR_GRAIN) : numTriangles + 1;
+	unsigned int vertexGrain = threaded ? pool.GetGrain(numVertices, NORMALGENERATOR_GRAIN) : numVertices + 1;
+
+	/*
+	 * Unindexed triangles each have their own vertices, and a single chunk
+	 * has nobody to share with, so either way the triangles can add straight
+	 * onto the output.
+	 */
+	if (!indices || triangleGrain >= numTriangles)
+	{
+		std::fill(into, into + numVertices, Vector3(0.0f, 0.0f, 0.0f));
+
+		pool.ParallelFor(numTriangles, triangleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+		{
+			accumulate(vertices, textureCoords, indices, begin, end, into);
+		});
+
+		pool.ParallelFor(numVertices, vertexGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+		{
+			NormaliseRange(into, begin, end);
+		});
+		return;
+	}
+
+	/*
+	 * A buffer per chunk rather than per thread: chunks are handed out to
+	 * whichever thread asks first, but each chunk always covers the same
+	 * triangles. GetGrain gives about one chunk a thread, so this is no more
+	 * memory than a buffer a thread would be.
+	 */
+	unsigned int numChunks = (numTriangles + triangleGrain - 1) / triangleGrain;
+	float *scratch = new float[numChunks * numVertices * 3];
+
+	pool.ParallelFor(numTriangles, triangleGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		float *buffer = scratch + (begin / triangleGrain) * numVertices * 3;
+
+		memset(buffer, 0, numVertices * 3 * sizeof(float));
+		accumulate(vertices, textureCoords, indices, begin, end, (Vector3 *)buffer);
+	});
+
+	// Add the buffers up in chunk order, so the result doesn't depend on which thread ran what
+	pool.ParallelFor(numVertices, vertexGrain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		float *out = (float *)(into + begin);
+		unsigned int count = (end - begin) * 3;
+
+		memset(out, 0, count * sizeof(float));
+
+		for (unsigned int c = 0; c < numChunks; ++c)
+		{
+			const float *buffer = scratch + (c * numVertices + begin) * 3;
+
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				out[i] += buffer[i];
+			}
+		}
+
+		NormaliseRange(into, begin, end);
+	});
+
+	delete[] scratch;
+}
+
+void NormalGenerator::GenerateNormals(const Vector3 *vertices, unsigned int numVertices, const unsigned int *indices,
+									  unsigned int numIndices, Vector3 *normals, bool threaded)
+{
+	GenerateVectors(AccumulateNormals, vertices, NULL, numVertices, indices, numIndices, normals, threaded);
+}
+
+void NormalGenerator::GenerateTangents(const Vector3 *vertices, const Vector2 *textureCoords, unsigned int numVertices,
+									   const unsigned int *indices, unsigned int numIndices, Vector3 *tangents, bool threaded)
+{
+	GenerateVectors(AccumulateTangents, vertices, textureCoords, numVertices, indices, numIndices, tangents, threaded);
+}
+
+const char * NormalGenerator::GetInstructionSet()
+{
+#if defined(NORMALGENERATOR_USE_AVX)
+	return "AVX";
+#elif defined(NORMALGENERATOR_USE_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+// Largest component difference between two sets of vectors. Degenerate UVs give NaNs, which only match other NaNs
+static float MaxDifference(const std::vector<Vector3> &a, const std::vector<Vector3> &b, unsigned int &identical)
+{
+	float largest = 0.0f;
+	identical = 0;
+
+	for (unsigned int i = 0; i < a.size(); ++i)
+	{
+		const float *fa = &a[i].x;
+		const float *fb = &b[i].x;
+		bool same = true;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			float difference;
+
+			if (fa[k] != fa[k] || fb[k] != fb[k])
+			{
+				difference = (fa[k] != fa[k] && fb[k] != fb[k]) ? 0.0f : 1.0f;
+			}
+			else
+			{
+				difference = fabs(fa[k] - fb[k]);
+			}
+
+			if (difference > largest)
+			{
+				largest = difference;
+			}
+
+			same = same && (fa[k] == fb[k] || (fa[k] != fa[k] && fb[k] != fb[k]));
+		}
+
+		if (same)
+		{
+			++identical;
+		}
+	}
+
+	return largest;
+}
+
+bool NormalGenerator::Benchmark(const std::string &name, const Vector3 *vertices, const Vector2 *textureCoords, unsigned int numVertices,
+								const unsigned int *indices, unsigned int numIndices, int iterations, float tolerance)
+{
+	GameTimer timer;
+	bool passed = true;
+
+	std::vector<Vector3> reference(numVertices);
+	std::vector<Vector3> single(numVertices);
+	std::vector<Vector3> threaded(numVertices);
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		if (pass == 1 && !textureCoords)
+		{
+			break;
+		}
+
+		float times[3];
+
+		for (int path = 0; path < 3; ++path)
+		{
+			Vector3 *out = (path == 0) ? &reference[0] : (path == 1) ? &single[0] : &threaded[0];
+			float start = timer.GetMS();
+
+			for (int i = 0; i < iterations; ++i)
+			{
+				if (pass == 0)
+				{
+					if (path == 0)
+					{
+						Mesh::GenerateNormalsReference(vertices, numVertices, indices, numIndices, out);
+					}
+					else
+					{
+						GenerateNormals(vertices, numVertices, indices, numIndices, out, path == 2);
+					}
+				}
+				else
+				{
+					if (path == 0)
+					{
+						Mesh::GenerateTangentsReference(vertices, textureCoords, numVertices, indices, numIndices, out);
+					}
+					else
+					{
+						GenerateTangents(vertices, textureCoords, numVertices, indices, numIndices, out, path == 2);
+					}
+				}
+			}
+
+			times[path] = (timer.GetMS() - start) / iterations;
+		}
+
+		unsigned int singleIdentical;
+		unsigned int threadedIdentical;
+		float singleError = MaxDifference(reference, single, singleIdentical);
+		float threadedError = MaxDifference(reference, threaded, threadedIdentical);
+
+		bool ok = singleError <= tolerance && threadedError <= tolerance;
+		passed = passed && ok;
+
+		std::cout << "NormalGenerator::Benchmark " << name << " " << (pass == 0 ? "normals" : "tangents") << ": "
+				  << numVertices << " vertices, scalar " << times[0] << "ms, " << GetInstructionSet() << " "
+				  << times[1] << "ms (" << times[0] / times[1] << "x), " << JobPool::Get().GetNumThreads()
+				  << " threads " << times[2] << "ms (" << times[0] / times[2] << "x), max error "
+				  << singleError << " / " << threadedError << ", bit identical " << singleIdentical << " / "
+				  << threadedIdentical << (ok ? "" : " OUT OF TOLERANCE") << std::endl;
+	}
+
+	return passed;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ * Multithreaded and vectorised versions of Mesh's normal and tangent
+ * generation, taking the same arrays and giving the same results.
+ *
+ * Large meshes have their triangles split across the JobPool. Indexed
+ * triangles share vertices, so each thread sums into its own buffer and the
+ * buffers are added up afterwards, instead of threads fighting over the same
+ * vertices. The final normalising pass runs on 4 (SSE) or 8 (AVX) vectors at
+ * once, in structure of arrays form, with a plain scalar fallback for builds
+ * without either.
+ *
+ * With one chunk of triangles, everything is summed in the same order as
+ * Mesh's scalar loops, so the results match them bit for bit. The threaded
+ * sums are ordered differently, which can move the last bit or so.
+ */
+#include <string>
+
+#include "Vector2.h"
+#include "Vector3.h"
+
+#if defined(__AVX__)
+#define NORMALGENERATOR_USE_AVX
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define NORMALGENERATOR_USE_SSE
+#endif
+
+// Fewest triangles (or vertices) worth handing to another thread
+#define NORMALGENERATOR_GRAIN		4096
+
+// Largest difference from the scalar path a normalised component may have
+#define NORMALGENERATOR_TOLERANCE	1e-5f
+
+class NormalGenerator
+{
+public:
+	static void GenerateNormals(const Vector3 *vertices, unsigned int numVertices, const unsigned int *indices,
+								unsigned int numIndices, Vector3 *normals, bool threaded = true);
+
+	static void GenerateTangents(const Vector3 *vertices, const Vector2 *textureCoords, unsigned int numVertices,
+								 const unsigned int *indices, unsigned int numIndices, Vector3 *tangents, bool threaded = true);
+
+	// "AVX", "SSE" or "scalar"
+	static const char * GetInstructionSet();
+
+	/*
+	 * Times Mesh's scalar loops against the SIMD path on one thread and on
+	 * the JobPool, and checks that every component stays within tolerance of
+	 * the scalar results. textureCoords can be NULL to skip the tangents.
+	 * Returns false if anything was out of tolerance.
+	 */
+	static bool Benchmark(const std::string &name, const Vector3 *vertices, const Vector2 *textureCoords, unsigned int numVertices,
+						  const unsigned int *indices, unsigned int numIndices, int iterations = 10,
+						  float tolerance = NORMALGENERATOR_TOLERANCE);
+};
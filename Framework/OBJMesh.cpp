@@ -1,4 +1,10 @@
 #include "OBJMesh.h"
+#include "GameTimer.h"
+#include "NormalGenerator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
 
 /*
 OBJ files look generally something like this:
@@ -20,27 +26,428 @@ f vert index / tex index / norm index  vert index / tex index / norm index  vert
 OBJ files can also be split up into a number of submeshes, making loading them
 in even more annoying. 
 */
-bool OBJMesh::LoadOBJMesh(std::string filename)	{
-	std::ifstream f(filename.c_str(), std::ios::in);
+bool OBJMesh::LoadOBJMesh(std::string filename, const VertexFormat &format)	{
+	SetVertexFormat(format);
 
-	if (!f) { //Oh dear, it can't find the file
+#ifdef OBJ_USE_MESH_CACHE
+	/*
+	If there's a valid cache next to the OBJ file, the submeshes come straight
+	out of the mapped cache, and the text file is never parsed.
+	*/
+	MeshCache cache;
+	if(cache.Open(filename, GetCacheBuildFlags())) {
+		std::vector<MeshCacheSubMesh> cached;
+		for(unsigned int i = 0; i < cache.GetNumSubMeshes(); ++i) {
+			cached.push_back(cache.GetSubMesh(i));
+		}
+
+		FitSubMeshBounds(cached);
+		for(unsigned int i = 0; i < cached.size(); ++i) {
+			AddSubMesh(cached[i]);
+		}
+		return true;
+	}
+#endif
+
+#ifdef OBJ_USE_STREAM_PARSER
+	bool streamParser = true;
+#else
+	bool streamParser = false;
+#endif
+
+	std::vector<OBJMeshData> meshData;
+	if(!ParseOBJMesh(filename, meshData, streamParser)) {
 		return false;
 	}
 
-	/*
-	Stores the loaded in vertex attributes
-	*/
-	std::vector<Vector2>inputTexCoords;
-	std::vector<Vector3>inputVertices;
-	std::vector<Vector3>inputNormals;
+	std::vector<MeshCacheSubMesh> subMeshes;
+	for(unsigned int i = 0; i < meshData.size(); ++i) {
+#ifdef OBJ_USE_MESH_OPTIMISER
+		OptimiseMeshData(meshData[i]);
+#endif
+		subMeshes.push_back(meshData[i].GetView());
+	}
 
-	/*
-	SubMeshes temporarily get kept in here
-	*/
-	std::vector<OBJSubMesh*> inputSubMeshes;
+	FitSubMeshBounds(subMeshes);
+	for(unsigned int i = 0; i < subMeshes.size(); ++i) {
+		AddSubMesh(subMeshes[i]);
+	}
+
+#ifdef OBJ_USE_MESH_CACHE
+	if(!MeshCache::Write(filename, subMeshes, GetCacheBuildFlags())) {
+		std::cout << "OBJMesh::LoadOBJMesh Couldn't write mesh cache for " << filename << std::endl;
+	}
+#endif
+	return true;
+}
+
+unsigned int OBJMesh::GetCacheBuildFlags()	{
+	unsigned int flags = 0;
+#ifdef OBJ_USE_NORMALS
+	flags |= MESHCACHE_BUILD_NORMALS;
+#endif
+#ifdef OBJ_USE_TANGENTS_BUMPMAPS
+	flags |= MESHCACHE_BUILD_TANGENTS;
+#endif
+#ifdef OBJ_USE_MESH_OPTIMISER
+	flags |= MESHCACHE_BUILD_OPTIMISED;
+#endif
+	return flags;
+}
+
+bool OBJMesh::ParseOBJMesh(std::string filename, std::vector<OBJMeshData> &into, bool streamParser)	{
+	OBJInputData input;
+	bool loaded = false;
+
+	if(streamParser) {
+		loaded = ReadOBJStream(filename, input);
+	}
+	else{
+		MappedFile file;
+		if(file.Open(filename)) {
+			loaded = ReadOBJBuffer(file.GetData(), file.GetSize(), input);
+		}
+	}
+
+	if(!loaded) {
+		for(unsigned int i = 0; i < input.subMeshes.size(); ++i) {
+			delete input.subMeshes[i];
+		}
+		return false;
+	}
+
+	BuildMeshData(input, into);
+	return true;
+}
+
+/*
+Helpers for the tokenizer. Each one takes the current position and the end of
+the buffer, and returns the position just past whatever it consumed.
+*/
+static inline bool IsOBJSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool IsOBJDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline bool IsOBJKeywordEnd(char c) {
+	return IsOBJSpace(c) || c == '\n';
+}
+
+static inline const char* SkipOBJSpaces(const char *p, const char *end) {
+	while(p < end && IsOBJSpace(*p)) {
+		++p;
+	}
+	return p;
+}
+
+static inline size_t OBJKeywordLength(const char *p, const char *end) {
+	const char *keyword = p;
+	while(p < end && !IsOBJKeywordEnd(*p)) {
+		++p;
+	}
+	return p - keyword;
+}
+
+//g, o or object, the same lines the stream parser starts a new submesh on
+static inline bool IsOBJSubMeshKeyword(const char *keyword, size_t length) {
+	return (length == 1 && (keyword[0] == 'g' || keyword[0] == 'o')) ||
+		   (length == sizeof(OBJOBJECT) - 1 && memcmp(keyword, OBJOBJECT, length) == 0);
+}
+
+static inline const char* SkipOBJLine(const char *p, const char *end) {
+	const char *newline = (const char*)memchr(p, '\n', end - p);
+	return newline ? newline + 1 : end;
+}
+
+/*
+Powers of ten that are exact as floats. A float mantissa of up to 24 bits,
+multiplied or divided by one of these, rounds exactly as strtof would, so
+the common case never has to leave this function.
+*/
+static const float objPowersOfTen[] = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+static const char* ParseOBJFloat(const char *p, const char *end, float &out) {
+	const char *start		= p;
+	bool negative			= false;
+	unsigned int mantissa	= 0;
+	int exponent			= 0;
+	bool fastPath			= true;
+	bool anyDigits			= false;
+
+	if(p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		++p;
+	}
+
+	for(; p < end && IsOBJDigit(*p); ++p) {
+		if(mantissa < (1 << 24) / 10) {
+			mantissa = mantissa * 10 + (*p - '0');
+		}
+		else{
+			fastPath = false;
+		}
+		anyDigits = true;
+	}
+
+	if(p < end && *p == '.') {
+		for(++p; p < end && IsOBJDigit(*p); ++p) {
+			if(mantissa < (1 << 24) / 10) {
+				mantissa = mantissa * 10 + (*p - '0');
+				--exponent;
+			}
+			else if(*p != '0') {
+				fastPath = false;
+			}
+			anyDigits = true;
+		}
+	}
+
+	if(!anyDigits) {
+		out = 0.0f;
+		return start;
+	}
+
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		const char *e	= p + 1;
+		bool negativeE	= false;
+		int value		= 0;
+
+		if(e < end && (*e == '-' || *e == '+')) {
+			negativeE = (*e == '-');
+			++e;
+		}
+		if(e < end && IsOBJDigit(*e)) {
+			for(; e < end && IsOBJDigit(*e); ++e) {
+				if(value < 1000) {
+					value = value * 10 + (*e - '0');
+				}
+			}
+			exponent += negativeE ? -value : value;
+			p = e;
+		}
+	}
+
+	if(fastPath && exponent >= -10 && exponent <= 10) {
+		float value = (float)mantissa;
+		value = (exponent < 0) ? value / objPowersOfTen[-exponent] : value * objPowersOfTen[exponent];
+		out = negative ? -value : value;
+		return p;
+	}
+
+	//Too many digits for the fast path, let the CRT round it
+	char number[64];
+	size_t length = p - start;
+	if(length > sizeof(number) - 1) {
+		length = sizeof(number) - 1;
+	}
+	memcpy(number, start, length);
+	number[length] = '\0';
+	out = strtof(number, NULL);
+	return p;
+}
+
+/*
+Reads an index, which might be negative. Returns 0 (which isn't a valid OBJ
+index) in index if there's no number at p.
+*/
+static const char* ParseOBJIndex(const char *p, const char *end, int &index) {
+	bool negative = false;
+	index = 0;
+
+	if(p < end && *p == '-') {
+		negative = true;
+		++p;
+	}
+	for(; p < end && IsOBJDigit(*p); ++p) {
+		index = index * 10 + (*p - '0');
+	}
+	if(negative) {
+		index = -index;
+	}
+	return p;
+}
+
+/*
+Negative indices count back from the most recently read attribute, so -1 is
+the last vertex read before this face. Returns false if the index is outside
+of the attributes read so far.
+*/
+static inline bool ResolveOBJIndex(int &index, size_t count) {
+	if(index < 0) {
+		index = (int)count + index + 1;
+	}
+	return index > 0 && index <= (int)count;
+}
+
+//Room for every face to be a triangle, n-gons will still grow the vectors
+static void ReserveOBJSubMesh(OBJSubMesh *m, size_t faces) {
+	m->vertIndices.reserve(faces * 3);
+	m->texIndices.reserve(faces * 3);
+	m->normIndices.reserve(faces * 3);
+}
+
+struct OBJCorner {
+	int v;
+	int t;
+	int n;
+};
+
+/*
+Walks the whole file in place. There's one quick pass that counts the lines
+of each type, so every vector can be reserved to its final size, then one
+pass that parses each line straight into them. Nothing is copied into
+strings or stringstreams along the way.
+*/
+bool OBJMesh::ReadOBJBuffer(const char *data, size_t size, OBJInputData &input)	{
+	const char *end = data + size;
+
+	size_t numVertices	= 0;
+	size_t numTexCoords	= 0;
+	size_t numNormals	= 0;
+	std::vector<size_t> subMeshFaces(1, 0);
+
+	for(const char *p = data; p < end; p = SkipOBJLine(p, end)) {
+		p = SkipOBJSpaces(p, end);
+		if(end - p < 2) {
+			continue;
+		}
+		if(p[0] == 'v' && (IsOBJKeywordEnd(p[1]) || p[1] == 't' || p[1] == 'n')) {
+			if(p[1] == 't')			++numTexCoords;
+			else if(p[1] == 'n')	++numNormals;
+			else					++numVertices;
+		}
+		else if(p[0] == 'f' && IsOBJKeywordEnd(p[1])) {
+			++subMeshFaces.back();
+		}
+		else if(IsOBJSubMeshKeyword(p, OBJKeywordLength(p, end))) {
+			subMeshFaces.push_back(0);
+		}
+	}
+
+	input.vertices.reserve(numVertices);
+	input.texCoords.reserve(numTexCoords);
+	input.normals.reserve(numNormals);
 
 	OBJSubMesh* currentMesh = new OBJSubMesh();
-	inputSubMeshes.push_back(currentMesh);	//It's safe to assume our OBJ will have a mesh in it ;)
+	input.subMeshes.push_back(currentMesh);
+	ReserveOBJSubMesh(currentMesh, subMeshFaces[0]);
+
+	std::vector<OBJCorner> corners;
+	corners.reserve(16);
+
+	unsigned int lineNumber = 0;
+	for(const char *p = data; p < end; p = SkipOBJLine(p, end)) {
+		++lineNumber;
+		p = SkipOBJSpaces(p, end);
+
+		const char *keyword = p;
+		size_t length = OBJKeywordLength(p, end);
+		p += length;
+
+		if(length == 0 || (length > 2 && !IsOBJSubMeshKeyword(keyword, length))) {
+			continue;	//Blank lines, and keywords we don't use
+		}
+
+		if(keyword[0] == 'v') {
+			if(length == 1) {		//This line is a vertex
+				Vector3 vertex;
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, vertex.x);
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, vertex.y);
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, vertex.z);
+				input.vertices.push_back(vertex);
+			}
+			else if(keyword[1] == 't') {	//This line is a texture coordinate!
+				Vector2 texCoord;
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, texCoord.x);
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, texCoord.y);
+				input.texCoords.push_back(texCoord);
+			}
+			else if(keyword[1] == 'n') {	//This line is a Normal!
+				Vector3 normal;
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, normal.x);
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, normal.y);
+				p = ParseOBJFloat(SkipOBJSpaces(p, end), end, normal.z);
+				input.normals.push_back(normal);
+			}
+		}
+		else if(IsOBJSubMeshKeyword(keyword, length)) {	//This line is a submesh!
+			currentMesh = new OBJSubMesh();
+			input.subMeshes.push_back(currentMesh);
+
+			size_t subMesh = input.subMeshes.size() - 1;
+			if(subMesh < subMeshFaces.size()) {
+				ReserveOBJSubMesh(currentMesh, subMeshFaces[subMesh]);
+			}
+		}
+		else if(length == 1 && keyword[0] == 'f') {	//This is an object face!
+			/*
+			Each corner is one of v, v/t, v//n or v/t/n. Missing indices are
+			left as 0, and faces can have any number of corners.
+			*/
+			corners.clear();
+			while(true) {
+				p = SkipOBJSpaces(p, end);
+				if(p == end || *p == '\n' || *p == '#') {
+					break;
+				}
+
+				OBJCorner c = {0, 0, 0};
+				p = ParseOBJIndex(p, end, c.v);
+				if(p < end && *p == '/') {
+					p = ParseOBJIndex(p + 1, end, c.t);
+					if(p < end && *p == '/') {
+						p = ParseOBJIndex(p + 1, end, c.n);
+					}
+				}
+
+				if(!ResolveOBJIndex(c.v, input.vertices.size()) ||
+				  (c.t && !ResolveOBJIndex(c.t, input.texCoords.size())) ||
+				  (c.n && !ResolveOBJIndex(c.n, input.normals.size()))) {
+					std::cout << "OBJMesh::ReadOBJBuffer Bad face index on line " << lineNumber << std::endl;
+					return false;
+				}
+				corners.push_back(c);
+			}
+
+			if(corners.size() < 3) {
+				std::cout << "OBJMesh::ReadOBJBuffer Face with less than 3 corners on line " << lineNumber << std::endl;
+				continue;
+			}
+
+			//Quads and n-gons are split into a fan of triangles around the first corner
+			for(size_t i = 1; i + 1 < corners.size(); ++i) {
+				const OBJCorner *triangle[3] = { &corners[0], &corners[i], &corners[i + 1] };
+
+				//Every corner pushes all three indices, even the 0s, so they stay in step
+				for(int j = 0; j < 3; ++j) {
+					currentMesh->vertIndices.push_back(triangle[j]->v);
+					currentMesh->texIndices.push_back(triangle[j]->t);
+					currentMesh->normIndices.push_back(triangle[j]->n);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/*
+The original parser, which streams the file a token at a time. It's kept for
+OBJ_USE_STREAM_PARSER, and as the reference the tokenizer is checked against.
+*/
+bool OBJMesh::ReadOBJStream(std::string filename, OBJInputData &input)	{
+	std::ifstream f(filename.c_str(), std::ios::in);
+
+	if (!f) { //Oh dear, it can't find the file
+		return false;
+	}
+
+	OBJSubMesh* currentMesh = new OBJSubMesh();
+	input.subMeshes.push_back(currentMesh);	//It's safe to assume our OBJ will have a mesh in it ;)
 
 	while (!f.eof()) {
 		std::string currentLine;
@@ -49,19 +456,19 @@ bool OBJMesh::LoadOBJMesh(std::string filename)	{
 		if (currentLine == OBJCOMMENT) {		//This line is a comment, ignore it
 			continue;
 		}
-		else if (currentLine == OBJMESH /*|| currentLine == OBJUSEMTL*/ || currentLine == OBJOBJECT) {	//This line is a submesh!
+		else if (currentLine == OBJMESH /*|| currentLine == OBJUSEMTL*/ || currentLine == OBJOBJECT || currentLine == OBJNAMEDOBJECT) {	//This line is a submesh!
 			currentMesh = new OBJSubMesh();
-			inputSubMeshes.push_back(currentMesh);
+			input.subMeshes.push_back(currentMesh);
 		}
 		else if (currentLine == OBJVERT) {	//This line is a vertex
 			Vector3 vertex;
 			f >> vertex.x; f >> vertex.y; f >> vertex.z;
-			inputVertices.push_back(vertex);
+			input.vertices.push_back(vertex);
 		}
 		else if (currentLine == OBJNORM) {	//This line is a Normal!
 			Vector3 normal;
 			f >> normal.x; f >> normal.y; f >> normal.z;
-			inputNormals.push_back(normal);
+			input.normals.push_back(normal);
 		}
 		else if (currentLine == OBJTEX) {	//This line is a texture coordinate!
 			Vector2 texCoord;
@@ -69,12 +476,12 @@ bool OBJMesh::LoadOBJMesh(std::string filename)	{
 			/*
 			TODO! Some OBJ files might have 3D tex coords...
 			*/
-			inputTexCoords.push_back(texCoord);
+			input.texCoords.push_back(texCoord);
 		}
 		else if (currentLine == OBJFACE) {	//This is an object face!
 			if (!currentMesh) {
-				inputSubMeshes.push_back(new OBJSubMesh());
-				currentMesh = inputSubMeshes[inputSubMeshes.size() - 1];
+				input.subMeshes.push_back(new OBJSubMesh());
+				currentMesh = input.subMeshes[input.subMeshes.size() - 1];
 			}
 
 			std::string			faceData;		//Keep the entire line in this!
@@ -259,6 +666,10 @@ bool OBJMesh::LoadOBJMesh(std::string filename)	{
 				//Uh oh! Face isn't a triangle nor a quad. Have fun adding stuff to this ;)
 				std::cout << "OBJMesh::LoadOBJMesh Face isn't a triangle nor a quad." << currentLine << std::endl;
 			}
+
+			//Corners without a tex coord or normal get a 0, so all three index lists stay in step
+			currentMesh->texIndices.resize(currentMesh->vertIndices.size(), 0);
+			currentMesh->normIndices.resize(currentMesh->vertIndices.size(), 0);
 		}
 		else {
 			//std::cout << "OBJMesh::LoadOBJMesh Unknown file data:" << currentLine << std::endl;
@@ -266,54 +677,414 @@ bool OBJMesh::LoadOBJMesh(std::string filename)	{
 	}
 
 	f.close();
+	return true;
+}
+
+/*
+Key for welding: a vertex of the final mesh is one unique combination of
+position, texture coordinate and normal index. Missing indices are 0.
+*/
+struct OBJVertexKey {
+	int v;
+	int t;
+	int n;
+
+	bool operator==(const OBJVertexKey &o) const {
+		return v == o.v && t == o.t && n == o.n;
+	}
+};
+
+struct OBJVertexKeyHash {
+	size_t operator()(const OBJVertexKey &k) const {
+		size_t hash = (size_t)k.v * 73856093u;
+		hash ^= (size_t)k.t * 19349663u;
+		hash ^= (size_t)k.n * 83492791u;
+		return hash;
+	}
+};
+
+/*
+Turns the indexed attributes read in from the file into the final per submesh
+arrays, and frees the temporary submeshes.
+
+OBJ files index each attribute separately, but OpenGL only has the one index
+per vertex. Every face corner is welded into a table of unique (v, vt, vn)
+triplets, and the submesh gets an index buffer into that table, so shared
+corners are only stored (and transformed) once.
+*/
+void OBJMesh::BuildMeshData(OBJInputData &input, std::vector<OBJMeshData> &into)	{
+	typedef std::unordered_map<OBJVertexKey, unsigned int, OBJVertexKeyHash> VertexTable;
 
-	//We now have all our mesh data loaded in...Now to convert it into OpenGL vertex buffers!
-	for(unsigned int i = 0; i < inputSubMeshes.size(); ++i) {
-		OBJSubMesh*sm = inputSubMeshes[i];
+	for(unsigned int i = 0; i < input.subMeshes.size(); ++i) {
+		OBJSubMesh*sm = input.subMeshes[i];
 
-		/*
-		We're going to be lazy and turn the indices into an absolute list
-		of vertex attributes (it makes handling the submesh list easier)
-		*/
 		if(!sm->vertIndices.empty()) {
-			OBJMesh*m		= new OBJMesh();
+			into.push_back(OBJMeshData());
+			OBJMeshData &m = into.back();
 
-			m->numVertices	= sm->vertIndices.size();
+			size_t numCorners	= sm->vertIndices.size();
+			bool hasTexCoords	= false;
+			bool hasNormals		= false;
 
-			m->vertices		= new Vector3[m->numVertices];
-			for(unsigned int j = 0; j < sm->vertIndices.size(); ++j) {
-				m->vertices[j] = inputVertices[sm->vertIndices[j]-1];
+			//The index lists are always as long as vertIndices, so look for any real index
+			for(size_t j = 0; j < numCorners; ++j) {
+				hasTexCoords	|= sm->texIndices[j] != 0;
+				hasNormals		|= sm->normIndices[j] != 0;
 			}
 
-			if(!sm->texIndices.empty())	{
-				m->textureCoords	= new Vector2[m->numVertices];
-				for(unsigned int j = 0; j < sm->texIndices.size(); ++j) {
-					m->textureCoords[j] = inputTexCoords[sm->texIndices[j]-1];
-				}
-			}
+			VertexTable table;
+			table.reserve(numCorners);
 
-#ifdef OBJ_USE_NORMALS
-			if(sm->normIndices.empty()) {
-				m->GenerateNormals();
+			m.indices.reserve(numCorners);
+			m.vertices.reserve(numCorners);
+			if(hasTexCoords) {
+				m.textureCoords.reserve(numCorners);
 			}
-			else{
-				m->normals		= new Vector3[m->numVertices];
+			if(hasNormals) {
+				m.normals.reserve(numCorners);
+			}
+
+			for(size_t j = 0; j < numCorners; ++j) {
+				OBJVertexKey key;
+				key.v = sm->vertIndices[j];
+				key.t = sm->texIndices[j];
+				key.n = sm->normIndices[j];
 
-				for(unsigned int j = 0; j < sm->normIndices.size(); ++j) {
-					m->normals[j] = inputNormals[sm->normIndices[j]-1];
+				std::pair<VertexTable::iterator, bool> entry = table.insert(std::make_pair(key, (unsigned int)m.vertices.size()));
+
+				if(entry.second) {	//First time we've seen this corner, so it's a new vertex
+					m.vertices.push_back(input.vertices[key.v-1]);
+					if(hasTexCoords) {
+						m.textureCoords.push_back(key.t ? input.texCoords[key.t-1] : Vector2());
+					}
+					if(hasNormals) {
+						m.normals.push_back(key.n ? input.normals[key.n-1] : Vector3());
+					}
 				}
+				m.indices.push_back(entry.first->second);
 			}
+
+			GLuint numVertices	= m.vertices.size();
+			GLuint numIndices	= m.indices.size();
+
+#ifdef OBJ_USE_NORMALS
+			//Generated normals are accumulated over every face sharing a vertex
+			if(!hasNormals) {
+				m.normals.resize(numVertices);
+				Mesh::GenerateNormals(&m.vertices[0], numVertices, &m.indices[0], numIndices, &m.normals[0]);
+			}
+#else
+			m.normals.clear();
 #endif
 #ifdef OBJ_USE_TANGENTS_BUMPMAPS
-			m->GenerateTangents();
+			if(hasTexCoords) {
+				m.tangents.resize(numVertices);
+				Mesh::GenerateTangents(&m.vertices[0], &m.textureCoords[0], numVertices, &m.indices[0], numIndices, &m.tangents[0]);
+			}
 #endif
+		}
+		delete input.subMeshes[i];
+	}
+	input.subMeshes.clear();
+}
+
+MeshCacheSubMesh OBJMeshData::GetView() const	{
+	MeshCacheSubMesh view;
+
+	view.numVertices	= vertices.size();
+	view.numIndices		= indices.size();
+	view.vertices		= vertices.empty()		? NULL : &vertices[0];
+	view.textureCoords	= textureCoords.empty()	? NULL : &textureCoords[0];
+	view.normals		= normals.empty()		? NULL : &normals[0];
+	view.tangents		= tangents.empty()		? NULL : &tangents[0];
+	view.indices		= indices.empty()		? NULL : &indices[0];
+
+	return view;
+}
+
+void OBJMesh::AddSubMesh(const MeshCacheSubMesh &data)	{
+	OBJMesh*m		= new OBJMesh();
+
+	m->numVertices	= data.numVertices;
+
+	m->vertices		= new Vector3[m->numVertices];
+	memcpy((void*)m->vertices, data.vertices, m->numVertices * sizeof(Vector3));
+
+	if(data.textureCoords) {
+		m->textureCoords = new Vector2[m->numVertices];
+		memcpy((void*)m->textureCoords, data.textureCoords, m->numVertices * sizeof(Vector2));
+	}
+
+	if(data.normals) {
+		m->normals = new Vector3[m->numVertices];
+		memcpy((void*)m->normals, data.normals, m->numVertices * sizeof(Vector3));
+	}
+
+	if(data.tangents) {
+		m->tangents = new Vector3[m->numVertices];
+		memcpy((void*)m->tangents, data.tangents, m->numVertices * sizeof(Vector3));
+	}
+
+	if(data.indices) {
+		m->numIndices	= data.numIndices;
+		m->indices		= new unsigned int[m->numIndices];
+		memcpy(m->indices, data.indices, m->numIndices * sizeof(unsigned int));
+	}
+
+	m->SetVertexFormat(format);
+	m->BufferData();
+	AddChild(m);
+}
+
+void OBJMesh::FitSubMeshBounds(const std::vector<MeshCacheSubMesh> &subMeshes)	{
+	if(!format.QuantisesPositions()) {
+		return;
+	}
+
+	std::vector<Vector3> points;
+	for(unsigned int i = 0; i < subMeshes.size(); ++i) {
+		points.insert(points.end(), subMeshes[i].vertices, subMeshes[i].vertices + subMeshes[i].numVertices);
+	}
+
+	format.FitBounds(points.empty() ? NULL : &points[0], points.size());
+}
 
-			m->BufferData();
-			AddChild(m);
+//Number of elements that aren't bit for bit identical in the two arrays
+template <class T>
+static unsigned int CountOBJMismatches(const std::vector<T> &a, const std::vector<T> &b) {
+	if(a.size() != b.size()) {
+		return (unsigned int)(a.size() > b.size() ? a.size() : b.size());
+	}
+	unsigned int mismatches = 0;
+	for(size_t i = 0; i < a.size(); ++i) {
+		if(memcmp(&a[i], &b[i], sizeof(T)) != 0) {
+			++mismatches;
 		}
-		delete inputSubMeshes[i];
 	}
-	return true;
+	return mismatches;
+}
+
+/*
+Golden comparison of the two parsers: both must build the same submeshes, with
+every attribute bit for bit identical. The stream parser only reads triangles
+and quads with positive indices, so for anything else it reads reference, the
+same faces rewritten in that form, while the tokenizer reads filename.
+*/
+bool OBJMesh::CompareParsers(std::string filename, std::string reference)	{
+	std::vector<OBJMeshData> tokenized;
+	std::vector<OBJMeshData> streamed;
+
+	if(reference.empty()) {
+		reference = filename;
+	}
+
+	if(!ParseOBJMesh(filename, tokenized) || !ParseOBJMesh(reference, streamed, true)) {
+		std::cout << "OBJMesh::CompareParsers Can't load " << filename << " or " << reference << std::endl;
+		return false;
+	}
+
+	if(tokenized.size() != streamed.size()) {
+		std::cout << "OBJMesh::CompareParsers " << filename << ": " << tokenized.size() 
+				  << " submeshes from the tokenizer, " << streamed.size() << " from the stream parser" << std::endl;
+		return false;
+	}
+
+	unsigned int mismatches = 0;
+	for(unsigned int i = 0; i < tokenized.size(); ++i) {
+		mismatches += CountOBJMismatches(tokenized[i].vertices,		 streamed[i].vertices);
+		mismatches += CountOBJMismatches(tokenized[i].textureCoords, streamed[i].textureCoords);
+		mismatches += CountOBJMismatches(tokenized[i].normals,		 streamed[i].normals);
+		mismatches += CountOBJMismatches(tokenized[i].tangents,		 streamed[i].tangents);
+		mismatches += CountOBJMismatches(tokenized[i].indices,		 streamed[i].indices);
+	}
+
+	std::cout << "OBJMesh::CompareParsers " << filename << ": " << tokenized.size() << " submeshes, " 
+			  << mismatches << " mismatched attributes" << std::endl;
+	return mismatches == 0;
+}
+
+bool OBJMesh::CompareParsers()	{
+	return CompareParsers("../Meshes/submeshes.obj", "../Meshes/submeshes_stream.obj");
+}
+
+/*
+Times the ways of getting an OBJ's submeshes into memory: a full text parse
+with each parser (the cold path, on the first launch) against mapping the mesh
+cache (the warm path). None of them touch OpenGL, so this can run without a
+window.
+*/
+void OBJMesh::BenchmarkLoad(std::string filename, int iterations)	{
+	GameTimer timer;
+	std::vector<OBJMeshData> meshData;
+	float times[2];
+
+	for(int parser = 0; parser < 2; ++parser) {
+		float start = timer.GetMS();
+		for(int i = 0; i < iterations; ++i) {
+			meshData.clear();
+			if(!ParseOBJMesh(filename, meshData, parser == 1)) {
+				std::cout << "OBJMesh::BenchmarkLoad Can't load " << filename << std::endl;
+				return;
+			}
+		}
+		times[parser] = (timer.GetMS() - start) / iterations;
+	}
+
+	//Write the cache just as LoadOBJMesh would have
+	std::vector<MeshCacheSubMesh> subMeshes;
+	for(unsigned int i = 0; i < meshData.size(); ++i) {
+#ifdef OBJ_USE_MESH_OPTIMISER
+		OptimiseMeshData(meshData[i]);
+#endif
+		subMeshes.push_back(meshData[i].GetView());
+	}
+	MeshCache::Write(filename, subMeshes, GetCacheBuildFlags());
+
+	float start = timer.GetMS();
+	for(int i = 0; i < iterations; ++i) {
+		MeshCache cache;
+		if(!cache.Open(filename, GetCacheBuildFlags())) {
+			std::cout << "OBJMesh::BenchmarkLoad Can't open the mesh cache of " << filename << std::endl;
+			return;
+		}
+
+		//Same copies AddSubMesh makes, minus the buffering
+		for(unsigned int j = 0; j < cache.GetNumSubMeshes(); ++j) {
+			const MeshCacheSubMesh &sm = cache.GetSubMesh(j);
+			OBJMeshData copy;
+			copy.vertices.assign(sm.vertices, sm.vertices + sm.numVertices);
+			if(sm.textureCoords)	copy.textureCoords.assign(sm.textureCoords, sm.textureCoords + sm.numVertices);
+			if(sm.normals)			copy.normals.assign(sm.normals, sm.normals + sm.numVertices);
+			if(sm.tangents)			copy.tangents.assign(sm.tangents, sm.tangents + sm.numVertices);
+			if(sm.indices)			copy.indices.assign(sm.indices, sm.indices + sm.numIndices);
+		}
+	}
+	float warm = (timer.GetMS() - start) / iterations;
+
+	std::cout << "OBJMesh::BenchmarkLoad " << filename << ": tokenizer " << times[0] 
+			  << "ms, stream parser " << times[1] << "ms (" << times[1] / times[0] << "x), mesh cache " 
+			  << warm << "ms" << std::endl;
+}
+
+/*
+Prints how much vertex data welding saves, against the old path that gave
+every face corner its own copy of each attribute and drew without indices.
+*/
+void OBJMesh::ReportMemory(std::string filename)	{
+	std::vector<OBJMeshData> meshData;
+
+	if(!ParseOBJMesh(filename, meshData)) {
+		std::cout << "OBJMesh::ReportMemory Can't load " << filename << std::endl;
+		return;
+	}
+
+	size_t corners		= 0;
+	size_t vertices		= 0;
+	size_t unwelded		= 0;
+	size_t welded		= 0;
+
+	for(unsigned int i = 0; i < meshData.size(); ++i) {
+		const OBJMeshData &m = meshData[i];
+
+		size_t vertexSize = sizeof(Vector3);
+		if(!m.textureCoords.empty())	vertexSize += sizeof(Vector2);
+		if(!m.normals.empty())			vertexSize += sizeof(Vector3);
+		if(!m.tangents.empty())			vertexSize += sizeof(Vector3);
+
+		corners		+= m.indices.size();
+		vertices	+= m.vertices.size();
+		unwelded	+= m.indices.size() * vertexSize;
+		welded		+= m.vertices.size() * vertexSize + m.indices.size() * sizeof(unsigned int);
+	}
+
+	std::cout << "OBJMesh::ReportMemory " << filename << ": " << corners << " corners welded to " << vertices 
+			  << " vertices, " << unwelded / 1024 << "KB -> " << welded / 1024 << "KB (" 
+			  << (unwelded - welded) / 1024 << "KB saved)" << std::endl;
+}
+
+void OBJMesh::OptimiseMeshData(OBJMeshData &m)	{
+	if(m.indices.empty()) {
+		return;
+	}
+
+	unsigned int numIndices	= m.indices.size();
+	unsigned int numVertices	= m.vertices.size();
+
+	MeshOptimiser::OptimiseVertexCache(&m.indices[0], numIndices, numVertices);
+	MeshOptimiser::OptimiseOverdraw(&m.indices[0], numIndices, &m.vertices[0], numVertices);
+
+	std::vector<unsigned int> remap;
+	MeshOptimiser::OptimiseVertexFetch(&m.indices[0], numIndices, numVertices, remap);
+
+	MeshOptimiser::RemapArray(&m.vertices[0], numVertices, remap);
+	if(!m.textureCoords.empty()) {
+		MeshOptimiser::RemapArray(&m.textureCoords[0], numVertices, remap);
+	}
+	if(!m.normals.empty()) {
+		MeshOptimiser::RemapArray(&m.normals[0], numVertices, remap);
+	}
+	if(!m.tangents.empty()) {
+		MeshOptimiser::RemapArray(&m.tangents[0], numVertices, remap);
+	}
+}
+
+void OBJMesh::ReportVertexCache(std::string filename)	{
+	std::vector<OBJMeshData> meshData;
+
+	if(!ParseOBJMesh(filename, meshData)) {
+		std::cout << "OBJMesh::ReportVertexCache Can't load " << filename << std::endl;
+		return;
+	}
+
+	for(unsigned int i = 0; i < meshData.size(); ++i) {
+		OBJMeshData &m = meshData[i];
+
+		VertexCacheStats before	= MeshOptimiser::AnalyseVertexCache(&m.indices[0], m.indices.size(), m.vertices.size());
+		OptimiseMeshData(m);
+		VertexCacheStats after	= MeshOptimiser::AnalyseVertexCache(&m.indices[0], m.indices.size(), m.vertices.size());
+
+		std::cout << "OBJMesh::ReportVertexCache " << filename << " submesh " << i << ": ACMR " 
+				  << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	}
+}
+
+void OBJMesh::ReportVertexFormat(std::string filename)	{
+	std::vector<OBJMeshData> meshData;
+
+	if(!ParseOBJMesh(filename, meshData)) {
+		std::cout << "OBJMesh::ReportVertexFormat Can't load " << filename << std::endl;
+		return;
+	}
+
+	for(unsigned int i = 0; i < meshData.size(); ++i) {
+		MeshCacheSubMesh m = meshData[i].GetView();
+
+		std::stringstream name;
+		name << filename << " submesh " << i;
+
+		VertexFormat::Report(name.str(), m.numVertices, m.vertices, NULL, m.textureCoords, m.normals, m.tangents);
+	}
+}
+
+bool OBJMesh::BenchmarkNormals(std::string filename, int iterations)	{
+	std::vector<OBJMeshData> meshData;
+
+	if(!ParseOBJMesh(filename, meshData)) {
+		std::cout << "OBJMesh::BenchmarkNormals Can't load " << filename << std::endl;
+		return false;
+	}
+
+	bool passed = true;
+	for(unsigned int i = 0; i < meshData.size(); ++i) {
+		MeshCacheSubMesh m = meshData[i].GetView();
+
+		std::stringstream name;
+		name << filename << " submesh " << i;
+
+		passed &= NormalGenerator::Benchmark(name.str(), m.vertices, m.textureCoords, m.numVertices, 
+											 m.indices, m.numIndices, iterations);
+	}
+	return passed;
 }
 
 /*
@@ -335,4 +1106,24 @@ void OBJMesh::Draw() {
 		}
 		children.at(i)->Draw();
 	}
-};
\ No newline at end of file
+};
+
+void OBJMesh::DrawInstanced(GLuint numInstances) {
+	Mesh::DrawInstanced(numInstances);
+	for(unsigned int i = 0; i < children.size(); ++i) {
+		if (texture) {
+			children.at(i)->SetTexture(texture);
+		}
+		if (bumpTexture) {
+			children.at(i)->SetBumpMap(bumpTexture);
+		}
+		children.at(i)->DrawInstanced(numInstances);
+	}
+}
+
+void OBJMesh::SetInstanceBuffer(const InstanceBuffer *buffer) {
+	Mesh::SetInstanceBuffer(buffer);
+	for(unsigned int i = 0; i < children.size(); ++i) {
+		children.at(i)->SetInstanceBuffer(buffer);
+	}
+}
\ No newline at end of file
@@ -10,21 +10,19 @@ framework, instead.
 
 You'll very quickly find OBJ meshes that can't be loaded by this loader.
 
-First up - any mesh with anything other than triangles in it won't work. Quads
-should be trivial to add in, n-sided polygons should be OK if they are convex
-(add a point in the middle and create triangles out of pairs of points).
+Faces are triangulated as fans, so quads and convex n-sided polygons are fine,
+but concave polygons will come out wrong. Negative (relative) indices are
+supported by the tokenizer, but not by the old stream parser.
 
-Some OBJ meshes use negative indices, which won't work.
-
-In both cases, loading the OBJ into Blender or maybe Milkshape, and exporting
-them out as OBJs again might create a file more likely to load. 
+If a mesh won't load, loading the OBJ into Blender or maybe Milkshape, and
+exporting it out as an OBJ again might create a file more likely to load. 
 
 OBJ files are ok for simple geometry (the tutorial series uses them for 2
 slightly different cubes, and an icosphere), but generally don't work very
 well for 'big' geometry. 
 
-The simple loader doesn't do anything fancy with indices - have fun trying
-to get that working!
+Face corners are welded into unique vertices, and each submesh is drawn with
+an index buffer.
 
 The 'Stanford Bunny' OBJ does load up with this though, if you really want
 to see a rabbit.
@@ -66,6 +64,27 @@ time lighting tutorial, uncomment both OBJ_USE_NORMALS and OBJ_USE_TANGENTS_BUMP
 #define OBJ_USE_NORMALS
 #define OBJ_USE_TANGENTS_BUMPMAPS
 
+/*
+With OBJ_USE_MESH_CACHE defined, the first load of an OBJ writes a binary
+cache of the finished submeshes next to it (see MeshCache), and later loads
+map that instead of parsing the text again.
+*/
+#define OBJ_USE_MESH_CACHE
+
+/*
+OBJ files are parsed by a tokenizer that walks the memory mapped file in
+place. Defining OBJ_USE_STREAM_PARSER goes back to the original iostream
+parser, which is a lot slower, and only understands triangles and quads.
+*/
+//#define OBJ_USE_STREAM_PARSER
+
+/*
+With OBJ_USE_MESH_OPTIMISER defined, each submesh's triangles are reordered
+for the post transform vertex cache and overdraw, and its vertices for fetch
+locality, before they are buffered (see MeshOptimiser).
+*/
+#define OBJ_USE_MESH_OPTIMISER
+
 
 #pragma once
 
@@ -73,13 +92,17 @@ time lighting tutorial, uncomment both OBJ_USE_NORMALS and OBJ_USE_TANGENTS_BUMP
 #include <string>
 #include <sstream>
 #include <map>
+#include <vector>
 
 #include "Vector3.h"
 #include "Vector2.h"
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimiser.h"
 #include "ChildMeshInterface.h"
 
 #define OBJOBJECT	"object"	//the current line of the obj file defines the start of a new material
+#define OBJNAMEDOBJECT	"o"		//the current line of the obj file defines the start of a new, named object
 #define OBJUSEMTL	"usemtl"	//the current line of the obj file defines the start of a new material
 #define OBJMESH		"g"			//the current line of the obj file defines the start of a new face
 #define OBJCOMMENT	"#"			//The current line of the obj file is a comment
@@ -91,7 +114,8 @@ time lighting tutorial, uncomment both OBJ_USE_NORMALS and OBJ_USE_TANGENTS_BUMP
 /*
 OBJSubMesh structs are used to temporarily keep the data loaded 
 in from the OBJ files, before being parsed into a series of
-Meshes
+Meshes. The three index lists are always the same length, with
+a 0 for a corner that has no tex coord or normal.
 */
 struct OBJSubMesh {
 	std::vector<int> texIndices;
@@ -101,13 +125,90 @@ struct OBJSubMesh {
 	int indexOffset;
 };
 
+/*
+OBJInputData is everything read in from the OBJ file, before the indices
+are resolved into per submesh vertex attributes. Indices are 1-based, as
+in the file.
+*/
+struct OBJInputData {
+	std::vector<Vector3>		vertices;
+	std::vector<Vector2>		texCoords;
+	std::vector<Vector3>		normals;
+	std::vector<OBJSubMesh*>	subMeshes;
+};
+
+/*
+OBJMeshData holds the finished (welded and indexed) vertex attributes of one
+submesh, ready to be buffered. Building these doesn't touch OpenGL, so the whole parse can run
+(and be timed) without a context.
+*/
+struct OBJMeshData {
+	std::vector<Vector3> vertices;
+	std::vector<Vector2> textureCoords;
+	std::vector<Vector3> normals;
+	std::vector<Vector3> tangents;
+	std::vector<unsigned int> indices;
+
+	MeshCacheSubMesh GetView() const;
+};
+
 class OBJMesh : public Mesh, public ChildMeshInterface	{
 public:
 	OBJMesh(void){};
 	OBJMesh(std::string filename){LoadOBJMesh(filename);};
+	OBJMesh(std::string filename, const VertexFormat &format){LoadOBJMesh(filename, format);};
 	~OBJMesh(void){};
-	bool	LoadOBJMesh(std::string filename);
+
+	//Every submesh is buffered in the given format. Quantised submeshes share one bounding box,
+	//so this OBJMesh's GetDequantMatrix works for all of them
+	bool	LoadOBJMesh(std::string filename, const VertexFormat &format = VertexFormat());
 
 	virtual void Draw();
+
+	//Draws every submesh instanced, one call each
+	virtual void DrawInstanced(GLuint numInstances);
+	virtual void SetInstanceBuffer(const InstanceBuffer *buffer);
+
+	//Parses an OBJ file into submesh data, without creating any GL objects
+	static bool	ParseOBJMesh(std::string filename, std::vector<OBJMeshData> &into, bool streamParser = false);
+
+	//Checks that the tokenizer and the stream parser build identical submeshes, with
+	//the stream parser reading reference if there is one
+	static bool	CompareParsers(std::string filename, std::string reference = "");
+	//Runs the above on the fixture cube, which has a submesh started by each of g, o
+	//and object, then n-gons, negative indices and every corner form
+	static bool	CompareParsers();
+
+	//Prints the average time of both text parsers against a mesh cache load
+	static void	BenchmarkLoad(std::string filename, int iterations = 10);
+
+	//Prints the vertex memory saved by welding the OBJ's face corners
+	static void	ReportMemory(std::string filename);
+
+	//Reorders a submesh's triangles and vertices for the vertex cache, overdraw and fetch
+	static void	OptimiseMeshData(OBJMeshData &m);
+
+	//Prints the ACMR and ATVR of each submesh, before and after OptimiseMeshData
+	static void	ReportVertexCache(std::string filename);
+
+	//Prints the size and round trip precision of each VertexFormat for each submesh
+	static void	ReportVertexFormat(std::string filename);
+
+	//Times and checks the NormalGenerator against Mesh's scalar loops on each submesh
+	static bool	BenchmarkNormals(std::string filename, int iterations = 10);
+
+protected:
+	static bool	ReadOBJStream(std::string filename, OBJInputData &input);
+	static bool	ReadOBJBuffer(const char *data, size_t size, OBJInputData &input);
+	static void	BuildMeshData(OBJInputData &input, std::vector<OBJMeshData> &into);
+
+	//The OBJ_USE_ defines that change what goes into a mesh cache, as MESHCACHE_BUILD_ flags
+	static unsigned int	GetCacheBuildFlags();
+
+	//Creates a child mesh from the given arrays, and buffers it in this OBJMesh's format
+	void	AddSubMesh(const MeshCacheSubMesh &data);
+
+	//Shares one bounding box between all of the submeshes, if the format quantises positions
+	void	FitSubMeshBounds(const std::vector<MeshCacheSubMesh> &subMeshes);
 };
 
@@ -18,6 +18,7 @@ way to do it - but it kept the Tutorial code down to a minimum!
 OGLRenderer::OGLRenderer(Window &parent)
 {
 	init = false;
+	state = NULL;
 
 	HWND windowHandle = parent.GetHandle();
 
@@ -122,6 +123,8 @@ OGLRenderer::OGLRenderer(Window &parent)
 	}
 	//If we get this far, everything's going well!
 
+	state = &GLStateCache::Get();				//Made now GLEW has the function pointers
+
 	glClearColor(0.2f,0.2f,0.2f,1.0f);			//When we clear the screen, we want it to be dark grey
 
 	currentShader = 0;							//0 is the 'null' object name for shader programs...
@@ -196,32 +199,32 @@ void OGLRenderer::UpdateShaderMatrices()
 {
 	if(currentShader)
 	{
-		glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "modelMatrix"),   1,false, (float*)&modelMatrix);
-		glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "viewMatrix"),	   1,false, (float*)&viewMatrix);
-		glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "projMatrix"),	   1,false, (float*)&projMatrix);
-		glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "textureMatrix"), 1,false, (float*)&textureMatrix);
+		currentShader->SetUniform("modelMatrix", modelMatrix);
+		currentShader->SetUniform("viewMatrix", viewMatrix);
+		currentShader->SetUniform("projMatrix", projMatrix);
+		currentShader->SetUniform("textureMatrix", textureMatrix);
 	}
 }
 
 void OGLRenderer::SetCurrentShader(Shader*s)
 {
 	currentShader = s;
-	glUseProgram(s->GetProgram());
+	state->UseProgram(s->GetProgram());
 }
 
 void OGLRenderer::SetTextureRepeating( GLuint target, bool repeating )
 {
-	glBindTexture(GL_TEXTURE_2D, target);
+	state->BindTexture(target);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, repeating ? GL_REPEAT : GL_CLAMP);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, repeating ? GL_REPEAT : GL_CLAMP);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	state->BindTexture(0);
 }
 
 void OGLRenderer::SetShaderLight(const Light &l)
 {
-	glUniform3fv(glGetUniformLocation(currentShader->GetProgram(), "lightPos"), 1, (float*)&l.GetPosition());
-	glUniform4fv(glGetUniformLocation(currentShader->GetProgram(), "lightColour"), 1, (float*)&l.GetColour());
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "lightRadius"), l.GetRadius());
+	currentShader->SetUniform("lightPos", l.GetPosition());
+	currentShader->SetUniform("lightColour", l.GetColour());
+	currentShader->SetUniform("lightRadius", l.GetRadius());
 }
 
 void OGLRenderer::SetShaderLights(Light **l, const int numLights)
@@ -241,8 +244,8 @@ void OGLRenderer::SetShaderLights(Light **l, const int numLights)
 		radiuses[i] = l[i]->GetRadius();
 	}
 
-	glUniform3fv(glGetUniformLocation(currentShader->GetProgram(), "lightPositions"), numLights, (float*)positions);
-	glUniform4fv(glGetUniformLocation(currentShader->GetProgram(), "lightColours"), numLights, (float*)colours);
-	glUniform1fv(glGetUniformLocation(currentShader->GetProgram(), "lightRadiuses"), numLights, (float*)radiuses);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "numLights"), numLights);
+	currentShader->SetUniform("lightPositions", positions, numLights);
+	currentShader->SetUniform("lightColours", colours, numLights);
+	currentShader->SetUniform("lightRadiuses", radiuses, numLights);
+	currentShader->SetUniform("numLights", numLights);
 }
\ No newline at end of file
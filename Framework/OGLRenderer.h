@@ -28,6 +28,7 @@ _-_-_-_-_-_-_-""  ""
 #include "Quaternion.h"
 #include "Matrix4.h"
 #include "Window.h"
+#include "GLStateCache.h"
 
 #include "Shader.h"		//Students make this file...
 #include "Mesh.h"		//And this one...
@@ -80,6 +81,9 @@ protected:
 
 	Shader *currentShader;
 
+	// Binds and render state go through this, so the ones already set are skipped
+	GLStateCache *state;
+
 	Matrix4 projMatrix;		//Projection matrix
 	Matrix4 modelMatrix;	//Model matrix. NOT MODELVIEW
 	Matrix4 viewMatrix;		//View matrix
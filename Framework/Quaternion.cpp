@@ -33,6 +33,40 @@ float Quaternion::Dot(const Quaternion &a,const Quaternion &b){
 	return (a.x * b.x) + (a.y * b.y) + (a.z * b.z) + (a.w * b.w);
 }
 
+Quaternion Quaternion::Slerp(const Quaternion &a, const Quaternion &b, float t){
+	float cosTheta = Dot(a,b);
+	float sign	   = 1.0f;
+
+	//q and -q are the same rotation, so go whichever way is shorter
+	if(cosTheta < 0.0f) {
+		cosTheta = -cosTheta;
+		sign	 = -1.0f;
+	}
+
+	float fromA = 1.0f - t;
+	float fromB = t;
+
+	//Nearly the same rotation, so sin(theta) is too small to divide by. A
+	//normalised lerp is indistinguishable this close.
+	if(cosTheta < 0.9995f) {
+		float theta		= acos(cosTheta);
+		float sinTheta	= sin(theta);
+
+		fromA = sin(fromA * theta) / sinTheta;
+		fromB = sin(fromB * theta) / sinTheta;
+	}
+
+	fromB *= sign;
+
+	Quaternion ans(	(a.x * fromA) + (b.x * fromB),
+					(a.y * fromA) + (b.y * fromB),
+					(a.z * fromA) + (b.z * fromB),
+					(a.w * fromA) + (b.w * fromB));
+	ans.Normalise();
+
+	return ans;
+}
+
 void Quaternion::Normalise(){
 	float magnitude = sqrt(Dot(*this,*this));
 
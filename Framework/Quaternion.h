@@ -62,6 +62,9 @@ public:
 
 	static float Dot(const Quaternion &a, const Quaternion &b);
 
+	//Spherical interpolation from a (t = 0) to b (t = 1), the short way round
+	static Quaternion Slerp(const Quaternion &a, const Quaternion &b, float t);
+
 	Quaternion operator *(const Quaternion &a) const;
 	Quaternion operator *(const Vector3 &a) const;
 
@@ -0,0 +1,224 @@
+#include "RenderTargetPool.h"
+
+#include <iostream>
+
+#include "Common.h"
+#include "GLStateCache.h"
+
+RenderTargetPool::RenderTargetPool()
+{
+	frame = 0;
+	numTextures = 0;
+	bytesAllocated = 0;
+	bytesInUse = 0;
+	peakBytesAllocated = 0;
+	peakBytesInUse = 0;
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+	Trim();
+
+	for (std::map<GLuint, RenderTargetDesc>::iterator i = usedTargets.begin(); i != usedTargets.end(); ++i)
+	{
+		GLStateCache::Get().ForgetTexture(i->first);
+		glDeleteTextures(1, &i->first);
+	}
+}
+
+void RenderTargetPool::BeginFrame()
+{
+	++frame;
+
+	std::map<RenderTargetDesc, std::vector<FreeTarget> >::iterator i = freeTargets.begin();
+
+	while (i != freeTargets.end())
+	{
+		std::vector<FreeTarget> &targets = i->second;
+
+		for (unsigned int t = 0; t < targets.size(); )
+		{
+			if (frame - targets[t].lastUsed > RENDERTARGETPOOL_IDLE_FRAMES)
+			{
+				DeleteTexture(targets[t].texture, i->first);
+				targets[t] = targets.back();
+				targets.pop_back();
+			}
+			else
+			{
+				++t;
+			}
+		}
+
+		if (targets.empty())
+		{
+			freeTargets.erase(i++);
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+GLuint RenderTargetPool::Acquire(const RenderTargetDesc &desc)
+{
+	GLuint texture = 0;
+
+	std::map<RenderTargetDesc, std::vector<FreeTarget> >::iterator i = freeTargets.find(desc);
+
+	if (i != freeTargets.end() && !i->second.empty())
+	{
+		// The most recently released, which is the likeliest to still be in cache
+		texture = i->second.back().texture;
+		i->second.pop_back();
+	}
+	else
+	{
+		texture = CreateTexture(desc);
+
+		if (!texture)
+		{
+			std::cout << "RenderTargetPool::Acquire: Can't create a " << desc.width << "x" << desc.height << " target!" << std::endl;
+			return 0;
+		}
+
+		++numTextures;
+		bytesAllocated += GetBytes(desc);
+		peakBytesAllocated = max(peakBytesAllocated, bytesAllocated);
+	}
+
+	usedTargets[texture] = desc;
+
+	bytesInUse += GetBytes(desc);
+	peakBytesInUse = max(peakBytesInUse, bytesInUse);
+
+	return texture;
+}
+
+void RenderTargetPool::Release(GLuint &texture)
+{
+	std::map<GLuint, RenderTargetDesc>::iterator i = usedTargets.find(texture);
+
+	if (i == usedTargets.end())
+	{
+		if (texture)
+		{
+			std::cout << "RenderTargetPool::Release: Texture " << texture << " isn't from this pool!" << std::endl;
+		}
+		return;
+	}
+
+	FreeTarget target;
+	target.texture = texture;
+	target.lastUsed = frame;
+
+	freeTargets[i->second].push_back(target);
+	bytesInUse -= GetBytes(i->second);
+
+	usedTargets.erase(i);
+	texture = 0;
+}
+
+void RenderTargetPool::Trim()
+{
+	for (std::map<RenderTargetDesc, std::vector<FreeTarget> >::iterator i = freeTargets.begin(); i != freeTargets.end(); ++i)
+	{
+		for (unsigned int t = 0; t < i->second.size(); ++t)
+		{
+			DeleteTexture(i->second[t].texture, i->first);
+		}
+	}
+	freeTargets.clear();
+}
+
+void RenderTargetPool::PrintStats(const std::string &name) const
+{
+	const float mb = 1.0f / (1024.0f * 1024.0f);
+
+	std::cout << name << " render targets: " << numTextures << " textures, " << bytesAllocated * mb << " MB ("
+			  << bytesInUse * mb << " MB in use), peak " << peakBytesAllocated * mb << " MB ("
+			  << peakBytesInUse * mb << " MB in use at once)" << std::endl;
+}
+
+size_t RenderTargetPool::GetBytes(const RenderTargetDesc &desc)
+{
+	// Every format there is packs into 32 bits a pixel; 24 bit depth is padded out by the driver
+	return (size_t)desc.width * desc.height * desc.layers * 4;
+}
+
+GLuint RenderTargetPool::CreateTexture(const RenderTargetDesc &desc)
+{
+	GLuint texture;
+	GLenum target = desc.IsArray() ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+
+	glGenTextures(1, &texture);
+
+	if (desc.IsArray())
+	{
+		GLStateCache::Get().BindTextureArray(texture);
+	}
+	else
+	{
+		GLStateCache::Get().BindTexture(texture);
+	}
+
+	glTexParameterf(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameterf(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameterf(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	GLint internalFormat = GL_RGBA8;
+	GLenum format = GL_RGBA;
+	GLenum type = GL_UNSIGNED_BYTE;
+
+	switch (desc.format)
+	{
+	case RENDERTARGET_DEPTH24_STENCIL8:
+		internalFormat = GL_DEPTH24_STENCIL8;
+		format = GL_DEPTH_STENCIL;
+		type = GL_UNSIGNED_INT_24_8;
+		break;
+	case RENDERTARGET_DEPTH24:
+		internalFormat = GL_DEPTH_COMPONENT24;
+		format = GL_DEPTH_COMPONENT;
+		type = GL_FLOAT;
+		break;
+	default:
+		break;
+	}
+
+	if (desc.IsArray())
+	{
+		glTexImage3D(target, 0, internalFormat, desc.width, desc.height, desc.layers, 0, format, type, NULL);
+	}
+	else
+	{
+		glTexImage2D(target, 0, internalFormat, desc.width, desc.height, 0, format, type, NULL);
+	}
+
+	if (desc.usage == RENDERTARGET_SHADOW)
+	{
+		glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+	}
+
+	if (desc.IsArray())
+	{
+		GLStateCache::Get().BindTextureArray(0);
+	}
+	else
+	{
+		GLStateCache::Get().BindTexture(0);
+	}
+
+	return texture;
+}
+
+void RenderTargetPool::DeleteTexture(GLuint texture, const RenderTargetDesc &desc)
+{
+	GLStateCache::Get().ForgetTexture(texture);
+	glDeleteTextures(1, &texture);
+
+	--numTextures;
+	bytesAllocated -= GetBytes(desc);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+/*
+ * Hands out render target textures by size, format and usage, and takes them
+ * back once a pass is done with them, so passes whose targets are never alive
+ * at the same time end up drawing into the same textures.
+ *
+ * Acquire gives back a free texture with the same description if there is
+ * one, and only creates a new one if not. Release puts it back on the free
+ * list, ready for the next pass (in this frame or a later one) that asks for
+ * the same thing. Whatever's on the free list is just a texture that isn't
+ * drawn into or read until it's handed out again, so a target acquired late
+ * in a frame can be the same texture one released earlier in it.
+ *
+ * Call BeginFrame once per rendered frame. Free textures nothing has asked
+ * for in the last RENDERTARGETPOOL_IDLE_FRAMES frames are deleted then, which
+ * is what gets rid of the old screen sized targets after a resize, or a mode
+ * that stopped using some. Trim deletes every free texture straight away.
+ *
+ * Memory is counted as width * height * bytes per pixel of each texture,
+ * which is what the driver has to find room for, give or take its padding.
+ */
+#include <map>
+#include <vector>
+#include <string>
+
+#include "GL/glew.h"
+
+// Frames a free texture is kept for before it's deleted
+#define RENDERTARGETPOOL_IDLE_FRAMES	2
+
+enum RenderTargetFormat
+{
+	RENDERTARGET_RGBA8,
+	RENDERTARGET_DEPTH24_STENCIL8,
+	RENDERTARGET_DEPTH24
+};
+
+enum RenderTargetUsage
+{
+	RENDERTARGET_SAMPLED,	// Linear filtering, clamped to the edges
+	RENDERTARGET_SHADOW		// As above, with depth comparison for shadow map lookups
+};
+
+/*
+ * A target with more than one layer is a 2D array texture, which a layered
+ * frame buffer can draw every layer of at once
+ */
+struct RenderTargetDesc
+{
+	RenderTargetDesc(unsigned int width = 0, unsigned int height = 0,
+					 RenderTargetFormat format = RENDERTARGET_RGBA8, RenderTargetUsage usage = RENDERTARGET_SAMPLED,
+					 unsigned int layers = 1)
+		: width(width), height(height), format(format), usage(usage), layers(layers) {}
+
+	bool operator<(const RenderTargetDesc &other) const
+	{
+		if (width != other.width)	{ return width < other.width; }
+		if (height != other.height)	{ return height < other.height; }
+		if (format != other.format)	{ return format < other.format; }
+		if (usage != other.usage)	{ return usage < other.usage; }
+		return layers < other.layers;
+	}
+
+	bool IsArray() const	{ return layers > 1; }
+
+	unsigned int		width;
+	unsigned int		height;
+	RenderTargetFormat	format;
+	RenderTargetUsage	usage;
+	unsigned int		layers;
+};
+
+class RenderTargetPool
+{
+public:
+	RenderTargetPool();
+	~RenderTargetPool();
+
+	// Starts a new frame, deleting any free texture that's been idle too long
+	void BeginFrame();
+
+	// A texture matching desc, reused if one's free
+	GLuint Acquire(const RenderTargetDesc &desc);
+	GLuint Acquire(unsigned int width, unsigned int height,
+				   RenderTargetFormat format = RENDERTARGET_RGBA8, RenderTargetUsage usage = RENDERTARGET_SAMPLED,
+				   unsigned int layers = 1)
+	{
+		return Acquire(RenderTargetDesc(width, height, format, usage, layers));
+	}
+
+	// Gives a texture from Acquire back, and zeroes the handle
+	void Release(GLuint &texture);
+
+	// Deletes every free texture
+	void Trim();
+
+	// Bytes in every texture the pool has, in the ones handed out, and the most there's ever been of each
+	size_t GetBytesAllocated() const	{ return bytesAllocated; }
+	size_t GetBytesInUse() const		{ return bytesInUse; }
+	size_t GetPeakBytesAllocated() const	{ return peakBytesAllocated; }
+	size_t GetPeakBytesInUse() const	{ return peakBytesInUse; }
+
+	unsigned int GetNumTextures() const	{ return numTextures; }
+
+	// Prints the pool's memory use, and its peak
+	void PrintStats(const std::string &name) const;
+
+	static size_t GetBytes(const RenderTargetDesc &desc);
+
+protected:
+	struct FreeTarget
+	{
+		GLuint			texture;
+		unsigned int	lastUsed;	// Frame it was released in
+	};
+
+	static GLuint CreateTexture(const RenderTargetDesc &desc);
+	void DeleteTexture(GLuint texture, const RenderTargetDesc &desc);
+
+	std::map<RenderTargetDesc, std::vector<FreeTarget> >	freeTargets;
+	std::map<GLuint, RenderTargetDesc>						usedTargets;
+
+	unsigned int	frame;
+	unsigned int	numTextures;
+
+	size_t			bytesAllocated;
+	size_t			bytesInUse;
+	size_t			peakBytesAllocated;
+	size_t			peakBytesInUse;
+};
@@ -1,5 +1,10 @@
 #include "Shader.h"
 
+#include <cstring>
+
+unsigned int Shader::uniformUploads = 0;
+unsigned int Shader::uniformsSkipped = 0;
+
 Shader::Shader(string vFile, string fFile, string gFile) {
 	program	= glCreateProgram();
 	objects[SHADER_VERTEX] = GenerateShader(vFile, GL_VERTEX_SHADER);
@@ -18,6 +23,8 @@ Shader::Shader(string vFile, string fFile, string gFile) {
 }
 
 Shader::~Shader(void) {
+	GLStateCache::Get().ForgetProgram(program);
+
 	for(int i = 0; i < 3; ++i) {
 		glDetachShader(program, objects[i]);
 		glDeleteShader(objects[i]);
@@ -89,13 +96,188 @@ bool Shader::LinkProgram() {
 
 	GLint code;
 	glGetProgramiv(program, GL_LINK_STATUS, &code);
-	return code == GL_TRUE ?  true : false;
+	if(code != GL_TRUE) {
+		return false;
+	}
+
+	FindUniforms();
+	return true;
+}
+
+void Shader::SetFeedbackVaryings(const char **names, int count) {
+	glTransformFeedbackVaryings(program, count, (const GLchar**)names, GL_INTERLEAVED_ATTRIBS);
 }
 
+bool Shader::BindUniformBlock(const string &name, GLuint binding) {
+	GLuint block = glGetUniformBlockIndex(program, name.c_str());
+	if(block == GL_INVALID_INDEX) {
+		return false;
+	}
+
+	glUniformBlockBinding(program, block, binding);
+	return true;
+}
+
+/*
+The attribute locations are the Mesh buffer slots, whatever VertexFormat a
+mesh was buffered with - packed attributes are turned back into floats by
+the vertex fetch, so the shader inputs never change. Skinning shaders get 
+their joint attributes after those; binding names a shader doesn't have
+does nothing.
+*/
 void Shader::SetDefaultAttributes() {
-	glBindAttribLocation(program, VERTEX_BUFFER,  "position");
-	glBindAttribLocation(program, COLOUR_BUFFER,  "colour");
-	glBindAttribLocation(program, TEXTURE_BUFFER, "texCoord");
-	glBindAttribLocation(program, NORMAL_BUFFER,  "normal");
-	glBindAttribLocation(program, TANGENT_BUFFER, "tangent");
+	for(int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i) {
+		glBindAttribLocation(program, i, VertexFormat::GetAttributeName((MeshBuffer)i));
+	}
+
+	glBindAttribLocation(program, JOINT_INDEX_ATTRIBUTE, "jointIndices");
+	glBindAttribLocation(program, JOINT_ANCHOR_ATTRIBUTE, "jointAnchors");
+	glBindAttribLocation(program, INSTANCE_MATRIX_ATTRIBUTE, "instanceMatrix");
+}
+
+/*
+Every active uniform the linker left in the program, by name. Arrays are
+listed as their first element ("kernel[0]"), and are kept under the plain
+name; uniforms in blocks have no location of their own, and are left out.
+*/
+void Shader::FindUniforms() {
+	uniforms.clear();
+	uniformIndices.clear();
+
+	GLint numUniforms = 0;
+	GLint maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	vector<char> name(maxLength + 1);
+
+	for(GLint i = 0; i < numUniforms; ++i) {
+		Uniform uniform;
+		GLsizei length = 0;
+
+		glGetActiveUniform(program, i, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, &name[0]);
+		uniform.name = string(&name[0], length);
+		uniform.location = glGetUniformLocation(program, uniform.name.c_str());
+
+		if(uniform.location < 0) {
+			continue;
+		}
+
+		size_t bracket = uniform.name.find('[');
+		if(bracket != string::npos) {
+			uniform.name.erase(bracket);
+		}
+
+		uniformIndices[uniform.name] = (unsigned int)uniforms.size();
+		uniforms.push_back(uniform);
+	}
+}
+
+//Ints, bools and samplers are all set with glUniform1i
+static bool IsIntegerType(GLenum type) {
+	switch(type) {
+	case GL_FLOAT:
+	case GL_FLOAT_VEC2:
+	case GL_FLOAT_VEC3:
+	case GL_FLOAT_VEC4:
+	case GL_FLOAT_MAT2:
+	case GL_FLOAT_MAT3:
+	case GL_FLOAT_MAT4:
+	case GL_INT_VEC2:
+	case GL_INT_VEC3:
+	case GL_INT_VEC4:
+	case GL_BOOL_VEC2:
+	case GL_BOOL_VEC3:
+	case GL_BOOL_VEC4:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static size_t GetElementBytes(GLenum type) {
+	switch(type) {
+	case GL_FLOAT_VEC2:	return sizeof(float) * 2;
+	case GL_FLOAT_VEC3:	return sizeof(float) * 3;
+	case GL_FLOAT_VEC4:	return sizeof(float) * 4;
+	case GL_FLOAT_MAT4:	return sizeof(float) * 16;
+	default:			return sizeof(float);
+	}
+}
+
+bool Shader::Upload(const string &name, GLenum type, const void *data, int count) {
+	unordered_map<string, unsigned int>::iterator i = uniformIndices.find(name);
+
+	if(i == uniformIndices.end()) {
+		return false;
+	}
+
+	Uniform &uniform = uniforms[i->second];
+
+	bool typeMatches = (type == GL_INT) ? IsIntegerType(uniform.type) : (type == uniform.type);
+
+	if(!typeMatches || count > uniform.size) {
+		cout << "Shader::SetUniform: " << name << " isn't the type or size it's being set as!" << endl;
+		return false;
+	}
+
+	size_t bytes = GetElementBytes(type) * count;
+
+	if(uniform.value.size() >= bytes && memcmp(&uniform.value[0], data, bytes) == 0) {
+		++uniformsSkipped;
+		return true;
+	}
+
+	if(uniform.value.size() < bytes) {
+		uniform.value.resize(bytes);
+	}
+	memcpy(&uniform.value[0], data, bytes);
+
+	switch(type) {
+	case GL_INT:		glUniform1iv(uniform.location, count, (const GLint*)data);			break;
+	case GL_FLOAT:		glUniform1fv(uniform.location, count, (const float*)data);			break;
+	case GL_FLOAT_VEC2:	glUniform2fv(uniform.location, count, (const float*)data);			break;
+	case GL_FLOAT_VEC3:	glUniform3fv(uniform.location, count, (const float*)data);			break;
+	case GL_FLOAT_VEC4:	glUniform4fv(uniform.location, count, (const float*)data);			break;
+	case GL_FLOAT_MAT4:	glUniformMatrix4fv(uniform.location, count, false, (const float*)data);	break;
+	}
+
+	++uniformUploads;
+	return true;
+}
+
+bool Shader::SetUniform(const string &name, int value) {
+	return Upload(name, GL_INT, &value, 1);
+}
+
+bool Shader::SetUniform(const string &name, float value) {
+	return Upload(name, GL_FLOAT, &value, 1);
+}
+
+bool Shader::SetUniform(const string &name, const Vector2 &value) {
+	return Upload(name, GL_FLOAT_VEC2, &value, 1);
+}
+
+bool Shader::SetUniform(const string &name, const Vector3 &value) {
+	return Upload(name, GL_FLOAT_VEC3, &value, 1);
+}
+
+bool Shader::SetUniform(const string &name, const Vector4 &value) {
+	return Upload(name, GL_FLOAT_VEC4, &value, 1);
+}
+
+bool Shader::SetUniform(const string &name, const Matrix4 &value) {
+	return Upload(name, GL_FLOAT_MAT4, value.values, 1);
+}
+
+bool Shader::SetUniform(const string &name, const float *values, int count) {
+	return Upload(name, GL_FLOAT, values, count);
+}
+
+bool Shader::SetUniform(const string &name, const Vector3 *values, int count) {
+	return Upload(name, GL_FLOAT_VEC3, values, count);
+}
+
+bool Shader::SetUniform(const string &name, const Vector4 *values, int count) {
+	return Upload(name, GL_FLOAT_VEC4, values, count);
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <vector>
+#include <unordered_map>
+
 #include "OGLRenderer.h"
 
 #define SHADER_VERTEX 0
@@ -16,13 +19,60 @@ public:
 	GLuint GetProgram() { return program; }
 	bool LinkProgram();
 
+	// Outputs of the last stage written, one after another, to a transform feedback buffer. Only takes effect on the next LinkProgram
+	void SetFeedbackVaryings(const char **names, int count);
+
+	// Points a uniform block at a binding point, once it's linked. Returns false if the shader hasn't got the block
+	bool BindUniformBlock(const string &name, GLuint binding);
+
+	/*
+	Typed uniform setters, for the shader in use. Each active uniform's
+	location and type are looked up once, when the program is linked, and the
+	last value given to it is kept, so setting what it's already got makes no
+	GL call at all. Setting a uniform the shader doesn't have (or that the
+	compiler optimised away) does nothing and returns false, like location -1.
+	*/
+	bool SetUniform(const string &name, int value);
+	bool SetUniform(const string &name, float value);
+	bool SetUniform(const string &name, const Vector2 &value);
+	bool SetUniform(const string &name, const Vector3 &value);
+	bool SetUniform(const string &name, const Vector4 &value);
+	bool SetUniform(const string &name, const Matrix4 &value);
+	bool SetUniform(const string &name, const float *values, int count);
+	bool SetUniform(const string &name, const Vector3 *values, int count);
+	bool SetUniform(const string &name, const Vector4 *values, int count);
+
+	bool HasUniform(const string &name) const { return uniformIndices.count(name) != 0; }
+
+	// GL uniform uploads made, and ones skipped as redundant, by every shader since the last reset
+	static unsigned int GetUniformUploads() { return uniformUploads; }
+	static unsigned int GetUniformsSkipped() { return uniformsSkipped; }
+	static void ResetUniformCounters() { uniformUploads = uniformsSkipped = 0; }
+
 protected:
+	struct Uniform {
+		string					name;
+		GLint					location;
+		GLenum					type;
+		GLint					size;	// Elements, if it's an array
+		vector<unsigned char>	value;	// What was last uploaded, empty until it's set
+	};
+
 	bool LoadShaderFile(string from, string &into);
 	GLuint GenerateShader(string from, GLenum type);
 	void SetDefaultAttributes();
+	void FindUniforms();
+
+	bool Upload(const string &name, GLenum type, const void *data, int count);
 
 	GLuint objects[3];
 	GLuint program;
 
 	bool loadFailed;
+
+	vector<Uniform>							uniforms;
+	unordered_map<string, unsigned int>		uniformIndices;
+
+	static unsigned int uniformUploads;
+	static unsigned int uniformsSkipped;
 };
\ No newline at end of file
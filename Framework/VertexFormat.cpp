@@ -0,0 +1,542 @@
+#include "VertexFormat.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// How many floats each attribute slot holds on the CPU side
+static const int attributeComponents[VERTEXFORMAT_ATTRIBUTES] = { 3, 4, 2, 3, 3 };
+
+static const char *attributeNames[VERTEXFORMAT_ATTRIBUTES] = { "position", "colour", "texCoord", "normal", "tangent" };
+
+static inline float Clamp(float value, float low, float high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+static inline int Round(float value)
+{
+	return (int)floorf(value + 0.5f);
+}
+
+static GLuint PackInt1010102(const float *v)
+{
+	GLuint packed = 0;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		int c = Round(Clamp(v[i], -1.0f, 1.0f) * 511.0f);
+		packed |= (GLuint)(c & 0x3ff) << (i * 10);
+	}
+
+	return packed;
+}
+
+static void UnpackInt1010102(GLuint packed, float *v)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		// Shift the 10 bit field to the top, and back down again to sign extend it
+		int c = (int)(packed << (22 - i * 10)) >> 22;
+		v[i] = Clamp(c / 511.0f, -1.0f, 1.0f);
+	}
+}
+
+// Writes n floats in the given encoding, returning the bytes written
+static unsigned int EncodeValues(unsigned char *into, VertexEncoding encoding, const float *values, int n)
+{
+	switch (encoding)
+	{
+	case ENCODING_FLOAT:
+		memcpy(into, values, n * sizeof(float));
+		return n * sizeof(float);
+
+	case ENCODING_HALF:
+		for (int i = 0; i < n; ++i)
+		{
+			((unsigned short*)into)[i] = VertexFormat::FloatToHalf(values[i]);
+		}
+		return n * sizeof(unsigned short);
+
+	case ENCODING_UNORM8:
+		for (int i = 0; i < n; ++i)
+		{
+			into[i] = (unsigned char)Round(Clamp(values[i], 0.0f, 1.0f) * 255.0f);
+		}
+		return n;
+
+	case ENCODING_UNORM16:
+		for (int i = 0; i < n; ++i)
+		{
+			((unsigned short*)into)[i] = (unsigned short)Round(Clamp(values[i], 0.0f, 1.0f) * 65535.0f);
+		}
+		return n * sizeof(unsigned short);
+
+	case ENCODING_SNORM16:
+		for (int i = 0; i < n; ++i)
+		{
+			((short*)into)[i] = (short)Round(Clamp(values[i], -1.0f, 1.0f) * 32767.0f);
+		}
+		return n * sizeof(short);
+
+	case ENCODING_INT_2_10_10_10:
+		*(GLuint*)into = PackInt1010102(values);
+		return sizeof(GLuint);
+	}
+
+	return 0;
+}
+
+static void DecodeValues(const unsigned char *from, VertexEncoding encoding, float *values, int n)
+{
+	switch (encoding)
+	{
+	case ENCODING_FLOAT:
+		memcpy(values, from, n * sizeof(float));
+		break;
+
+	case ENCODING_HALF:
+		for (int i = 0; i < n; ++i)
+		{
+			values[i] = VertexFormat::HalfToFloat(((const unsigned short*)from)[i]);
+		}
+		break;
+
+	case ENCODING_UNORM8:
+		for (int i = 0; i < n; ++i)
+		{
+			values[i] = from[i] / 255.0f;
+		}
+		break;
+
+	case ENCODING_UNORM16:
+		for (int i = 0; i < n; ++i)
+		{
+			values[i] = ((const unsigned short*)from)[i] / 65535.0f;
+		}
+		break;
+
+	case ENCODING_SNORM16:
+		for (int i = 0; i < n; ++i)
+		{
+			values[i] = Clamp(((const short*)from)[i] / 32767.0f, -1.0f, 1.0f);
+		}
+		break;
+
+	case ENCODING_INT_2_10_10_10:
+		UnpackInt1010102(*(const GLuint*)from, values);
+		break;
+	}
+}
+
+VertexFormat::VertexFormat()
+{
+	interleaved = false;
+	quantisePositions = false;
+	packedNormals = false;
+
+	hasBounds = false;
+	boundsScale = 1.0f;
+
+	stride = 0;
+
+	for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+	{
+		SetEncoding((MeshBuffer)i, ENCODING_FLOAT);
+	}
+}
+
+VertexFormat VertexFormat::Interleaved(bool quantisePositions, bool packedNormals)
+{
+	VertexFormat format;
+
+	format.interleaved = true;
+	format.quantisePositions = quantisePositions;
+
+	format.SetEncoding(VERTEX_BUFFER, quantisePositions ? ENCODING_UNORM16 : ENCODING_FLOAT);
+	format.SetEncoding(COLOUR_BUFFER, ENCODING_UNORM8);
+	format.SetEncoding(TEXTURE_BUFFER, ENCODING_HALF);
+	format.SetPackedNormals(packedNormals);
+
+	return format;
+}
+
+void VertexFormat::SetPackedNormals(bool packed)
+{
+	if (!interleaved)
+	{
+		return;
+	}
+
+	packedNormals = packed;
+
+	SetEncoding(NORMAL_BUFFER, packed ? ENCODING_INT_2_10_10_10 : ENCODING_SNORM16);
+	SetEncoding(TANGENT_BUFFER, packed ? ENCODING_INT_2_10_10_10 : ENCODING_SNORM16);
+}
+
+void VertexFormat::SetEncoding(MeshBuffer b, VertexEncoding encoding)
+{
+	VertexAttribute &a = attributes[b];
+
+	a.enabled = false;
+	a.encoding = encoding;
+	a.components = attributeComponents[b];
+	a.offset = 0;
+
+	switch (encoding)
+	{
+	case ENCODING_FLOAT:
+		a.type = GL_FLOAT;
+		a.normalised = GL_FALSE;
+		a.size = a.components * sizeof(float);
+		break;
+
+	case ENCODING_HALF:
+		a.type = GL_HALF_FLOAT;
+		a.normalised = GL_FALSE;
+		a.size = a.components * sizeof(unsigned short);
+		break;
+
+	case ENCODING_UNORM8:
+		a.type = GL_UNSIGNED_BYTE;
+		a.normalised = GL_TRUE;
+		a.size = a.components;
+		break;
+
+	case ENCODING_UNORM16:
+		a.type = GL_UNSIGNED_SHORT;
+		a.normalised = GL_TRUE;
+		a.size = a.components * sizeof(unsigned short);
+		break;
+
+	case ENCODING_SNORM16:
+		a.type = GL_SHORT;
+		a.normalised = GL_TRUE;
+		a.size = a.components * sizeof(short);
+		break;
+
+	case ENCODING_INT_2_10_10_10:
+		a.type = GL_INT_2_10_10_10_REV;
+		a.normalised = GL_TRUE;
+		a.components = 4;	// The format is always 4 components, the 2 bit w goes unused
+		a.size = sizeof(GLuint);
+		break;
+	}
+
+	// Keep every attribute 4 byte aligned
+	a.size = (a.size + 3) & ~3u;
+}
+
+void VertexFormat::FitBounds(const Vector3 *vertices, unsigned int numVertices)
+{
+	if (numVertices == 0)
+	{
+		SetBounds(Vector3(0.0f, 0.0f, 0.0f), 1.0f);
+		return;
+	}
+
+	Vector3 minimum = vertices[0];
+	Vector3 maximum = vertices[0];
+
+	for (unsigned int i = 1; i < numVertices; ++i)
+	{
+		const Vector3 &v = vertices[i];
+
+		if (v.x < minimum.x) minimum.x = v.x;
+		if (v.y < minimum.y) minimum.y = v.y;
+		if (v.z < minimum.z) minimum.z = v.z;
+
+		if (v.x > maximum.x) maximum.x = v.x;
+		if (v.y > maximum.y) maximum.y = v.y;
+		if (v.z > maximum.z) maximum.z = v.z;
+	}
+
+	// One scale for all three axes, so the dequant matrix is a uniform scale
+	Vector3 extent = maximum - minimum;
+	float scale = extent.x;
+
+	if (extent.y > scale) scale = extent.y;
+	if (extent.z > scale) scale = extent.z;
+
+	SetBounds(minimum, scale > 0.0f ? scale : 1.0f);
+}
+
+void VertexFormat::SetBounds(const Vector3 &minimum, float scale)
+{
+	boundsMin = minimum;
+	boundsScale = scale;
+	hasBounds = true;
+}
+
+Matrix4 VertexFormat::GetDequantMatrix() const
+{
+	Matrix4 m;
+
+	if (quantisePositions)
+	{
+		m = Matrix4::Translation(boundsMin) * Matrix4::Scale(Vector3(boundsScale, boundsScale, boundsScale));
+	}
+
+	return m;
+}
+
+GLuint VertexFormat::Layout(bool colours, bool texCoords, bool normals, bool tangents)
+{
+	bool present[VERTEXFORMAT_ATTRIBUTES] = { true, colours, texCoords, normals, tangents };
+
+	stride = 0;
+
+	for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+	{
+		attributes[i].enabled = present[i];
+		attributes[i].offset = present[i] ? stride : 0;
+
+		if (present[i])
+		{
+			stride += attributes[i].size;
+		}
+	}
+
+	return stride;
+}
+
+void VertexFormat::Pack(unsigned char *into, unsigned int numVertices, const Vector3 *vertices, const Vector4 *colours,
+						const Vector2 *texCoords, const Vector3 *normals, const Vector3 *tangents) const
+{
+	const float *sources[VERTEXFORMAT_ATTRIBUTES] = { (const float*)vertices, (const float*)colours, (const float*)texCoords,
+													  (const float*)normals, (const float*)tangents };
+
+	memset(into, 0, numVertices * stride);
+
+	float inverseScale = 1.0f / boundsScale;
+
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		unsigned char *vertex = into + v * stride;
+
+		for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+		{
+			const VertexAttribute &a = attributes[i];
+
+			if (!a.enabled || !sources[i])
+			{
+				continue;
+			}
+
+			const float *values = sources[i] + v * attributeComponents[i];
+			float quantised[3];
+
+			// Positions are stored relative to the bounding box
+			if (i == VERTEX_BUFFER && quantisePositions)
+			{
+				quantised[0] = (values[0] - boundsMin.x) * inverseScale;
+				quantised[1] = (values[1] - boundsMin.y) * inverseScale;
+				quantised[2] = (values[2] - boundsMin.z) * inverseScale;
+				values = quantised;
+			}
+
+			EncodeValues(vertex + a.offset, a.encoding, values, attributeComponents[i]);
+		}
+	}
+}
+
+void VertexFormat::Unpack(const unsigned char *from, unsigned int numVertices, Vector3 *vertices, Vector4 *colours,
+						  Vector2 *texCoords, Vector3 *normals, Vector3 *tangents) const
+{
+	float *targets[VERTEXFORMAT_ATTRIBUTES] = { (float*)vertices, (float*)colours, (float*)texCoords,
+												(float*)normals, (float*)tangents };
+
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		const unsigned char *vertex = from + v * stride;
+
+		for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+		{
+			const VertexAttribute &a = attributes[i];
+
+			if (!a.enabled || !targets[i])
+			{
+				continue;
+			}
+
+			float *values = targets[i] + v * attributeComponents[i];
+			DecodeValues(vertex + a.offset, a.encoding, values, attributeComponents[i]);
+
+			if (i == VERTEX_BUFFER && quantisePositions)
+			{
+				values[0] = boundsMin.x + values[0] * boundsScale;
+				values[1] = boundsMin.y + values[1] * boundsScale;
+				values[2] = boundsMin.z + values[2] * boundsScale;
+			}
+		}
+	}
+}
+
+void VertexFormat::SetAttribPointers() const
+{
+	for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+	{
+		const VertexAttribute &a = attributes[i];
+
+		if (a.enabled)
+		{
+			glVertexAttribPointer(i, a.components, a.type, a.normalised, stride, (const GLvoid*)(size_t)a.offset);
+			glEnableVertexAttribArray(i);
+		}
+	}
+}
+
+const char * VertexFormat::GetAttributeName(MeshBuffer b)
+{
+	return attributeNames[b];
+}
+
+void VertexFormat::Report(const std::string &name, unsigned int numVertices, const Vector3 *vertices, const Vector4 *colours,
+						  const Vector2 *texCoords, const Vector3 *normals, const Vector3 *tangents)
+{
+	const float *sources[VERTEXFORMAT_ATTRIBUTES] = { (const float*)vertices, (const float*)colours, (const float*)texCoords,
+													  (const float*)normals, (const float*)tangents };
+
+	unsigned int floatBytes = 0;
+
+	for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+	{
+		if (sources[i])
+		{
+			floatBytes += attributeComponents[i] * sizeof(float);
+		}
+	}
+
+	std::cout << "VertexFormat::Report " << name << ": " << numVertices << " vertices, separate floats "
+			  << floatBytes << " bytes/vertex (" << (floatBytes * numVertices) / 1024 << "KB)" << std::endl;
+
+	for (int quantise = 0; quantise < 2; ++quantise)
+	{
+		VertexFormat format = Interleaved(quantise == 1);
+		format.FitBounds(vertices, numVertices);
+		format.Layout(colours != NULL, texCoords != NULL, normals != NULL, tangents != NULL);
+
+		unsigned char *packed = new unsigned char[numVertices * format.GetStride()];
+		format.Pack(packed, numVertices, vertices, colours, texCoords, normals, tangents);
+
+		float *unpacked[VERTEXFORMAT_ATTRIBUTES];
+		for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+		{
+			unpacked[i] = sources[i] ? new float[numVertices * attributeComponents[i]] : NULL;
+		}
+
+		format.Unpack(packed, numVertices, (Vector3*)unpacked[VERTEX_BUFFER], (Vector4*)unpacked[COLOUR_BUFFER],
+					  (Vector2*)unpacked[TEXTURE_BUFFER], (Vector3*)unpacked[NORMAL_BUFFER], (Vector3*)unpacked[TANGENT_BUFFER]);
+
+		std::cout << "  interleaved" << (quantise ? ", quantised positions: " : ": ") << format.GetStride()
+				  << " bytes/vertex (" << (format.GetStride() * numVertices) / 1024 << "KB), max error";
+
+		for (int i = 0; i < VERTEXFORMAT_ATTRIBUTES; ++i)
+		{
+			if (!sources[i])
+			{
+				continue;
+			}
+
+			float maxError = 0.0f;
+
+			for (unsigned int j = 0; j < numVertices * attributeComponents[i]; ++j)
+			{
+				float error = fabsf(unpacked[i][j] - sources[i][j]);
+
+				if (error > maxError)
+				{
+					maxError = error;
+				}
+			}
+
+			std::cout << " " << attributeNames[i] << " " << maxError;
+			delete[] unpacked[i];
+		}
+
+		std::cout << std::endl;
+		delete[] packed;
+	}
+}
+
+unsigned short VertexFormat::FloatToHalf(float f)
+{
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(float));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	// Infinity and NaN
+	if (((bits >> 23) & 0xff) == 0xff)
+	{
+		return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+
+	// Too big, so it becomes infinity
+	if (exponent >= 31)
+	{
+		return (unsigned short)(sign | 0x7c00);
+	}
+
+	// Too small for a normal half, so it becomes a denormal, or zero
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+		{
+			return (unsigned short)sign;
+		}
+
+		mantissa |= 0x800000;
+
+		unsigned int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		unsigned int rest = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+
+		if (rest > halfway || (rest == halfway && (half & 1)))
+		{
+			++half;
+		}
+
+		return (unsigned short)(sign | half);
+	}
+
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1fff;
+
+	// Round to nearest even; a carry out of the mantissa correctly bumps the exponent
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+	{
+		++half;
+	}
+
+	return (unsigned short)half;
+}
+
+float VertexFormat::HalfToFloat(unsigned short h)
+{
+	unsigned int sign = (h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1f;
+	unsigned int mantissa = h & 0x3ff;
+	unsigned int bits;
+
+	if (exponent == 0)
+	{
+		float value = ldexpf((float)mantissa, -24);
+		return sign ? -value : value;
+	}
+	else if (exponent == 31)
+	{
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
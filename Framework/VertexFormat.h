@@ -0,0 +1,144 @@
+#pragma once
+
+/*
+ * Describes how a Mesh's vertex attributes are laid out in graphics memory.
+ *
+ * The default format is the original one: a separate VBO of 32 bit floats for
+ * each attribute. The interleaved format packs every attribute of a vertex
+ * into one struct in a single VBO, and shrinks them on the way:
+ *
+ *	position	3 floats, or 3 16 bit unorms in the mesh's bounding box
+ *	colour		4 unsigned bytes
+ *	texCoord	2 half floats
+ *	normal		10:10:10:2 signed normalised (4 shorts without GL 3.3)
+ *	tangent		10:10:10:2 signed normalised (4 shorts without GL 3.3)
+ *
+ * All of these are converted back to floats by the vertex fetch, so shaders
+ * keep the same 'in' variables. Quantised positions come out in the 0 to 1
+ * range, and GetDequantMatrix gives the matrix that puts them back, to be
+ * multiplied onto the model matrix. The bounding box is scaled uniformly, so
+ * folding it into the model matrix doesn't skew normals or tangents.
+ */
+#include <string>
+
+#include "GL/glew.h"
+
+#include "Vector2.h"
+#include "Vector3.h"
+#include "Vector4.h"
+#include "Matrix4.h"
+
+// Attribute slots of a mesh, which double as the shader attribute locations
+enum MeshBuffer
+{
+	VERTEX_BUFFER,
+	COLOUR_BUFFER,
+	TEXTURE_BUFFER,
+	NORMAL_BUFFER,
+	TANGENT_BUFFER,
+	INDEX_BUFFER,
+	MAX_BUFFER
+};
+
+// Number of vertex attribute slots (everything before the index buffer)
+#define VERTEXFORMAT_ATTRIBUTES		INDEX_BUFFER
+
+/*
+ * Locations past the Mesh buffers, for the static attributes of meshes that
+ * are skinned in the vertex shader: 4 joint indices, and then an array of 4
+ * weighted anchors, one location each.
+ */
+#define JOINT_INDEX_ATTRIBUTE		VERTEXFORMAT_ATTRIBUTES
+#define JOINT_ANCHOR_ATTRIBUTE		(VERTEXFORMAT_ATTRIBUTES + 1)
+
+// After those, the 4 columns of an instanced mesh's model matrix (see InstanceBuffer)
+#define INSTANCE_MATRIX_ATTRIBUTE	(JOINT_ANCHOR_ATTRIBUTE + 4)
+
+enum VertexEncoding
+{
+	ENCODING_FLOAT,
+	ENCODING_HALF,
+	ENCODING_UNORM8,
+	ENCODING_UNORM16,
+	ENCODING_SNORM16,
+	ENCODING_INT_2_10_10_10
+};
+
+struct VertexAttribute
+{
+	bool			enabled;
+	VertexEncoding	encoding;
+	GLint			components;	// As passed to glVertexAttribPointer
+	GLenum			type;
+	GLboolean		normalised;
+	GLuint			offset;		// Byte offset within the vertex
+	GLuint			size;		// Bytes per vertex, including padding
+};
+
+class VertexFormat
+{
+public:
+	// Separate full float buffers
+	VertexFormat();
+
+	static VertexFormat Interleaved(bool quantisePositions = false, bool packedNormals = true);
+
+	bool IsInterleaved() const			{ return interleaved; }
+	bool QuantisesPositions() const		{ return quantisePositions; }
+	bool UsesPackedNormals() const		{ return packedNormals; }
+
+	// Switches normals and tangents to 16 bit shorts, for contexts without 10:10:10:2 attributes
+	void SetPackedNormals(bool packed);
+
+	// Bounding box the quantised positions are relative to
+	void FitBounds(const Vector3 *vertices, unsigned int numVertices);
+	void SetBounds(const Vector3 &minimum, float scale);
+	bool HasBounds() const				{ return hasBounds; }
+	Matrix4 GetDequantMatrix() const;
+
+	// The uniform scale in GetDequantMatrix, for offsets given in the mesh's own units (1 without quantisation)
+	float GetDequantScale() const		{ return quantisePositions ? boundsScale : 1.0f; }
+
+	// Lays out the attributes a mesh actually has, and returns the stride of one vertex
+	GLuint Layout(bool colours, bool texCoords, bool normals, bool tangents);
+
+	GLuint GetStride() const								{ return stride; }
+	const VertexAttribute & GetAttribute(MeshBuffer b) const	{ return attributes[b]; }
+
+	// Converts the attribute arrays into interleaved vertices, using the current layout
+	void Pack(unsigned char *into, unsigned int numVertices, const Vector3 *vertices, const Vector4 *colours,
+			  const Vector2 *texCoords, const Vector3 *normals, const Vector3 *tangents) const;
+
+	// The reverse of Pack, for checking precision; any array can be NULL
+	void Unpack(const unsigned char *from, unsigned int numVertices, Vector3 *vertices, Vector4 *colours,
+				Vector2 *texCoords, Vector3 *normals, Vector3 *tangents) const;
+
+	// Sets up the attribute pointers of the layout, on the currently bound VAO and VBO
+	void SetAttribPointers() const;
+
+	static const char * GetAttributeName(MeshBuffer b);
+
+	/*
+	 * Prints the vertex memory of each format for the given arrays, and the
+	 * largest error each attribute picks up in a pack and unpack.
+	 */
+	static void Report(const std::string &name, unsigned int numVertices, const Vector3 *vertices, const Vector4 *colours,
+					   const Vector2 *texCoords, const Vector3 *normals, const Vector3 *tangents);
+
+	static unsigned short FloatToHalf(float f);
+	static float HalfToFloat(unsigned short h);
+
+protected:
+	void SetEncoding(MeshBuffer b, VertexEncoding encoding);
+
+	bool interleaved;
+	bool quantisePositions;
+	bool packedNormals;
+
+	bool hasBounds;
+	Vector3 boundsMin;
+	float boundsScale;
+
+	VertexAttribute attributes[VERTEXFORMAT_ATTRIBUTES];
+	GLuint stride;
+};
@@ -100,7 +100,7 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 
 	// frame buffer
 	glGenFramebuffers(1, &beckmannFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, beckmannFBO);
+	state->BindFramebuffer(beckmannFBO);
 
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, beckmannTex, 0);
 
@@ -109,14 +109,14 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state->BindFramebuffer(0);
 #pragma endregion
 
 
 #pragma region shadow map buffer
 	// depth texture
 	glGenTextures(1, &shadowTex);
-	glBindTexture(GL_TEXTURE_2D, shadowTex);
+	state->BindTexture(shadowTex);
 
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -125,11 +125,11 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, MAP_SIZE, MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	state->BindTexture(0);
 
 	// frame buffer
 	glGenFramebuffers(1, &shadowFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
+	state->BindFramebuffer(shadowFBO);
 
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,	GL_TEXTURE_2D, shadowTex, 0);
 	glDrawBuffer(GL_NONE);
@@ -139,30 +139,32 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state->BindFramebuffer(0);
 #pragma endregion
 
 
 #pragma region 1 non-convolved & 5 convolved irradiance textures
-	generateTexture(nonBlurredTexture, MAP_SIZE, MAP_SIZE);
+	// all read by every frame's mainPass, so they're held for good
+	nonBlurredTexture = targetPool.Acquire(MAP_SIZE, MAP_SIZE);
 
 	for (int i = 0; i < 5; ++i)
 	{
-		generateTexture(blurredTexture[i], MAP_SIZE, MAP_SIZE);
+		blurredTexture[i] = targetPool.Acquire(MAP_SIZE, MAP_SIZE);
 	}
 #pragma endregion
 
 
 #pragma region stretch map buffer
-	// depth texture
-	generateTexture(stretchDepthTex, MAP_SIZE, MAP_SIZE, true);
+	// depth texture, only needed while the stretch map is drawn, after which
+	// it goes back to the pool for unwrapMesh
+	stretchDepthTex = targetPool.Acquire(MAP_SIZE, MAP_SIZE, RENDERTARGET_DEPTH24_STENCIL8);
 
 	// colour texture
-	generateTexture(stretchColourTex, MAP_SIZE, MAP_SIZE);
+	stretchColourTex = targetPool.Acquire(MAP_SIZE, MAP_SIZE);
 		
 	// frame buffer
 	glGenFramebuffers(1, &stretchFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, stretchFBO);
+	state->BindFramebuffer(stretchFBO);
 
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,	GL_TEXTURE_2D, stretchDepthTex, 0);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, stretchDepthTex, 0);
@@ -173,20 +175,21 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state->BindFramebuffer(0);
 #pragma endregion
 
 
 #pragma region unwrap buffer
-	// depth texture
-	generateTexture(unwrapDepthTex, MAP_SIZE, MAP_SIZE, true);
+	// depth texture, taken from the pool each frame by unwrapMesh, so the
+	// frame buffer is checked with the stretch map's, which is the same kind
+	unwrapDepthTex = 0;
 
 	// frame buffer
 	glGenFramebuffers(1, &unwrapFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, unwrapFBO);
+	state->BindFramebuffer(unwrapFBO);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,	GL_TEXTURE_2D, unwrapDepthTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, unwrapDepthTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,	GL_TEXTURE_2D, stretchDepthTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, stretchDepthTex, 0);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, nonBlurredTexture, 0);
 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -194,13 +197,13 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state->BindFramebuffer(0);
 #pragma endregion
 
 
 #pragma region blur buffer
-	// colour texture
-	generateTexture(tempColourTex, MAP_SIZE, MAP_SIZE);
+	// colour texture, taken from the pool each frame by blurPass
+	tempColourTex = 0;
 
 	// frame buffer
 	glGenFramebuffers(1, &blurFBO);
@@ -208,10 +211,12 @@ Renderer::Renderer(Window &parent) : OGLRenderer(parent)
 
 
 #pragma region OpenGL & others variables
-	glEnable(GL_DEPTH_TEST);
+	state->Enable(GL_DEPTH_TEST);
 
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
 
+	reportedTargetBytes = 0;
+
 	firstFrame = true;
 	useBlur = true;
 	useStretch = true;
@@ -242,24 +247,9 @@ Renderer::~Renderer(void)
 	glDeleteFramebuffers(1, &shadowFBO);
 
 
-	// Textures
-	glDeleteTextures(1, &nonBlurredTexture);
-	glDeleteTextures(5, blurredTexture);
-
-
-	// stretch buffer
-	glDeleteTextures(1, &stretchColourTex);
-	glDeleteTextures(1, &stretchDepthTex);
+	// stretch, unwrap & blur buffers; the pool deletes their textures
 	glDeleteFramebuffers(1, &stretchFBO);
-
-
-	// unwrap buffer
-	glDeleteTextures(1, &unwrapDepthTex);
 	glDeleteFramebuffers(1, &unwrapFBO);
-
-
-	// blur buffer
-	glDeleteTextures(1, &tempColourTex);
 	glDeleteFramebuffers(1, &blurFBO);
 
 
@@ -276,7 +266,7 @@ Renderer::~Renderer(void)
 void Renderer::generateTexture(GLuint &into, float width, float height, bool depth_stencil)
 {
 	glGenTextures(1, &into);
-	glBindTexture(GL_TEXTURE_2D, into);
+	state->BindTexture(into);
 
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -290,7 +280,7 @@ void Renderer::generateTexture(GLuint &into, float width, float height, bool dep
 				 depth_stencil ? GL_UNSIGNED_INT_24_8	: GL_UNSIGNED_BYTE, 
 				 NULL);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	state->BindTexture(0);
 }
 
 void Renderer::drawQuad(GLuint &texture, Vector2 &pos, float w, float h)
@@ -302,7 +292,7 @@ void Renderer::drawQuad(GLuint &texture, Vector2 &pos, float w, float h)
 	SetCurrentShader(basicShader);
 
 	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
+	currentShader->SetUniform("diffuseTex", 0);
 
 	// matrices
 	viewMatrix.ToIdentity();
@@ -317,7 +307,7 @@ void Renderer::drawQuad(GLuint &texture, Vector2 &pos, float w, float h)
 	quad->Draw();
 
 	// clean up
-	glUseProgram(0);
+	state->UseProgram(0);
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
 }
 
@@ -371,11 +361,15 @@ void Renderer::RenderScene()
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	state->BeginFrame();
+	targetPool.BeginFrame();
+
 	if (firstFrame)
 	{
 		computeBeckmannTex();
 		computeStretchMap();
 
+		targetPool.Release(stretchDepthTex);
 		firstFrame = false;
 	}
 
@@ -384,16 +378,22 @@ void Renderer::RenderScene()
 	blurPass();
 	mainPass();
 
+	if (targetPool.GetPeakBytesAllocated() > reportedTargetBytes)
+	{
+		targetPool.PrintStats("SSS");
+		reportedTargetBytes = targetPool.GetPeakBytesAllocated();
+	}
+
 	GL_BREAKPOINT
 	SwapBuffers();
-	glUseProgram(0);
+	state->UseProgram(0);
 }
 
 void Renderer::computeBeckmannTex()
 {
 	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, beckmannFBO);
-	glViewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
+	state->BindFramebuffer(beckmannFBO);
+	state->Viewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
@@ -410,16 +410,16 @@ void Renderer::computeBeckmannTex()
 	quad->Draw();
 
 	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0.0f, 0.0f, (float)width, (float)height);
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0.0f, 0.0f, (float)width, (float)height);
 }
 
 void Renderer::computeStretchMap()
 {
 	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, stretchFBO);
-	glViewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
+	state->BindFramebuffer(stretchFBO);
+	state->Viewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
@@ -436,16 +436,16 @@ void Renderer::computeStretchMap()
 	drawMesh();
 
 	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0.0f, 0.0f, (float)width, (float)height);
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0.0f, 0.0f, (float)width, (float)height);
 }
 
 void Renderer::shadowPass()
 {
 	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-	glViewport(0, 0, MAP_SIZE, MAP_SIZE);
+	state->BindFramebuffer(shadowFBO);
+	state->Viewport(0, 0, MAP_SIZE, MAP_SIZE);
 	glClear(GL_DEPTH_BUFFER_BIT);
 	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
@@ -464,16 +464,21 @@ void Renderer::shadowPass()
 
 	// clean up
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glViewport(0, 0, width, height);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(0);
+	state->Viewport(0, 0, width, height);
+	state->BindFramebuffer(0);
+	state->UseProgram(0);
 }
 
 void Renderer::unwrapMesh()
 {
+	// render target, only for depth testing the unwrap itself
+	unwrapDepthTex = targetPool.Acquire(MAP_SIZE, MAP_SIZE, RENDERTARGET_DEPTH24_STENCIL8);
+
 	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, unwrapFBO);
-	glViewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
+	state->BindFramebuffer(unwrapFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,	GL_TEXTURE_2D, unwrapDepthTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, unwrapDepthTex, 0);
+	state->Viewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
@@ -481,16 +486,15 @@ void Renderer::unwrapMesh()
 	SetCurrentShader(unwrapShader);
 	
 	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "bumpTex"), 1);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "shadowTex"), 2);
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("bumpTex", 1);
+	currentShader->SetUniform("shadowTex", 2);
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, shadowTex);
+	state->BindTexture(2, shadowTex);
 
 	// shader light variables
 	SetShaderLight(*light);
-	glUniform3fv(glGetUniformLocation(currentShader->GetProgram(), "cameraPos"), 1, (float*)&camera->GetPosition());
+	currentShader->SetUniform("cameraPos", camera->GetPosition());
 
 	// matrices
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0, FOV);
@@ -502,35 +506,39 @@ void Renderer::unwrapMesh()
 	drawMesh();
 
 	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0.0f, 0.0f, (float)width, (float)height);
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0.0f, 0.0f, (float)width, (float)height);
+
+	targetPool.Release(unwrapDepthTex);
 }
 
 void Renderer::blurPass()
 {
+	// render target
+	tempColourTex = targetPool.Acquire(MAP_SIZE, MAP_SIZE);
+
 	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, blurFBO);
+	state->BindFramebuffer(blurFBO);
 	
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
-	glDisable(GL_DEPTH_TEST);
-	glViewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
+	state->Disable(GL_DEPTH_TEST);
+	state->Viewport(0.0f, 0.0f, MAP_SIZE, MAP_SIZE);
 
 	// shader
 	SetCurrentShader(blurShader);
 
 	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "stretchTex"), 2);
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("stretchTex", 2);
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, stretchColourTex);
+	state->BindTexture(2, stretchColourTex);
 
 	// shader variables
-	glUniform2f(glGetUniformLocation(currentShader->GetProgram(), "pixelSize"), 1.0f/MAP_SIZE, 1.0f/MAP_SIZE);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "useStretch"), useStretch);
+	currentShader->SetUniform("pixelSize", Vector2(1.0f/MAP_SIZE, 1.0f/MAP_SIZE));
+	currentShader->SetUniform("useStretch", useStretch);
 
 	// matrices
 	modelMatrix.ToIdentity();
@@ -550,21 +558,23 @@ void Renderer::blurPass()
 	uvPass(blurredTexture[3], blurredTexture[4]);
 
 	// clean up
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(0);
-	glEnable(GL_DEPTH_TEST);
-	glViewport(0.0f, 0.0f, (float)width, (float)height);
+	state->BindFramebuffer(0);
+	state->UseProgram(0);
+	state->Enable(GL_DEPTH_TEST);
+	state->Viewport(0.0f, 0.0f, (float)width, (float)height);
+
+	targetPool.Release(tempColourTex);
 }
 
 void Renderer::uvPass(GLuint &sourceTex, GLuint &targetTex)
 {
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "xAxis"), true);
+	currentShader->SetUniform("xAxis", true);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tempColourTex, 0);
 
 	quad->SetTexture(sourceTex);
 	quad->Draw();
 
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "xAxis"), false);
+	currentShader->SetUniform("xAxis", false);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTex, 0);
 
 	quad->SetTexture(tempColourTex);
@@ -577,39 +587,31 @@ void Renderer::mainPass()
 	SetCurrentShader(mainShader);
 	
 	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "bumpTex"), 1);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "shadowTex"), 2);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "beckmannTex"), 3);
-
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex1"), 5);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex2"), 6);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex3"), 7);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex4"), 8);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex5"), 9);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex6"), 10);
-
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, shadowTex);
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, beckmannTex);
-
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, nonBlurredTexture);
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[0]);
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[1]);
-	glActiveTexture(GL_TEXTURE8);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[2]);
-	glActiveTexture(GL_TEXTURE9);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[3]);
-	glActiveTexture(GL_TEXTURE10);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[4]);
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("bumpTex", 1);
+	currentShader->SetUniform("shadowTex", 2);
+	currentShader->SetUniform("beckmannTex", 3);
+
+	currentShader->SetUniform("blurredTex1", 5);
+	currentShader->SetUniform("blurredTex2", 6);
+	currentShader->SetUniform("blurredTex3", 7);
+	currentShader->SetUniform("blurredTex4", 8);
+	currentShader->SetUniform("blurredTex5", 9);
+	currentShader->SetUniform("blurredTex6", 10);
+
+	state->BindTexture(2, shadowTex);
+	state->BindTexture(3, beckmannTex);
+
+	state->BindTexture(5, nonBlurredTexture);
+	state->BindTexture(6, blurredTexture[0]);
+	state->BindTexture(7, blurredTexture[1]);
+	state->BindTexture(8, blurredTexture[2]);
+	state->BindTexture(9, blurredTexture[3]);
+	state->BindTexture(10, blurredTexture[4]);
 
 	// shader variables
-	glUniform3fv(glGetUniformLocation(currentShader->GetProgram(), "cameraPos"), 1, (float*)&camera->GetPosition());
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "useBlur"), useBlur);
+	currentShader->SetUniform("cameraPos", camera->GetPosition());
+	currentShader->SetUniform("useBlur", useBlur);
 
 	// shader light variables
 	SetShaderLight(*light);
@@ -625,7 +627,7 @@ void Renderer::mainPass()
 	drawLight();
 
 	// clean up
-	glUseProgram(0);
+	state->UseProgram(0);
 }
 
 void Renderer::drawMesh()
@@ -633,7 +635,7 @@ void Renderer::drawMesh()
 	modelMatrix = Matrix4::Translation(Vector3(0.0f, 0.0f, 0.0f)) * Matrix4::Scale(Vector3(1.0f, 1.0f, 1.0f));
 
 	Matrix4 tempMatrix = shadowMatrix * modelMatrix;
-	glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "shadowMatrix"), 1, false, *&tempMatrix.values);
+	currentShader->SetUniform("shadowMatrix", tempMatrix);
 
 	UpdateShaderMatrices();
 
@@ -3,6 +3,7 @@
 #include "../Framework/OGLRenderer.h"
 #include "../Framework/Camera.h"
 #include "../Framework/OBJMesh.h"
+#include "../Framework/RenderTargetPool.h"
 
 #define ZNEAR		0.1f
 #define ZFAR		10.0f
@@ -61,6 +62,14 @@ protected:
 	Shader *mainShader;
 
 	
+	// Every render target but the Beckmann texture and the shadow map. The
+	// unwrap and blur passes take theirs from here each frame and give them
+	// back at the end of the pass, so the stretch map's depth buffer, which
+	// is only used once, is the unwrap's from then on.
+	RenderTargetPool targetPool;
+	size_t reportedTargetBytes;
+
+
 	// Beckmann Texture buffer
 	GLuint beckmannFBO;
 	GLuint beckmannTex;
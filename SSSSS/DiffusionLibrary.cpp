@@ -0,0 +1,305 @@
+#include "DiffusionLibrary.h"
+
+#include <iostream>
+
+#include "../Framework/Common.h"
+
+DiffusionLibrary & DiffusionLibrary::Get()
+{
+	static DiffusionLibrary library;
+	return library;
+}
+
+DiffusionLibrary::DiffusionLibrary()
+{
+	revision = 0;
+	materials.resize(2);
+
+	/*
+	 * The sums the materials have always been drawn with. The skin's first
+	 * Gaussian is too narrow to be noticeable, so the unblurred image stands
+	 * in for it; the marble's is wide, so the unblurred image is given a
+	 * weight of its own on top
+	 */
+	const float skinVariances[4] = { 0.0f, 0.0516500425655f, 0.271928080903f, 2.00626388153f };
+	const Vector3 skinWeights[4] =
+	{
+		Vector3(0.240516183695f, 0.447403391891f, 0.615796108321f),
+		Vector3(0.115857499765f, 0.366176401412f, 0.343917471552f),
+		Vector3(0.183619017698f, 0.186420206697f, 0.0f),
+		Vector3(0.460007298842f, 0.0f, 0.0402864201267f)
+	};
+
+	const float marbleVariances[5] = { 0.0f, 0.0362208693441f, 0.114450574559f, 0.455584392509f, 3.48331959682f };
+	const Vector3 marbleWeights[5] =
+	{
+		Vector3(0.2f, 0.2f, 0.2f),
+		Vector3(0.0544578254963f, 0.12454890956f, 0.217724878147f),
+		Vector3(0.243663230592f, 0.243532369381f, 0.18904245481f),
+		Vector3(0.310530428621f, 0.315816663292f, 0.374244725886f),
+		Vector3(0.391348515291f, 0.316102057768f, 0.218987941157f)
+	};
+
+	materials[SSS_SKIN].name = "skin";
+	materials[SSS_SKIN].shipped.variances.assign(skinVariances, skinVariances + 4);
+	materials[SSS_SKIN].shipped.weights.assign(skinWeights, skinWeights + 4);
+
+	materials[SSS_MARBLE].name = "marble";
+	materials[SSS_MARBLE].shipped.variances.assign(marbleVariances, marbleVariances + 5);
+	materials[SSS_MARBLE].shipped.weights.assign(marbleWeights, marbleWeights + 5);
+
+	// Their profiles, until they're read from a file: d'Eon and Luebke's six Gaussians for skin
+	const float deonVariances[6] = { 0.0064f, 0.0484f, 0.187f, 0.567f, 1.99f, 7.41f };
+	const Vector3 deonWeights[6] =
+	{
+		Vector3(0.233f, 0.455f, 0.649f),
+		Vector3(0.100f, 0.336f, 0.344f),
+		Vector3(0.118f, 0.198f, 0.0f),
+		Vector3(0.113f, 0.007f, 0.007f),
+		Vector3(0.358f, 0.004f, 0.0f),
+		Vector3(0.078f, 0.0f, 0.0f)
+	};
+
+	materials[SSS_SKIN].profile.SetGaussians(std::vector<float>(deonVariances, deonVariances + 6),
+											 std::vector<Vector3>(deonWeights, deonWeights + 6));
+
+	// and Jensen et al.'s marble, out to where the shipped sum's widest Gaussian has all but gone
+	materials[SSS_MARBLE].profile.SetDipole(Vector3(0.0021f, 0.0041f, 0.0071f), Vector3(2.19f, 2.62f, 3.00f), 1.5f);
+	materials[SSS_MARBLE].profile.SetRadius(8.0f);
+
+	for (int m = 0; m < 2; ++m)
+	{
+		materials[m].numGaussians = 0;
+		materials[m].shipped.rmsError = materials[m].shipped.errorBound = 0.0f;
+		materials[m].fit = materials[m].shipped;
+		Build((SSSMaterial)m);
+	}
+
+	transmittance.variances = materials[SSS_SKIN].profile.GetVariances();
+	transmittance.weights = materials[SSS_SKIN].profile.GetWeights();
+}
+
+bool DiffusionLibrary::Load(SSSMaterial material, const std::string &filename)
+{
+	Material &m = materials[material];
+	DiffusionProfile profile;
+
+	if (!profile.Load(filename))
+	{
+		return false;
+	}
+
+	m.profile = profile;
+
+	// The transmittance keeps the skin's Gaussians, or the closest there are to them
+	if (material == SSS_SKIN)
+	{
+		if (profile.GetSource() == DIFFUSION_GAUSSIANS)
+		{
+			transmittance.variances = profile.GetVariances();
+			transmittance.weights = profile.GetWeights();
+		}
+		else if (!profile.FitCached(DIFFUSIONPROFILE_MAX_GAUSSIANS, transmittance))
+		{
+			std::cout << "DiffusionLibrary: Couldn't fit the transmittance to " << filename << std::endl;
+			return false;
+		}
+	}
+
+	++revision;
+
+	// what it's drawn with is fitted to what was read
+	if (m.numGaussians > 0)
+	{
+		unsigned int n = m.numGaussians;
+		m.numGaussians = 0;
+
+		if (!SetNumGaussians(material, n))
+		{
+			SetNumGaussians(material, 0);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool DiffusionLibrary::AddMaterial(const std::string &name, const DiffusionProfile &profile, unsigned int numGaussians,
+								   SSSMaterial &material)
+{
+	if (materials.size() >= DIFFUSIONLIBRARY_MAX_MATERIALS)
+	{
+		std::cout << "DiffusionLibrary: No room for " << name << ", there are already " << materials.size() << " materials" << std::endl;
+		return false;
+	}
+
+	Material m;
+	m.name = name;
+	m.profile = profile;
+	m.numGaussians = 0;
+
+	// what it's drawn with to begin with stands in for a shipped sum
+	if (numGaussians < 2 || numGaussians > DIFFUSIONLIBRARY_MAX_FIT || !profile.FitCached(numGaussians, m.shipped))
+	{
+		std::cout << "DiffusionLibrary: Couldn't fit " << name << " with " << numGaussians << " Gaussians" << std::endl;
+		return false;
+	}
+
+	m.fit = m.shipped;
+	materials.push_back(m);
+
+	material = (SSSMaterial)(materials.size() - 1);
+	Build(material);
+	++revision;
+
+	return true;
+}
+
+void DiffusionLibrary::RemoveMaterials(SSSMaterial first)
+{
+	if ((unsigned int)first < 2 || (unsigned int)first >= materials.size())
+	{
+		return;
+	}
+
+	materials.resize(first);
+	++revision;
+}
+
+bool DiffusionLibrary::SetNumGaussians(SSSMaterial material, unsigned int n)
+{
+	Material &m = materials[material];
+
+	if (n == m.numGaussians)
+	{
+		return true;
+	}
+
+	if (n == 0)
+	{
+		m.fit = m.shipped;
+	}
+	else
+	{
+		DiffusionFit fit;
+
+		if (n < 2 || n > DIFFUSIONLIBRARY_MAX_FIT || !m.profile.FitCached(n, fit))
+		{
+			std::cout << "DiffusionLibrary: Couldn't fit " << m.name << " with " << n << " Gaussians" << std::endl;
+			return false;
+		}
+		m.fit = fit;
+	}
+
+	m.numGaussians = n;
+	Build(material);
+	++revision;
+
+	return true;
+}
+
+void DiffusionLibrary::Build(SSSMaterial material)
+{
+	Material &m = materials[material];
+	unsigned int n = (unsigned int)m.fit.variances.size();
+
+	// Each level is blurred from the one before, the first from the unblurred image, as if that had a variance of 0
+	std::vector<float> variances(m.fit.variances.begin() + 1, m.fit.variances.end());
+	std::vector<Vector3> weights(m.fit.weights);
+
+	m.gaussians = Gaussian::gaussianSum(&variances[0], &weights[0], (int)n - 1);
+	m.weights.resize(n * 3);
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		m.weights[i * 3 + 0] = m.fit.weights[i].x;
+		m.weights[i * 3 + 1] = m.fit.weights[i].y;
+		m.weights[i * 3 + 2] = m.fit.weights[i].z;
+	}
+}
+
+unsigned int DiffusionLibrary::GetNumLevels(unsigned int materials) const
+{
+	unsigned int numLevels = 0;
+
+	for (unsigned int m = 0; m < this->materials.size(); ++m)
+	{
+		if (materials & (1u << m))
+		{
+			numLevels = max(numLevels, (unsigned int)this->materials[m].gaussians.size());
+		}
+	}
+	return min(numLevels, (unsigned int)DIFFUSIONLIBRARY_MAX_LEVELS);
+}
+
+void DiffusionLibrary::FillBlock(DiffusionBlock &block) const
+{
+	for (int p = 0; p < DIFFUSIONLIBRARY_PROFILES; ++p)
+	{
+		DiffusionBlock::Profile &profile = block.profiles[p];
+
+		// a slot without a material is left with nothing in it
+		const DiffusionFit *fit = p == DIFFUSIONLIBRARY_TRANSMITTANCE ? &transmittance :
+								  p < (int)materials.size() ? &materials[p].fit : NULL;
+		unsigned int count = fit ? min((unsigned int)fit->variances.size(), (unsigned int)DIFFUSIONPROFILE_MAX_GAUSSIANS) : 0;
+		float variance = 0.0f;
+
+		for (unsigned int i = 0; i < DIFFUSIONPROFILE_MAX_GAUSSIANS; ++i)
+		{
+			Vector3 weight = i < count ? fit->weights[i] : Vector3(0.0f, 0.0f, 0.0f);
+
+			profile.gaussians[i][0] = weight.x;
+			profile.gaussians[i][1] = weight.y;
+			profile.gaussians[i][2] = weight.z;
+
+			// a material's first is drawn as the unblurred image, and the levels past its last blur by nothing
+			if (i < count && (i > 0 || p == DIFFUSIONLIBRARY_TRANSMITTANCE))
+			{
+				variance = fit->variances[i];
+			}
+			profile.gaussians[i][3] = variance;
+		}
+
+		profile.count[0] = (int)count;
+		profile.count[1] = profile.count[2] = profile.count[3] = 0;
+	}
+}
+
+void DiffusionLibrary::PrintFit(SSSMaterial material) const
+{
+	const Material &m = materials[material];
+	unsigned int n = (unsigned int)m.fit.variances.size();
+
+	std::cout << "DiffusionLibrary: " << m.name << " drawn with ";
+
+	if (m.numGaussians == 0 && material <= SSS_MARBLE)
+	{
+		std::cout << "the " << n << " Gaussians it's shipped with";
+	}
+	else
+	{
+		std::cout << n << " Gaussians fitted to ";
+
+		if (m.profile.GetFilename().empty())
+		{
+			std::cout << "its built in profile";
+		}
+		else
+		{
+			std::cout << m.profile.GetFilename();
+		}
+	}
+
+	std::cout << " (" << n - 1 << " blur levels): variances ";
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		std::cout << m.fit.variances[i] << (i + 1 < n ? ", " : " mm^2");
+	}
+
+	if (m.numGaussians > 0 || material > SSS_MARBLE)
+	{
+		std::cout << ", rms error " << 100.0f * m.fit.rmsError << "%, error bound " << 100.0f * m.fit.errorBound << "%";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+/*
+ * Each material's diffusion profile, and the sum of Gaussians sssPass,
+ * accumulationPass and SSSReference draw it with, in one place for every
+ * shader to read through the DiffusionProfiles uniform block.
+ *
+ * Skin and marble start with the sums they've always shipped with (the
+ * skin's four, the marble's five), and their profiles (d'Eon and Luebke's six
+ * Gaussians, Jensen's dipole for marble) can be read from a .profile file
+ * and fitted with fewer or more instead (SetNumGaussians). Up to
+ * DIFFUSIONLIBRARY_MAX_MATERIALS materials in all can be drawn, the rest
+ * added with a fit of a profile of their own (AddMaterial). A fit's
+ * narrowest Gaussian is drawn as the unblurred image, as the shipped sums'
+ * first is, and each of the rest is a blur level, blurred from the level
+ * before by the difference of their variances. So a fit of n Gaussians takes
+ * n - 1 levels, of which there can be DIFFUSIONLIBRARY_MAX_LEVELS.
+ *
+ * Each pixel's material is mainPass's to write, as its SSSMaterial, in the
+ * linear depth target's green channel, and the blurs and the accumulation
+ * look its profile up with it. A frame runs as many levels as the material
+ * drawn with the most has (GetNumLevels), however many materials that is;
+ * where a pixel's material has fewer, the levels past its own are blurred by
+ * nothing and added up with no weight.
+ *
+ * The block has a profile for each material, by its SSSMaterial, then the one
+ * mainFrag.glsl's transmittance is worked out with: the skin's own
+ * Gaussians, as they were read, whatever it's drawn with, or the most a fit
+ * can have of a skin profile that isn't a sum of them. Each is a count and
+ * DIFFUSIONPROFILE_MAX_GAUSSIANS vec4s, a Gaussian's weight in rgb and its
+ * variance in a, 0 for the unblurred image. Past the count the weights are 0
+ * and the variances the last one's, so every level's width is there to read:
+ *
+ *   struct DiffusionProfile { vec4 gaussians[6]; ivec4 count; };
+ *   layout(std140) uniform DiffusionProfiles { DiffusionProfile profiles[17]; };
+ *
+ * A shader with the block has to have it bound to DIFFUSIONLIBRARY_BINDING
+ * (Shader::BindUniformBlock), and DiffusionBlock is what's uploaded into it.
+ */
+#include <string>
+#include <vector>
+
+#include "DiffusionProfile.h"
+#include "Gaussian.h"
+
+// Binding point of the DiffusionProfiles block (MD5Mesh's palette has 0)
+#define DIFFUSIONLIBRARY_BINDING		1
+
+// Most materials; the ID mainPass writes has 8 bits, so it's only the block's size that limits them
+#define DIFFUSIONLIBRARY_MAX_MATERIALS	16
+
+// Profiles in the block: a material's at its SSSMaterial, and the transmittance's
+#define DIFFUSIONLIBRARY_PROFILES		(DIFFUSIONLIBRARY_MAX_MATERIALS + 1)
+#define DIFFUSIONLIBRARY_TRANSMITTANCE	DIFFUSIONLIBRARY_MAX_MATERIALS
+
+// Most blur levels a material's drawn with, and so most Gaussians in a fit
+#define DIFFUSIONLIBRARY_MAX_LEVELS		4
+#define DIFFUSIONLIBRARY_MAX_FIT		(DIFFUSIONLIBRARY_MAX_LEVELS + 1)
+
+enum SSSMaterial
+{
+	SSS_SKIN,	// The head
+	SSS_MARBLE,	// The knight
+
+	// Added ones follow these, up to
+	SSS_MAX_MATERIALS = DIFFUSIONLIBRARY_MAX_MATERIALS
+};
+
+// The DiffusionProfiles block, laid out as std140 lays it out
+struct DiffusionBlock
+{
+	struct Profile
+	{
+		float	gaussians[DIFFUSIONPROFILE_MAX_GAUSSIANS][4];
+		int		count[4];
+	};
+
+	Profile		profiles[DIFFUSIONLIBRARY_PROFILES];
+};
+
+class DiffusionLibrary
+{
+public:
+	static DiffusionLibrary & Get();
+
+	// Reads a material's profile, refitting it if it's drawn with a fit. Returns false, printing why, if it can't
+	bool Load(SSSMaterial material, const std::string &filename);
+
+	/*
+	 * Adds a material drawn with a fit of profile with numGaussians Gaussians,
+	 * from 2 to DIFFUSIONLIBRARY_MAX_FIT, which is what it goes back to for
+	 * SetNumGaussians(0). Returns false, printing why, if there's no room
+	 * left or it can't be fitted
+	 */
+	bool AddMaterial(const std::string &name, const DiffusionProfile &profile, unsigned int numGaussians,
+					 SSSMaterial &material);
+
+	// Drops every material added from first on
+	void RemoveMaterials(SSSMaterial first);
+
+	unsigned int GetNumMaterials() const	{ return (unsigned int)materials.size(); }
+
+	const std::string & GetName(SSSMaterial material) const		{ return materials[material].name; }
+
+	/*
+	 * Draws a material with a fit of its profile with n Gaussians, from 2 to
+	 * DIFFUSIONLIBRARY_MAX_FIT, from the cache if it's there, or with the sum
+	 * it's shipped with for 0. Returns false, leaving it as it was, if it can't
+	 */
+	bool SetNumGaussians(SSSMaterial material, unsigned int n);
+
+	// 0 if it's drawn with the shipped sum
+	unsigned int GetNumGaussians(SSSMaterial material) const		{ return materials[material].numGaussians; }
+
+	const DiffusionProfile & GetProfile(SSSMaterial material) const	{ return materials[material].profile; }
+
+	// What it's drawn with, the unblurred image first
+	const DiffusionFit & GetFit(SSSMaterial material) const			{ return materials[material].fit; }
+
+	// Its blur levels, each blurring the one before
+	const std::vector<Gaussian> & GetGaussians(SSSMaterial material) const	{ return materials[material].gaussians; }
+
+	// Per channel weight of each of the accumulation's taps, the unblurred colour first
+	unsigned int GetNumAccumulationTaps(SSSMaterial material) const	{ return (unsigned int)materials[material].fit.weights.size(); }
+	const float * GetAccumulationWeights(SSSMaterial material) const	{ return &materials[material].weights[0]; }
+
+	/*
+	 * The levels a frame drawing a set of materials runs: the most any of
+	 * them has. Bit m of materials is SSSMaterial m
+	 */
+	unsigned int GetNumLevels(unsigned int materials) const;
+
+	// Every material's
+	unsigned int GetAllMaterials() const	{ return (1u << materials.size()) - 1; }
+
+	// Goes up every time anything in the block changes
+	unsigned int GetRevision() const		{ return revision; }
+
+	void FillBlock(DiffusionBlock &block) const;
+
+	// What a material's drawn with, and how far that is from its profile
+	void PrintFit(SSSMaterial material) const;
+
+protected:
+	DiffusionLibrary();
+
+	// The levels and accumulation weights from the fit
+	void Build(SSSMaterial material);
+
+	struct Material
+	{
+		std::string				name;
+		DiffusionProfile		profile;
+		DiffusionFit			shipped;
+		DiffusionFit			fit;
+		unsigned int			numGaussians;
+		std::vector<Gaussian>	gaussians;
+		std::vector<float>		weights;
+	};
+
+	std::vector<Material>	materials;
+	DiffusionFit			transmittance;
+	unsigned int			revision;
+};
@@ -0,0 +1,1174 @@
+#include "DiffusionProfile.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "../Framework/Common.h"
+#include "../Framework/MeshCache.h"
+#include "../Framework/GameTimer.h"
+
+// What ReadFit and WriteFit expect at the start of a cached fit, before its floats
+struct DiffusionFitHeader
+{
+	unsigned int		magic;
+	unsigned int		version;
+	unsigned long long	sourceHash;
+	unsigned int		numGaussians;
+	unsigned int		padding;
+};
+
+static inline float Channel(const Vector3 &v, int c)
+{
+	return c == 0 ? v.x : (c == 1 ? v.y : v.z);
+}
+
+static inline void SetChannel(Vector3 &v, int c, float value)
+{
+	if (c == 0)			v.x = value;
+	else if (c == 1)	v.y = value;
+	else				v.z = value;
+}
+
+// A Gaussian of variance v, r from its centre, adding up to 1 over the plane
+static inline double Gaussian2D(double v, double r)
+{
+	return exp(-r * r / (2.0 * v)) / (2.0 * PI * v);
+}
+
+// Jensen et al.'s dipole: the light coming back out r from where it went in, for one channel
+static double Dipole(double sigmaA, double sigmaSPrime, double eta, double r)
+{
+	double sigmaTPrime = sigmaA + sigmaSPrime;
+	double albedo = sigmaSPrime / sigmaTPrime;
+	double sigmaTr = sqrt(3.0 * sigmaA * sigmaTPrime);
+
+	// The boundary condition, from the diffuse Fresnel reflectance
+	double fdr = -1.440 / (eta * eta) + 0.710 / eta + 0.668 + 0.0636 * eta;
+	double a = (1.0 + fdr) / (1.0 - fdr);
+
+	// The real source below the surface, and the virtual one above it
+	double zr = 1.0 / sigmaTPrime;
+	double zv = zr * (1.0 + 4.0 * a / 3.0);
+	double dr = sqrt(r * r + zr * zr);
+	double dv = sqrt(r * r + zv * zv);
+
+	return albedo / (4.0 * PI) * (zr * (sigmaTr * dr + 1.0) * exp(-sigmaTr * dr) / (dr * dr * dr) +
+								  zv * (sigmaTr * dv + 1.0) * exp(-sigmaTr * dv) / (dv * dv * dv));
+}
+
+// Solves the n by n system a x = b by Gaussian elimination with partial pivoting, overwriting a and b
+static bool SolveLinear(double *a, double *b, unsigned int n, double *x)
+{
+	for (unsigned int col = 0; col < n; ++col)
+	{
+		unsigned int pivot = col;
+
+		for (unsigned int row = col + 1; row < n; ++row)
+		{
+			if (fabs(a[row * n + col]) > fabs(a[pivot * n + col]))
+			{
+				pivot = row;
+			}
+		}
+
+		if (fabs(a[pivot * n + col]) < 1e-300)
+		{
+			return false;
+		}
+
+		if (pivot != col)
+		{
+			for (unsigned int k = 0; k < n; ++k)
+			{
+				std::swap(a[col * n + k], a[pivot * n + k]);
+			}
+			std::swap(b[col], b[pivot]);
+		}
+
+		for (unsigned int row = col + 1; row < n; ++row)
+		{
+			double f = a[row * n + col] / a[col * n + col];
+
+			for (unsigned int k = col; k < n; ++k)
+			{
+				a[row * n + k] -= f * a[col * n + k];
+			}
+			b[row] -= f * b[col];
+		}
+	}
+
+	for (int row = (int)n - 1; row >= 0; --row)
+	{
+		double sum = b[row];
+
+		for (unsigned int k = row + 1; k < n; ++k)
+		{
+			sum -= a[row * n + k] * x[k];
+		}
+		x[row] = sum / a[row * n + row];
+	}
+	return true;
+}
+
+// The normal equations restricted to the columns in set, solved into z, which is 0 elsewhere
+static bool SolveSubset(const double *AtA, const double *Atb, unsigned int n, const bool *set, double *z)
+{
+	unsigned int index[DIFFUSIONPROFILE_MAX_GAUSSIANS * 2];
+	unsigned int m = 0;
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		z[i] = 0.0;
+
+		if (set[i])
+		{
+			index[m++] = i;
+		}
+	}
+
+	double a[DIFFUSIONPROFILE_MAX_GAUSSIANS * DIFFUSIONPROFILE_MAX_GAUSSIANS * 4];
+	double b[DIFFUSIONPROFILE_MAX_GAUSSIANS * 2];
+	double y[DIFFUSIONPROFILE_MAX_GAUSSIANS * 2];
+
+	for (unsigned int i = 0; i < m; ++i)
+	{
+		for (unsigned int k = 0; k < m; ++k)
+		{
+			a[i * m + k] = AtA[index[i] * n + index[k]];
+		}
+		b[i] = Atb[index[i]];
+	}
+
+	if (!SolveLinear(a, b, m, y))
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < m; ++i)
+	{
+		z[index[i]] = y[i];
+	}
+	return true;
+}
+
+DiffusionProfile::DiffusionProfile()
+{
+	source = DIFFUSION_NONE;
+	radius = 0.0f;
+	eta = 1.3f;
+}
+
+bool DiffusionProfile::Load(const std::string &filename)
+{
+	std::ifstream f(filename.c_str());
+
+	if (!f)
+	{
+		std::cout << "DiffusionProfile: Can't open " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<float> newVariances;
+	std::vector<Vector3> newWeights;
+	std::vector<float> newRadii;
+	std::vector<Vector3> newValues;
+	DiffusionSource newSource = DIFFUSION_NONE;
+	float newRadius = 0.0f;
+
+	std::string line;
+	unsigned int lineNumber = 0;
+
+	while (std::getline(f, line))
+	{
+		++lineNumber;
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream in(line);
+		std::string keyword;
+
+		if (!(in >> keyword))
+		{
+			continue;
+		}
+
+		DiffusionSource lineSource = DIFFUSION_NONE;
+		bool ok = true;
+
+		if (keyword == "gaussian")
+		{
+			float v;
+			Vector3 w;
+			ok = (in >> v >> w.x >> w.y >> w.z) && v > 0.0f && newVariances.size() < DIFFUSIONPROFILE_MAX_GAUSSIANS;
+			newVariances.push_back(v);
+			newWeights.push_back(w);
+			lineSource = DIFFUSION_GAUSSIANS;
+		}
+		else if (keyword == "dipole")
+		{
+			ok = (in >> sigmaA.x >> sigmaA.y >> sigmaA.z >> sigmaSPrime.x >> sigmaSPrime.y >> sigmaSPrime.z >> eta) &&
+				 eta > 1.0f && newSource != DIFFUSION_DIPOLE;
+			lineSource = DIFFUSION_DIPOLE;
+		}
+		else if (keyword == "measured")
+		{
+			float r;
+			Vector3 value;
+			ok = (in >> r >> value.x >> value.y >> value.z) && (newRadii.empty() || r > newRadii.back());
+			newRadii.push_back(r);
+			newValues.push_back(value);
+			lineSource = DIFFUSION_MEASURED;
+		}
+		else if (keyword == "radius")
+		{
+			ok = (in >> newRadius) && newRadius > 0.0f;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		// One kind of profile to a file
+		if (lineSource != DIFFUSION_NONE)
+		{
+			ok = ok && (newSource == DIFFUSION_NONE || newSource == lineSource);
+			newSource = lineSource;
+		}
+
+		if (!ok)
+		{
+			std::cout << "DiffusionProfile: " << filename << "(" << lineNumber << "): Can't make sense of \"" << line << "\"" << std::endl;
+			return false;
+		}
+	}
+
+	if (newSource == DIFFUSION_NONE)
+	{
+		std::cout << "DiffusionProfile: " << filename << " has no profile in it" << std::endl;
+		return false;
+	}
+
+	source = newSource;
+	variances = newVariances;
+	weights = newWeights;
+	radii = newRadii;
+	values = newValues;
+	radius = newRadius;
+	this->filename = filename;
+
+	return true;
+}
+
+void DiffusionProfile::SetGaussians(const std::vector<float> &variances, const std::vector<Vector3> &weights)
+{
+	source = DIFFUSION_GAUSSIANS;
+	this->variances = variances;
+	this->weights = weights;
+	filename.clear();
+}
+
+void DiffusionProfile::SetDipole(const Vector3 &sigmaA, const Vector3 &sigmaSPrime, float eta)
+{
+	source = DIFFUSION_DIPOLE;
+	this->sigmaA = sigmaA;
+	this->sigmaSPrime = sigmaSPrime;
+	this->eta = eta;
+	filename.clear();
+}
+
+void DiffusionProfile::SetMeasured(const std::vector<float> &radii, const std::vector<Vector3> &values)
+{
+	source = DIFFUSION_MEASURED;
+	this->radii = radii;
+	this->values = values;
+	filename.clear();
+}
+
+float DiffusionProfile::GetRadius() const
+{
+	if (radius > 0.0f)
+	{
+		return radius;
+	}
+
+	if (source == DIFFUSION_GAUSSIANS)
+	{
+		float widest = 0.0f;
+
+		for (unsigned int i = 0; i < variances.size(); ++i)
+		{
+			widest = max(widest, variances[i]);
+		}
+		return 4.0f * sqrt(widest);
+	}
+
+	if (source == DIFFUSION_MEASURED)
+	{
+		return radii.empty() ? 0.0f : radii.back();
+	}
+
+	if (source == DIFFUSION_DIPOLE)
+	{
+		Vector3 centre = Evaluate(0.0f);
+
+		for (float r = 0.05f; r < 1000.0f; r += 0.05f)
+		{
+			Vector3 value = Evaluate(r);
+
+			if (value.x <= 0.001f * centre.x && value.y <= 0.001f * centre.y && value.z <= 0.001f * centre.z)
+			{
+				return r;
+			}
+		}
+		return 1000.0f;
+	}
+
+	return 0.0f;
+}
+
+Vector3 DiffusionProfile::Evaluate(float r) const
+{
+	Vector3 value(0.0f, 0.0f, 0.0f);
+
+	if (source == DIFFUSION_GAUSSIANS)
+	{
+		for (unsigned int i = 0; i < variances.size(); ++i)
+		{
+			value += weights[i] * (float)Gaussian2D(variances[i], r);
+		}
+	}
+	else if (source == DIFFUSION_DIPOLE)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			SetChannel(value, c, (float)Dipole(Channel(sigmaA, c), Channel(sigmaSPrime, c), eta, r));
+		}
+	}
+	else if (source == DIFFUSION_MEASURED && !radii.empty())
+	{
+		// Straight lines between the points, the first held in to the centre, and nothing past the last
+		if (r <= radii[0])
+		{
+			return values[0];
+		}
+
+		for (unsigned int i = 1; i < radii.size(); ++i)
+		{
+			if (r <= radii[i])
+			{
+				float t = (r - radii[i - 1]) / (radii[i] - radii[i - 1]);
+				return values[i - 1] + (values[i] - values[i - 1]) * t;
+			}
+		}
+	}
+
+	return value;
+}
+
+bool DiffusionProfile::Sample(std::vector<double> &samples, std::vector<double> &areas, std::vector<double> &targets) const
+{
+	float extent = GetRadius();
+
+	if (source == DIFFUSION_NONE || !(extent > 0.0f))
+	{
+		return false;
+	}
+
+	unsigned int m = DIFFUSIONPROFILE_FIT_SAMPLES;
+	double h = extent / m;
+
+	samples.resize(m);
+	areas.resize(m);
+	targets.assign(m * 3, 0.0);
+
+	double totals[3] = { 0.0, 0.0, 0.0 };
+
+	// The ring each sample stands for, from the midpoints out
+	for (unsigned int j = 0; j < m; ++j)
+	{
+		samples[j] = (j + 0.5) * h;
+		areas[j] = 2.0 * PI * samples[j] * h;
+
+		Vector3 value = Evaluate((float)samples[j]);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			targets[c * m + j] = Channel(value, c);
+			totals[c] += areas[j] * Channel(value, c);
+		}
+	}
+
+	// Normalised to white, as the fit will be
+	bool any = false;
+
+	for (int c = 0; c < 3; ++c)
+	{
+		for (unsigned int j = 0; j < m && totals[c] > 0.0; ++j)
+		{
+			targets[c * m + j] /= totals[c];
+		}
+		any = any || totals[c] > 0.0;
+	}
+
+	return any;
+}
+
+double DiffusionProfile::FitError(const std::vector<double> &logVariances, const std::vector<double> &samples,
+								  const std::vector<double> &areas, const std::vector<double> &targets,
+								  std::vector<Vector3> *weightsOut) const
+{
+	unsigned int n = (unsigned int)logVariances.size();
+	unsigned int m = (unsigned int)samples.size();
+
+	std::vector<double> basis(n * m);
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		double v = exp(logVariances[i]);
+
+		for (unsigned int j = 0; j < m; ++j)
+		{
+			basis[i * m + j] = Gaussian2D(v, samples[j]);
+		}
+	}
+
+	double AtA[DIFFUSIONPROFILE_MAX_GAUSSIANS * DIFFUSIONPROFILE_MAX_GAUSSIANS];
+	double Atb[DIFFUSIONPROFILE_MAX_GAUSSIANS];
+	double x[DIFFUSIONPROFILE_MAX_GAUSSIANS];
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		for (unsigned int k = i; k < n; ++k)
+		{
+			double sum = 0.0;
+
+			for (unsigned int j = 0; j < m; ++j)
+			{
+				sum += areas[j] * basis[i * m + j] * basis[k * m + j];
+			}
+			AtA[i * n + k] = AtA[k * n + i] = sum;
+		}
+	}
+
+	/*
+	 * With a heavily weighted row more, asking for the weights to add up to 1,
+	 * as they have to be to leave white white, so normalising them after
+	 * hardly moves the fit
+	 */
+	double trace = 0.0;
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		trace += AtA[i * n + i];
+	}
+
+	double constraint = 1e4 * trace / n;
+
+	for (unsigned int i = 0; i < n * n; ++i)
+	{
+		AtA[i] += constraint;
+	}
+
+	if (weightsOut)
+	{
+		weightsOut->assign(n, Vector3(0.0f, 0.0f, 0.0f));
+	}
+
+	double error = 0.0;
+
+	for (int c = 0; c < 3; ++c)
+	{
+		const double *target = &targets[c * m];
+		double energy = 0.0;
+
+		for (unsigned int j = 0; j < m; ++j)
+		{
+			energy += areas[j] * target[j] * target[j];
+		}
+
+		// A channel with nothing in it is fitted by nothing
+		if (!(energy > 0.0))
+		{
+			continue;
+		}
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			double sum = 0.0;
+
+			for (unsigned int j = 0; j < m; ++j)
+			{
+				sum += areas[j] * basis[i * m + j] * target[j];
+			}
+			Atb[i] = sum + constraint;
+		}
+
+		if (!SolveNNLS(AtA, Atb, n, x))
+		{
+			return 1e30;
+		}
+
+		double residual = 0.0;
+
+		for (unsigned int j = 0; j < m; ++j)
+		{
+			double fitted = 0.0;
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				fitted += x[i] * basis[i * m + j];
+			}
+			residual += areas[j] * (target[j] - fitted) * (target[j] - fitted);
+		}
+		error += residual / energy;
+
+		for (unsigned int i = 0; weightsOut && i < n; ++i)
+		{
+			SetChannel((*weightsOut)[i], c, (float)x[i]);
+		}
+	}
+
+	return error;
+}
+
+double DiffusionProfile::Search(unsigned int n, const std::vector<double> &samples, const std::vector<double> &areas,
+								const std::vector<double> &targets, std::vector<double> &best) const
+{
+	// From a Gaussian about as narrow as the samples are apart to one half as wide as the profile
+	double h = samples[1] - samples[0];
+	double logLo = log(h * h);
+	double logHi = log(samples.back() * samples.back() / 4.0);
+	unsigned int grid = DIFFUSIONPROFILE_FIT_GRID;
+
+	std::vector<double> trial(n);
+	double bestError = 1e30;
+
+	/*
+	 * Start from the best of a grid of evenly spread variances, the first
+	 * from narrowest to widest and each the next by a ratio from 1.2 to as
+	 * much as fits, and of the best fit with one fewer and another anywhere
+	 * along the grid, so a fit with more is never worse
+	 */
+	std::vector<double> fewer;
+
+	if (n > 1)
+	{
+		Search(n - 1, samples, areas, targets, fewer);
+	}
+
+	for (unsigned int a = 0; a < grid * (n == 1 ? grid : 1); ++a)
+	{
+		double first = logLo + (logHi - logLo) * a / (grid * (n == 1 ? grid : 1) - 1);
+
+		for (unsigned int b = 0; b < (n == 1 ? 1 : grid + 1); ++b)
+		{
+			if (b == grid)
+			{
+				trial = fewer;
+				trial.push_back(first);
+			}
+			else
+			{
+				double most = n > 1 ? (logHi - first) / (n - 1) : 0.0;
+				double ratio = n > 1 ? log(1.2) + (most - log(1.2)) * b / (grid - 1) : 0.0;
+
+				if (n > 1 && most < log(1.2))
+				{
+					continue;
+				}
+
+				for (unsigned int i = 0; i < n; ++i)
+				{
+					trial[i] = first + ratio * i;
+				}
+			}
+
+			double error = FitError(trial, samples, areas, targets, NULL);
+
+			if (error < bestError)
+			{
+				bestError = error;
+				best = trial;
+			}
+		}
+	}
+
+	// then move each one at a time while that helps, in smaller and smaller steps
+	double step = (logHi - logLo) / grid;
+
+	for (unsigned int iteration = 0; step > 1e-4 && iteration < 2000; ++iteration)
+	{
+		bool improved = false;
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			for (int sign = -1; sign <= 1; sign += 2)
+			{
+				trial = best;
+				trial[i] += sign * step;
+
+				if (trial[i] < logLo || trial[i] > logHi)
+				{
+					continue;
+				}
+
+				double error = FitError(trial, samples, areas, targets, NULL);
+
+				if (error < bestError)
+				{
+					bestError = error;
+					best = trial;
+					improved = true;
+				}
+			}
+		}
+
+		if (!improved)
+		{
+			step *= 0.5;
+		}
+	}
+
+	return bestError;
+}
+
+bool DiffusionProfile::Fit(unsigned int numGaussians, DiffusionFit &fit) const
+{
+	std::vector<double> samples, areas, targets;
+
+	if (numGaussians < 1 || numGaussians > DIFFUSIONPROFILE_MAX_GAUSSIANS || !Sample(samples, areas, targets))
+	{
+		return false;
+	}
+
+	unsigned int n = numGaussians;
+	std::vector<double> best;
+
+	Search(n, samples, areas, targets, best);
+
+	std::vector<Vector3> fitted;
+
+	if (FitError(best, samples, areas, targets, &fitted) >= 1e30)
+	{
+		return false;
+	}
+
+	// Narrowest first, with the weights normalised to white
+	std::vector<unsigned int> order(n);
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return best[a] < best[b]; });
+
+	Vector3 total(0.0f, 0.0f, 0.0f);
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		total += fitted[i];
+	}
+
+	fit.variances.resize(n);
+	fit.weights.resize(n);
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		fit.variances[i] = (float)exp(best[order[i]]);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			float t = Channel(total, c);
+			SetChannel(fit.weights[i], c, t > 0.0f ? Channel(fitted[order[i]], c) / t : 0.0f);
+		}
+	}
+
+	MeasureFit(fit);
+	return true;
+}
+
+void DiffusionProfile::MeasureFit(DiffusionFit &fit) const
+{
+	std::vector<double> samples, areas, targets;
+	fit.rmsError = fit.errorBound = 0.0f;
+
+	if (!Sample(samples, areas, targets))
+	{
+		return;
+	}
+
+	unsigned int m = (unsigned int)samples.size();
+	double extent = samples.back() + (samples[1] - samples[0]) * 0.5;
+
+	for (int c = 0; c < 3; ++c)
+	{
+		double energy = 0.0;
+		double squared = 0.0;
+		double absolute = 0.0;
+
+		for (unsigned int j = 0; j < m; ++j)
+		{
+			double fitted = 0.0;
+
+			for (unsigned int i = 0; i < fit.variances.size(); ++i)
+			{
+				fitted += Channel(fit.weights[i], c) * Gaussian2D(fit.variances[i], samples[j]);
+			}
+
+			double target = targets[c * m + j];
+			energy += areas[j] * target * target;
+			squared += areas[j] * (target - fitted) * (target - fitted);
+			absolute += areas[j] * fabs(target - fitted);
+		}
+
+		// What the fit puts past the radius counts against it too
+		for (unsigned int i = 0; i < fit.variances.size(); ++i)
+		{
+			absolute += Channel(fit.weights[i], c) * exp(-extent * extent / (2.0 * fit.variances[i]));
+		}
+
+		if (energy > 0.0)
+		{
+			fit.rmsError = max(fit.rmsError, (float)sqrt(squared / energy));
+			fit.errorBound = max(fit.errorBound, (float)absolute);
+		}
+	}
+}
+
+bool DiffusionProfile::FitCached(unsigned int numGaussians, DiffusionFit &fit) const
+{
+	if (filename.empty())
+	{
+		return Fit(numGaussians, fit);
+	}
+
+	unsigned long long hash = MeshCache::HashFile(filename);
+	std::string cacheName = GetCacheName(filename, numGaussians);
+
+	if (ReadFit(cacheName, hash, numGaussians, fit))
+	{
+		return true;
+	}
+
+	if (!Fit(numGaussians, fit))
+	{
+		return false;
+	}
+
+	if (!WriteFit(cacheName, hash, fit))
+	{
+		std::cout << "DiffusionProfile: Couldn't cache the fit in " << cacheName << std::endl;
+	}
+	return true;
+}
+
+std::string DiffusionProfile::GetCacheName(const std::string &filename, unsigned int numGaussians)
+{
+	std::ostringstream name;
+	name << filename << "." << numGaussians << DIFFUSIONPROFILE_FIT_EXTENSION;
+	return name.str();
+}
+
+bool DiffusionProfile::WriteFit(const std::string &cacheName, unsigned long long sourceHash, const DiffusionFit &fit)
+{
+	DiffusionFitHeader header;
+	header.magic = DIFFUSIONPROFILE_FIT_MAGIC;
+	header.version = DIFFUSIONPROFILE_FIT_VERSION;
+	header.sourceHash = sourceHash;
+	header.numGaussians = (unsigned int)fit.variances.size();
+	header.padding = 0;
+
+	std::ofstream f(cacheName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if (!f)
+	{
+		return false;
+	}
+
+	f.write((const char*)&header, sizeof(DiffusionFitHeader));
+	f.write((const char*)&fit.variances[0], fit.variances.size() * sizeof(float));
+	f.write((const char*)&fit.weights[0], fit.weights.size() * sizeof(Vector3));
+	f.write((const char*)&fit.rmsError, sizeof(float));
+	f.write((const char*)&fit.errorBound, sizeof(float));
+	f.close();
+
+	// Don't leave a half written cache behind
+	if (f.fail())
+	{
+		remove(cacheName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool DiffusionProfile::ReadFit(const std::string &cacheName, unsigned long long sourceHash, unsigned int numGaussians,
+							   DiffusionFit &fit)
+{
+	std::ifstream f(cacheName.c_str(), std::ios::in | std::ios::binary);
+	DiffusionFitHeader header;
+
+	if (!f || !f.read((char*)&header, sizeof(DiffusionFitHeader)))
+	{
+		return false;
+	}
+
+	if (header.magic != DIFFUSIONPROFILE_FIT_MAGIC || header.version != DIFFUSIONPROFILE_FIT_VERSION ||
+		header.sourceHash != sourceHash || header.numGaussians != numGaussians ||
+		numGaussians < 1 || numGaussians > DIFFUSIONPROFILE_MAX_GAUSSIANS)
+	{
+		return false;
+	}
+
+	DiffusionFit read;
+	read.variances.resize(numGaussians);
+	read.weights.resize(numGaussians);
+
+	f.read((char*)&read.variances[0], numGaussians * sizeof(float));
+	f.read((char*)&read.weights[0], numGaussians * sizeof(Vector3));
+	f.read((char*)&read.rmsError, sizeof(float));
+	f.read((char*)&read.errorBound, sizeof(float));
+
+	if (!f)
+	{
+		return false;
+	}
+
+	fit = read;
+	return true;
+}
+
+bool DiffusionProfile::SolveNNLS(const double *AtA, const double *Atb, unsigned int n, double *x)
+{
+	bool passive[DIFFUSIONPROFILE_MAX_GAUSSIANS * 2];
+	double z[DIFFUSIONPROFILE_MAX_GAUSSIANS * 2];
+	double w[DIFFUSIONPROFILE_MAX_GAUSSIANS * 2];
+
+	if (n > DIFFUSIONPROFILE_MAX_GAUSSIANS * 2)
+	{
+		return false;
+	}
+
+	double scale = 0.0;
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		x[i] = 0.0;
+		passive[i] = false;
+		scale = max(scale, fabs(Atb[i]));
+	}
+
+	double tolerance = 1e-12 * max(scale, 1e-300);
+
+	// Each time round, the column whose weight would bring the error down most is let in
+	for (unsigned int outer = 0; outer < 3 * n + 3; ++outer)
+	{
+		int next = -1;
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			double gradient = Atb[i];
+
+			for (unsigned int k = 0; k < n; ++k)
+			{
+				gradient -= AtA[i * n + k] * x[k];
+			}
+			w[i] = gradient;
+
+			if (!passive[i] && w[i] > tolerance && (next < 0 || w[i] > w[next]))
+			{
+				next = (int)i;
+			}
+		}
+
+		if (next < 0)
+		{
+			return true;
+		}
+
+		passive[next] = true;
+
+		bool feasible = false;
+
+		// and while the least squares over the columns let in takes any of them below 0, it's taken back
+		for (unsigned int inner = 0; inner < 3 * n + 3; ++inner)
+		{
+			if (!SolveSubset(AtA, Atb, n, passive, z))
+			{
+				return false;
+			}
+
+			double alpha = 1.0;
+			feasible = true;
+
+			// A weight already at 0 with z[i] at 0 too doesn't limit the step, and is taken back below either way
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				if (passive[i] && z[i] <= 0.0)
+				{
+					feasible = false;
+
+					if (x[i] - z[i] > 0.0)
+					{
+						alpha = min(alpha, x[i] / (x[i] - z[i]));
+					}
+				}
+			}
+
+			if (feasible)
+			{
+				for (unsigned int i = 0; i < n; ++i)
+				{
+					x[i] = z[i];
+				}
+				break;
+			}
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				x[i] += alpha * (z[i] - x[i]);
+
+				if (passive[i] && x[i] <= tolerance * 1e-6)
+				{
+					x[i] = 0.0;
+					passive[i] = false;
+				}
+			}
+		}
+
+		// Out of goes without a least squares that's all at or above 0, so x isn't the answer
+		if (!feasible)
+		{
+			return false;
+		}
+	}
+
+	// Out of goes with columns still to let in, so it isn't here either
+	return false;
+}
+
+bool DiffusionProfile::Check()
+{
+	bool passed = true;
+
+	// SolveNNLS against the best of every subset of columns whose least squares has no weight below 0
+	unsigned int seed = 12345;
+	unsigned int mismatches = 0;
+
+	for (unsigned int problem = 0; problem < 300; ++problem)
+	{
+		unsigned int n = 1 + problem % 5;
+		const unsigned int rows = 9;
+		double a[rows * 5], b[rows];
+
+		for (unsigned int i = 0; i < rows * n; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			a[i] = (seed >> 8) / 8388608.0 - 1.0;
+		}
+		for (unsigned int i = 0; i < rows; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			b[i] = (seed >> 8) / 8388608.0 - 1.0;
+		}
+
+		double AtA[25], Atb[5], x[5];
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			Atb[i] = 0.0;
+
+			for (unsigned int r = 0; r < rows; ++r)
+			{
+				Atb[i] += a[r * n + i] * b[r];
+			}
+
+			for (unsigned int k = 0; k < n; ++k)
+			{
+				AtA[i * n + k] = 0.0;
+
+				for (unsigned int r = 0; r < rows; ++r)
+				{
+					AtA[i * n + k] += a[r * n + i] * a[r * n + k];
+				}
+			}
+		}
+
+		// x'AtAx - 2x'Atb, which is |Ax - b|^2 less |b|^2
+		auto objective = [&](const double *y)
+		{
+			double f = 0.0;
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				f -= 2.0 * y[i] * Atb[i];
+
+				for (unsigned int k = 0; k < n; ++k)
+				{
+					f += y[i] * AtA[i * n + k] * y[k];
+				}
+			}
+			return f;
+		};
+
+		double bestObjective = 0.0;
+
+		for (unsigned int mask = 1; mask < (1u << n); ++mask)
+		{
+			bool set[5];
+			double z[5];
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				set[i] = (mask & (1u << i)) != 0;
+			}
+
+			if (!SolveSubset(AtA, Atb, n, set, z))
+			{
+				continue;
+			}
+
+			bool feasible = true;
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				feasible = feasible && z[i] >= 0.0;
+			}
+
+			if (feasible)
+			{
+				bestObjective = min(bestObjective, objective(z));
+			}
+		}
+
+		bool solved = SolveNNLS(AtA, Atb, n, x);
+		bool nonNegative = true;
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			nonNegative = nonNegative && x[i] >= 0.0;
+		}
+
+		if (!solved || !nonNegative || fabs(objective(x) - bestObjective) > 1e-9 * (1.0 + fabs(bestObjective)))
+		{
+			++mismatches;
+		}
+	}
+
+	if (mismatches > 0)
+	{
+		std::cout << "DiffusionProfile::Check: SolveNNLS missed the best weights of " << mismatches << " of 300 problems" << std::endl;
+		passed = false;
+	}
+
+	// A sum of Gaussians comes back from a fit of as many, with its variances and its weights
+	DiffusionProfile made;
+	std::vector<float> madeVariances;
+	std::vector<Vector3> madeWeights;
+
+	madeVariances.push_back(0.01f);
+	madeVariances.push_back(0.2f);
+	madeVariances.push_back(2.0f);
+	madeWeights.push_back(Vector3(0.5f, 0.2f, 0.1f));
+	madeWeights.push_back(Vector3(0.3f, 0.5f, 0.3f));
+	madeWeights.push_back(Vector3(0.2f, 0.3f, 0.6f));
+
+	for (unsigned int count = 1; count <= 3; count += 2)
+	{
+		std::vector<float> v(madeVariances.begin() + (count == 1 ? 1 : 0), madeVariances.begin() + (count == 1 ? 2 : 3));
+		std::vector<Vector3> w(count, Vector3(1.0f, 1.0f, 1.0f));
+
+		if (count == 3)
+		{
+			w = madeWeights;
+		}
+
+		made.SetGaussians(v, w);
+
+		DiffusionFit fit;
+		bool ok = made.Fit(count, fit);
+
+		for (unsigned int i = 0; ok && i < count; ++i)
+		{
+			Vector3 difference = fit.weights[i] - w[i];
+			ok = fabs(fit.variances[i] / v[i] - 1.0f) < 0.02f &&
+				 fabs(difference.x) < 0.01f && fabs(difference.y) < 0.01f && fabs(difference.z) < 0.01f;
+		}
+
+		if (!ok || fit.rmsError > 0.01f)
+		{
+			std::cout << "DiffusionProfile::Check: A sum of " << count << " Gaussians didn't come back from a fit of as many" << std::endl;
+			passed = false;
+		}
+	}
+
+	// The errors fall, or at worst stay, as there are more Gaussians to fit with, for a sum of them and a dipole
+	DiffusionProfile profiles[2];
+	profiles[0].SetGaussians(madeVariances, madeWeights);
+	profiles[1].SetDipole(Vector3(0.032f, 0.17f, 0.48f), Vector3(0.74f, 0.88f, 1.01f), 1.3f);
+
+	const char *names[2] = { "3 Gaussians", "skin dipole" };
+
+	for (int p = 0; p < 2; ++p)
+	{
+		std::cout << "DiffusionProfile::Check " << names[p] << ", out to " << profiles[p].GetRadius() << " mm:" << std::endl;
+
+		float lastError = 1e30f;
+
+		for (unsigned int count = 1; count <= DIFFUSIONPROFILE_MAX_GAUSSIANS; ++count)
+		{
+			GameTimer timer;
+			float start = timer.GetMS();
+
+			DiffusionFit fit;
+			bool ok = profiles[p].Fit(count, fit);
+			float ms = timer.GetMS() - start;
+
+			std::cout << "  " << count << ": ";
+
+			for (unsigned int i = 0; ok && i < count; ++i)
+			{
+				std::cout << fit.variances[i] << (i + 1 < count ? ", " : "");
+			}
+
+			std::cout << " mm^2, rms " << 100.0f * fit.rmsError << "%, bound " << 100.0f * fit.errorBound << "%, " << ms << " ms" << std::endl;
+
+			if (!ok || fit.rmsError > lastError + 0.001f)
+			{
+				std::cout << "DiffusionProfile::Check: Fitting " << names[p] << " with " << count << " Gaussians did worse than with fewer" << std::endl;
+				passed = false;
+			}
+			lastError = ok ? fit.rmsError : lastError;
+		}
+	}
+
+	// A cached fit comes back as it went in, and only for the profile and the count it was for
+	DiffusionFit written, read;
+	profiles[0].Fit(2, written);
+
+	std::string cacheName = GetCacheName("DiffusionProfile.check", 2);
+	bool cached = WriteFit(cacheName, 42, written) && ReadFit(cacheName, 42, 2, read);
+
+	for (unsigned int i = 0; cached && i < 2; ++i)
+	{
+		cached = read.variances[i] == written.variances[i] && read.weights[i] == written.weights[i];
+	}
+
+	cached = cached && read.rmsError == written.rmsError && read.errorBound == written.errorBound &&
+			 !ReadFit(cacheName, 43, 2, read) && !ReadFit(cacheName, 42, 3, read);
+	remove(cacheName.c_str());
+
+	if (!cached)
+	{
+		std::cout << "DiffusionProfile::Check: A cached fit didn't come back right" << std::endl;
+		passed = false;
+	}
+
+	std::cout << "DiffusionProfile::Check: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
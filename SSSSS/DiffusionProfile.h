@@ -0,0 +1,159 @@
+#pragma once
+
+/*
+ * A radial diffusion profile: how much of the light going into a surface at
+ * one point comes back out r mm away, for each colour channel. It's either a
+ * sum of Gaussians, such as d'Eon and Luebke's six for skin, Jensen's dipole
+ * for a material's absorption and reduced scattering coefficients, or a
+ * measured table, and is read from a text .profile file (see Load).
+ *
+ * Fit works out the sum of fewer Gaussians that comes closest to it, which
+ * is what sssPass draws: each Gaussian's own variance and a weight per
+ * channel, normalised to white. The variances are searched for, and for each
+ * set tried the weights are solved for with non negative least squares
+ * (SolveNNLS), so no weight ever comes out negative. A Gaussian here is
+ * exp(-r^2 / 2v) / 2 pi v, which adds up to 1 over the plane, as each blur
+ * level's does.
+ *
+ * The fit comes with two errors, both over the profile's radius and both
+ * the worst of the three channels: the root mean square difference relative
+ * to the profile, and the difference integrated over the plane, relative to
+ * the profile's integral. The second is a bound: blurring any irradiance no
+ * brighter than 1 with the fit instead of the profile is never further off
+ * than that.
+ *
+ * A fit of a profile read from a file is cached next to it, as a mesh's is
+ * (skin.profile -> skin.profile.3.fit for three Gaussians), and only taken
+ * back if the profile hasn't changed since.
+ */
+#include <string>
+#include <vector>
+
+#include "../Framework/Vector3.h"
+
+#define DIFFUSIONPROFILE_FIT_MAGIC		0x54494644	// "DFIT"
+#define DIFFUSIONPROFILE_FIT_VERSION	1
+#define DIFFUSIONPROFILE_FIT_EXTENSION	".fit"
+
+// Most Gaussians in a profile, or in a fit of one
+#define DIFFUSIONPROFILE_MAX_GAUSSIANS	6
+
+// Radii the profile's compared with a fit at, evenly spaced out to the profile's radius
+#define DIFFUSIONPROFILE_FIT_SAMPLES	256
+
+// Starting points tried along each of the first variance and the ratio between variances, before they're refined
+#define DIFFUSIONPROFILE_FIT_GRID		24
+
+enum DiffusionSource
+{
+	DIFFUSION_NONE,
+	DIFFUSION_GAUSSIANS,
+	DIFFUSION_DIPOLE,
+	DIFFUSION_MEASURED
+};
+
+struct DiffusionFit
+{
+	std::vector<float>		variances;		// In mm^2, narrowest first
+	std::vector<Vector3>	weights;		// Adding up to 1 in each channel
+	float					rmsError;
+	float					errorBound;
+};
+
+class DiffusionProfile
+{
+public:
+	DiffusionProfile();
+
+	/*
+	 * Reads a profile. Every line is one of, in mm:
+	 *   gaussian variance r g b	- one of a sum of Gaussians
+	 *   dipole sigmaA(r g b) sigmaS'(r g b) eta	- Jensen's dipole
+	 *   measured radius r g b		- a measured point, in order out from the centre
+	 *   radius r					- how far out to fit it, if not the default
+	 * with # starting a comment. Returns false, printing why, if it can't.
+	 */
+	bool Load(const std::string &filename);
+
+	void SetGaussians(const std::vector<float> &variances, const std::vector<Vector3> &weights);
+	void SetDipole(const Vector3 &sigmaA, const Vector3 &sigmaSPrime, float eta);
+	void SetMeasured(const std::vector<float> &radii, const std::vector<Vector3> &values);
+
+	/*
+	 * How far out it's fitted: four standard deviations of the widest
+	 * Gaussian, the last measured point, or where the dipole's fallen to a
+	 * thousandth of what it is near the centre, unless one's been set
+	 */
+	void SetRadius(float r)							{ radius = r; }
+	float GetRadius() const;
+
+	DiffusionSource GetSource() const				{ return source; }
+	const std::string & GetFilename() const			{ return filename; }
+
+	// The Gaussians a sum of Gaussians is made of
+	const std::vector<float> & GetVariances() const		{ return variances; }
+	const std::vector<Vector3> & GetWeights() const		{ return weights; }
+
+	Vector3 Evaluate(float r) const;
+
+	// Fits numGaussians Gaussians to it, from 1 to DIFFUSIONPROFILE_MAX_GAUSSIANS. Returns false if it can't
+	bool Fit(unsigned int numGaussians, DiffusionFit &fit) const;
+
+	// The same, but from the cache if it's there and up to date, and cached if it wasn't
+	bool FitCached(unsigned int numGaussians, DiffusionFit &fit) const;
+
+	static std::string GetCacheName(const std::string &filename, unsigned int numGaussians);
+
+	// A fit cached against a hash of what it was fitted to, and read back if the hash and the count match
+	static bool WriteFit(const std::string &cacheName, unsigned long long sourceHash, const DiffusionFit &fit);
+	static bool ReadFit(const std::string &cacheName, unsigned long long sourceHash, unsigned int numGaussians,
+						DiffusionFit &fit);
+
+	/*
+	 * Lawson and Hanson's active set method on the normal equations: the x
+	 * of n no less than 0 that minimises |Ax - b|^2, given AtA (n by n, row
+	 * major) and Atb. Returns false if a set of the columns it tries is
+	 * singular, or if it hasn't converged within 3n + 3 goes of either loop.
+	 */
+	static bool SolveNNLS(const double *AtA, const double *Atb, unsigned int n, double *x);
+
+	/*
+	 * Checks SolveNNLS against every subset of the columns of made up
+	 * problems, that a single Gaussian and a made up sum of three come back
+	 * from fits of as many, that the errors fall as the fits get more
+	 * Gaussians, for that sum and a skin dipole, and that a cached fit is read
+	 * back, and thrown away for another profile or count. Prints the fits
+	 * with 1 to 6 Gaussians and what each took. Returns false if anything
+	 * didn't hold.
+	 */
+	static bool Check();
+
+protected:
+	// The profile at DIFFUSIONPROFILE_FIT_SAMPLES radii, channel after channel, and the ring each stands for
+	bool Sample(std::vector<double> &samples, std::vector<double> &areas, std::vector<double> &targets) const;
+
+	// The sum of squared errors relative to the profile over the channels, and the weights, for a set of variances
+	double FitError(const std::vector<double> &logVariances, const std::vector<double> &samples,
+					const std::vector<double> &areas, const std::vector<double> &targets, std::vector<Vector3> *weightsOut) const;
+
+	// The log variances of the best fit of n Gaussians, and its error as FitError has it
+	double Search(unsigned int n, const std::vector<double> &samples, const std::vector<double> &areas,
+				  const std::vector<double> &targets, std::vector<double> &best) const;
+
+	// The fit's errors against the profile, at the same samples
+	void MeasureFit(DiffusionFit &fit) const;
+
+	DiffusionSource			source;
+	std::string				filename;
+	float					radius;			// 0 for the default
+
+	std::vector<float>		variances;
+	std::vector<Vector3>	weights;
+
+	Vector3					sigmaA;
+	Vector3					sigmaSPrime;
+	float					eta;
+
+	std::vector<float>		radii;
+	std::vector<Vector3>	values;
+};
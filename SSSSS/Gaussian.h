@@ -2,6 +2,7 @@
 
 /*
  * Class that encapsulates a function to build a Gaussian from variances and weights.
+ * Each material's are in the DiffusionLibrary.
  */
 #include <vector>
 #include "../Framework/Vector3.h"
@@ -17,9 +18,6 @@ class Gaussian
         float	getWidth()	const { return width; }
         Vector4	getWeight()	const { return weight; }
 
-        static const std::vector<Gaussian> SKIN;
-		static const std::vector<Gaussian> MARBLE;
-
     private:
         Gaussian() {} 
         Gaussian(float variance, Vector3 weights[], int n);
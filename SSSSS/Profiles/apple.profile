@@ -0,0 +1,6 @@
+# Jensen et al.'s apple, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.003 0.0034 0.046 2.29 2.39 1.97 1.3
+
+# its tail goes on for centimetres; only as far as marble's is fitted
+radius 8
@@ -0,0 +1,3 @@
+# Jensen et al.'s chicken1, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.015 0.077 0.19 0.15 0.21 0.38 1.3
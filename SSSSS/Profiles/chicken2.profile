@@ -0,0 +1,3 @@
+# Jensen et al.'s chicken2, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.018 0.088 0.2 0.19 0.25 0.32 1.3
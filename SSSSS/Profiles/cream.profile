@@ -0,0 +1,6 @@
+# Jensen et al.'s cream, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.0002 0.0028 0.0163 7.38 5.47 3.15 1.3
+
+# its tail goes on for centimetres; only as far as marble's is fitted
+radius 8
@@ -0,0 +1,3 @@
+# Jensen et al.'s ketchup, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.061 0.97 1.45 0.18 0.07 0.03 1.3
@@ -0,0 +1,6 @@
+# Jensen et al.'s marble, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.0021 0.0041 0.0071 2.19 2.62 3.00 1.5
+
+# its tail goes on for centimetres; only as far as the shipped sum reaches is fitted
+radius 8
@@ -0,0 +1,6 @@
+# Jensen et al.'s potato, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.0024 0.009 0.12 0.68 0.7 0.55 1.3
+
+# its tail goes on for centimetres; only as far as marble's is fitted
+radius 8
@@ -0,0 +1,6 @@
+# Jensen et al.'s skimmilk, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.0014 0.0025 0.0142 0.7 1.22 1.9 1.3
+
+# its tail goes on for centimetres; only as far as marble's is fitted
+radius 8
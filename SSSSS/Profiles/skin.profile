@@ -0,0 +1,8 @@
+# d'Eon and Luebke's sum of six Gaussians for skin, from GPU Gems 3, chapter 14
+# gaussian variance(mm^2) r g b
+gaussian 0.0064 0.233 0.455 0.649
+gaussian 0.0484 0.100 0.336 0.344
+gaussian 0.187  0.118 0.198 0.0
+gaussian 0.567  0.113 0.007 0.007
+gaussian 1.99   0.358 0.004 0.0
+gaussian 7.41   0.078 0.0   0.0
@@ -0,0 +1,3 @@
+# Jensen et al.'s skin1, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.032 0.17 0.48 0.74 0.88 1.01 1.3
@@ -0,0 +1,3 @@
+# Jensen et al.'s skin2, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.013 0.07 0.145 1.09 1.59 1.79 1.3
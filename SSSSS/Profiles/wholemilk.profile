@@ -0,0 +1,6 @@
+# Jensen et al.'s wholemilk, from A Practical Model for Subsurface Light Transport
+# dipole sigmaA(r g b, 1/mm) sigmaS'(r g b, 1/mm) eta
+dipole 0.0011 0.0024 0.014 2.55 3.21 3.77 1.3
+
+# its tail goes on for centimetres; only as far as marble's is fitted
+radius 8
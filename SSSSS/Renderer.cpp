@@ -8,10 +8,19 @@
  */
 #include "Renderer.h"
 
+#include <sstream>
+#include <cstring>
+
+#include "../Framework/GameTimer.h"
+
 #define FRONT	true
 #define BACK	false
 
-Renderer::Renderer(Window &parent) : OGLRenderer( parent )
+Renderer::Renderer(Window &parent) : OGLRenderer( parent ),
+	temporal(ZNEAR, ZFAR),
+	tileStats(SSS_TIMER_SAMPLES),
+	sssTimer("SSS (skin)", "blurs and accumulation", "separable kernel", SSS_TIMER_SAMPLES),
+	lightTimer("Light views", "separate passes", "layered pass", SSS_TIMER_SAMPLES)
 {
 #pragma region camera
 	camera = new Camera(4.660f, 37.680f, Vector3(0.364f, -0.030f, 0.482f));
@@ -21,17 +30,28 @@ Renderer::Renderer(Window &parent) : OGLRenderer( parent )
 	// Quad
 	quad = Mesh::GenerateQuad();
 
+	// the screen tiles with SSS, drawn in its place by the full resolution SSS passes
+	sssTiles = new FeedbackMesh();
+	sssArea = blurArea = quad;
+	glGenVertexArrays(1, &tileArray);
+
 	// head
-	OBJMesh *mHead = new OBJMesh( "../Meshes/head.obj" );
+	// Static meshes use the packed interleaved format, every depth pass reads them again
+	OBJMesh *mHead = new OBJMesh( "../Meshes/head.obj", VertexFormat::Interleaved(true) );
 	mHead->SetTexture( SOIL_load_OGL_texture("../Textures/head_col.jpg", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_MIPMAPS) );
 	mHead->SetBumpMap( SOIL_load_OGL_texture("../Textures/head_normal.jpg", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_MIPMAPS) );
 	headMesh = mHead;
 
 	// knight
-	OBJMesh *mPiece = new OBJMesh("../Meshes/knight.obj");
+	OBJMesh *mPiece = new OBJMesh("../Meshes/knight.obj", VertexFormat::Interleaved(true));
 	mPiece->SetTexture( SOIL_load_OGL_texture("../Textures/marble.jpg", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_MIPMAPS) );
 	mPiece->SetBumpMap( SOIL_load_OGL_texture("../Textures/basicBumpmap.jpg", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_MIPMAPS) );
 	knightMesh = mPiece;		
+
+	// the copies drawn without singleMesh read their model matrices from here when they're instanced
+	instances = new InstanceBuffer();
+	headMesh->SetInstanceBuffer(instances);
+	knightMesh->SetInstanceBuffer(instances);
 #pragma endregion
 
 
@@ -83,14 +103,14 @@ Renderer::Renderer(Window &parent) : OGLRenderer( parent )
 		return;
 	}
 
-	accumSkinShader = new Shader("Shaders/basicVert.glsl", "Shaders/accumSkinFrag.glsl");
-	if ( !accumSkinShader->LinkProgram() )
+	accumShader = new Shader("Shaders/basicVert.glsl", "Shaders/accumFrag.glsl");
+	if ( !accumShader->LinkProgram() )
 	{
 		return;
 	}
 
-	accumMarbleShader = new Shader("Shaders/basicVert.glsl", "Shaders/accumMarbleFrag.glsl");
-	if ( !accumMarbleShader->LinkProgram() )
+	separableBlurShader = new Shader( "Shaders/blurVert.glsl", "Shaders/separableBlurFrag.glsl" );
+	if ( !separableBlurShader->LinkProgram() )
 	{
 		return;
 	}
@@ -100,191 +120,184 @@ Renderer::Renderer(Window &parent) : OGLRenderer( parent )
 	{
 		return;
 	}
-#pragma endregion
-
-
-#pragma region beckmann texture buffer
-	// diffuse texture
-	generateTexture(beckmannTex, BECKMANN, BECKMANN);
-
-	// frame buffer
-	glGenFramebuffers(1, &beckmannFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, beckmannFBO);
-
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, beckmannTex, 0);
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE || !beckmannTex)
+	lightLayersShader = new Shader("Shaders/lightLayersVert.glsl", "Shaders/depthFrag.glsl", "Shaders/lightLayersGeom.glsl");
+	if ( !lightLayersShader->LinkProgram() )
 	{
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-#pragma endregion
-
-
-#pragma region front & back depth buffers
-	generateTexture(frontZValTex, SHADOWMAP, SHADOWMAP);
-	generateTexture(backZValTex, SHADOWMAP, SHADOWMAP);
-	generateDepthTexture(frontDepthTex, SHADOWMAP, SHADOWMAP);
-	generateDepthTexture(backDepthTex, SHADOWMAP, SHADOWMAP);
-
-	glGenFramebuffers(1, &frontDepthFBO);
-	glGenFramebuffers(1, &backDepthFBO);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, frontDepthFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, frontDepthTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, frontZValTex, 0);
-	//glDrawBuffer( GL_NONE );
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	downsampleShader = new Shader("Shaders/blurVert.glsl", "Shaders/downsampleFrag.glsl");
+	if ( !downsampleShader->LinkProgram() )
 	{
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, backDepthFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, backDepthTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, backZValTex, 0);
-	//glDrawBuffer( GL_NONE );
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	upsampleShader = new Shader("Shaders/blurVert.glsl", "Shaders/upsampleFrag.glsl");
+	if ( !upsampleShader->LinkProgram() )
 	{
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-#pragma endregion
-
-
-#pragma region shadow map buffer
-	// colour texture
-	generateTexture(shadowMapTex, SHADOWMAP, SHADOWMAP);
-
-	// depth texture
-	glGenTextures(1, &shadowMapDepthTex);
-	glBindTexture(GL_TEXTURE_2D, shadowMapDepthTex);
-
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOWMAP, SHADOWMAP, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// frame buffer
-	glGenFramebuffers(1, &shadowMapFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+	temporalBlurShader = new Shader("Shaders/blurVert.glsl", "Shaders/temporalBlurFrag.glsl");
+	if ( !temporalBlurShader->LinkProgram() )
+	{
+		return;
+	}
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMapDepthTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shadowMapTex, 0);
-	//glDrawBuffer(GL_NONE);
+	packedBlurShader = new Shader("Shaders/blurVert.glsl", "Shaders/packedBlurFrag.glsl");
+	if ( !packedBlurShader->LinkProgram() )
+	{
+		return;
+	}
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE  || !shadowMapDepthTex)
+	tileMaskShader = new Shader("Shaders/blurVert.glsl", "Shaders/tileMaskFrag.glsl");
+	if ( !tileMaskShader->LinkProgram() )
 	{
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-#pragma endregion
+	// only captured, so its fragment shader never runs
+	tileClassifyShader = new Shader("Shaders/tileClassifyVert.glsl", "Shaders/tileMaskFrag.glsl", "Shaders/tileClassifyGeom.glsl");
+	tileClassifyShader->SetFeedbackVaryings(FeedbackMesh::varyings, FEEDBACKMESH_VARYINGS);
+	if ( !tileClassifyShader->LinkProgram() )
+	{
+		return;
+	}
 
+	// every shader drawing with the diffusion profiles reads them from the one buffer
+	Shader *profileShaders[] = { mainShader, blurShader, accumShader, temporalBlurShader, packedBlurShader };
 
-#pragma region gaussian blur buffer
-	// textures
 	for (int i = 0; i < 5; ++i)
 	{
-		generateTexture(blurredTexture[i], width, height);
+		if ( !profileShaders[i]->BindUniformBlock("DiffusionProfiles", DIFFUSIONLIBRARY_BINDING) )
+		{
+			return;
+		}
 	}
 
-	generateTexture(blurTempTex, width, height);
-
-	if (!blurTempTex)
+	// and the separable kernels made of them from another
+	if ( !separableBlurShader->BindUniformBlock("SeparableKernels", SSS_KERNEL_BINDING) )
 	{
 		return;
 	}
-
-	// frame buffer
-	glGenFramebuffers(1, &blurFBO);
 #pragma endregion
 
 
-#pragma region main buffer
-	GLenum buffers[2];
-	buffers[0] = GL_COLOR_ATTACHMENT0;
-	buffers[1] = GL_COLOR_ATTACHMENT1;
-
+#pragma region beckmann texture buffer
 	// diffuse texture
-	generateTexture(bufferColourTex, width, height);
-
-	// linear depth texture
-	generateTexture(bufferDepthTex, width, height);
-
-	// depth-stencil texture
-	generateTexture(bufferDepthStencilTex, width, height, true);
+	generateTexture(beckmannTex, BECKMANN, BECKMANN);
 
 	// frame buffer
-	glGenFramebuffers(1, &bufferFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, bufferFBO);
+	glGenFramebuffers(1, &beckmannFBO);
+	state->BindFramebuffer(beckmannFBO);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferColourTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, bufferDepthTex, 0);
-	glDrawBuffers(2, buffers);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, beckmannTex, 0);
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE || 
-		!bufferColourTex || !bufferDepthTex || !bufferDepthStencilTex)
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE || !beckmannTex)
 	{
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state->BindFramebuffer(0);
 #pragma endregion
 
 
-#pragma region final buffer
-	// diffuse texture
-	generateTexture(finalColourTex, width, height);
-
-	// frame buffer
+#pragma region render targets
+	// Every target but the Beckmann texture comes from the pool as each frame
+	// needs it, so only the frame buffers are made here
+	glGenFramebuffers(1, &frontDepthFBO);
+	glGenFramebuffers(1, &backDepthFBO);
+	glGenFramebuffers(1, &shadowMapFBO);
+	glGenFramebuffers(1, &lightLayersFBO);
+	glGenFramebuffers(1, &blurFBO);
+	glGenFramebuffers(1, &bufferFBO);
 	glGenFramebuffers(1, &finalFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, finalFBO);
+	glGenFramebuffers(1, &reducedFBO);
+	glGenFramebuffers(1, &historyFBO);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, finalColourTex, 0);
-		
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE || !finalColourTex)
+	for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+	{
+		blurredTexture[i] = 0;
+		reducedBlurredTex[i] = 0;
+		historyTex[i] = 0;
+	}
+
+	lightDepthTex = lightZTex = 0;
+	blurTempTex = 0;
+	bufferColourTex = bufferDepthTex = bufferDepthStencilTex = 0;
+	finalColourTex = 0;
+	reducedColourTex = reducedDepthTex = reducedTempTex = 0;
+	historyDepthTex = 0;
+	tileMaskTex = 0;
+	historyValid = false;
+	historyKey = 0;
+	temporalFrame = 0;
+	reportedTargetBytes = 0;
+	blurTempTarget = 0;
+	dumpFrameGraph = false;
+
+	if (!checkRenderTargets())
 	{
 		return;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// the light's depth is made to compare against; this reads it as it is
+	glGenSamplers(1, &rawDepthSampler);
+	glSamplerParameteri(rawDepthSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(rawDepthSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(rawDepthSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(rawDepthSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(rawDepthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
 #pragma endregion
 
 
 #pragma region gaussians
-	gaussiansSkin = &Gaussian::SKIN;
-	gaussiansMarble = &Gaussian::MARBLE;
-
-	// This 6-gaussian sum is included for comparison purposes
-	float variances[] = { 0.0484f, 0.187f, 0.567f, 1.99f, 7.41f };
-	Vector3 weights[] = {
-							Vector3(0.233f, 0.455f, 0.649f),
-							Vector3(0.100f, 0.336f, 0.344f),
-							Vector3(0.118f, 0.198f, 0.0f),
-							Vector3(0.113f, 0.007f, 0.007f),
-							Vector3(0.358f, 0.004f, 0.0f),
-							Vector3(0.078f, 0.0f, 0.0f)
-						};
-
-	skin6Gaussians = Gaussian::gaussianSum(variances, weights, 5);
-	gaussians6Skin = &skin6Gaussians;
+	// each material's profile, drawn with the sum it's shipped with until G fits it with another
+	if ( !DiffusionLibrary::Get().Load(SSS_SKIN, "Profiles/skin.profile") ||
+		 !DiffusionLibrary::Get().Load(SSS_MARBLE, "Profiles/marble.profile") )
+	{
+		return;
+	}
+
+	// the rest of Jensen et al.'s materials, fitted with 4 Gaussians, for the copies drawn with mixed materials (M)
+	const char *jensenMaterials[10] = { "apple", "chicken1", "chicken2", "cream", "ketchup",
+										"potato", "skimmilk", "skin1", "skin2", "wholemilk" };
+
+	for (int i = 0; i < 10; ++i)
+	{
+		DiffusionProfile profile;
+		SSSMaterial material;
+
+		if ( !profile.Load(std::string("Profiles/") + jensenMaterials[i] + ".profile") ||
+			 !DiffusionLibrary::Get().AddMaterial(jensenMaterials[i], profile, 4, material) )
+		{
+			return;
+		}
+	}
+
+	// uploaded for the DiffusionProfiles block, and folded into one kernel each for the SeparableKernels block
+	glGenBuffers(1, &diffusionBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, diffusionBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(DiffusionBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, DIFFUSIONLIBRARY_BINDING, diffusionBuffer);
+
+	glGenBuffers(1, &kernelBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, kernelBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, DIFFUSIONLIBRARY_MAX_MATERIALS * SSSREFERENCE_MAX_KERNEL_TAPS * sizeof(Vector4), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, SSS_KERNEL_BINDING, kernelBuffer);
+
+	diffusionRevision = ~0u;
+	updateDiffusionProfiles();
 
 	correction = 800.0f;
 #pragma endregion
 
 
 #pragma region OpenGL & others variables
-	glEnable(GL_DEPTH_TEST);
+	state->Enable(GL_DEPTH_TEST);
 
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
 		
@@ -292,6 +305,20 @@ Renderer::Renderer(Window &parent) : OGLRenderer( parent )
 	useSSS = true;
 	singleMesh = true;
 	switchMesh = true;
+	mixMaterials = false;
+	compareReference = false;
+	useSeparableKernel = false;
+	useInstancing = true;
+	benchmarkInstances = false;
+	useLayeredLightViews = true;
+	useLightViewCache = true;
+	benchmarkSSS = false;
+	sssReduction = 1;
+	useTemporalSSS = false;
+	useSSSTiles = true;
+	usePackedBlur = true;
+	numInstances = 9;
+	instancesHead = true;
 
 	firstFrame = true;
 	init = true;
@@ -306,9 +333,16 @@ Renderer::~Renderer(void)
 	delete shadowShader;
 	delete mainShader;
 	delete blurShader;
-	delete accumSkinShader;
-	delete accumMarbleShader;
+	delete accumShader;
+	delete separableBlurShader;
 	delete depthShader;
+	delete lightLayersShader;
+	delete downsampleShader;
+	delete upsampleShader;
+	delete temporalBlurShader;
+	delete packedBlurShader;
+	delete tileMaskShader;
+	delete tileClassifyShader;
 	currentShader = NULL;
 
 
@@ -317,36 +351,33 @@ Renderer::~Renderer(void)
 	glDeleteFramebuffers(1, &beckmannFBO);
 
 
-	// --- two depth maps ---
-	glDeleteTextures(1, &frontZValTex);
-	glDeleteTextures(1, &backZValTex);
-	glDeleteTextures(1, &frontDepthTex);
-	glDeleteTextures(1, &backDepthTex);
+	// Render targets; the pool deletes their textures
 	glDeleteFramebuffers(1, &frontDepthFBO);
 	glDeleteFramebuffers(1, &backDepthFBO);
-	// --- o ---
-
-
-	// Shadow map buffer
-	glDeleteTextures(1, &shadowMapTex);
-	glDeleteTextures(1, &shadowMapDepthTex);
 	glDeleteFramebuffers(1, &shadowMapFBO);
-
-
-	// main buffer
-	glDeleteTextures(1, &bufferColourTex);
-	glDeleteTextures(1, &bufferDepthTex);
-	glDeleteTextures(1, &bufferDepthStencilTex);
+	glDeleteFramebuffers(1, &lightLayersFBO);
 	glDeleteFramebuffers(1, &bufferFBO);
+	glDeleteFramebuffers(1, &blurFBO);
+	glDeleteFramebuffers(1, &finalFBO);
+	glDeleteFramebuffers(1, &reducedFBO);
+	glDeleteFramebuffers(1, &historyFBO);
 
 
-	// gaussian blur buffer
-	glDeleteTextures(5, blurredTexture);
-	glDeleteTextures(1, &blurTempTex);
-	glDeleteFramebuffers(1, &blurFBO);
+	glDeleteSamplers(1, &rawDepthSampler);
+	glDeleteBuffers(1, &diffusionBuffer);
+	glDeleteBuffers(1, &kernelBuffer);
+	targetPool.Release(lightDepthTex);
+	targetPool.Release(lightZTex);
+	releaseHistory();
+
 
+	// Meshes; the tiles' last texture came from the pool, which deletes it
+	sssTiles->SetTexture(0);
+	delete sssTiles;
+	state->ForgetVertexArray(tileArray);
+	glDeleteVertexArrays(1, &tileArray);
 
-	// Meshes
+	delete instances;
 	delete quad;
 	delete headMesh;
 	delete lightMesh;
@@ -360,7 +391,7 @@ Renderer::~Renderer(void)
 void Renderer::generateTexture(GLuint &into, float width, float height, bool depth_stencil)
 {
 	glGenTextures(1, &into);
-	glBindTexture(GL_TEXTURE_2D, into);
+	state->BindTexture(into);
 
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -378,31 +409,95 @@ void Renderer::generateTexture(GLuint &into, float width, float height, bool dep
 				 NULL
 				);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	state->BindTexture(0);
 }
 
-void Renderer::generateDepthTexture(GLuint &into, float width, float height)
+bool Renderer::checkRenderTargets()
 {
-	glGenTextures(1, &into);
-	glBindTexture(GL_TEXTURE_2D, into);
+	bool complete = true;
 
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	// the light's depth targets, a layer at a time for the separate passes and all of them for the layered one.
+	// These are kept, attached, until the renderer goes, for frames that can reuse what's in them
+	lightDepthTex = targetPool.Acquire(SHADOWMAP, SHADOWMAP, RENDERTARGET_DEPTH24, RENDERTARGET_SHADOW, LIGHT_LAYERS);
+	lightZTex = targetPool.Acquire(SHADOWMAP, SHADOWMAP, RENDERTARGET_RGBA8, RENDERTARGET_SAMPLED, LIGHT_LAYERS);
 
-	glTexImage2D(GL_TEXTURE_2D, 
-				 0, 
-				 GL_DEPTH_COMPONENT24, 
-				 width, 
-				 height, 
-				 0, 
-				 GL_DEPTH_COMPONENT, 
-				 GL_UNSIGNED_BYTE, 
-				 NULL
-				);
+	GLuint layerFBOs[LIGHT_LAYERS] = { shadowMapFBO, frontDepthFBO, backDepthFBO };
+
+	for (int layer = 0; layer < LIGHT_LAYERS; ++layer)
+	{
+		state->BindFramebuffer(layerFBOs[layer]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, lightDepthTex, 0, layer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lightZTex, 0, layer);
+		complete &= (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	}
+
+	state->BindFramebuffer(lightLayersFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, lightDepthTex, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lightZTex, 0);
+	complete &= (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	// main buffer, which always draws into both its colour attachments
+	GLenum buffers[2];
+	buffers[0] = GL_COLOR_ATTACHMENT0;
+	buffers[1] = GL_COLOR_ATTACHMENT1;
+
+	bufferColourTex = targetPool.Acquire(width, height);
+	bufferDepthTex = targetPool.Acquire(width, height);
+	bufferDepthStencilTex = targetPool.Acquire(width, height, RENDERTARGET_DEPTH24_STENCIL8);
+
+	attachMainTargets();
+	glDrawBuffers(2, buffers);
+	complete &= (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	// blur and final buffers, which share the main buffer's depth & stencil
+	blurTempTex = targetPool.Acquire(width, height);
+	finalColourTex = targetPool.Acquire(width, height);
+
+	GLuint fbos[2] = { blurFBO, finalFBO };
+	GLuint colourTex[2] = { blurTempTex, finalColourTex };
+
+	for (int i = 0; i < 2; ++i)
+	{
+		state->BindFramebuffer(fbos[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colourTex[i], 0);
+		complete &= (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	}
+
+	targetPool.Release(blurTempTex);
+	targetPool.Release(finalColourTex);
+	targetPool.Release(bufferColourTex);
+	targetPool.Release(bufferDepthTex);
+	targetPool.Release(bufferDepthStencilTex);
+
+	state->BindFramebuffer(0);
+
+	if (!complete)
+	{
+		std::cout << "Renderer::checkRenderTargets: A frame buffer isn't complete!" << std::endl;
+	}
+
+	return complete;
+}
+
+void Renderer::attachMainTargets()
+{
+	state->BindFramebuffer(bufferFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferColourTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, bufferDepthTex, 0);
+}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+void Renderer::Resize(int x, int y)
+{
+	OGLRenderer::Resize(x, y);
+
+	// the light's targets are the same size whatever the window's, and the temporal mode's history
+	// is drawn again at the new size, so every target of the old size can go now
+	releaseHistory();
+	targetPool.Trim();
 }
 
 void Renderer::drawQuad(GLuint &texture, Vector2 &pos, float w, float h)
@@ -414,7 +509,7 @@ void Renderer::drawQuad(GLuint &texture, Vector2 &pos, float w, float h)
 	SetCurrentShader(basicShader);
 
 	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
+	currentShader->SetUniform("diffuseTex", 0);
 
 	// matrices
 	viewMatrix.ToIdentity();
@@ -429,7 +524,7 @@ void Renderer::drawQuad(GLuint &texture, Vector2 &pos, float w, float h)
 	quad->Draw();
 
 	// clean up
-	glUseProgram(0);
+	state->UseProgram(0);
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
 }
 
@@ -457,18 +552,150 @@ void Renderer::UpdateScene(float msec)
 	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_2))
 	{
 		useTransmittance = !useTransmittance;
+
+		// the light views' timings so far drew a different number of layers
+		lightTimer.Reset();
 	}
 
 	// switch between meshes
 	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_3))
 	{
 		switchMesh = !switchMesh;
+
+		// the timings so far were for the other material and mesh
+		sssTimer.SetName(switchMesh ? "SSS (skin)" : "SSS (marble)");
+		sssTimer.Reset();
+		lightTimer.Reset();
 	}
 
 	// switch between a single mesh and multiple meshes
 	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_4))
 	{
 		singleMesh = !singleMesh;
+		lightTimer.Reset();
+	}
+
+	// check the next frame's SSS against the CPU reference
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_5))
+	{
+		compareReference = true;
+	}
+
+	// switch between the cascade of blurs and the single separable kernel
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_6))
+	{
+		useSeparableKernel = !useSeparableKernel;
+	}
+
+	// print the next frame's schedule, the uniforms it set and the GL calls it made
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_7))
+	{
+		dumpFrameGraph = true;
+	}
+
+	// switch between drawing the copies of the mesh one at a time and all at once
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_8))
+	{
+		useInstancing = !useInstancing;
+		lightTimer.Reset();
+	}
+
+	// time both ways of drawing them for more and more copies
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_9))
+	{
+		benchmarkInstances = true;
+	}
+
+	// double or halve the copies
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_PLUS))
+	{
+		numInstances = min(numInstances * 2, (unsigned int)SSS_MAX_INSTANCES);
+		lightTimer.Reset();
+	}
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_MINUS) && numInstances > 1)
+	{
+		numInstances /= 2;
+		lightTimer.Reset();
+	}
+
+	// switch between drawing the light's views in separate passes and in one layered pass
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_0))
+	{
+		useLayeredLightViews = !useLayeredLightViews;
+	}
+
+	// switch between keeping the light's views while nothing they show changes and drawing them every frame
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_C))
+	{
+		useLightViewCache = !useLightViewCache;
+		lightViewCache.ResetCounters();
+	}
+
+	// run the wide blur levels at full, half or a quarter of the resolution
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_Q))
+	{
+		sssReduction = sssReduction >= 4 ? 1 : sssReduction * 2;
+		sssTimer.Reset();
+		std::cout << "SSS blur levels from " << SSSREFERENCE_REDUCED_MIN_WIDTH << " wide at 1/" << sssReduction << " resolution" << std::endl;
+	}
+
+	// time each blur level at each resolution
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_T))
+	{
+		benchmarkSSS = true;
+	}
+
+	// switch between blurring every level from scratch and blending in the last frame's
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_H))
+	{
+		useTemporalSSS = !useTemporalSSS;
+		sssTimer.Reset();
+
+		if (!useTemporalSSS)
+		{
+			releaseHistory();
+		}
+	}
+
+	// switch between drawing the full resolution SSS passes over the whole screen and only over the tiles with SSS
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_K))
+	{
+		useSSSTiles = !useSSSTiles;
+		sssTimer.Reset();
+		tileStats.ResetCounters();
+		std::cout << "SSS passes drawn over " << (useSSSTiles ? "the tiles with SSS" : "the whole screen") << std::endl;
+	}
+
+	// switch between blurFrag.glsl's blurs and packedBlurFrag.glsl's, which read the depth from the alpha the pass before packed it into
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_P))
+	{
+		usePackedBlur = !usePackedBlur;
+		sssTimer.Reset();
+		printBlurFetches();
+	}
+
+	// draw the material with the next fit of its profile, cached next to it once it's been fitted
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_G))
+	{
+		cycleDiffusionFit();
+	}
+
+	// switch between drawing every copy with the mesh's material and each with the next of the DiffusionLibrary's
+	if (Window::GetKeyboard()->KeyTriggered(KEYBOARD_M))
+	{
+		mixMaterials = !mixMaterials;
+		sssTimer.Reset();
+
+		std::cout << "SSS materials drawn:";
+
+		for (unsigned int m = 0; m < DiffusionLibrary::Get().GetNumMaterials(); ++m)
+		{
+			if (frameMaterials() & (1u << m))
+			{
+				std::cout << " " << DiffusionLibrary::Get().GetName((SSSMaterial)m);
+			}
+		}
+		std::cout << ", in " << DiffusionLibrary::Get().GetNumLevels(frameMaterials()) << " levels" << std::endl;
 	}
 
 	// light movement
@@ -494,88 +721,525 @@ void Renderer::UpdateScene(float msec)
 
 void Renderer::RenderScene()
 {
-	// Beckmann texture
-	if (firstFrame) {
-		computeBeckmannTex();
+	state->BeginFrame();
+	targetPool.BeginFrame();
+	Shader::ResetUniformCounters();
 
-		firstFrame = false;
+	updateInstances();
+
+	if (benchmarkInstances)
+	{
+		benchmarkInstancing();
+		benchmarkInstances = false;
 	}
 
-	// Depth maps
-	drawDepthmap(FRONT);
-	drawDepthmap(BACK);
+	// Only plan the frame again if what it has to do has changed
+	SSSFrameSettings settings = getFrameSettings();
+	settings.lightViewsCached = !lightViewsChanged();
 
-	// Shadow map pass
-	shadowMapPass();
+	if (!frameGraph.IsCompiled() || !(settings == graphSettings))
+	{
+		if (!declareFrameGraph(frameGraph, settings, this))
+		{
+			return;
+		}
+		graphSettings = settings;
+	}
 
-	// Main rendering pass
-	mainPass();
+	// the quad until the tiles are listed, if they are
+	sssArea = quad;
 
-	// SSS pass
-	if ( switchMesh ) {
-		sssPass(*gaussiansSkin);
-	}
-	else {
-		sssPass(*gaussiansMarble);
-	}
+	frameGraph.Execute(targetPool);
 
-	// Final accumulation pass
-	accumulationPass();
+	if (dumpFrameGraph)
+	{
+		frameGraph.Dump(std::cout);
+		std::cout << "Uniforms: " << Shader::GetUniformUploads() << " uploaded this frame, "
+				  << Shader::GetUniformsSkipped() << " skipped as unchanged" << std::endl;
+		state->PrintStats("SSSSS");
+		lightViewCache.PrintStats("SSSSS light");
 
-	// Render to screen
-	presentScene();
+		if (useSSSTiles)
+		{
+			tileStats.PrintStats("SSSSS");
+		}
+
+		if (useSSS && !useSeparableKernel)
+		{
+			printBlurFetches();
+		}
+
+		DiffusionLibrary::Get().PrintFit(meshMaterial());
+		dumpFrameGraph = false;
+	}
+
+	if (targetPool.GetPeakBytesAllocated() > reportedTargetBytes)
+	{
+		targetPool.PrintStats("SSSSS");
+		reportedTargetBytes = targetPool.GetPeakBytesAllocated();
+	}
 
 	GL_BREAKPOINT
 	SwapBuffers();
-	glUseProgram(0);
+	state->UseProgram(0);
 }
 
-void Renderer::computeBeckmannTex()
+SSSFrameSettings Renderer::getFrameSettings() const
 {
-	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, beckmannFBO);
-	glViewport(0.0f, 0.0f, BECKMANN, BECKMANN);
-	glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	SSSFrameSettings settings;
+	settings.width = width;
+	settings.height = height;
+	settings.firstFrame = firstFrame;
+	settings.useTransmittance = useTransmittance;
+	settings.useSSS = useSSS;
+	settings.useSeparableKernel = useSeparableKernel;
+	settings.switchMesh = switchMesh;
+	settings.compareReference = compareReference;
+	settings.layeredLightViews = useLayeredLightViews;
+	settings.lightViewsCached = false;
+	settings.sssReduction = sssReduction;
+	settings.temporalSSS = useTemporalSSS;
+	settings.sssTiles = useSSSTiles;
+	settings.sssMaterials = frameMaterials();
+	settings.numBlurs = DiffusionLibrary::Get().GetNumLevels(settings.sssMaterials);
+	settings.profileRevision = DiffusionLibrary::Get().GetRevision();
+
+	return settings;
+}
 
-	// shader
-	SetCurrentShader(beckmannShader);
+bool Renderer::declareFrameGraph(FrameGraph &graph, const SSSFrameSettings &settings, Renderer *renderer)
+{
+	graph.Reset();
 
-	// matrices
-	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
-	viewMatrix.ToIdentity();
-	modelMatrix.ToIdentity();
-	UpdateShaderMatrices();
+	Renderer *r = renderer;
 
-	// draw call
-	quad->Draw();
+	RenderTargetDesc screenDesc(settings.width, settings.height);
 
-	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0.0f, 0.0f, (float)width, (float)height);
-}
+#pragma region Targets
+	unsigned int beckmann = graph.Import("beckmann");
+	unsigned int backBuffer = graph.Import("back buffer", true);
 
-void Renderer::drawDepthmap(bool face)
-{
-	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, face ? frontDepthFBO : backDepthFBO);
-	glViewport(0.0f, 0.0f, SHADOWMAP, SHADOWMAP);
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-	glEnable(GL_CULL_FACE);
-	glCullFace(face ? GL_BACK : GL_FRONT);
+	// the shadow map, front and back depth maps, a layer each, held by the renderer so they can be kept
+	unsigned int lightDepth = graph.Import("light depth");
+	unsigned int lightZ = graph.Import("light z");
 
-	// shader
-	SetCurrentShader(depthShader);
+	// the temporal mode's last levels and depth, held by the renderer from frame to frame
+	unsigned int history = settings.temporalSSS ? graph.Import("sss history") : 0;
 
-	// Shader variables
-	glUniform1f( glGetUniformLocation(currentShader->GetProgram(), "zNear"), ZNEAR );
-	glUniform1f( glGetUniformLocation(currentShader->GetProgram(), "zFar"), ZFAR );
+	// the screen tiles with SSS, listed into the renderer's mesh
+	unsigned int tiles = settings.sssTiles ? graph.Import("sss tiles") : 0;
 
-	// matrices
-	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV);
-	viewMatrix = Matrix4::BuildViewMatrix(light->GetPosition(), lightTarget);
+	unsigned int colour = graph.AddTarget("colour", screenDesc, r ? &r->bufferColourTex : NULL);
+	unsigned int linearDepth = graph.AddTarget("linear depth", screenDesc, r ? &r->bufferDepthTex : NULL);
+	unsigned int depthStencil = graph.AddTarget("depth & stencil",
+		RenderTargetDesc(settings.width, settings.height, RENDERTARGET_DEPTH24_STENCIL8), r ? &r->bufferDepthStencilTex : NULL);
+
+	unsigned int blurTemp = graph.AddTarget("blur temp", screenDesc, r ? &r->blurTempTex : NULL);
+	unsigned int finalColour = graph.AddTarget("final", screenDesc, r ? &r->finalColourTex : NULL);
+	unsigned int sssMask = settings.sssTiles ? graph.AddTarget("sss mask", screenDesc, r ? &r->tileMaskTex : NULL) : 0;
+
+	int numBlurs = (int)settings.numBlurs;
+	unsigned int blurred[SSSREFERENCE_MAX_BLURS];
+
+	for (int i = 0; i < numBlurs; ++i)
+	{
+		std::ostringstream name;
+		name << "blurred " << i + 1;
+		blurred[i] = graph.AddTarget(name.str(), screenDesc, r ? &r->blurredTexture[i] : NULL);
+	}
+
+	// the wide levels' targets, when any of them run at a reduced resolution
+	bool blurs = !(settings.useSSS && settings.useSeparableKernel);
+	int firstReduced = (int)SSSReference::GetFirstReducedLevel(settings.sssMaterials, settings.sssReduction);
+	bool reduced = blurs && firstReduced < numBlurs;
+
+	unsigned int reducedTargets[3 + SSSREFERENCE_MAX_BLURS];
+	unsigned int numReducedTargets = 0;
+
+	if (reduced)
+	{
+		RenderTargetDesc reducedDesc(SSSReference::GetReducedSize(settings.width, settings.sssReduction),
+									 SSSReference::GetReducedSize(settings.height, settings.sssReduction));
+
+		reducedTargets[numReducedTargets++] = graph.AddTarget("reduced colour", reducedDesc, r ? &r->reducedColourTex : NULL);
+		reducedTargets[numReducedTargets++] = graph.AddTarget("reduced depth", reducedDesc, r ? &r->reducedDepthTex : NULL);
+		reducedTargets[numReducedTargets++] = graph.AddTarget("reduced temp", reducedDesc, r ? &r->reducedTempTex : NULL);
+
+		for (int i = firstReduced; i < numBlurs; ++i)
+		{
+			std::ostringstream name;
+			name << "reduced blurred " << i + 1;
+			reducedTargets[numReducedTargets++] = graph.AddTarget(name.str(), reducedDesc, r ? &r->reducedBlurredTex[i] : NULL);
+		}
+	}
+
+	if (r)
+	{
+		r->blurTempTarget = blurTemp;
+	}
+#pragma endregion
+
+#pragma region Passes
+	unsigned int pass;
+
+	// Beckmann texture, kept from the first frame on
+	if (settings.firstFrame)
+	{
+		pass = graph.AddPass("beckmann", [r]() { r->computeBeckmannTex(); r->firstFrame = false; });
+		graph.Write(pass, beckmann, FRAMEGRAPH_CLEAR);
+	}
+
+	// The light's views, unless what they show hasn't changed since they were last drawn
+	if (!settings.lightViewsCached)
+	{
+		// The depth maps share their targets with the shadow map, which is always read,
+		// so instead of being culled when there's no transmittance they're left out
+		if (settings.layeredLightViews)
+		{
+			pass = graph.AddPass("light views", [r]()
+			{
+				r->lightTimer.Begin(1);
+				r->lightViewsPass();
+				r->lightTimer.End();
+			});
+			graph.Write(pass, lightDepth, FRAMEGRAPH_CLEAR);
+			graph.Write(pass, lightZ, FRAMEGRAPH_CLEAR);
+		}
+		else
+		{
+			// each clears the layer it draws into
+			if (settings.useTransmittance)
+			{
+				pass = graph.AddPass("front depth map", [r]() { r->lightTimer.Begin(0); r->drawDepthmap(FRONT); });
+				graph.Write(pass, lightDepth, FRAMEGRAPH_CLEAR);
+				graph.Write(pass, lightZ, FRAMEGRAPH_CLEAR);
+
+				pass = graph.AddPass("back depth map", [r]() { r->drawDepthmap(BACK); });
+				graph.Write(pass, lightDepth, FRAMEGRAPH_CLEAR);
+				graph.Write(pass, lightZ, FRAMEGRAPH_CLEAR);
+			}
+
+			// timed from the first of the passes, so a timing that couldn't start there doesn't start part way
+			bool first = !settings.useTransmittance;
+
+			pass = graph.AddPass("shadow map", [r, first]()
+			{
+				if (first)
+				{
+					r->lightTimer.Begin(0);
+				}
+				r->shadowMapPass();
+				r->lightTimer.End();
+			});
+			graph.Write(pass, lightDepth, FRAMEGRAPH_CLEAR);
+			graph.Write(pass, lightZ, FRAMEGRAPH_CLEAR);
+		}
+	}
+
+	// Main rendering pass; the linear shadow map and depth maps are only sampled for transmittance
+	pass = graph.AddPass("main", [r]() { r->mainPass(); });
+	graph.Read(pass, lightDepth);
+	graph.Read(pass, beckmann);
+
+	if (settings.useTransmittance)
+	{
+		graph.Read(pass, lightZ);
+	}
+
+	graph.Write(pass, colour, FRAMEGRAPH_CLEAR);
+	graph.Write(pass, linearDepth, FRAMEGRAPH_CLEAR);
+	graph.Write(pass, depthStencil, FRAMEGRAPH_CLEAR);
+
+	// The tiles the SSS is drawn over, culled with it
+	if (settings.sssTiles)
+	{
+		// timed with the SSS they're for
+		pass = graph.AddPass("sss mask", [r]()
+		{
+			if (!r->benchmarkSSS)
+			{
+				r->beginSSSTimer();
+			}
+			r->tileMaskPass();
+		});
+		graph.Read(pass, depthStencil);
+		graph.Write(pass, sssMask, FRAMEGRAPH_CLEAR);
+
+		pass = graph.AddPass("sss tiles", [r]() { r->tileClassifyPass(); });
+		graph.Read(pass, sssMask);
+		graph.Write(pass, tiles);
+	}
+
+	if (!blurs)
+	{
+		// SSS in two passes, straight into the final buffer
+		pass = graph.AddPass("separable sss", [r]()
+		{
+			r->beginSSSTimer();
+			r->separableSSSPass();
+			r->sssTimer.End();
+		});
+		graph.Read(pass, colour);
+		graph.Read(pass, linearDepth);
+
+		if (settings.sssTiles)
+		{
+			graph.Read(pass, tiles);
+		}
+
+		graph.Write(pass, blurTemp, FRAMEGRAPH_CLEAR);
+		graph.Write(pass, finalColour);
+		graph.Write(pass, depthStencil);
+	}
+	else
+	{
+		// SSS blurs, only read by the accumulation when SSS is on
+		pass = graph.AddPass("sss blurs", [r]()
+		{
+			// the level benchmark has the frame's one elapsed time query to itself
+			if (!r->benchmarkSSS)
+			{
+				r->beginSSSTimer();
+			}
+			r->sssPass(r->frameMaterials());
+		});
+		graph.Read(pass, colour);
+		graph.Read(pass, linearDepth);
+		graph.Read(pass, depthStencil);
+
+		if (settings.sssTiles)
+		{
+			graph.Read(pass, tiles);
+		}
+
+		graph.Write(pass, blurTemp, FRAMEGRAPH_CLEAR);
+
+		for (int i = 0; i < numBlurs; ++i)
+		{
+			graph.Write(pass, blurred[i], FRAMEGRAPH_CLEAR);
+		}
+
+		// every texel of these is drawn, so none need clearing
+		for (unsigned int i = 0; i < numReducedTargets; ++i)
+		{
+			graph.Write(pass, reducedTargets[i]);
+		}
+
+		// blended in
+		if (settings.temporalSSS)
+		{
+			graph.Read(pass, history);
+		}
+
+		// then replaced with this frame's, for the next; only while there's SSS, so it doesn't keep the blurs from being culled
+		if (settings.temporalSSS && settings.useSSS)
+		{
+			pass = graph.AddPass("keep sss history", [r]() { r->keepHistory(); });
+			graph.Read(pass, linearDepth);
+			graph.Read(pass, depthStencil);
+
+			for (int i = 0; i < numBlurs; ++i)
+			{
+				graph.Read(pass, blurred[i]);
+			}
+
+			if (settings.sssTiles)
+			{
+				graph.Read(pass, tiles);
+			}
+
+			graph.Write(pass, history);
+			graph.SetSideEffect(pass);
+		}
+
+		// Final accumulation pass
+		pass = graph.AddPass("accumulation", [r]()
+		{
+			r->accumulationPass();
+			r->sssTimer.End();
+		});
+		graph.Read(pass, colour);
+
+		// with each pixel's material
+		if (settings.useSSS)
+		{
+			graph.Read(pass, linearDepth);
+
+			for (int i = 0; i < numBlurs; ++i)
+			{
+				graph.Read(pass, blurred[i]);
+			}
+		}
+
+		graph.Write(pass, finalColour);
+		graph.Write(pass, depthStencil);
+	}
+
+	// Checked against the CPU reference, which reads back everything mainPass and the SSS left
+	if (settings.compareReference)
+	{
+		pass = graph.AddPass("compare with reference", [r]()
+		{
+			r->compareWithReference();
+			r->compareReference = false;
+		});
+		graph.Read(pass, colour);
+		graph.Read(pass, linearDepth);
+		graph.Read(pass, depthStencil);
+		graph.Read(pass, finalColour);
+		graph.SetSideEffect(pass);
+	}
+
+	// Render to screen
+	pass = graph.AddPass("present", [r]() { r->presentScene(); });
+	graph.Read(pass, finalColour);
+	graph.Write(pass, backBuffer, FRAMEGRAPH_CLEAR);
+#pragma endregion
+
+	// Without a renderer the passes are only planned, never run
+	return graph.Compile();
+}
+
+bool Renderer::CheckFrameGraph()
+{
+	bool passed = true;
+
+	SSSFrameSettings settings;
+	settings.width = 1900;
+	settings.height = 1024;
+
+	// Every combination of what changes the schedule
+	for (int combination = 0; combination < 2048; ++combination)
+	{
+		settings.firstFrame = (combination & 1) != 0;
+		settings.useTransmittance = (combination & 2) != 0;
+		settings.useSSS = (combination & 4) != 0;
+		settings.useSeparableKernel = (combination & 8) != 0;
+		settings.switchMesh = (combination & 16) != 0;
+		settings.compareReference = (combination & 32) != 0;
+		settings.layeredLightViews = (combination & 64) != 0;
+		settings.lightViewsCached = (combination & 128) != 0;
+		settings.sssReduction = (combination & 256) != 0 ? 2 : 1;
+		settings.temporalSSS = (combination & 512) != 0;
+		settings.sssTiles = (combination & 1024) != 0;
+		settings.sssMaterials = 1u << (settings.switchMesh ? SSS_SKIN : SSS_MARBLE);
+		settings.numBlurs = DiffusionLibrary::Get().GetNumLevels(settings.sssMaterials);
+		settings.profileRevision = DiffusionLibrary::Get().GetRevision();
+
+		FrameGraph graph;
+
+		if (!declareFrameGraph(graph, settings, NULL))
+		{
+			std::cout << "Renderer::CheckFrameGraph: Settings " << combination << " don't compile!" << std::endl;
+			passed = false;
+			continue;
+		}
+
+		bool separable = settings.useSSS && settings.useSeparableKernel;
+		bool lightPasses = !settings.lightViewsCached;
+		bool depthMaps = lightPasses && settings.useTransmittance && !settings.layeredLightViews;
+		int blurs = graph.FindPass("sss blurs");
+		int front = graph.FindPass("front depth map");
+		int back = graph.FindPass("back depth map");
+		int shadow = graph.FindPass("shadow map");
+		int lightViews = graph.FindPass("light views");
+		bool reduced = !separable && settings.sssReduction > 1;
+		int keep = graph.FindPass("keep sss history");
+		int mask = graph.FindPass("sss mask");
+		int tiles = graph.FindPass("sss tiles");
+		bool correct =
+			(settings.sssTiles ? graph.IsCulled(mask) == !settings.useSSS && graph.IsCulled(tiles) == !settings.useSSS :
+								 mask < 0 && tiles < 0) &&
+			(settings.temporalSSS && settings.useSSS && !separable ? keep >= 0 && !graph.IsCulled(keep) : keep < 0) &&
+			(reduced == (graph.FindTarget("reduced colour") >= 0)) &&
+			(depthMaps ? !graph.IsCulled(front) && !graph.IsCulled(back) : front < 0 && back < 0) &&
+			(!lightPasses ? shadow < 0 && lightViews < 0 :
+			 settings.layeredLightViews ? shadow < 0 && !graph.IsCulled(lightViews) : lightViews < 0 && !graph.IsCulled(shadow)) &&
+			(separable ? blurs < 0 : graph.IsCulled(blurs) == !settings.useSSS) &&
+			!graph.IsCulled(graph.FindPass("main")) &&
+			(separable || !graph.IsCulled(graph.FindPass("accumulation"))) &&
+			!graph.IsCulled(graph.FindPass("present")) &&
+			graph.GetBytes() <= graph.GetUnaliasedBytes();
+
+		if (!correct)
+		{
+			std::cout << "Renderer::CheckFrameGraph: Settings " << combination << " culled the wrong passes:" << std::endl;
+			graph.Dump(std::cout);
+			passed = false;
+		}
+	}
+
+	// The schedule of a frame with the default settings, after the first
+	settings.firstFrame = false;
+	settings.useTransmittance = true;
+	settings.useSSS = true;
+	settings.useSeparableKernel = false;
+	settings.switchMesh = true;
+	settings.compareReference = false;
+	settings.layeredLightViews = true;
+	settings.lightViewsCached = false;
+	settings.sssReduction = 1;
+	settings.temporalSSS = false;
+	settings.sssTiles = true;
+	settings.sssMaterials = 1u << SSS_SKIN;
+	settings.numBlurs = DiffusionLibrary::Get().GetNumLevels(settings.sssMaterials);
+
+	FrameGraph graph;
+	declareFrameGraph(graph, settings, NULL);
+	graph.Dump(std::cout);
+
+	std::cout << "Renderer::CheckFrameGraph: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
+
+void Renderer::computeBeckmannTex()
+{
+	// set up
+	state->BindFramebuffer(beckmannFBO);
+	state->Viewport(0.0f, 0.0f, BECKMANN, BECKMANN);
+	glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// shader
+	SetCurrentShader(beckmannShader);
+
+	// matrices
+	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
+	viewMatrix.ToIdentity();
+	modelMatrix.ToIdentity();
+	UpdateShaderMatrices();
+
+	// draw call
+	quad->Draw();
+
+	// clean up
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0.0f, 0.0f, (float)width, (float)height);
+}
+
+void Renderer::drawDepthmap(bool face)
+{
+	// set up; the frame buffer has its layer of the light's targets attached, the depth of which
+	// is read by mainPass, the colour by nothing after this
+	state->BindFramebuffer(face ? frontDepthFBO : backDepthFBO);
+	state->Viewport(0.0f, 0.0f, SHADOWMAP, SHADOWMAP);
+	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	state->Enable(GL_CULL_FACE);
+	state->CullFace(face ? GL_BACK : GL_FRONT);
+
+	// shader
+	SetCurrentShader(depthShader);
+
+	// Shader variables
+	currentShader->SetUniform("zNear", ZNEAR);
+	currentShader->SetUniform("zFar", ZFAR);
+
+	// matrices
+	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV);
+	viewMatrix = Matrix4::BuildViewMatrix(light->GetPosition(), lightTarget);
 	modelMatrix.ToIdentity();
 	UpdateShaderMatrices();
 
@@ -583,30 +1247,71 @@ void Renderer::drawDepthmap(bool face)
 	drawMesh();
 
 	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDisable(GL_CULL_FACE);
-	glViewport(0, 0, width, height);
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Disable(GL_CULL_FACE);
+	state->Viewport(0, 0, width, height);
 }
 
 void Renderer::shadowMapPass()
 {
-	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-	glViewport(0.0f, 0.0f, SHADOWMAP, SHADOWMAP);
+	// set up; attached again as the instancing benchmark borrows the frame buffer
+	state->BindFramebuffer(shadowMapFBO);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, lightDepthTex, 0, LIGHT_SHADOW_LAYER);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lightZTex, 0, LIGHT_SHADOW_LAYER);
+	state->Viewport(0.0f, 0.0f, SHADOWMAP, SHADOWMAP);
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glEnable(GL_DEPTH_TEST);
-	glDepthMask(GL_TRUE);
-	glDepthFunc(GL_LEQUAL);
+	state->Enable(GL_DEPTH_TEST);
+	state->DepthMask(GL_TRUE);
+	state->DepthFunc(GL_LEQUAL);
 
 	// shader
 	SetCurrentShader(shadowShader);
 
 	// Shader variables
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "zNear"), ZNEAR);
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "zFar"), ZFAR);
+	currentShader->SetUniform("zNear", ZNEAR);
+	currentShader->SetUniform("zFar", ZFAR);
+
+	// matrices
+	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV);
+	viewMatrix = Matrix4::BuildViewMatrix(light->GetPosition(), lightTarget);
+	modelMatrix.ToIdentity();
+	shadowMatrix = biasMatrix * (projMatrix * viewMatrix);
+	UpdateShaderMatrices();
+
+	// draw
+	drawMesh();
+
+	// clean up
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0, 0, width, height);
+}
+
+void Renderer::lightViewsPass()
+{
+	// set up; every layer is attached, so the clear clears them all
+	state->BindFramebuffer(lightLayersFBO);
+	state->Viewport(0.0f, 0.0f, SHADOWMAP, SHADOWMAP);
+	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	state->Enable(GL_DEPTH_TEST);
+	state->DepthMask(GL_TRUE);
+	state->DepthFunc(GL_LEQUAL);
+
+	// the geometry shader sorts the faces into the depth map layers itself
+	state->Disable(GL_CULL_FACE);
+
+	// shader
+	SetCurrentShader(lightLayersShader);
+
+	// Shader variables
+	currentShader->SetUniform("zNear", ZNEAR);
+	currentShader->SetUniform("zFar", ZFAR);
+	currentShader->SetUniform("numLayers", useTransmittance ? LIGHT_LAYERS : 1);
 
 	// matrices
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV);
@@ -619,58 +1324,53 @@ void Renderer::shadowMapPass()
 	drawMesh();
 
 	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, width, height);
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0, 0, width, height);
 }
 
 void Renderer::mainPass()
 {
 	//set up
-	glBindFramebuffer(GL_FRAMEBUFFER, bufferFBO);
+	attachMainTargets();
 
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClearStencil(0);
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_STENCIL_TEST);
+	state->Enable(GL_DEPTH_TEST);
+	state->Enable(GL_STENCIL_TEST);
 
 	// shader
 	SetCurrentShader(mainShader);
 
 	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "bumpTex"), 1);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "shadowMapTex"), 2);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "beckmannTex"), 3);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "linearShadowMapTex"), 4);
-
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, shadowMapDepthTex);
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, beckmannTex);
-	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_2D, shadowMapTex);
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("bumpTex", 1);
+	currentShader->SetUniform("shadowMapTex", 2);
+	currentShader->SetUniform("beckmannTex", 3);
+	currentShader->SetUniform("linearShadowMapTex", 4);
+
+	state->BindTextureArray(2, lightDepthTex);
+	state->BindTexture(3, beckmannTex);
+	state->BindTextureArray(4, lightZTex);
 
 	// --- two depth maps ---
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "frontDepthTex"), 5);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "backDepthTex"), 6);
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, frontDepthTex);
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, backDepthTex);
+	// the same layers as the shadow map, but read as plain depths, which the sampler does without touching its compare mode
+	currentShader->SetUniform("lightDepthTex", 5);
+	state->BindTextureArray(5, lightDepthTex);
+	glBindSampler(5, rawDepthSampler);
 	// --- o ---
 
 	// shader variables
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "zNear"), ZNEAR);
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "zFar"), ZFAR);
+	currentShader->SetUniform("zNear", ZNEAR);
+	currentShader->SetUniform("zFar", ZFAR);
 
-	glUniform3fv(glGetUniformLocation(currentShader->GetProgram(), "cameraPos"), 1, (float*)&camera->GetPosition());
+	currentShader->SetUniform("cameraPos", camera->GetPosition());
 	SetShaderLight(*light);
 
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "useTransmittance"), useTransmittance);
+	currentShader->SetUniform("useTransmittance", useTransmittance);
 
 	// matrices
 	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
@@ -681,34 +1381,58 @@ void Renderer::mainPass()
 	Matrix4 lightViewMatrix = Matrix4::BuildViewMatrix(light->GetPosition(), lightTarget);
 	Matrix4 lightProjMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV);
 	lightView = biasMatrix * (lightProjMatrix * lightViewMatrix);
-	glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "lightView"), 1,false, (float*)&lightView);
+	currentShader->SetUniform("lightView", lightView);
 	// --- o ---
 
 	// set stencil for geometry with SSS
-	glStencilFunc(GL_ALWAYS, 1, ~0);
-	glStencilOp(GL_REPLACE, GL_REPLACE, GL_REPLACE);
+	state->StencilFunc(GL_ALWAYS, 1, ~0);
+	state->StencilOp(GL_REPLACE, GL_REPLACE, GL_REPLACE);
 
 	// draw calls
 	drawMesh();
 
 	// set stencil for geometry without SSS
-	glStencilFunc(GL_ALWAYS, 2, ~0);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	state->StencilFunc(GL_ALWAYS, 2, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
 	// draw calls
 	drawLight();
 
 	// clean up
-	glUseProgram(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindSampler(5, 0);
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
 }
 
-void Renderer::sssPass(const std::vector<Gaussian> &gaussians)
+void Renderer::sssPass(unsigned int materials)
 {
+	if (benchmarkSSS)
+	{
+		benchmarkSSSLevels(materials);
+		benchmarkSSS = false;
+	}
+
+	// the temporal mode reads the depth buffer to reproject, so it keeps blurFrag.glsl's way
+	bool packed = usePackedBlur && !useTemporalSSS;
+
 	// set up
-	glBindFramebuffer(GL_FRAMEBUFFER, blurFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	beginBlurs(false, useTemporalSSS, packed);
+
+	if (useTemporalSSS)
+	{
+		beginTemporal();
+	}
+
+	// every horizontal pass only draws the stencilled pixels, so the rest of
+	// the temporary texture only has to be cleared once, not once per blur;
+	// packed, to the background's depth of 0
+	if (frameGraph.NeedsClear(blurTempTarget))
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTempTex, 0);
+		glClearColor(0.0f, 0.0f, 0.0f, packed ? 0.0f : 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	}
 /*
 	// clear textures
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTempTex[0], 0);
@@ -717,125 +1441,705 @@ void Renderer::sssPass(const std::vector<Gaussian> &gaussians)
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTempTex[1], 0);
 	glClear( GL_COLOR_BUFFER_BIT );
 */
-	// set up stencil test
-	glStencilFunc(GL_EQUAL, 1, ~0);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	// as many levels as the material with the most has; the rest blur by nothing past their own
+	unsigned int numBlurs = DiffusionLibrary::Get().GetNumLevels(materials);
+	unsigned int first = SSSReference::GetFirstReducedLevel(materials, sssReduction);
 
-	// shader
-	SetCurrentShader(blurShader);
+	//Call blur passes, each blurring the one before, the narrow ones at full resolution:
+	GLuint *source = &bufferColourTex;
 
-	// shader textures
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "diffuseTex"), 0);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "depthTex"), 5);
+	for (unsigned int i = 0; i < first; ++i)
+	{
+		// what was kept of this level, for the temporal mode
+		if (useTemporalSSS)
+		{
+			state->BindTexture(6, historyTex[i]);
+		}
 
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, bufferDepthTex);
+		if (packed)
+		{
+			// the level the reduced ones are shrunk from keeps the strength in its alpha
+			packedBlurPass(*source, blurredTexture[i], blurTempTex, i, i > 0, i + 1 < first || first == numBlurs);
+		}
+		else
+		{
+			blurPass(*source, blurredTexture[i], blurTempTex, i);
+		}
+		source = &blurredTexture[i];
+	}
 
-	// shader variables
-	glUniform2f(glGetUniformLocation(currentShader->GetProgram(), "pixelSize"), 1.0f/width, 1.0f/height);
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "correction"), correction);
+	if (first < numBlurs)
+	{
+		reducedSSSPass(first, numBlurs, *source);
+	}
 
-	// matrices
+	// clean up
+	state->BindFramebuffer(0);
+	state->UseProgram(0);
+}
+
+void Renderer::tileMaskPass()
+{
+	// Set up; the stencil can't be sampled before GL 4.3, so its SSS pixels are marked where it can
+	state->BindFramebuffer(blurFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileMaskTex, 0);
+	state->Viewport(0, 0, width, height);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	state->StencilFunc(GL_EQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	// Shader
+	SetCurrentShader(tileMaskShader);
+
+	// Matrices
 	modelMatrix.ToIdentity();
 	viewMatrix.ToIdentity();
 	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
 	UpdateShaderMatrices();
 
-	//Call blur passes:
-	// blur 1
-	blurPass(bufferColourTex, blurredTexture[0], bufferColourTex, gaussians[0]);
-	// blur 2
-	blurPass(blurredTexture[0], blurredTexture[1], bufferColourTex, gaussians[1]);
-	// blur 3
-	blurPass(blurredTexture[1], blurredTexture[2], bufferColourTex, gaussians[2]);
-
-	if (!switchMesh)
-	{
-		// blur 4
-		blurPass(blurredTexture[2], blurredTexture[3], bufferColourTex, gaussians[3]);
-	}
+	// Draw call
+	quad->Draw();
 
-	// clean up
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(0);
+	// Clean up; the mask's read next, so it can't stay attached to what's bound
+	state->BindFramebuffer(0);
+	state->UseProgram(0);
 }
 
-void Renderer::blurPass(GLuint &sourceTex, GLuint &targetTex, GLuint &finalTarget, const Gaussian &gaussian)
+void Renderer::tileClassifyPass()
 {
-	// gaussian variables
-	glUniform1f(glGetUniformLocation(currentShader->GetProgram(), "gaussianWidth"), gaussian.getWidth());
+	unsigned int tilesAcross = SSSTiles::GetTilesAcross(width);
+	unsigned int tilesDown = SSSTiles::GetTilesAcross(height);
 
-#pragma region Horizontal Pass
-	// set up render targets
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTempTex, 0);
+	// The last list whose count has come back, before a new size throws the record away
+	unsigned int triangles;
 
-	glClear(GL_COLOR_BUFFER_BIT);
+	if (sssTiles->CollectPrimitivesWritten(triangles))
+	{
+		tileStats.Record(triangles / SSS_TILE_TRIANGLES);
+	}
 
-	// shader variables
-	glUniform2f(glGetUniformLocation(currentShader->GetProgram(), "dir"), 1.0f, 0.0f);
+	tileStats.SetScreen(width, height);
+	sssTiles->Reserve(tilesAcross * tilesDown * SSS_TILE_VERTICES);
 
-	// draw
-	quad->SetTexture(sourceTex);
-	quad->Draw();
-#pragma endregion
+	// Shader
+	SetCurrentShader(tileClassifyShader);
+	currentShader->SetUniform("maskTex", 0);
+	currentShader->SetUniform("tilesAcross", (int)tilesAcross);
+	currentShader->SetUniform("tileSize", SSS_TILE_SIZE);
+	currentShader->SetUniform("margin", SSS_TILE_MARGIN);
+	currentShader->SetUniform("screenSize", Vector2((float)width, (float)height));
 
-#pragma region Vertical Pass
-	// set up render targets
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTex, 0);
+	state->BindTexture(0, tileMaskTex);
 
-	glClear(GL_COLOR_BUFFER_BIT);
+	// Draw call; a point a tile, with nothing to read but its index, and only the tiles with SSS written
+	state->Enable(GL_RASTERIZER_DISCARD);
+	state->BindVertexArray(tileArray);
 
-	// shader variables
-	glUniform2f(glGetUniformLocation(currentShader->GetProgram(), "dir"), 0.0f, 1.0f);
+	sssTiles->BeginCapture(GL_TRIANGLES);
+	glDrawArrays(GL_POINTS, 0, tilesAcross * tilesDown);
+	sssTiles->EndCapture();
 
-	// draw
-	quad->SetTexture(blurTempTex);
-	quad->Draw();
-#pragma endregion
+	state->Disable(GL_RASTERIZER_DISCARD);
+
+	// the rest of the frame's stencilled SSS passes draw them
+	sssArea = sssTiles;
+
+	// Clean up
+	state->UseProgram(0);
 }
 
-void Renderer::accumulationPass()
+void Renderer::beginBlurs(bool reduced, bool temporal, bool packed)
 {
-	// Set up
-	glBindFramebuffer(GL_FRAMEBUFFER, finalFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
-
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	int w = reduced ? (int)SSSReference::GetReducedSize(width, sssReduction) : width;
+	int h = reduced ? (int)SSSReference::GetReducedSize(height, sssReduction) : height;
 
-	// Shader
-	if (switchMesh)
+	if (reduced)
 	{
-		SetCurrentShader(accumSkinShader);
+		// no depth & stencil here, so every texel is drawn and the stencil test passes; the next
+		// level's taps read round the pixels with SSS, so it's the quad rather than the tiles
+		state->BindFramebuffer(reducedFBO);
+		state->Viewport(0, 0, w, h);
+		blurArea = quad;
 	}
 	else
 	{
-		SetCurrentShader(accumMarbleShader);
+		state->BindFramebuffer(blurFBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+		state->Viewport(0, 0, width, height);
+
+		// set up stencil test
+		state->StencilFunc(GL_EQUAL, 1, ~0);
+		state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+		blurArea = sssArea;
 	}
 
-	// Shader textures & variables
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "useSSS"), useSSS);
+	// shader
+	SetCurrentShader(temporal ? temporalBlurShader : packed ? packedBlurShader : blurShader);
 
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex1"), 5);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex2"), 6);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex3"), 7);
-	glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex4"), 8);
+	// shader textures
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("depthTex", 5);
 
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, bufferColourTex);
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[0]);
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[1]);
-	glActiveTexture(GL_TEXTURE8);
-	glBindTexture(GL_TEXTURE_2D, blurredTexture[2]);
+	// along with each pixel's material, and for the packed blur, its strength
+	state->BindTexture(5, reduced ? reducedDepthTex : bufferDepthTex);
 
-	if (!switchMesh)
+	// shader variables; each pixel's widths are its material's profile's
+	currentShader->SetUniform("pixelSize", Vector2(1.0f/w, 1.0f/h));
+	currentShader->SetUniform("correction", correction);
+
+	// matrices
+	modelMatrix.ToIdentity();
+	viewMatrix.ToIdentity();
+	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
+	UpdateShaderMatrices();
+}
+
+void Renderer::blurPass(GLuint &sourceTex, GLuint &targetTex, GLuint &tempTex, unsigned int level, float widthScale)
+{
+	// gaussian variables
+	currentShader->SetUniform("level", (int)level);
+	currentShader->SetUniform("widthScale", widthScale);
+
+#pragma region Horizontal Pass
+	// set up render targets
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tempTex, 0);
+
+	// shader variables
+	currentShader->SetUniform("dir", Vector2(1.0f, 0.0f));
+
+	// draw
+	blurArea->SetTexture(sourceTex);
+	blurArea->Draw();
+#pragma endregion
+
+#pragma region Vertical Pass
+	// set up render targets
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTex, 0);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// shader variables
+	currentShader->SetUniform("dir", Vector2(0.0f, 1.0f));
+
+	// draw
+	blurArea->SetTexture(tempTex);
+	blurArea->Draw();
+#pragma endregion
+}
+
+void Renderer::packedBlurPass(GLuint &sourceTex, GLuint &targetTex, GLuint &tempTex, unsigned int level,
+							  bool packedSource, bool packTarget)
+{
+	// gaussian variables
+	currentShader->SetUniform("level", (int)level);
+
+#pragma region Horizontal Pass
+	// set up render targets; sssPass cleared the temporary texture to no depth
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tempTex, 0);
+
+	// shader variables
+	currentShader->SetUniform("dir", Vector2(1.0f, 0.0f));
+	currentShader->SetUniform("packedSource", packedSource);
+	currentShader->SetUniform("packOutput", true);
+
+	// draw
+	blurArea->SetTexture(sourceTex);
+	blurArea->Draw();
+#pragma endregion
+
+#pragma region Vertical Pass
+	// set up render targets
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTex, 0);
+
+	glClearColor(0.0f, 0.0f, 0.0f, packTarget ? 0.0f : 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// shader variables
+	currentShader->SetUniform("dir", Vector2(0.0f, 1.0f));
+	currentShader->SetUniform("packedSource", true);
+	currentShader->SetUniform("packOutput", packTarget);
+
+	// draw
+	blurArea->SetTexture(tempTex);
+	blurArea->Draw();
+#pragma endregion
+}
+
+void Renderer::reducedSSSPass(unsigned int first, unsigned int numBlurs, GLuint &sourceTex)
+{
+	downsamplePass(sourceTex);
+
+	// the widths are in the reduced texels
+	beginBlurs(true);
+
+	GLuint *source = &reducedColourTex;
+
+	for (unsigned int i = first; i < numBlurs; ++i)
+	{
+		blurPass(*source, reducedBlurredTex[i], reducedTempTex, i, 1.0f / sssReduction);
+		source = &reducedBlurredTex[i];
+	}
+
+	// each level back up, for the accumulation
+	for (unsigned int i = first; i < numBlurs; ++i)
+	{
+		upsamplePass(reducedBlurredTex[i], blurredTexture[i]);
+	}
+}
+
+void Renderer::downsamplePass(GLuint &sourceTex)
+{
+	// Set up; the colour and depth are shrunk together
+	GLenum buffers[2];
+	buffers[0] = GL_COLOR_ATTACHMENT0;
+	buffers[1] = GL_COLOR_ATTACHMENT1;
+
+	state->BindFramebuffer(reducedFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reducedColourTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, reducedDepthTex, 0);
+	glDrawBuffers(2, buffers);
+
+	state->Viewport(0, 0, SSSReference::GetReducedSize(width, sssReduction), SSSReference::GetReducedSize(height, sssReduction));
+
+	// Shader
+	SetCurrentShader(downsampleShader);
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("depthTex", 5);
+	currentShader->SetUniform("factor", (int)sssReduction);
+
+	state->BindTexture(5, bufferDepthTex);
+
+	// Matrices
+	modelMatrix.ToIdentity();
+	viewMatrix.ToIdentity();
+	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
+	UpdateShaderMatrices();
+
+	// Draw call
+	quad->SetTexture(sourceTex);
+	quad->Draw();
+
+	// Clean up; the blurs read the depth, so it can't stay attached
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+void Renderer::upsamplePass(GLuint &reducedTex, GLuint &targetTex)
+{
+	// Set up; only the stencilled pixels are drawn, as in blurPass
+	state->BindFramebuffer(blurFBO);
+	state->Viewport(0, 0, width, height);
+	state->StencilFunc(GL_EQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTex, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// Shader
+	SetCurrentShader(upsampleShader);
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("depthTex", 5);
+	currentShader->SetUniform("reducedDepthTex", 6);
+	currentShader->SetUniform("factor", (int)sssReduction);
+	currentShader->SetUniform("correction", correction);
+
+	state->BindTexture(5, bufferDepthTex);
+	state->BindTexture(6, reducedDepthTex);
+
+	// Matrices
+	modelMatrix.ToIdentity();
+	viewMatrix.ToIdentity();
+	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
+	UpdateShaderMatrices();
+
+	// Draw call
+	sssArea->SetTexture(reducedTex);
+	sssArea->Draw();
+}
+
+bool Renderer::beginTemporal()
+{
+	// held from frame to frame, like the light's targets
+	if (!historyDepthTex)
+	{
+		historyDepthTex = targetPool.Acquire(width, height);
+
+		for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+		{
+			historyTex[i] = targetPool.Acquire(width, height);
+		}
+		historyValid = false;
+	}
+
+	// another mesh or materials, other levels at full resolution, or another fit, and what was kept isn't this frame's levels
+	unsigned int key = (switchMesh ? 1 : 0) | (mixMaterials ? 2 : 0) | (sssReduction << 2) | (DiffusionLibrary::Get().GetRevision() << 5);
+
+	if (key != historyKey)
+	{
+		historyValid = false;
+		historyKey = key;
+	}
+
+	Matrix4 proj = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
+	temporal.SetCameras(proj, camera->BuildViewMatrix(), historyProj, historyView);
+
+	float tapOffsets[2];
+	SSSTemporal::GetTapOffsets(temporalFrame++, tapOffsets[0], tapOffsets[1]);
+
+	// shader textures; each level's history is bound as it's blurred
+	currentShader->SetUniform("historyTex", 6);
+	currentShader->SetUniform("historyDepthTex", 7);
+
+	state->BindTexture(7, historyDepthTex);
+
+	// shader variables
+	currentShader->SetUniform("useHistory", historyValid);
+	currentShader->SetUniform("reprojectMatrix", temporal.GetReprojection());
+	currentShader->SetUniform("previousProjMatrix", temporal.GetPreviousProj());
+	currentShader->SetUniform("unproject", temporal.GetUnproject());
+	currentShader->SetUniform("zNear", ZNEAR);
+	currentShader->SetUniform("zFar", ZFAR);
+	currentShader->SetUniform("depthTolerance", SSSTEMPORAL_DEPTH_TOLERANCE);
+	currentShader->SetUniform("historyWeight", SSSTEMPORAL_HISTORY_WEIGHT);
+	currentShader->SetUniform("tapOffsets", Vector2(tapOffsets[0], tapOffsets[1]));
+
+	return historyValid;
+}
+
+void Renderer::keepHistory()
+{
+	unsigned int first = SSSReference::GetFirstReducedLevel(frameMaterials(), sssReduction);
+
+	// Set up; only what's under the stencil is kept
+	state->BindFramebuffer(historyFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	state->Viewport(0, 0, width, height);
+
+	state->StencilFunc(GL_EQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	// Shader
+	SetCurrentShader(basicShader);
+	currentShader->SetUniform("diffuseTex", 0);
+
+	// Matrices
+	modelMatrix.ToIdentity();
+	viewMatrix.ToIdentity();
+	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
+	UpdateShaderMatrices();
+
+	// Draw calls; a pixel whose depth wasn't kept is turned away, so only the depth needs clearing
+	for (unsigned int i = 0; i < first; ++i)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTex[i], 0);
+		sssArea->SetTexture(blurredTexture[i]);
+		sssArea->Draw();
+	}
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyDepthTex, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	sssArea->SetTexture(bufferDepthTex);
+	sssArea->Draw();
+
+	// the cameras they were drawn with, to reproject them next frame
+	historyProj = Matrix4::Perspective(ZNEAR, ZFAR, (float)width / (float)height, FOV);
+	historyView = camera->BuildViewMatrix();
+	historyValid = true;
+}
+
+void Renderer::releaseHistory()
+{
+	targetPool.Release(historyDepthTex);
+
+	for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+	{
+		targetPool.Release(historyTex[i]);
+	}
+	historyValid = false;
+}
+
+void Renderer::benchmarkSSSLevels(unsigned int materials)
+{
+	unsigned int wasReduction = sssReduction;
+	GLuint wasColour = reducedColourTex;
+	GLuint wasDepth = reducedDepthTex;
+	GLuint wasTemp = reducedTempTex;
+	GLuint wasBlurred[SSSREFERENCE_MAX_BLURS];
+
+	for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+	{
+		wasBlurred[i] = reducedBlurredTex[i];
+	}
+
+	unsigned int numBlurs = DiffusionLibrary::Get().GetNumLevels(materials);
+	const unsigned int reductions[3] = { 1, 2, 4 };
+
+	// each level's widest Gaussian, of the materials drawn
+	float widths[SSSREFERENCE_MAX_BLURS] = {};
+
+	for (unsigned int m = 0; m < DiffusionLibrary::Get().GetNumMaterials(); ++m)
+	{
+		const std::vector<Gaussian> &gaussians = DiffusionLibrary::Get().GetGaussians((SSSMaterial)m);
+
+		for (unsigned int i = 0; (materials & (1u << m)) && i < numBlurs && i < gaussians.size(); ++i)
+		{
+			widths[i] = max(widths[i], gaussians[i].getWidth());
+		}
+	}
+
+	// ms a pass of each level at each reduction, and of the downsample in the last row
+	double ms[3][SSSREFERENCE_MAX_BLURS + 1];
+
+	GLuint query;
+	glGenQueries(1, &query);
+
+	for (int r = 0; r < 3; ++r)
+	{
+		sssReduction = reductions[r];
+		unsigned int w = SSSReference::GetReducedSize(width, sssReduction);
+		unsigned int h = SSSReference::GetReducedSize(height, sssReduction);
+
+		// targets of its own for the reductions the frame isn't running at
+		if (sssReduction > 1)
+		{
+			reducedColourTex = targetPool.Acquire(w, h);
+			reducedDepthTex = targetPool.Acquire(w, h);
+			reducedTempTex = targetPool.Acquire(w, h);
+
+			for (unsigned int i = 0; i < numBlurs; ++i)
+			{
+				reducedBlurredTex[i] = targetPool.Acquire(w, h);
+			}
+		}
+
+		ms[r][numBlurs] = 0.0;
+
+		if (sssReduction > 1)
+		{
+			glBeginQuery(GL_TIME_ELAPSED, query);
+
+			for (int n = 0; n < SSS_LEVEL_BENCHMARK_PASSES; ++n)
+			{
+				downsamplePass(bufferColourTex);
+			}
+
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			ms[r][numBlurs] = elapsed / 1000000.0 / SSS_LEVEL_BENCHMARK_PASSES;
+		}
+
+		// each level from what the one before left, with its bring back up when reduced
+		for (unsigned int i = 0; i < numBlurs; ++i)
+		{
+			glBeginQuery(GL_TIME_ELAPSED, query);
+
+			for (int n = 0; n < SSS_LEVEL_BENCHMARK_PASSES; ++n)
+			{
+				if (sssReduction == 1)
+				{
+					beginBlurs(false);
+					blurPass(i == 0 ? bufferColourTex : blurredTexture[i - 1], blurredTexture[i], blurTempTex, i);
+				}
+				else
+				{
+					beginBlurs(true);
+					blurPass(i == 0 ? reducedColourTex : reducedBlurredTex[i - 1], reducedBlurredTex[i], reducedTempTex,
+							 i, 1.0f / sssReduction);
+					upsamplePass(reducedBlurredTex[i], blurredTexture[i]);
+				}
+			}
+
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			ms[r][i] = elapsed / 1000000.0 / SSS_LEVEL_BENCHMARK_PASSES;
+		}
+
+		if (sssReduction > 1)
+		{
+			targetPool.Release(reducedColourTex);
+			targetPool.Release(reducedDepthTex);
+			targetPool.Release(reducedTempTex);
+
+			for (unsigned int i = 0; i < numBlurs; ++i)
+			{
+				targetPool.Release(reducedBlurredTex[i]);
+			}
+		}
+	}
+
+	// put everything back as the frame expects it; it draws every level again after this
+	sssReduction = wasReduction;
+	reducedColourTex = wasColour;
+	reducedDepthTex = wasDepth;
+	reducedTempTex = wasTemp;
+
+	for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+	{
+		reducedBlurredTex[i] = wasBlurred[i];
+	}
+
+	// the temporal mode's levels at full resolution, with history to use, and then keeping them
+	double temporalMs[SSSREFERENCE_MAX_BLURS + 1];
+	bool timeTemporal = useTemporalSSS && historyValid;
+
+	for (unsigned int i = 0; timeTemporal && i <= numBlurs; ++i)
+	{
+		glBeginQuery(GL_TIME_ELAPSED, query);
+
+		for (int n = 0; n < SSS_LEVEL_BENCHMARK_PASSES; ++n)
+		{
+			if (i < numBlurs)
+			{
+				beginBlurs(false, true);
+				beginTemporal();
+				state->BindTexture(6, historyTex[i]);
+				blurPass(i == 0 ? bufferColourTex : blurredTexture[i - 1], blurredTexture[i], blurTempTex, i);
+			}
+			else
+			{
+				keepHistory();
+			}
+		}
+
+		glEndQuery(GL_TIME_ELAPSED);
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		temporalMs[i] = elapsed / 1000000.0 / SSS_LEVEL_BENCHMARK_PASSES;
+	}
+
+	// what was kept is this frame's now, so the frame starts again from its own full blur
+	if (timeTemporal)
+	{
+		historyValid = false;
+	}
+
+	// the full resolution levels through packedBlurFrag.glsl, each from what the one before packed
+	double packedMs[SSSREFERENCE_MAX_BLURS];
+
+	for (unsigned int i = 0; i < numBlurs; ++i)
+	{
+		glBeginQuery(GL_TIME_ELAPSED, query);
+
+		for (int n = 0; n < SSS_LEVEL_BENCHMARK_PASSES; ++n)
+		{
+			beginBlurs(false, false, true);
+			packedBlurPass(i == 0 ? bufferColourTex : blurredTexture[i - 1], blurredTexture[i], blurTempTex, i, i > 0, true);
+		}
+
+		glEndQuery(GL_TIME_ELAPSED);
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		packedMs[i] = elapsed / 1000000.0 / SSS_LEVEL_BENCHMARK_PASSES;
+	}
+
+	glDeleteQueries(1, &query);
+
+	std::cout << "SSS level benchmark (" << (mixMaterials ? "mixed materials" : DiffusionLibrary::Get().GetName(meshMaterial())) << ", "
+			  << SSS_LEVEL_BENCHMARK_PASSES << " passes of each, GPU ms a pass at full / half / quarter resolution / full packed"
+			  << (timeTemporal ? " / temporal" : "") << "):" << std::endl;
+
+	for (unsigned int i = 0; i <= numBlurs; ++i)
+	{
+		if (i < numBlurs)
+		{
+			// the fetches each pixel of the level makes at full resolution, unpacked and packed
+			std::cout << "  level " << i + 1 << " (width " << widths[i] << ", "
+					  << SSSReference::GetBlurFetches(i + 1, false) - SSSReference::GetBlurFetches(i, false) << " / "
+					  << SSSReference::GetBlurFetches(i + 1, true) - SSSReference::GetBlurFetches(i, true) << " fetches): ";
+		}
+		else
+		{
+			std::cout << "  downsample, or keeping the history: ";
+		}
+		std::cout << ms[0][i] << " / " << ms[1][i] << " / " << ms[2][i] << " / ";
+
+		if (i < numBlurs)
+		{
+			std::cout << packedMs[i];
+		}
+		else
+		{
+			std::cout << "-";
+		}
+
+		if (timeTemporal)
+		{
+			std::cout << " / " << temporalMs[i];
+		}
+		std::cout << std::endl;
+	}
+
+	std::cout << "  levels from " << SSSREFERENCE_REDUCED_MIN_WIDTH << " wide are reduced, from level "
+			  << SSSReference::GetFirstReducedLevel(materials, 2) + 1 << std::endl;
+
+	if (!timeTemporal)
+	{
+		std::cout << "  the temporal mode is timed once it's on (H) and has history to use" << std::endl;
+	}
+
+	std::cout << "  the full resolution passes drew " << (sssArea == sssTiles ? "only the tiles with SSS" : "the whole screen")
+			  << ", switched with K" << std::endl;
+
+	unsigned int fetches = SSSReference::GetBlurFetches(numBlurs, false);
+	unsigned int packedFetches = SSSReference::GetBlurFetches(numBlurs, true);
+
+	std::cout << "  every level at full resolution: " << fetches << " fetches a pixel unpacked, " << packedFetches << " packed ("
+			  << 100.0f * (fetches - packedFetches) / fetches << "% fewer), switched with P" << std::endl;
+
+	state->BindFramebuffer(0);
+	state->UseProgram(0);
+}
+
+void Renderer::accumulationPass()
+{
+	// Set up
+	state->BindFramebuffer(finalFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, finalColourTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+
+	// The two draws below cover every pixel between them, so the colour needs no clear
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	// Set up stencil test; sssPass may have been culled, and not set it
+	state->StencilFunc(GL_EQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	// Shader
+	SetCurrentShader(accumShader);
+
+	// Shader textures & variables; only the levels the frame ran are read, each pixel's with its material's weights
+	unsigned int numBlurs = DiffusionLibrary::Get().GetNumLevels(frameMaterials());
+
+	currentShader->SetUniform("useSSS", useSSS);
+	currentShader->SetUniform("numLevels", (int)numBlurs);
+
+	currentShader->SetUniform("depthTex", 10);
+	state->BindTexture(10, bufferDepthTex);
+
+	currentShader->SetUniform("blurredTex1", 5);
+	state->BindTexture(5, bufferColourTex);
+
+	for (unsigned int i = 0; i < numBlurs; ++i)
 	{
-		glUniform1i(glGetUniformLocation(currentShader->GetProgram(), "blurredTex5"), 9);
+		std::ostringstream name;
+		name << "blurredTex" << i + 2;
 
-		glActiveTexture(GL_TEXTURE9);
-		glBindTexture(GL_TEXTURE_2D, blurredTexture[3]);
+		currentShader->SetUniform(name.str(), 6 + (int)i);
+		state->BindTexture(6 + i, blurredTexture[i]);
 	}
 
 	// Matrices
@@ -852,8 +2156,8 @@ void Renderer::accumulationPass()
 
 #pragma region Draw geometry without SSS
 	// set up stencil test
-	glStencilFunc(GL_NOTEQUAL, 1, ~0);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	state->StencilFunc(GL_NOTEQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
 	// Shader
 	SetCurrentShader(basicShader);
@@ -867,14 +2171,179 @@ void Renderer::accumulationPass()
 #pragma endregion
 
 	// Clean up
-	glUseProgram(0);
-	glDisable(GL_STENCIL_TEST);
+	state->UseProgram(0);
+	state->Disable(GL_STENCIL_TEST);
+}
+
+void Renderer::separableSSSPass()
+{
+	// set up
+	state->BindFramebuffer(blurFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTempTex, 0);
+
+	if (frameGraph.NeedsClear(blurTempTarget))
+	{
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+
+	// set up stencil test
+	state->StencilFunc(GL_EQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	// shader
+	SetCurrentShader(separableBlurShader);
+
+	// shader textures
+	currentShader->SetUniform("diffuseTex", 0);
+	currentShader->SetUniform("depthTex", 5);
+
+	state->BindTexture(5, bufferDepthTex);
+
+	// shader variables; each pixel's kernel is its material's, in the SeparableKernels block
+	currentShader->SetUniform("pixelSize", Vector2(1.0f/width, 1.0f/height));
+	currentShader->SetUniform("correction", correction);
+	currentShader->SetUniform("kernelTaps", (GLint)SSSREFERENCE_KERNEL_TAPS);
+
+	// matrices
+	modelMatrix.ToIdentity();
+	viewMatrix.ToIdentity();
+	projMatrix = Matrix4::Orthographic(-1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f);
+	UpdateShaderMatrices();
+
+#pragma region Horizontal Pass
+	currentShader->SetUniform("dir", Vector2(1.0f, 0.0f));
+	currentShader->SetUniform("finalPass", 0);
+
+	// draw
+	sssArea->SetTexture(bufferColourTex);
+	sssArea->Draw();
+#pragma endregion
+
+#pragma region Vertical Pass
+	// set up render targets
+	state->BindFramebuffer(finalFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, bufferDepthStencilTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, finalColourTex, 0);
+
+	// this and the draw without SSS cover every pixel, so the colour needs no clear
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	// shader variables
+	currentShader->SetUniform("dir", Vector2(0.0f, 1.0f));
+	currentShader->SetUniform("finalPass", 1);
+
+	// draw
+	sssArea->SetTexture(blurTempTex);
+	sssArea->Draw();
+#pragma endregion
+
+#pragma region Draw geometry without SSS
+	// set up stencil test
+	state->StencilFunc(GL_NOTEQUAL, 1, ~0);
+	state->StencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+	// Shader
+	SetCurrentShader(basicShader);
+
+	// matrices
+	UpdateShaderMatrices();
+
+	// Draw call
+	quad->SetTexture(bufferColourTex);
+	quad->Draw();
+#pragma endregion
+
+	// Clean up
+	state->UseProgram(0);
+	state->Disable(GL_STENCIL_TEST);
+}
+
+bool Renderer::beginSSSTimer()
+{
+	// timings without SSS aren't worth comparing
+	return useSSS && sssTimer.Begin(useSeparableKernel ? 1 : 0);
+}
+
+void Renderer::printBlurFetches()
+{
+	unsigned int first = SSSReference::GetFirstReducedLevel(frameMaterials(), sssReduction);
+
+	bool packed = usePackedBlur && !useTemporalSSS;
+	unsigned int fetches = SSSReference::GetBlurFetches(first, packed);
+	unsigned int unpackedFetches = SSSReference::GetBlurFetches(first, false);
+
+	std::cout << "SSS blurs " << (packed ? "packed" : "unpacked") << (usePackedBlur && useTemporalSSS ? " in the temporal mode" : "")
+			  << ": " << fetches << " texture fetches a pixel with SSS over the " << first << " full resolution levels";
+
+	if (packed && unpackedFetches > 0)
+	{
+		std::cout << ", " << 100.0f * (unpackedFetches - fetches) / unpackedFetches << "% fewer than the " << unpackedFetches << " unpacked";
+	}
+	std::cout << std::endl;
+}
+
+void Renderer::updateDiffusionProfiles()
+{
+	if (diffusionRevision == DiffusionLibrary::Get().GetRevision())
+	{
+		return;
+	}
+
+	DiffusionBlock block;
+	DiffusionLibrary::Get().FillBlock(block);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, diffusionBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(DiffusionBlock), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	diffusionRevision = DiffusionLibrary::Get().GetRevision();
+
+	// The same sums of gaussians, each material's folded into one kernel for separableSSSPass
+	std::vector<Vector4> kernels(DIFFUSIONLIBRARY_MAX_MATERIALS * SSSREFERENCE_MAX_KERNEL_TAPS, Vector4(0.0f, 0.0f, 0.0f, 0.0f));
+	std::vector<Vector4> kernel;
+
+	for (unsigned int m = 0; m < DiffusionLibrary::Get().GetNumMaterials(); ++m)
+	{
+		SSSReference::BuildSeparableKernel((SSSMaterial)m, SSSREFERENCE_KERNEL_TAPS, kernel);
+		std::copy(kernel.begin(), kernel.end(), kernels.begin() + m * SSSREFERENCE_MAX_KERNEL_TAPS);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, kernelBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, kernels.size() * sizeof(Vector4), &kernels[0]);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Renderer::cycleDiffusionFit()
+{
+	SSSMaterial material = meshMaterial();
+	unsigned int n = DiffusionLibrary::Get().GetNumGaussians(material);
+
+	// the shipped sum, then 2 Gaussians, one level, up to as many as there are levels for
+	n = n == 0 ? 2 : (n < DIFFUSIONLIBRARY_MAX_FIT ? n + 1 : 0);
+
+	GameTimer timer;
+	float start = timer.GetMS();
+
+	if (!DiffusionLibrary::Get().SetNumGaussians(material, n))
+	{
+		return;
+	}
+
+	std::cout << "SSS profile ready in " << timer.GetMS() - start << " ms" << std::endl;
+	DiffusionLibrary::Get().PrintFit(material);
+
+	updateDiffusionProfiles();
+	sssTimer.Reset();
+	printBlurFetches();
 }
 
 void Renderer::presentScene()
 {
 	// Set up
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	state->BindFramebuffer(0);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
 	// Shader
@@ -891,80 +2360,317 @@ void Renderer::presentScene()
 	quad->Draw();
 
 	// Clean up
-	glUseProgram(0);
+	state->UseProgram(0);
+}
+
+void Renderer::compareWithReference()
+{
+	SSSReference reference(width, height);
+	reference.SetCorrection(correction);
+
+	unsigned int numPixels = width * height;
+	std::vector<float> depthColour(numPixels * 4);
+	std::vector<float> gpuFinal(numPixels * 4);
+
+	// read back what mainPass and accumulationPass left
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	state->BindFramebuffer(bufferFBO);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, reference.GetColour());
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &depthColour[0]);
+	glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, reference.GetStencil());
+
+	state->BindFramebuffer(finalFBO);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &gpuFinal[0]);
+
+	state->BindFramebuffer(0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	// the linear depth target has the depth in red and the material in green
+	for (unsigned int i = 0; i < numPixels; ++i)
+	{
+		reference.GetDepth()[i] = depthColour[i * 4];
+		reference.GetMaterials()[i] = (unsigned char)(depthColour[i * 4 + 1] * 255.0f + 0.5f);
+	}
+
+	unsigned int materials = frameMaterials();
+	bool reduced = useSSS && !useSeparableKernel && sssReduction > 1;
+
+	// at a reduction, the full resolution cascade from the same buffers, to see what it costs
+	SSSReference full(width, height);
+
+	if (reduced)
+	{
+		full.SetCorrection(correction);
+		memcpy(full.GetColour(), reference.GetColour(), numPixels * 4 * sizeof(float));
+		memcpy(full.GetDepth(), reference.GetDepth(), numPixels * sizeof(float));
+		memcpy(full.GetMaterials(), reference.GetMaterials(), numPixels);
+		memcpy(full.GetStencil(), reference.GetStencil(), numPixels);
+		full.RenderMaterials(materials, true);
+	}
+
+	if (useSSS && useSeparableKernel)
+	{
+		reference.RenderSeparableMaterials();
+	}
+	else
+	{
+		reference.SetReduction(sssReduction);
+		reference.SetPackedBlur(usePackedBlur && !useTemporalSSS);
+		reference.RenderMaterials(materials, useSSS);
+	}
+
+	float error = SSSReference::MaxDifference(reference.GetFinal(), &gpuFinal[0], numPixels);
+
+	std::cout << "SSS against the CPU reference (" << (mixMaterials ? "mixed materials" : DiffusionLibrary::Get().GetName(meshMaterial()))
+			  << (useSSS && useSeparableKernel ? ", separable kernel" : "")
+			  << (useSSS && !useSeparableKernel && useTemporalSSS ? ", temporal, which the reference doesn't blend in" : "")
+			  << (useSSS && !useSeparableKernel && !useTemporalSSS && usePackedBlur ? ", packed" : "");
+
+	if (reduced)
+	{
+		std::cout << ", 1/" << sssReduction << " resolution from level " << SSSReference::GetFirstReducedLevel(materials, sssReduction) + 1;
+	}
+
+	std::cout << "): max difference " << error * 255.0f << "/255" << (error <= SSSREFERENCE_TOLERANCE ? "" : " OUT OF TOLERANCE") << std::endl;
+
+	if (reduced)
+	{
+		float psnr = SSSReference::PSNR(full.GetFinal(), &gpuFinal[0], reference.GetStencil(), numPixels);
+
+		std::cout << "  against the full resolution reference: PSNR " << psnr << " dB"
+				  << (psnr >= SSSREFERENCE_REDUCED_PSNR ? "" : " UNDER THRESHOLD") << std::endl;
+	}
 }
 
 void Renderer::drawMesh()
 {
+	OBJMesh *mesh = switchMesh ? headMesh : knightMesh;
+
+	// the light's matrix; mainVert multiplies the model matrix onto it
+	currentShader->SetUniform("shadowMatrix", shadowMatrix);
+
+	// and offsets the shadow lookup by 1.5 of the mesh's units, before its quantised positions are scaled back
+	currentShader->SetUniform("dequantScale", mesh->GetDequantScale());
+
+	// the SSS material mainPass writes for the first copy, and how the rest follow on from it
+	currentShader->SetUniform("material", (int)meshMaterial());
+	currentShader->SetUniform("mixMaterials", mixMaterials);
+	currentShader->SetUniform("numMaterials", (int)DiffusionLibrary::Get().GetNumMaterials());
+
 	if (singleMesh)
 	{
-		if (switchMesh)
-		{
-			modelMatrix = Matrix4::Translation(Vector3(0.0f, 0.0f, 0.0f)) * Matrix4::Scale(Vector3(1.0f, 1.0f, 1.0f));
-		}
-		else
+		modelMatrix = singleMeshMatrix();
+		UpdateShaderMatrices();
+
+		mesh->Draw();
+	}
+	else if (useInstancing)
+	{
+		// one draw per submesh for every copy, each placed by its matrix in the instance buffer
+		currentShader->SetUniform("useInstancing", 1);
+		mesh->DrawInstanced(instances->GetNumInstances());
+		currentShader->SetUniform("useInstancing", 0);
+	}
+	else
+	{
+		for (unsigned int i = 0; i < instanceMatrices.size(); ++i)
 		{
-			modelMatrix = Matrix4::Translation(Vector3(0.0f, -0.2f, 0.0f)) * Matrix4::Scale(Vector3(0.0051f, 0.005f, 0.005f));
+			modelMatrix = instanceMatrices[i];
+			UpdateShaderMatrices();
+
+			currentShader->SetUniform("material", (int)copyMaterial(i));
+			mesh->Draw();
 		}
+	}
+}
 
-		Matrix4 tempMatrix = shadowMatrix * modelMatrix;
-		glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "shadowMatrix"), 1, false, *&tempMatrix.values);
+SSSMaterial Renderer::meshMaterial() const
+{
+	return switchMesh ? SSS_SKIN : SSS_MARBLE;
+}
 
-		UpdateShaderMatrices();
+SSSMaterial Renderer::copyMaterial(unsigned int i) const
+{
+	return mixMaterials ? (SSSMaterial)((meshMaterial() + i) % DiffusionLibrary::Get().GetNumMaterials()) : meshMaterial();
+}
 
-		if (switchMesh)
-		{
-			headMesh->Draw();
-		}
-		else
-		{
-			knightMesh->Draw();
-		}
+unsigned int Renderer::frameMaterials() const
+{
+	unsigned int numCopies = singleMesh ? 1 : numInstances;
+	unsigned int materials = 0;
+
+	for (unsigned int i = 0; i < numCopies && i < DiffusionLibrary::Get().GetNumMaterials(); ++i)
+	{
+		materials |= 1u << copyMaterial(i);
+	}
+	return materials;
+}
+
+Matrix4 Renderer::singleMeshMatrix() const
+{
+	Matrix4 model;
+
+	if (switchMesh)
+	{
+		model = Matrix4::Translation(Vector3(0.0f, 0.0f, 0.0f)) * Matrix4::Scale(Vector3(1.0f, 1.0f, 1.0f));
+	}
+	else
+	{
+		model = Matrix4::Translation(Vector3(0.0f, -0.2f, 0.0f)) * Matrix4::Scale(Vector3(0.0051f, 0.005f, 0.005f));
+	}
+
+	// Undo the mesh's position quantisation
+	return model * (switchMesh ? headMesh : knightMesh)->GetDequantMatrix();
+}
+
+void Renderer::buildInstanceGrid(std::vector<Matrix4> &into, unsigned int count, bool head, const Matrix4 &dequant)
+{
+	into.resize(count);
+
+	unsigned int side = (unsigned int)ceil(sqrt((float)count));
+	float centre = (side - 1) * 0.25f;
+
+	Matrix4 scale = head ? Matrix4::Scale(Vector3(1.0f, 1.0f, 1.0f)) : Matrix4::Scale(Vector3(0.0051f, 0.005f, 0.005f));
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		float x = (i % side) * 0.5f - centre;
+		float z = (i / side) * 0.5f - centre;
+
+		into[i] = Matrix4::Translation(Vector3(x, head ? 0.0f : -0.2f, z)) * scale * dequant;
+	}
+}
+
+void Renderer::updateInstances()
+{
+	if (instanceMatrices.size() == numInstances && instancesHead == switchMesh)
+	{
+		return;
+	}
+
+	OBJMesh *mesh = switchMesh ? headMesh : knightMesh;
+
+	buildInstanceGrid(instanceMatrices, numInstances, switchMesh, mesh->GetDequantMatrix());
+	instances->Update(instanceMatrices);
+	instancesHead = switchMesh;
+}
+
+bool Renderer::lightViewsChanged()
+{
+	if (!useLightViewCache)
+	{
+		lightViewCache.Invalidate();
+		return true;
+	}
+
+	// the meshes are OBJs, with no animation; the key is which one, and how many of the layers get drawn
+	unsigned int layers = useTransmittance ? LIGHT_LAYERS : 1;
+	unsigned int key = (switchMesh ? 1 : 0) | (layers << 1);
+
+	Matrix4 lightMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV) * Matrix4::BuildViewMatrix(light->GetPosition(), lightTarget);
+
+	lightViewCache.Begin(lightMatrix, key);
+
+	if (singleMesh)
+	{
+		lightViewCache.AddModel(singleMeshMatrix());
 	}
 	else
 	{
-		float xPos = 0.5f;
-		float zPos = -0.5f;
-		float count = 0.0f;
+		lightViewCache.AddModels(instanceMatrices);
+	}
+
+	return lightViewCache.End();
+}
+
+void Renderer::benchmarkInstancing()
+{
+	bool wasSingleMesh = singleMesh;
+	bool wasInstancing = useInstancing;
+	unsigned int wasInstances = numInstances;
+
+	singleMesh = false;
+
+	// draws into shadow map sized targets of its own, from the light
+	GLuint colourTex = targetPool.Acquire(SHADOWMAP, SHADOWMAP);
+	GLuint depthTex = targetPool.Acquire(SHADOWMAP, SHADOWMAP, RENDERTARGET_DEPTH24);
+
+	state->BindFramebuffer(shadowMapFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colourTex, 0);
+	state->Viewport(0.0f, 0.0f, SHADOWMAP, SHADOWMAP);
 
-		for (int i = 0; i < 9; ++i)
+	state->Enable(GL_DEPTH_TEST);
+	state->DepthMask(GL_TRUE);
+	state->DepthFunc(GL_LEQUAL);
+
+	SetCurrentShader(shadowShader);
+	currentShader->SetUniform("zNear", ZNEAR);
+	currentShader->SetUniform("zFar", ZFAR);
+
+	projMatrix = Matrix4::Perspective(ZNEAR, ZFAR, 1.0f, FOV);
+	viewMatrix = Matrix4::BuildViewMatrix(light->GetPosition(), lightTarget);
+
+	GLuint query;
+	glGenQueries(1, &query);
+
+	std::cout << "Instancing benchmark (" << (switchMesh ? "head" : "knight") << ", "
+			  << SSS_INSTANCE_BENCHMARK_PASSES << " passes of each, CPU / GPU ms a pass):" << std::endl;
+
+	for (numInstances = 1; numInstances <= SSS_MAX_INSTANCES; numInstances *= 4)
+	{
+		updateInstances();
+
+		double cpu[2];
+		double gpu[2];
+
+		for (int path = 0; path < 2; ++path)
 		{
-			if (i == 3)
-			{
-				zPos = 0.0f;
-				count = 0.0f;
-			}
-			if (i == 6)
-			{
-				zPos = 0.5f;
-				count = 0.0f;
-			}
+			useInstancing = (path == 1);
 
-			if (switchMesh)
-			{
-				modelMatrix = Matrix4::Translation(Vector3(xPos * count - 0.5f, 0.0f, zPos)) * Matrix4::Scale(Vector3(1.0f, 1.0f, 1.0f));
-			}
-			else
-			{
-				modelMatrix = Matrix4::Translation(Vector3(xPos * count - 0.5f, -0.2f, zPos)) * Matrix4::Scale(Vector3(0.0051f, 0.005f, 0.005f));
-			}
-			++count;
+			glFinish();
 
-			Matrix4 tempMatrix = shadowMatrix * modelMatrix;
-			glUniformMatrix4fv(glGetUniformLocation(currentShader->GetProgram(), "shadowMatrix"), 1, false, *&tempMatrix.values);
+			GameTimer timer;
+			float start = timer.GetMS();
 
-			UpdateShaderMatrices();
+			glBeginQuery(GL_TIME_ELAPSED, query);
 
-			if (switchMesh)
-			{
-				headMesh->Draw();
-			}
-			else
+			for (int i = 0; i < SSS_INSTANCE_BENCHMARK_PASSES; ++i)
 			{
-				knightMesh->Draw();
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				drawMesh();
 			}
+
+			glEndQuery(GL_TIME_ELAPSED);
+			cpu[path] = (timer.GetMS() - start) / SSS_INSTANCE_BENCHMARK_PASSES;
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			gpu[path] = elapsed / 1000000.0 / SSS_INSTANCE_BENCHMARK_PASSES;
 		}
+
+		std::cout << "  " << numInstances << " copies: one at a time " << cpu[0] << " / " << gpu[0]
+				  << ", instanced " << cpu[1] << " / " << gpu[1] << std::endl;
 	}
+
+	glDeleteQueries(1, &query);
+
+	// put everything back as the frame expects it
+	state->UseProgram(0);
+	state->BindFramebuffer(0);
+	state->Viewport(0, 0, width, height);
+
+	targetPool.Release(colourTex);
+	targetPool.Release(depthTex);
+
+	singleMesh = wasSingleMesh;
+	useInstancing = wasInstancing;
+	numInstances = wasInstances;
+	updateInstances();
 }
 
 void Renderer::drawLight()
@@ -3,7 +3,17 @@
 #include "../Framework/OGLRenderer.h"
 #include "../Framework/Camera.h"
 #include "../Framework/OBJMesh.h"
+#include "../Framework/RenderTargetPool.h"
+#include "../Framework/FrameGraph.h"
+#include "../Framework/InstanceBuffer.h"
+#include "../Framework/GPUTimer.h"
+#include "../Framework/DepthMapCache.h"
+#include "../Framework/FeedbackMesh.h"
 #include "Gaussian.h"
+#include "DiffusionLibrary.h"
+#include "SSSReference.h"
+#include "SSSTemporal.h"
+#include "SSSTiles.h"
 
 #define ZNEAR		0.1f
 #define ZFAR		10.0f
@@ -12,6 +22,60 @@
 #define BECKMANN	1024.0f
 #define SHADOWMAP	2048.0f
 
+// Layers of the light's depth targets (see lightLayersGeom.glsl)
+#define LIGHT_SHADOW_LAYER	0
+#define LIGHT_FRONT_LAYER	1
+#define LIGHT_BACK_LAYER	2
+#define LIGHT_LAYERS		3
+
+// Frames of SSS timings averaged before they're printed
+#define SSS_TIMER_SAMPLES	100
+
+// Repeats of each blur level the SSS level benchmark times at each resolution
+#define SSS_LEVEL_BENCHMARK_PASSES	20
+
+// Most copies of the mesh drawn without singleMesh, and the passes the instancing benchmark times for each count
+#define SSS_MAX_INSTANCES			1024
+#define SSS_INSTANCE_BENCHMARK_PASSES	20
+
+// Binding point of separableBlurFrag.glsl's SeparableKernels block (the DiffusionProfiles block has 1)
+#define SSS_KERNEL_BINDING	2
+
+/*
+ * Everything that changes which passes a frame runs, or the size of their
+ * targets. The frame graph is only declared and compiled again when this does
+ */
+struct SSSFrameSettings
+{
+	bool operator==(const SSSFrameSettings &other) const
+	{
+		return width == other.width && height == other.height && firstFrame == other.firstFrame &&
+			   useTransmittance == other.useTransmittance && useSSS == other.useSSS &&
+			   useSeparableKernel == other.useSeparableKernel && switchMesh == other.switchMesh &&
+			   compareReference == other.compareReference && layeredLightViews == other.layeredLightViews &&
+			   lightViewsCached == other.lightViewsCached && sssReduction == other.sssReduction &&
+			   temporalSSS == other.temporalSSS && sssTiles == other.sssTiles && sssMaterials == other.sssMaterials &&
+			   numBlurs == other.numBlurs && profileRevision == other.profileRevision;
+	}
+
+	unsigned int	width;
+	unsigned int	height;
+	bool			firstFrame;
+	bool			useTransmittance;
+	bool			useSSS;
+	bool			useSeparableKernel;
+	bool			switchMesh;
+	bool			compareReference;
+	bool			layeredLightViews;
+	bool			lightViewsCached;	// The light's depth targets still hold this frame's views
+	unsigned int	sssReduction;		// 1, or 2 or 4 to run the wide blur levels at half or a quarter of the resolution
+	bool			temporalSSS;		// The full resolution blur levels blend in the last frame's
+	bool			sssTiles;			// The full resolution SSS passes only draw the screen tiles with SSS in them
+	unsigned int	sssMaterials;		// The SSSMaterials drawn, bit m for material m
+	unsigned int	numBlurs;			// The blur levels of the material drawn that has the most
+	unsigned int	profileRevision;	// The DiffusionLibrary's, as another fit can reduce other levels
+};
+
 class Renderer : public OGLRenderer
 {
 public:
@@ -20,22 +84,119 @@ public:
 
 	virtual void RenderScene();
 	virtual void UpdateScene(float msec);
+	virtual void Resize(int x, int y);
+
+	/*
+	 * Declares and compiles the frame graph for every combination of settings
+	 * without a GL context, checks the right passes are culled in each, and
+	 * dumps the default one's schedule
+	 */
+	static bool CheckFrameGraph();
 
 protected:
 	void generateTexture(GLuint &into, float width, float height, bool depth_stencil = false);
-	void generateDepthTexture(GLuint &into, float width, float height);
+	bool checkRenderTargets();
+	void attachMainTargets();
 	void drawQuad(GLuint &texture, Vector2 &pos, float w, float h);
 	void drawMesh();
+
+	// The mesh's model matrix with singleMesh
+	Matrix4 singleMeshMatrix() const;
+
+	/*
+	 * The mesh's SSS material, and copy i's, which with mixMaterials is the
+	 * DiffusionLibrary's i materials on from it, round. frameMaterials has
+	 * bit m set for each material the frame draws
+	 */
+	SSSMaterial meshMaterial() const;
+	SSSMaterial copyMaterial(unsigned int i) const;
+	unsigned int frameMaterials() const;
 	void drawLight();
 
+	// Lays out count copies of the mesh in a square grid, half a unit apart; nine is the original 3x3
+	static void buildInstanceGrid(std::vector<Matrix4> &into, unsigned int count, bool head, const Matrix4 &dequant);
+	void updateInstances();
+
+	// Describes this frame's light views to the cache, returning whether they have to be drawn
+	bool lightViewsChanged();
+
+	// Times numbers of copies up to SSS_MAX_INSTANCES drawn one at a time and instanced, into the shadow map
+	void benchmarkInstancing();
+
+	// The frame's passes, with the targets each reads and writes. renderer can be NULL, to plan a frame without drawing it
+	static bool declareFrameGraph(FrameGraph &graph, const SSSFrameSettings &settings, Renderer *renderer);
+	SSSFrameSettings getFrameSettings() const;
+
 	void drawDepthmap(bool face);
 	void computeBeckmannTex();
 	void shadowMapPass();
+
+	// The shadow map and both depth maps in one go, drawing each triangle into the layers it belongs in
+	void lightViewsPass();
 	void mainPass();
-	void sssPass(const std::vector<Gaussian> &gaussians);
-	void blurPass(GLuint &sourceTex, GLuint &targetTex, GLuint &finalTarget, const Gaussian &gaussian);
+	void sssPass(unsigned int materials);
+
+	/*
+	 * The list of screen tiles the full resolution SSS passes draw, in place
+	 * of the quad: tileMaskPass marks the stencil's SSS pixels in a target a
+	 * shader can read, and tileClassifyPass captures the tiles with any of
+	 * them into sssTiles, on the GPU, and picks up how many the last list had
+	 * for the record. See SSSTiles
+	 */
+	void tileMaskPass();
+	void tileClassifyPass();
+
+	// Binds the blur's frame buffer and shader for the full or the reduced resolution, or the temporal mode's, or the packed blur's
+	void beginBlurs(bool reduced, bool temporal = false, bool packed = false);
+	void blurPass(GLuint &sourceTex, GLuint &targetTex, GLuint &tempTex, unsigned int level, float widthScale = 1.0f);
+
+	/*
+	 * blurPass through packedBlurFrag.glsl, at full resolution: from the
+	 * colour buffer, or a level with the depth packed into its alpha, into a
+	 * target packed the same way, or with the strength in its alpha for the
+	 * reduced levels to be shrunk from. The temporary texture is always
+	 * packed, and has to have been cleared to an alpha of 0
+	 */
+	void packedBlurPass(GLuint &sourceTex, GLuint &targetTex, GLuint &tempTex, unsigned int level,
+						bool packedSource, bool packTarget);
+
+	/*
+	 * The blur levels from first on at 1/sssReduction of the resolution: the
+	 * level before's result (or the colour buffer) and the depth shrunk, the
+	 * levels chained at that size, and each brought back up into its blurred
+	 * texture with a depth aware filter. See SSSReference::Downsample and Upsample
+	 */
+	void reducedSSSPass(unsigned int first, unsigned int numBlurs, GLuint &sourceTex);
+	void downsamplePass(GLuint &sourceTex);
+	void upsamplePass(GLuint &reducedTex, GLuint &targetTex);
+
+	/*
+	 * The temporal mode: beginTemporal gets the history's targets if there
+	 * are none, and sets temporalBlurFrag.glsl up to reproject into them,
+	 * returning whether they hold anything to use. keepHistory copies the
+	 * full resolution levels, and the depth under the stencil, into them for
+	 * the next frame. See SSSTemporal
+	 */
+	bool beginTemporal();
+	void keepHistory();
+	void releaseHistory();
+
+	// Times each blur level at full, half and quarter resolution, packed, and in the temporal mode, from sssPass, where the targets it needs are there
+	void benchmarkSSSLevels(unsigned int materials);
+
+	// The texture fetches the full resolution blur levels make a pixel, as they're set up
+	void printBlurFetches();
+
+	// Uploads the DiffusionLibrary's profiles, and their separable kernels, if they've changed since they last were
+	void updateDiffusionProfiles();
+
+	// Draws the current material with the next fit of its profile: the shipped sum, then 2 Gaussians up to DIFFUSIONLIBRARY_MAX_FIT
+	void cycleDiffusionFit();
 	void accumulationPass();
+	void separableSSSPass();
+	bool beginSSSTimer();
 	void presentScene();
+	void compareWithReference();
 
 	// Meshes
 	Mesh *quad;
@@ -57,9 +218,27 @@ protected:
 	Shader *shadowShader;
 	Shader *mainShader;
 	Shader *blurShader;
-	Shader *accumSkinShader;
-	Shader *accumMarbleShader;
+	Shader *accumShader;
+	Shader *separableBlurShader;
 	Shader *depthShader;
+	Shader *lightLayersShader;
+	Shader *downsampleShader;
+	Shader *upsampleShader;
+	Shader *temporalBlurShader;
+	Shader *packedBlurShader;
+	Shader *tileMaskShader;
+	Shader *tileClassifyShader;
+
+
+	// Every render target but the Beckmann texture and the light's is acquired from here
+	// by the frame graph before the first pass that needs it, and released after the last
+	RenderTargetPool targetPool;
+	size_t reportedTargetBytes;
+
+	FrameGraph frameGraph;
+	SSSFrameSettings graphSettings;
+	unsigned int blurTempTarget;
+	bool dumpFrameGraph;
 
 
 	// Beckmann Texture buffer
@@ -67,10 +246,20 @@ protected:
 	GLuint beckmannTex;
 
 
+	// The light's depth and linear depth, as array textures with LIGHT_LAYERS layers. The
+	// shadow map and depth maps are drawn into a layer each, or all of them at once. They're
+	// held for the renderer's lifetime, so a frame where nothing they show has changed keeps them
+	GLuint lightDepthTex;
+	GLuint lightZTex;
+	GLuint lightLayersFBO;
+	DepthMapCache lightViewCache;
+
+	// For reading lightDepthTex as plain depth rather than comparing against it
+	GLuint rawDepthSampler;
+
+
 	// Shadow map
 	GLuint shadowMapFBO;
-	GLuint shadowMapTex;
-	GLuint shadowMapDepthTex;
 	Matrix4 shadowMatrix;
 	Matrix4 lightView;
 
@@ -78,7 +267,39 @@ protected:
 	// gaussian blur buffer
 	GLuint blurFBO;
 	GLuint blurTempTex;
-	GLuint blurredTexture[4];
+	GLuint blurredTexture[SSSREFERENCE_MAX_BLURS];
+
+
+	// the blur levels run at a reduced resolution, with no depth & stencil attached
+	GLuint reducedFBO;
+	GLuint reducedColourTex;
+	GLuint reducedDepthTex;
+	GLuint reducedTempTex;
+	GLuint reducedBlurredTex[SSSREFERENCE_MAX_BLURS];
+
+
+	// the temporal mode's history: the full resolution levels and the depth under the stencil, from the
+	// last frame they were kept in, held from frame to frame while the mode's on
+	GLuint historyFBO;
+	GLuint historyTex[SSSREFERENCE_MAX_BLURS];
+	GLuint historyDepthTex;
+	Matrix4 historyProj;
+	Matrix4 historyView;
+	bool historyValid;
+	unsigned int historyKey;
+	unsigned int temporalFrame;
+	SSSTemporal temporal;
+
+
+	// the screen tiles with SSS, written by tileClassifyPass from the mask, one point a tile drawn from
+	// the empty vertex array. sssArea is what the stencilled SSS passes draw, the tiles once they're listed,
+	// the quad till then; blurArea is what blurPass draws, the quad at a reduced resolution
+	GLuint tileMaskTex;
+	GLuint tileArray;
+	FeedbackMesh *sssTiles;
+	Mesh *sssArea;
+	Mesh *blurArea;
+	SSSTiles tileStats;
 
 
 	// main buffer
@@ -93,13 +314,21 @@ protected:
 	GLuint finalColourTex;
 
 
-	// Gaussians
-	vector<Gaussian> skin6Gaussians;
-	const vector<Gaussian> *gaussiansSkin;
-	const vector<Gaussian> *gaussians6Skin;
-	const vector<Gaussian> *gaussiansMarble;
+	// Gaussians; each material's are in the DiffusionLibrary, uploaded into diffusionBuffer
+	// for the DiffusionProfiles block whenever its revision isn't the one last uploaded
+	GLuint diffusionBuffer;
+	unsigned int diffusionRevision;
 	float correction;
 
+	// each material's gaussians and accumulation as a single separable kernel, uploaded
+	// into kernelBuffer for the SeparableKernels block along with the profiles
+	GLuint kernelBuffer;
+
+
+	// GPU timings, for comparing the two ways of doing SSS and of drawing the light's views
+	GPUTimer sssTimer;
+	GPUTimer lightTimer;
+
 
 	// bool variables
 	bool firstFrame;
@@ -107,16 +336,29 @@ protected:
 	bool useTransmittance;
 	bool switchMesh;
 	bool singleMesh;
+	bool mixMaterials;
+	bool compareReference;
+	bool useSeparableKernel;
+	bool useInstancing;
+	bool benchmarkInstances;
+	bool useLayeredLightViews;
+	bool useLightViewCache;
+	bool benchmarkSSS;
+	unsigned int sssReduction;
+	bool useTemporalSSS;
+	bool useSSSTiles;
+	bool usePackedBlur;
+
+
+	// Model matrices of the copies drawn without singleMesh, and the same in the instance buffer
+	std::vector<Matrix4> instanceMatrices;
+	InstanceBuffer *instances;
+	unsigned int numInstances;
+	bool instancesHead;
 
 
 	// --- two depth maps ---
 	GLuint frontDepthFBO;
 	GLuint backDepthFBO;
-
-	GLuint frontDepthTex;
-	GLuint backDepthTex;
-
-	GLuint frontZValTex;
-	GLuint backZValTex;
 	// --- o ---
 };
\ No newline at end of file
@@ -0,0 +1,1664 @@
+#include "SSSReference.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "../Framework/Common.h"
+#include "../Framework/JobPool.h"
+#include "../Framework/GameTimer.h"
+
+#ifdef SSSREFERENCE_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// blurFrag.glsl's taps either side of the centre, and their offsets in steps
+static const float blurWeights[6] = { 0.006f, 0.0610f, 0.2420f, 0.2420f, 0.0610f, 0.006f };
+static const float blurOffsets[6] = { -1.000f, -0.6667f, -0.3333f, 0.3333f, 0.6667f, 1.000f };
+static const float blurCentreWeight = 0.382f;
+
+// What an RGBA8 texture would store a channel as
+static inline float Quantise(float v)
+{
+	v = min(max(v, 0.0f), 1.0f);
+	return (float)(int)(v * 255.0f + 0.5f) / 255.0f;
+}
+
+#ifdef SSSREFERENCE_USE_SSE
+static inline __m128 Quantise(__m128 v)
+{
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f));
+	return _mm_div_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(v)), _mm_set1_ps(255.0f));
+}
+#endif
+
+/*
+ * Where a tap at p texels along a row or column lands, as GL_LINEAR and
+ * GL_CLAMP_TO_EDGE would have it: the two texels either side, and how far
+ * between them it is. The other coordinate is always on a texel centre, so
+ * the bilinear filter only ever blends along the blur direction.
+ */
+static inline void LinearTap(float p, unsigned int length, unsigned int &i0, unsigned int &i1, float &f)
+{
+	p = min(max(p, 0.0f), (float)(length - 1));
+	i0 = (unsigned int)p;
+	i1 = min(i0 + 1, length - 1);
+	f = p - i0;
+}
+
+SSSReference::SSSReference(unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+	correction = SSSREFERENCE_CORRECTION;
+	quantise = true;
+	reduction = 1;
+	packedBlur = false;
+
+	unsigned int numPixels = width * height;
+
+	colour.resize(numPixels * 4, 0.0f);
+	depth.resize(numPixels, 0.0f);
+	materials.resize(numPixels, SSS_SKIN);
+	stencil.resize(numPixels, 0);
+	temp.resize(numPixels * 4, 0.0f);
+	final.resize(numPixels * 4, 0.0f);
+
+	for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+	{
+		blurred[i].resize(numPixels * 4, 0.0f);
+	}
+}
+
+const std::vector<Gaussian> & SSSReference::GetGaussians(SSSMaterial material)
+{
+	return DiffusionLibrary::Get().GetGaussians(material);
+}
+
+unsigned int SSSReference::GetFirstReducedLevel(const std::vector<Gaussian> &gaussians, unsigned int reduction)
+{
+	unsigned int numLevels = min((unsigned int)gaussians.size(), (unsigned int)SSSREFERENCE_MAX_BLURS);
+
+	if (reduction <= 1)
+	{
+		return numLevels;
+	}
+
+	// The Gaussians get wider level by level, and each level blurs the last, so once one is reduced the rest are too
+	for (unsigned int i = 0; i < numLevels; ++i)
+	{
+		if (gaussians[i].getWidth() >= SSSREFERENCE_REDUCED_MIN_WIDTH)
+		{
+			return i;
+		}
+	}
+	return numLevels;
+}
+
+unsigned int SSSReference::GetFirstReducedLevel(unsigned int materialMask, unsigned int reduction)
+{
+	const DiffusionLibrary &library = DiffusionLibrary::Get();
+	unsigned int numLevels = library.GetNumLevels(materialMask);
+	unsigned int first = 0;
+
+	for (unsigned int m = 0; m < library.GetNumMaterials(); ++m)
+	{
+		if (materialMask & (1u << m))
+		{
+			first = max(first, GetFirstReducedLevel(library.GetGaussians((SSSMaterial)m), reduction));
+		}
+	}
+	return min(first, numLevels);
+}
+
+unsigned int SSSReference::GetNumAccumulationTaps(SSSMaterial material)
+{
+	return DiffusionLibrary::Get().GetNumAccumulationTaps(material);
+}
+
+const float * SSSReference::GetAccumulationWeights(SSSMaterial material)
+{
+	return DiffusionLibrary::Get().GetAccumulationWeights(material);
+}
+
+void SSSReference::Render(SSSMaterial material, bool useSSS, bool threaded, bool vectorised)
+{
+	materials.assign(width * height, (unsigned char)material);
+	RenderMaterials(1u << material, useSSS, threaded, vectorised);
+}
+
+void SSSReference::RenderMaterials(unsigned int materialMask, bool useSSS, bool threaded, bool vectorised)
+{
+	const DiffusionLibrary &library = DiffusionLibrary::Get();
+	unsigned int numMaterials = library.GetNumMaterials();
+	unsigned int numLevels = useSSS ? library.GetNumLevels(materialMask) : 0;
+
+	/*
+	 * Each level's width for every material drawn, and their accumulation
+	 * weights for as many levels as the frame runs, 0 for the ones past
+	 * their own, as the DiffusionProfiles block pads them. The rest are
+	 * left at 0, which is nothing the GPU would draw
+	 */
+	float widths[SSSREFERENCE_MAX_BLURS][DIFFUSIONLIBRARY_MAX_MATERIALS] = {};
+	std::vector<float> weights(numMaterials * (numLevels + 1) * 3, 0.0f);
+
+	for (unsigned int m = 0; m < numMaterials; ++m)
+	{
+		if (!(materialMask & (1u << m)))
+		{
+			continue;
+		}
+
+		const std::vector<Gaussian> &gaussians = GetGaussians((SSSMaterial)m);
+		unsigned int numTaps = min(GetNumAccumulationTaps((SSSMaterial)m), numLevels + 1);
+
+		for (unsigned int i = 0; i < numLevels && i < gaussians.size(); ++i)
+		{
+			widths[i][m] = gaussians[i].getWidth();
+		}
+
+		std::copy(GetAccumulationWeights((SSSMaterial)m), GetAccumulationWeights((SSSMaterial)m) + numTaps * 3,
+				  weights.begin() + m * (numLevels + 1) * 3);
+	}
+
+	if (useSSS)
+	{
+		const float *source = &colour[0];
+		unsigned int firstReduced = GetFirstReducedLevel(materialMask, reduction);
+
+		if (packedBlur)
+		{
+			packedDepth.resize(width * height);
+
+			for (unsigned int pixel = 0; pixel < width * height; ++pixel)
+			{
+				packedDepth[pixel] = (stencil[pixel] == 1) ? depth[pixel] : 0.0f;
+			}
+		}
+
+		// Each level blurs the one before, as sssPass chains them
+		for (unsigned int i = 0; i < firstReduced; ++i)
+		{
+			BlurPass(source, &temp[0], widths[i], true, threaded, vectorised);
+
+			// Only the colour buffer's taps read the depth buffer; the centre's depth is the same either way
+			if (packedBlur && i == 0)
+			{
+				depth.swap(packedDepth);
+			}
+
+			BlurPass(&temp[0], &blurred[i][0], widths[i], false, threaded, vectorised);
+			source = &blurred[i][0];
+		}
+
+		// Back to the depth buffer, for the downsample and the next render
+		if (packedBlur && firstReduced > 0)
+		{
+			depth.swap(packedDepth);
+		}
+
+		// The rest chain at the reduced size, with widths in its texels, and are each brought back up
+		if (firstReduced < numLevels)
+		{
+			SSSReference reduced(GetReducedSize(width, reduction), GetReducedSize(height, reduction));
+			reduced.correction = correction;
+			reduced.quantise = quantise;
+
+			Downsample(source, reduced, threaded);
+			source = &reduced.colour[0];
+
+			for (unsigned int i = firstReduced; i < numLevels; ++i)
+			{
+				float reducedWidths[DIFFUSIONLIBRARY_MAX_MATERIALS];
+
+				for (unsigned int m = 0; m < DIFFUSIONLIBRARY_MAX_MATERIALS; ++m)
+				{
+					reducedWidths[m] = widths[i][m] / reduction;
+				}
+
+				reduced.BlurPass(source, &reduced.temp[0], reducedWidths, true, threaded, vectorised);
+				reduced.BlurPass(&reduced.temp[0], &reduced.blurred[i][0], reducedWidths, false, threaded, vectorised);
+				source = &reduced.blurred[i][0];
+
+				Upsample(reduced, source, &blurred[i][0], threaded);
+			}
+		}
+	}
+
+	unsigned int grain = threaded ? SSSREFERENCE_TILE_ROWS : height + 1;
+
+	JobPool::Get().ParallelFor(height, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		Accumulate(&weights[0], numLevels + 1, useSSS, begin, end);
+	});
+}
+
+void SSSReference::BlurPass(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+							bool threaded, bool vectorised)
+{
+	unsigned int grain = threaded ? SSSREFERENCE_TILE_ROWS : height + 1;
+
+	JobPool::Get().ParallelFor(height, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+#ifdef SSSREFERENCE_USE_SSE
+		if (vectorised)
+		{
+			BlurRows(source, target, gaussianWidths, horizontal, begin, end);
+			return;
+		}
+#endif
+		BlurRowsScalar(source, target, gaussianWidths, horizontal, begin, end);
+	});
+}
+
+void SSSReference::Downsample(const float *source, SSSReference &reduced, bool threaded) const
+{
+	unsigned int factor = reduction;
+	unsigned int grain = threaded ? SSSREFERENCE_TILE_ROWS : reduced.height + 1;
+
+	JobPool::Get().ParallelFor(reduced.height, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int y = begin; y < end; ++y)
+		{
+			for (unsigned int x = 0; x < reduced.width; ++x)
+			{
+				unsigned int pixel = y * reduced.width + x;
+				float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				float depthSum = 0.0f;
+				unsigned char material = SSS_SKIN;
+				unsigned int count = 0;
+
+				for (unsigned int j = y * factor; j < (y + 1) * factor && j < height; ++j)
+				{
+					for (unsigned int i = x * factor; i < (x + 1) * factor && i < width; ++i)
+					{
+						unsigned int p = j * width + i;
+
+						if (!(depth[p] > 0.0f))
+						{
+							continue;
+						}
+
+						if (count == 0)
+						{
+							material = materials[p];
+						}
+
+						for (int c = 0; c < 4; ++c)
+						{
+							sum[c] += source[p * 4 + c];
+						}
+						depthSum += depth[p];
+						++count;
+					}
+				}
+
+				float *out = &reduced.colour[pixel * 4];
+
+				if (count)
+				{
+					for (int c = 0; c < 4; ++c)
+					{
+						out[c] = quantise ? Quantise(sum[c] / count) : sum[c] / count;
+					}
+					reduced.depth[pixel] = quantise ? Quantise(depthSum / count) : depthSum / count;
+				}
+				else
+				{
+					out[0] = out[1] = out[2] = 0.0f;
+					out[3] = 1.0f;
+					reduced.depth[pixel] = 0.0f;
+				}
+				reduced.materials[pixel] = material;
+				reduced.stencil[pixel] = 1;
+			}
+		}
+	});
+}
+
+void SSSReference::Upsample(const SSSReference &reduced, const float *source, float *target, bool threaded) const
+{
+	unsigned int factor = reduction;
+	unsigned int grain = threaded ? SSSREFERENCE_TILE_ROWS : height + 1;
+	float depthScale = 0.0125f * correction;
+
+	JobPool::Get().ParallelFor(height, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int y = begin; y < end; ++y)
+		{
+			// Where the pixel's centre falls among the reduced texels' centres
+			float v = (y + 0.5f) / factor - 0.5f;
+			float fy = v - floor(v);
+			int y0 = (int)floor(v);
+			int rows[2] = { max(y0, 0), min(y0 + 1, (int)reduced.height - 1) };
+
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				unsigned int pixel = y * width + x;
+				float *out = target + pixel * 4;
+
+				if (stencil[pixel] != 1)
+				{
+					out[0] = out[1] = out[2] = 0.0f;
+					out[3] = 1.0f;
+					continue;
+				}
+
+				float u = (x + 0.5f) / factor - 0.5f;
+				float fx = u - floor(u);
+				int x0 = (int)floor(u);
+				int columns[2] = { max(x0, 0), min(x0 + 1, (int)reduced.width - 1) };
+
+				float depthM = depth[pixel];
+				float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				float total = 0.0f;
+				unsigned int nearest = 0;
+				float nearestDifference = 0.0f;
+
+				for (int t = 0; t < 4; ++t)
+				{
+					unsigned int texel = rows[t / 2] * reduced.width + columns[t % 2];
+					float d = reduced.depth[texel];
+					float difference = fabs(depthM - d);
+
+					// The bilinear weight, less the further the texel's depth is from the pixel's
+					float w = ((t % 2) ? fx : 1.0f - fx) * ((t / 2) ? fy : 1.0f - fy);
+					w *= (d > 0.0f) ? 1.0f - min(depthScale * difference, 1.0f) : 0.0f;
+
+					for (int c = 0; c < 4; ++c)
+					{
+						sum[c] += w * source[texel * 4 + c];
+					}
+					total += w;
+
+					if (t == 0 || difference < nearestDifference)
+					{
+						nearest = texel;
+						nearestDifference = difference;
+					}
+				}
+
+				for (int c = 0; c < 4; ++c)
+				{
+					float value = (total > 0.0001f) ? sum[c] / total : source[nearest * 4 + c];
+					out[c] = quantise ? Quantise(value) : value;
+				}
+			}
+		}
+	});
+}
+
+void SSSReference::RenderSeparable(SSSMaterial material, bool threaded, bool vectorised)
+{
+	materials.assign(width * height, (unsigned char)material);
+	RenderSeparableMaterials(threaded, vectorised);
+}
+
+void SSSReference::RenderSeparableMaterials(bool threaded, bool vectorised)
+{
+	std::vector<Vector4> kernels[DIFFUSIONLIBRARY_MAX_MATERIALS];
+
+	for (unsigned int m = 0; m < DiffusionLibrary::Get().GetNumMaterials(); ++m)
+	{
+		BuildSeparableKernel((SSSMaterial)m, SSSREFERENCE_KERNEL_TAPS, kernels[m]);
+	}
+
+	KernelPass(&colour[0], &temp[0], kernels, true, false, threaded, vectorised);
+	KernelPass(&temp[0], &blurred[0][0], kernels, false, true, threaded, vectorised);
+
+	// The vertical pass draws straight into the final image, and basicShader fills in the rest
+	unsigned int grain = threaded ? SSSREFERENCE_TILE_ROWS : height + 1;
+
+	JobPool::Get().ParallelFor(height, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+		for (unsigned int pixel = begin * width; pixel < end * width; ++pixel)
+		{
+			const float *from = (stencil[pixel] == 1) ? &blurred[0][pixel * 4] : &colour[pixel * 4];
+
+			for (int c = 0; c < 4; ++c)
+			{
+				final[pixel * 4 + c] = quantise ? Quantise(from[c]) : from[c];
+			}
+		}
+	});
+}
+
+void SSSReference::KernelPass(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+							  bool lastPass, bool threaded, bool vectorised)
+{
+	unsigned int grain = threaded ? SSSREFERENCE_TILE_ROWS : height + 1;
+
+	JobPool::Get().ParallelFor(height, grain, [&](unsigned int begin, unsigned int end, unsigned int)
+	{
+#ifdef SSSREFERENCE_USE_SSE
+		if (vectorised)
+		{
+			KernelRows(source, target, kernels, horizontal, lastPass, begin, end);
+			return;
+		}
+#endif
+		KernelRowsScalar(source, target, kernels, horizontal, lastPass, begin, end);
+	});
+}
+
+/*
+ * blurFrag.glsl, one pixel at a time. The step between taps is in texels
+ * here, where the shader works in texture coordinates, which is the same
+ * thing once it's multiplied by pixelSize.
+ */
+void SSSReference::BlurRowsScalar(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+								  unsigned int begin, unsigned int end) const
+{
+	unsigned int length = horizontal ? width : height;
+	unsigned int stride = horizontal ? 1 : width;
+	float depthScale = 0.0125f * correction;
+
+	for (unsigned int y = begin; y < end; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = y * width + x;
+			const float *colourM = source + pixel * 4;
+			float *out = target + pixel * 4;
+
+			// Only the stencilled pixels are drawn, the rest keep mainPass's clear colour
+			if (stencil[pixel] != 1)
+			{
+				out[0] = out[1] = out[2] = 0.0f;
+				out[3] = 1.0f;
+				continue;
+			}
+
+			float depthM = depth[pixel];
+
+			// The shader would divide by zero; there's nothing sensible to blur with
+			if (!(depthM > 0.0f))
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					out[c] = quantise ? Quantise(colourM[c]) : colourM[c];
+				}
+				continue;
+			}
+
+			float step = colourM[3] * gaussianWidths[materials[pixel]] / depthM;
+			unsigned int along = horizontal ? x : y;
+			unsigned int lineStart = pixel - along * stride;
+
+			float blurredColour[3];
+
+			for (int c = 0; c < 3; ++c)
+			{
+				blurredColour[c] = colourM[c] * blurCentreWeight;
+			}
+
+			for (int i = 0; i < 6; ++i)
+			{
+				unsigned int i0, i1;
+				float f;
+				LinearTap(along + blurOffsets[i] * step, length, i0, i1, f);
+
+				unsigned int p0 = lineStart + i0 * stride;
+				unsigned int p1 = lineStart + i1 * stride;
+
+				float d = depth[p0] + (depth[p1] - depth[p0]) * f;
+				float s = min(depthScale * fabs(depthM - d), 1.0f);
+
+				for (int c = 0; c < 3; ++c)
+				{
+					float tap = source[p0 * 4 + c] + (source[p1 * 4 + c] - source[p0 * 4 + c]) * f;
+
+					// If the difference in depth is huge, lerp the colour back to the centre's
+					tap = tap + (colourM[c] - tap) * s;
+					blurredColour[c] += blurWeights[i] * tap;
+				}
+			}
+
+			for (int c = 0; c < 3; ++c)
+			{
+				out[c] = quantise ? Quantise(blurredColour[c]) : blurredColour[c];
+			}
+			out[3] = quantise ? Quantise(colourM[3]) : colourM[3];
+		}
+	}
+}
+
+#ifdef SSSREFERENCE_USE_SSE
+/*
+ * The same sums as BlurRowsScalar in the same order, on all four channels of
+ * a pixel at once. The taps' weights have 0 in alpha, so alpha comes through
+ * as the centre's, just as the shader leaves it.
+ */
+void SSSReference::BlurRows(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+							unsigned int begin, unsigned int end) const
+{
+	unsigned int length = horizontal ? width : height;
+	unsigned int stride = horizontal ? 1 : width;
+	float depthScale = 0.0125f * correction;
+
+	const __m128 centreWeight = _mm_setr_ps(blurCentreWeight, blurCentreWeight, blurCentreWeight, 1.0f);
+	const __m128 cleared = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+
+	__m128 tapWeights[6];
+
+	for (int i = 0; i < 6; ++i)
+	{
+		tapWeights[i] = _mm_setr_ps(blurWeights[i], blurWeights[i], blurWeights[i], 0.0f);
+	}
+
+	for (unsigned int y = begin; y < end; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = y * width + x;
+			float *out = target + pixel * 4;
+
+			if (stencil[pixel] != 1)
+			{
+				_mm_storeu_ps(out, cleared);
+				continue;
+			}
+
+			__m128 colourM = _mm_loadu_ps(source + pixel * 4);
+			float depthM = depth[pixel];
+
+			if (!(depthM > 0.0f))
+			{
+				_mm_storeu_ps(out, quantise ? Quantise(colourM) : colourM);
+				continue;
+			}
+
+			float step = source[pixel * 4 + 3] * gaussianWidths[materials[pixel]] / depthM;
+			unsigned int along = horizontal ? x : y;
+			unsigned int lineStart = pixel - along * stride;
+
+			__m128 blurredColour = _mm_mul_ps(colourM, centreWeight);
+
+			for (int i = 0; i < 6; ++i)
+			{
+				unsigned int i0, i1;
+				float f;
+				LinearTap(along + blurOffsets[i] * step, length, i0, i1, f);
+
+				unsigned int p0 = lineStart + i0 * stride;
+				unsigned int p1 = lineStart + i1 * stride;
+
+				float d = depth[p0] + (depth[p1] - depth[p0]) * f;
+				float s = min(depthScale * fabs(depthM - d), 1.0f);
+
+				__m128 c0 = _mm_loadu_ps(source + p0 * 4);
+				__m128 c1 = _mm_loadu_ps(source + p1 * 4);
+				__m128 tap = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), _mm_set1_ps(f)));
+
+				tap = _mm_add_ps(tap, _mm_mul_ps(_mm_sub_ps(colourM, tap), _mm_set1_ps(s)));
+				blurredColour = _mm_add_ps(blurredColour, _mm_mul_ps(tapWeights[i], tap));
+			}
+
+			_mm_storeu_ps(out, quantise ? Quantise(blurredColour) : blurredColour);
+		}
+	}
+}
+#else
+void SSSReference::BlurRows(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+							unsigned int begin, unsigned int end) const
+{
+	BlurRowsScalar(source, target, gaussianWidths, horizontal, begin, end);
+}
+#endif
+
+// separableBlurFrag.glsl, one pixel at a time
+void SSSReference::KernelRowsScalar(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+									bool lastPass, unsigned int begin, unsigned int end) const
+{
+	unsigned int length = horizontal ? width : height;
+	unsigned int stride = horizontal ? 1 : width;
+	float depthScale = 0.0125f * correction;
+
+	for (unsigned int y = begin; y < end; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = y * width + x;
+			const float *colourM = source + pixel * 4;
+			float *out = target + pixel * 4;
+
+			if (stencil[pixel] != 1)
+			{
+				out[0] = out[1] = out[2] = 0.0f;
+				out[3] = 1.0f;
+				continue;
+			}
+
+			float depthM = depth[pixel];
+
+			if (!(depthM > 0.0f))
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					out[c] = quantise ? Quantise(colourM[c]) : colourM[c];
+				}
+				out[3] = lastPass ? 1.0f : out[3];
+				continue;
+			}
+
+			const std::vector<Vector4> &kernel = kernels[materials[pixel]];
+			unsigned int numTaps = (unsigned int)kernel.size();
+			float step = colourM[3] / depthM;
+			unsigned int along = horizontal ? x : y;
+			unsigned int lineStart = pixel - along * stride;
+
+			float blurredColour[3] =
+			{
+				colourM[0] * kernel[0].x,
+				colourM[1] * kernel[0].y,
+				colourM[2] * kernel[0].z
+			};
+
+			for (unsigned int i = 1; i < numTaps; ++i)
+			{
+				unsigned int i0, i1;
+				float f;
+				LinearTap(along + kernel[i].w * step, length, i0, i1, f);
+
+				unsigned int p0 = lineStart + i0 * stride;
+				unsigned int p1 = lineStart + i1 * stride;
+
+				float d = depth[p0] + (depth[p1] - depth[p0]) * f;
+				float s = min(depthScale * fabs(depthM - d), 1.0f);
+				const float *weight = &kernel[i].x;
+
+				for (int c = 0; c < 3; ++c)
+				{
+					float tap = source[p0 * 4 + c] + (source[p1 * 4 + c] - source[p0 * 4 + c]) * f;
+
+					tap = tap + (colourM[c] - tap) * s;
+					blurredColour[c] += weight[c] * tap;
+				}
+			}
+
+			for (int c = 0; c < 3; ++c)
+			{
+				out[c] = quantise ? Quantise(blurredColour[c]) : blurredColour[c];
+			}
+			out[3] = lastPass ? 1.0f : (quantise ? Quantise(colourM[3]) : colourM[3]);
+		}
+	}
+}
+
+#ifdef SSSREFERENCE_USE_SSE
+void SSSReference::KernelRows(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+							  bool lastPass, unsigned int begin, unsigned int end) const
+{
+	unsigned int length = horizontal ? width : height;
+	unsigned int stride = horizontal ? 1 : width;
+	float depthScale = 0.0125f * correction;
+
+	const __m128 cleared = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// Every material's taps, with the centre's alpha weight of 1 in the first
+	__m128 tapWeights[DIFFUSIONLIBRARY_MAX_MATERIALS][SSSREFERENCE_MAX_KERNEL_TAPS];
+
+	for (unsigned int m = 0; m < DiffusionLibrary::Get().GetNumMaterials(); ++m)
+	{
+		const std::vector<Vector4> &kernel = kernels[m];
+
+		for (unsigned int i = 0; i < kernel.size(); ++i)
+		{
+			tapWeights[m][i] = _mm_setr_ps(kernel[i].x, kernel[i].y, kernel[i].z, i == 0 ? 1.0f : 0.0f);
+		}
+	}
+
+	for (unsigned int y = begin; y < end; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = y * width + x;
+			float *out = target + pixel * 4;
+
+			if (stencil[pixel] != 1)
+			{
+				_mm_storeu_ps(out, cleared);
+				continue;
+			}
+
+			__m128 colourM = _mm_loadu_ps(source + pixel * 4);
+			float depthM = depth[pixel];
+			__m128 blurredColour;
+
+			const std::vector<Vector4> &kernel = kernels[materials[pixel]];
+			const __m128 *weights = tapWeights[materials[pixel]];
+			unsigned int numTaps = (unsigned int)kernel.size();
+
+			if (!(depthM > 0.0f))
+			{
+				blurredColour = colourM;
+			}
+			else
+			{
+				float step = source[pixel * 4 + 3] / depthM;
+				unsigned int along = horizontal ? x : y;
+				unsigned int lineStart = pixel - along * stride;
+
+				blurredColour = _mm_mul_ps(colourM, weights[0]);
+
+				for (unsigned int i = 1; i < numTaps; ++i)
+				{
+					unsigned int i0, i1;
+					float f;
+					LinearTap(along + kernel[i].w * step, length, i0, i1, f);
+
+					unsigned int p0 = lineStart + i0 * stride;
+					unsigned int p1 = lineStart + i1 * stride;
+
+					float d = depth[p0] + (depth[p1] - depth[p0]) * f;
+					float s = min(depthScale * fabs(depthM - d), 1.0f);
+
+					__m128 c0 = _mm_loadu_ps(source + p0 * 4);
+					__m128 c1 = _mm_loadu_ps(source + p1 * 4);
+					__m128 tap = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), _mm_set1_ps(f)));
+
+					tap = _mm_add_ps(tap, _mm_mul_ps(_mm_sub_ps(colourM, tap), _mm_set1_ps(s)));
+					blurredColour = _mm_add_ps(blurredColour, _mm_mul_ps(weights[i], tap));
+				}
+			}
+
+			_mm_storeu_ps(out, quantise ? Quantise(blurredColour) : blurredColour);
+
+			// The last pass's alpha comes out as 1, the first's as the centre's
+			if (lastPass)
+			{
+				out[3] = 1.0f;
+			}
+		}
+	}
+}
+#else
+void SSSReference::KernelRows(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+							  bool lastPass, unsigned int begin, unsigned int end) const
+{
+	KernelRowsScalar(source, target, kernels, horizontal, lastPass, begin, end);
+}
+#endif
+
+/*
+ * Level k of the cascade is colour blurred by every Gaussian up to k, which
+ * is a Gaussian with all their variances added up. blurFrag.glsl's 7 taps
+ * are a Gaussian a third of a step wide, so in steps level k's standard
+ * deviation is a third of the square root of that sum. Each level is sampled
+ * at the kernel's taps, weighted by the distance each tap covers, normalised
+ * and added up with the accumulation's weights; level 0, the unblurred colour,
+ * all goes on the centre tap. Blurring with that horizontally then vertically
+ * squares its total, so the taps are divided by the square root of the
+ * accumulation weights' sum, which leaves the image's energy where the
+ * cascade leaves it.
+ */
+void SSSReference::BuildSeparableKernel(SSSMaterial material, unsigned int numTaps, std::vector<Vector4> &kernel)
+{
+	numTaps = min(max(numTaps | 1u, 3u), (unsigned int)SSSREFERENCE_MAX_KERNEL_TAPS);
+
+	const std::vector<Gaussian> &gaussians = GetGaussians(material);
+	const float *weights = GetAccumulationWeights(material);
+	unsigned int numLevels = min((unsigned int)gaussians.size(), GetNumAccumulationTaps(material) - 1);
+
+	std::vector<float> deviations(numLevels + 1, 0.0f);
+	float variance = 0.0f;
+
+	for (unsigned int k = 0; k < numLevels; ++k)
+	{
+		variance += gaussians[k].getWidth() * gaussians[k].getWidth();
+		deviations[k + 1] = sqrt(variance) / 3.0f;
+	}
+
+	// Three standard deviations of the widest level either side, closer together in the middle
+	float range = 3.0f * deviations[numLevels];
+	unsigned int half = numTaps / 2;
+
+	std::vector<float> offsets(numTaps);
+
+	for (unsigned int i = 0; i < numTaps; ++i)
+	{
+		float t = ((float)i - half) / half;
+		offsets[i] = range * t * fabs(t);
+	}
+
+	// How much of the line each tap stands for
+	std::vector<float> areas(numTaps);
+
+	for (unsigned int i = 0; i < numTaps; ++i)
+	{
+		float from = (i == 0) ? offsets[0] : (offsets[i - 1] + offsets[i]) * 0.5f;
+		float to = (i == numTaps - 1) ? offsets[i] : (offsets[i] + offsets[i + 1]) * 0.5f;
+		areas[i] = max(to - from, 1e-6f);
+	}
+
+	std::vector<Vector3> sums(numTaps, Vector3(0.0f, 0.0f, 0.0f));
+	std::vector<float> level(numTaps);
+
+	for (unsigned int k = 0; k <= numLevels; ++k)
+	{
+		Vector3 weight(weights[k * 3], weights[k * 3 + 1], weights[k * 3 + 2]);
+
+		if (k == 0 || deviations[k] <= 0.0f)
+		{
+			sums[half] += weight;
+			continue;
+		}
+
+		float total = 0.0f;
+
+		for (unsigned int i = 0; i < numTaps; ++i)
+		{
+			float x = offsets[i] / deviations[k];
+			level[i] = exp(-0.5f * x * x) * areas[i];
+			total += level[i];
+		}
+
+		for (unsigned int i = 0; i < numTaps; ++i)
+		{
+			sums[i] += weight * (level[i] / total);
+		}
+	}
+
+	Vector3 scale(0.0f, 0.0f, 0.0f);
+
+	for (unsigned int k = 0; k <= numLevels; ++k)
+	{
+		scale += Vector3(weights[k * 3], weights[k * 3 + 1], weights[k * 3 + 2]);
+	}
+
+	scale.x = scale.x > 0.0f ? 1.0f / sqrt(scale.x) : 0.0f;
+	scale.y = scale.y > 0.0f ? 1.0f / sqrt(scale.y) : 0.0f;
+	scale.z = scale.z > 0.0f ? 1.0f / sqrt(scale.z) : 0.0f;
+
+	// Centre first, then outwards in pairs
+	kernel.clear();
+	kernel.push_back(Vector4(sums[half].x * scale.x, sums[half].y * scale.y, sums[half].z * scale.z, 0.0f));
+
+	for (unsigned int i = 1; i <= half; ++i)
+	{
+		unsigned int taps[2] = { half - i, half + i };
+
+		for (int j = 0; j < 2; ++j)
+		{
+			const Vector3 &sum = sums[taps[j]];
+			kernel.push_back(Vector4(sum.x * scale.x, sum.y * scale.y, sum.z * scale.z, offsets[taps[j]]));
+		}
+	}
+}
+
+// accumulationPass: the SSS shader inside the stencil, basicShader outside it
+void SSSReference::Accumulate(const float *weights, unsigned int numTaps, bool useSSS, unsigned int begin, unsigned int end)
+{
+	for (unsigned int pixel = begin * width; pixel < end * width; ++pixel)
+	{
+		float *out = &final[pixel * 4];
+
+		if (!useSSS || stencil[pixel] != 1)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				out[c] = quantise ? Quantise(colour[pixel * 4 + c]) : colour[pixel * 4 + c];
+			}
+			continue;
+		}
+
+		float diffuseLight[3] = { 0.0f, 0.0f, 0.0f };
+		const float *materialWeights = weights + materials[pixel] * numTaps * 3;
+
+		for (unsigned int t = 0; t < numTaps; ++t)
+		{
+			const float *tap = (t == 0) ? &colour[pixel * 4] : &blurred[t - 1][pixel * 4];
+
+			for (int c = 0; c < 3; ++c)
+			{
+				diffuseLight[c] += materialWeights[t * 3 + c] * tap[c];
+			}
+		}
+
+		for (int c = 0; c < 3; ++c)
+		{
+			out[c] = quantise ? Quantise(diffuseLight[c]) : diffuseLight[c];
+		}
+		out[3] = 1.0f;
+	}
+}
+
+unsigned int SSSReference::GetBlurFetches(unsigned int numLevels, bool packed)
+{
+	if (!packed || numLevels == 0)
+	{
+		return numLevels * 2 * SSSREFERENCE_BLUR_FETCHES;
+	}
+
+	// The first pass reads the colour buffer and the depth, and every pass after it what the last one packed
+	return SSSREFERENCE_BLUR_FETCHES + (numLevels * 2 - 1) * SSSREFERENCE_PACKED_BLUR_FETCHES;
+}
+
+float SSSReference::MaxDifference(const float *a, const float *b, unsigned int numPixels)
+{
+	float error = 0.0f;
+
+	for (unsigned int i = 0; i < numPixels * 4; ++i)
+	{
+		error = max(error, fabs(a[i] - b[i]));
+	}
+	return error;
+}
+
+float SSSReference::RMSDifference(const float *a, const float *b, const unsigned char *stencil, unsigned int numPixels)
+{
+	double sum = 0.0;
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < numPixels; ++i)
+	{
+		if (stencil[i] != 1)
+		{
+			continue;
+		}
+
+		for (int c = 0; c < 3; ++c)
+		{
+			double d = a[i * 4 + c] - b[i * 4 + c];
+			sum += d * d;
+		}
+		count += 3;
+	}
+	return count ? (float)sqrt(sum / count) : 0.0f;
+}
+
+float SSSReference::PSNR(const float *a, const float *b, const unsigned char *stencil, unsigned int numPixels)
+{
+	float rms = RMSDifference(a, b, stencil, numPixels);
+	return rms > 0.00001f ? 20.0f * log10(1.0f / rms) : 100.0f;
+}
+
+void SSSReference::MakeTestScene()
+{
+	/*
+	 * A striped, shaded ellipse with SSS about 0.4m from the camera, in the
+	 * linear depth mainVert.glsl writes, and a small disc without SSS in
+	 * front of it, over the cleared background
+	 */
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = y * width + x;
+			float u = (2.0f * x - width) / height;
+			float v = (2.0f * y - height) / height;
+			float r2 = (u * u) / 0.6f + (v * v) / 0.8f;
+
+			float *c = &colour[pixel * 4];
+
+			if ((u - 0.5f) * (u - 0.5f) + (v - 0.4f) * (v - 0.4f) < 0.01f)
+			{
+				c[0] = c[1] = c[2] = c[3] = 1.0f;
+				depth[pixel] = Quantise(0.02f);
+				stencil[pixel] = 2;
+			}
+			else if (r2 < 1.0f)
+			{
+				float shade = sqrt(1.0f - r2) * (0.6f + 0.4f * (((x / 3) + (y / 7)) % 2));
+
+				c[0] = Quantise(0.9f * shade);
+				c[1] = Quantise(0.6f * shade);
+				c[2] = Quantise(0.5f * shade);
+				c[3] = 1.0f;
+				depth[pixel] = Quantise(0.03f + 0.01f * r2);
+				stencil[pixel] = 1;
+			}
+			else
+			{
+				c[0] = c[1] = c[2] = 0.0f;
+				c[3] = 1.0f;
+				depth[pixel] = 0.0f;
+				stencil[pixel] = 0;
+			}
+		}
+	}
+}
+
+bool SSSReference::Benchmark(unsigned int width, unsigned int height, int iterations)
+{
+	SSSReference reference(width, height);
+	reference.MakeTestScene();
+
+	const char *paths[3] = { "scalar", "SSE", "threaded SSE" };
+	float times[3];
+	std::vector<float> results[3];
+
+	for (int path = 0; path < 3; ++path)
+	{
+		bool vectorised = (path > 0);
+		bool threaded = (path == 2);
+
+		GameTimer timer;
+		float start = timer.GetMS();
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			reference.Render(SSS_MARBLE, true, threaded, vectorised);
+		}
+		times[path] = (timer.GetMS() - start) / iterations;
+
+		results[path].assign(reference.GetFinal(), reference.GetFinal() + width * height * 4);
+	}
+
+	float pathError = max(MaxDifference(&results[0][0], &results[1][0], width * height),
+						  MaxDifference(&results[0][0], &results[2][0], width * height));
+
+	// Every blur's weights add up to 1, so a flat colour at a flat depth should come through them untouched
+	SSSReference flat(64, 64);
+
+	for (unsigned int pixel = 0; pixel < 64 * 64; ++pixel)
+	{
+		float *c = flat.GetColour() + pixel * 4;
+		c[0] = Quantise(0.5f);
+		c[1] = Quantise(0.4f);
+		c[2] = Quantise(0.3f);
+		c[3] = 1.0f;
+		flat.GetDepth()[pixel] = 0.05f;
+		flat.GetStencil()[pixel] = 1;
+	}
+
+	flat.Render(SSS_MARBLE);
+
+	float flatError = 0.0f;
+
+	for (int i = 0; i < SSSREFERENCE_MAX_BLURS; ++i)
+	{
+		flatError = max(flatError, MaxDifference(flat.GetColour(), flat.GetBlurred(i), 64 * 64));
+	}
+
+	bool passed = (pathError <= 1.0f / 255.0f) && (flatError <= 1.0f / 255.0f);
+
+	// Four levels of a horizontal and a vertical pass, then the accumulation
+	unsigned int passes = 4 * 2 + 1;
+
+	std::cout << "SSSReference::Benchmark " << width << "x" << height << ", marble, "
+			  << JobPool::Get().GetNumThreads() << " threads" << std::endl;
+
+	for (int path = 0; path < 3; ++path)
+	{
+		std::cout << "  " << paths[path] << ": " << times[path] << " ms a frame, "
+				  << (times[path] * 1000000.0f) / ((float)width * height * passes) << " ns per pixel per pass ("
+				  << times[0] / times[path] << "x)" << std::endl;
+	}
+
+	std::cout << "  max difference between paths " << pathError * 255.0f << "/255, flat colour moved "
+			  << flatError * 255.0f << "/255" << (passed ? " (passed)" : " (FAILED)") << std::endl;
+
+	return passed;
+}
+
+bool SSSReference::CompareSeparable(unsigned int width, unsigned int height, unsigned int numTaps, float tolerance)
+{
+	SSSReference reference(width, height);
+	reference.MakeTestScene();
+
+	unsigned int numPixels = width * height;
+
+	/*
+	 * Where a blur reaches past the stencil, or over a jump in depth, the
+	 * cascade and the kernel both pull in whatever's there, by an amount
+	 * that depends on the number of passes, so they can't agree. Only the
+	 * pixels whose whole footprint, out to the widest Gaussian, is inside
+	 * the stencil count towards the tolerance. A summed area table of the
+	 * pixels outside the stencil says which those are.
+	 */
+	std::vector<unsigned int> outside((width + 1) * (height + 1), 0);
+
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			outside[(y + 1) * (width + 1) + x + 1] = (reference.stencil[y * width + x] != 1)
+												   + outside[y * (width + 1) + x + 1]
+												   + outside[(y + 1) * (width + 1) + x]
+												   - outside[y * (width + 1) + x];
+		}
+	}
+
+	std::vector<Vector4> kernels[DIFFUSIONLIBRARY_MAX_MATERIALS];
+	BuildSeparableKernel(SSS_SKIN, numTaps, kernels[SSS_SKIN]);
+	BuildSeparableKernel(SSS_MARBLE, numTaps, kernels[SSS_MARBLE]);
+
+	std::vector<float> cascade(numPixels * 4);
+	bool passed = true;
+
+	std::cout << "SSSReference::CompareSeparable " << width << "x" << height << ", " << numTaps << " taps" << std::endl;
+
+	for (int m = 0; m < 2; ++m)
+	{
+		SSSMaterial material = (m == 0) ? SSS_SKIN : SSS_MARBLE;
+
+		// The widest tap is at the edge of the kernel
+		float range = fabs(kernels[material].back().w);
+
+		std::vector<unsigned char> interior(numPixels, 0);
+		unsigned int numInterior = 0;
+
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				unsigned int pixel = y * width + x;
+
+				if (reference.stencil[pixel] != 1 || !(reference.depth[pixel] > 0.0f))
+				{
+					continue;
+				}
+
+				int reach = (int)ceil(range * reference.colour[pixel * 4 + 3] / reference.depth[pixel]) + 1;
+				int x0 = (int)x - reach, x1 = (int)x + reach + 1;
+				int y0 = (int)y - reach, y1 = (int)y + reach + 1;
+
+				if (x0 < 0 || y0 < 0 || x1 > (int)width || y1 > (int)height)
+				{
+					continue;
+				}
+
+				unsigned int count = outside[y1 * (width + 1) + x1] - outside[y0 * (width + 1) + x1]
+								   - outside[y1 * (width + 1) + x0] + outside[y0 * (width + 1) + x0];
+
+				if (count == 0)
+				{
+					interior[pixel] = 1;
+					++numInterior;
+				}
+			}
+		}
+
+		GameTimer timer;
+		float start = timer.GetMS();
+
+		reference.Render(material);
+		float cascadeTime = timer.GetMS() - start;
+
+		cascade.assign(reference.GetFinal(), reference.GetFinal() + numPixels * 4);
+
+		start = timer.GetMS();
+
+		reference.KernelPass(reference.GetColour(), &reference.temp[0], kernels, true, false);
+		reference.KernelPass(&reference.temp[0], &reference.final[0], kernels, false, true);
+		float separableTime = timer.GetMS() - start;
+
+		// Only the pixels with SSS are compared, the rest are just copied
+		float rms = RMSDifference(&cascade[0], reference.GetFinal(), &interior[0], numPixels);
+		float edgeRMS = RMSDifference(&cascade[0], reference.GetFinal(), reference.GetStencil(), numPixels);
+		float worst = 0.0f;
+
+		for (unsigned int pixel = 0; pixel < numPixels; ++pixel)
+		{
+			for (int c = 0; interior[pixel] && c < 3; ++c)
+			{
+				worst = max(worst, fabs(cascade[pixel * 4 + c] - reference.final[pixel * 4 + c]));
+			}
+		}
+
+		bool ok = (rms <= tolerance);
+		passed &= ok;
+
+		std::cout << "  " << (m == 0 ? "skin" : "marble") << ": cascade " << cascadeTime << " ms ("
+				  << GetGaussians(material).size() * 2 << " blur passes + accumulation), separable "
+				  << separableTime << " ms (2 passes)" << std::endl;
+		std::cout << "    " << numInterior << " pixels clear of edges: rms difference " << rms * 255.0f
+				  << "/255, max " << worst * 255.0f << "/255" << (ok ? "" : " OUT OF TOLERANCE")
+				  << "; every SSS pixel: rms " << edgeRMS * 255.0f << "/255" << std::endl;
+	}
+
+	return passed;
+}
+
+bool SSSReference::CompareReduced(unsigned int width, unsigned int height, float threshold)
+{
+	SSSReference reference(width, height);
+	reference.MakeTestScene();
+
+	unsigned int numPixels = width * height;
+	std::vector<float> full(numPixels * 4);
+	bool passed = true;
+
+	std::cout << "SSSReference::CompareReduced " << width << "x" << height << std::endl;
+
+	for (int m = 0; m < 2; ++m)
+	{
+		SSSMaterial material = (m == 0) ? SSS_SKIN : SSS_MARBLE;
+		const std::vector<Gaussian> &gaussians = GetGaussians(material);
+
+		GameTimer timer;
+		float start = timer.GetMS();
+
+		reference.SetReduction(1);
+		reference.Render(material);
+		float fullTime = timer.GetMS() - start;
+
+		full.assign(reference.GetFinal(), reference.GetFinal() + numPixels * 4);
+
+		std::cout << "  " << (m == 0 ? "skin" : "marble") << ": full resolution " << fullTime << " ms" << std::endl;
+
+		for (unsigned int reduction = 2; reduction <= 4; reduction *= 2)
+		{
+			unsigned int first = GetFirstReducedLevel(gaussians, reduction);
+
+			start = timer.GetMS();
+
+			reference.SetReduction(reduction);
+			reference.Render(material);
+			float reducedTime = timer.GetMS() - start;
+
+			float psnr = PSNR(&full[0], reference.GetFinal(), reference.GetStencil(), numPixels);
+			bool ok = (psnr >= threshold);
+			passed &= ok;
+
+			std::cout << "    1/" << reduction << " resolution from level " << first + 1 << " of " << gaussians.size()
+					  << ": " << reducedTime << " ms, PSNR " << psnr << " dB" << (ok ? "" : " UNDER THRESHOLD") << std::endl;
+		}
+	}
+
+	std::cout << "SSSReference::CompareReduced: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
+
+bool SSSReference::ComparePacked(unsigned int width, unsigned int height, float threshold)
+{
+	SSSReference reference(width, height);
+	reference.MakeTestScene();
+
+	unsigned int numPixels = width * height;
+	std::vector<float> unpacked(numPixels * 4);
+	bool passed = true;
+
+	std::cout << "SSSReference::ComparePacked " << width << "x" << height << std::endl;
+
+	for (int m = 0; m < 2; ++m)
+	{
+		SSSMaterial material = (m == 0) ? SSS_SKIN : SSS_MARBLE;
+		unsigned int numLevels = min((unsigned int)GetGaussians(material).size(), (unsigned int)SSSREFERENCE_MAX_BLURS);
+
+		GameTimer timer;
+		float start = timer.GetMS();
+
+		reference.SetPackedBlur(false);
+		reference.Render(material);
+		float unpackedTime = timer.GetMS() - start;
+
+		unpacked.assign(reference.GetFinal(), reference.GetFinal() + numPixels * 4);
+
+		start = timer.GetMS();
+
+		reference.SetPackedBlur(true);
+		reference.Render(material);
+		float packedTime = timer.GetMS() - start;
+
+		// Where the two differ at all, which should only be round the disc without SSS
+		unsigned int changed = 0;
+
+		for (unsigned int pixel = 0; pixel < numPixels; ++pixel)
+		{
+			changed += MaxDifference(&unpacked[pixel * 4], reference.GetFinal() + pixel * 4, 1) > 0.0f ? 1 : 0;
+		}
+
+		float psnr = PSNR(&unpacked[0], reference.GetFinal(), reference.GetStencil(), numPixels);
+		bool ok = (psnr >= threshold);
+		passed &= ok;
+
+		unsigned int fetches = GetBlurFetches(numLevels, false);
+		unsigned int packedFetches = GetBlurFetches(numLevels, true);
+
+		std::cout << "  " << (m == 0 ? "skin" : "marble") << ": " << numLevels << " levels, " << fetches << " fetches a pixel unpacked ("
+				  << unpackedTime << " ms), " << packedFetches << " packed (" << packedTime << " ms), "
+				  << 100.0f * (fetches - packedFetches) / fetches << "% fewer" << std::endl;
+		std::cout << "    PSNR " << psnr << " dB, " << changed << " pixels changed" << (ok ? "" : " UNDER THRESHOLD") << std::endl;
+	}
+
+	std::cout << "SSSReference::ComparePacked: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
+
+bool SSSReference::CompareFits(unsigned int width, unsigned int height)
+{
+	SSSReference reference(width, height);
+	reference.MakeTestScene();
+
+	unsigned int numPixels = width * height;
+	std::vector<float> shipped(numPixels * 4);
+	DiffusionLibrary &library = DiffusionLibrary::Get();
+	bool passed = true;
+
+	std::cout << "SSSReference::CompareFits " << width << "x" << height << std::endl;
+
+	for (int m = 0; m < 2; ++m)
+	{
+		SSSMaterial material = (m == 0) ? SSS_SKIN : SSS_MARBLE;
+		unsigned int wasGaussians = library.GetNumGaussians(material);
+
+		GameTimer timer;
+
+		// Against the sum it's shipped with, then each fit, fewest Gaussians first
+		for (unsigned int n = 0; n <= DIFFUSIONLIBRARY_MAX_FIT; n = (n == 0 ? 2 : n + 1))
+		{
+			float start = timer.GetMS();
+
+			if (!library.SetNumGaussians(material, n))
+			{
+				passed = false;
+				continue;
+			}
+
+			float fitTime = timer.GetMS() - start;
+			start = timer.GetMS();
+
+			reference.Render(material);
+			float renderTime = timer.GetMS() - start;
+
+			const DiffusionFit &fit = library.GetFit(material);
+			unsigned int numLevels = (unsigned int)GetGaussians(material).size();
+
+			std::cout << "  " << (m == 0 ? "skin" : "marble") << ", ";
+
+			if (n == 0)
+			{
+				shipped.assign(reference.GetFinal(), reference.GetFinal() + numPixels * 4);
+				std::cout << "shipped " << fit.variances.size() << " Gaussians: " << numLevels << " levels, " << renderTime << " ms" << std::endl;
+				continue;
+			}
+
+			std::cout << n << " Gaussians: " << numLevels << " levels, " << renderTime << " ms, PSNR "
+					  << PSNR(&shipped[0], reference.GetFinal(), reference.GetStencil(), numPixels) << " dB against the shipped sum; "
+					  << "against the profile, rms error " << 100.0f * fit.rmsError << "%, error bound " << 100.0f * fit.errorBound
+					  << "% (fitted in " << fitTime << " ms)" << std::endl;
+		}
+
+		library.SetNumGaussians(material, wasGaussians);
+	}
+
+	std::cout << "SSSReference::CompareFits: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
+
+
+bool SSSReference::CompareMaterials(unsigned int width, unsigned int height)
+{
+	DiffusionLibrary &library = DiffusionLibrary::Get();
+	unsigned int numExisting = library.GetNumMaterials();
+	bool passed = true;
+
+	std::cout << "SSSReference::CompareMaterials " << width << "x" << height << std::endl;
+
+	/*
+	 * Dipoles a little further from skin's each time, fitted with 2 to 5
+	 * Gaussians in turn, so there are materials with fewer levels than the
+	 * frame runs as well as the most
+	 */
+	GameTimer timer;
+	float start = timer.GetMS();
+
+	for (unsigned int m = numExisting; m < DIFFUSIONLIBRARY_MAX_MATERIALS; ++m)
+	{
+		float scale = 1.0f + 0.2f * (m - numExisting);
+
+		DiffusionProfile profile;
+		profile.SetDipole(Vector3(0.032f, 0.17f, 0.48f) / scale, Vector3(0.74f, 0.88f, 1.01f) * scale, 1.3f);
+
+		SSSMaterial material;
+
+		if (!library.AddMaterial("made up " + std::to_string(m), profile, 2 + m % 4, material))
+		{
+			library.RemoveMaterials((SSSMaterial)numExisting);
+			return false;
+		}
+	}
+
+	unsigned int numMaterials = library.GetNumMaterials();
+	unsigned int allMaterials = library.GetAllMaterials();
+
+	std::cout << "  " << numMaterials - numExisting << " materials added in " << timer.GetMS() - start << " ms" << std::endl;
+
+	/*
+	 * A striped, shaded plane with SSS over the whole frame, sloping gently
+	 * away, split into a 4 by 4 grid of squares, a material each
+	 */
+	SSSReference reference(width, height);
+	unsigned int numPixels = width * height;
+	float nearest = 1.0f;
+
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = y * width + x;
+			float shade = 0.6f + 0.4f * (((x / 3) + (y / 7)) % 2);
+			float *c = &reference.colour[pixel * 4];
+
+			c[0] = Quantise(0.9f * shade);
+			c[1] = Quantise(0.6f * shade);
+			c[2] = Quantise(0.5f * shade);
+			c[3] = 1.0f;
+			reference.depth[pixel] = Quantise(0.3f + 0.02f * y / height);
+			reference.materials[pixel] = (unsigned char)(((x * 4 / width) + (y * 4 / height) * 4) % numMaterials);
+			reference.stencil[pixel] = 1;
+
+			nearest = min(nearest, reference.depth[pixel]);
+		}
+	}
+
+	/*
+	 * How far a pixel's blurs reach, from the widest any material has at
+	 * each level and the nearest depth: each pass's taps go a step out and
+	 * filter the texel past it, and a reduced level's texels take in a
+	 * block of pixels, which the upsample then filters between
+	 */
+	std::vector<Vector4> kernels[DIFFUSIONLIBRARY_MAX_MATERIALS];
+	float kernelRange = 0.0f;
+	unsigned int numLevels = library.GetNumLevels(allMaterials);
+	float levelWidths[SSSREFERENCE_MAX_BLURS] = {};
+
+	for (unsigned int m = 0; m < numMaterials; ++m)
+	{
+		const std::vector<Gaussian> &gaussians = GetGaussians((SSSMaterial)m);
+
+		for (unsigned int i = 0; i < numLevels && i < gaussians.size(); ++i)
+		{
+			levelWidths[i] = max(levelWidths[i], gaussians[i].getWidth());
+		}
+
+		BuildSeparableKernel((SSSMaterial)m, SSSREFERENCE_KERNEL_TAPS, kernels[m]);
+		kernelRange = max(kernelRange, fabs(kernels[m].back().w));
+	}
+
+	// Full resolution, half, and the separable kernels
+	const char *paths[3] = { "full resolution", "1/2 resolution", "separable" };
+	int reaches[3] = { 0, 0, 2 * ((int)ceil(kernelRange / nearest) + 1) };
+
+	unsigned int firstReduced = GetFirstReducedLevel(allMaterials, 2);
+
+	for (unsigned int i = 0; i < numLevels; ++i)
+	{
+		int step = (int)ceil(levelWidths[i] / nearest) + 1;
+		reaches[0] += 2 * step;
+		reaches[1] += 2 * step + (i >= firstReduced ? 2 * 2 + 2 * 2 : 0);
+	}
+
+	// Each material's interior for each path, from a summed area table of the pixels that aren't that material
+	std::vector<unsigned int> others((width + 1) * (height + 1), 0);
+	std::vector<unsigned char> interiors[3];
+	unsigned int numInterior[3][DIFFUSIONLIBRARY_MAX_MATERIALS] = {};
+
+	for (int path = 0; path < 3; ++path)
+	{
+		interiors[path].assign(numPixels, 0);
+	}
+
+	for (unsigned int m = 0; m < numMaterials; ++m)
+	{
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				others[(y + 1) * (width + 1) + x + 1] = (reference.materials[y * width + x] != m)
+													  + others[y * (width + 1) + x + 1]
+													  + others[(y + 1) * (width + 1) + x]
+													  - others[y * (width + 1) + x];
+			}
+		}
+
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				unsigned int pixel = y * width + x;
+
+				if (reference.materials[pixel] != m)
+				{
+					continue;
+				}
+
+				// Taps past the edges are clamped onto them, so only what's inside the frame counts
+				for (int path = 0; path < 3; ++path)
+				{
+					int x0 = max((int)x - reaches[path], 0), x1 = min((int)x + reaches[path] + 1, (int)width);
+					int y0 = max((int)y - reaches[path], 0), y1 = min((int)y + reaches[path] + 1, (int)height);
+
+					unsigned int count = others[y1 * (width + 1) + x1] - others[y0 * (width + 1) + x1]
+									   - others[y1 * (width + 1) + x0] + others[y0 * (width + 1) + x0];
+
+					if (count == 0)
+					{
+						interiors[path][pixel] = 1;
+						++numInterior[path][m];
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<unsigned char> mixed(reference.materials);
+	std::vector<float> mixedFinal(numPixels * 4);
+	std::vector<float> single(numPixels * 4);
+
+	for (int path = 0; path < 3; ++path)
+	{
+		reference.SetReduction(path == 1 ? 2 : 1);
+		reference.materials = mixed;
+
+		start = timer.GetMS();
+
+		if (path == 2)
+		{
+			reference.RenderSeparableMaterials();
+		}
+		else
+		{
+			reference.RenderMaterials(allMaterials);
+		}
+		float mixedTime = timer.GetMS() - start;
+
+		mixedFinal.assign(reference.GetFinal(), reference.GetFinal() + numPixels * 4);
+
+		/*
+		 * Each material over the whole frame, in a frame of its own: the
+		 * levels past its own that the grid's runs change nothing, as long as
+		 * they're reduced from the same level on. Where they aren't, it's
+		 * against a frame that runs the grid's levels
+		 */
+		unsigned int mismatched = 0;
+		unsigned int emptyMaterials = 0;
+		unsigned int ownFrames = 0;
+
+		for (unsigned int m = 0; m < numMaterials; ++m)
+		{
+			unsigned int mask = 1u << m;
+
+			unsigned int ownLevels = library.GetNumLevels(mask);
+
+			if (GetFirstReducedLevel(mask, reference.reduction) != min(GetFirstReducedLevel(allMaterials, reference.reduction), ownLevels))
+			{
+				mask = allMaterials;
+			}
+
+			ownFrames += (mask == allMaterials) ? 0 : 1;
+			reference.materials.assign(numPixels, (unsigned char)m);
+
+			if (path == 2)
+			{
+				reference.RenderSeparableMaterials();
+			}
+			else
+			{
+				reference.RenderMaterials(mask);
+			}
+
+			for (unsigned int pixel = 0; pixel < numPixels; ++pixel)
+			{
+				if (interiors[path][pixel] && mixed[pixel] == m &&
+					MaxDifference(&mixedFinal[pixel * 4], reference.GetFinal() + pixel * 4, 1) > 0.0f)
+				{
+					++mismatched;
+				}
+			}
+
+			emptyMaterials += numInterior[path][m] ? 0 : 1;
+		}
+
+		unsigned int checked = 0;
+
+		for (unsigned int m = 0; m < numMaterials; ++m)
+		{
+			checked += numInterior[path][m];
+		}
+
+		bool ok = (mismatched == 0 && emptyMaterials == 0);
+		passed &= ok;
+
+		std::cout << "  " << paths[path] << ", " << numMaterials << " materials: " << mixedTime << " ms, "
+				  << checked << " pixels out of reach of another material, " << mismatched << " unlike their own material's ("
+				  << ownFrames << " drawn in a frame of their own)"
+				  << (emptyMaterials ? ", and some materials have none" : "") << (ok ? "" : " (FAILED)") << std::endl;
+	}
+
+	// A frame of every material against one of marble alone
+	reference.SetReduction(1);
+	reference.materials = mixed;
+
+	start = timer.GetMS();
+	reference.RenderMaterials(allMaterials);
+	float mixedTime = timer.GetMS() - start;
+
+	start = timer.GetMS();
+	reference.Render(SSS_MARBLE);
+	float marbleTime = timer.GetMS() - start;
+
+	unsigned int marbleLevels = library.GetNumLevels(1u << SSS_MARBLE);
+
+	// Each level's two passes and the accumulation; the accumulation fetches the material as well as the levels
+	unsigned int marblePasses = marbleLevels * 2 + 1;
+	unsigned int mixedPasses = numLevels * 2 + 1;
+	unsigned int marbleFetches = GetBlurFetches(marbleLevels, false) + marbleLevels + 2;
+	unsigned int mixedFetches = GetBlurFetches(numLevels, false) + numLevels + 2;
+
+	bool ok = (marbleLevels == numLevels && marblePasses == mixedPasses && marbleFetches == mixedFetches);
+	passed &= ok;
+
+	std::cout << "  marble alone: " << marbleLevels << " levels, " << marblePasses << " passes, " << marbleFetches
+			  << " fetches a pixel, " << marbleTime << " ms; all " << numMaterials << ": " << numLevels << " levels, "
+			  << mixedPasses << " passes, " << mixedFetches << " fetches a pixel, " << mixedTime << " ms"
+			  << (ok ? "" : " (FAILED)") << std::endl;
+
+	for (unsigned int reduction = 2; reduction <= 4; reduction *= 2)
+	{
+		std::cout << "  1/" << reduction << " resolution from level " << GetFirstReducedLevel(1u << SSS_MARBLE, reduction) + 1
+				  << " for marble alone, " << GetFirstReducedLevel(allMaterials, reduction) + 1 << " for all" << std::endl;
+	}
+
+	library.RemoveMaterials((SSSMaterial)numExisting);
+
+	std::cout << "SSSReference::CompareMaterials: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
\ No newline at end of file
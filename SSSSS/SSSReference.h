@@ -0,0 +1,328 @@
+#pragma once
+
+/*
+ * A CPU copy of Renderer::sssPass and accumulationPass, for checking what the
+ * GPU draws, and for working on the blur itself, without a GL context.
+ *
+ * It takes the four images mainPass leaves behind - the colour buffer, the
+ * linear depth buffer, the material each pixel was drawn with, which the GPU
+ * has in the depth target's green channel, and the stencil buffer (1 under
+ * meshes with SSS) - and runs the same chain of separable, depth aware
+ * Gaussian blurs as blurFrag.glsl, each pixel with the widths of its
+ * material's Gaussians in the DiffusionLibrary, then adds the levels up with
+ * its material's weights, as accumFrag.glsl does. Everything the shaders rely on OpenGL for is done
+ * the same way here: taps are bilinearly filtered and clamped to the edges,
+ * pixels outside the stencil are left at the clear colour, and with
+ * quantising on, every pass is rounded to the 8 bits per channel of the
+ * RGBA8 textures it would have been drawn into.
+ *
+ * RenderSeparable does the same for Renderer's single kernel mode
+ * (separableBlurFrag.glsl), where the whole sum of Gaussians, accumulation
+ * weights and all, is folded into one wider kernel per material with a
+ * weight per channel per tap, and blurred horizontally then vertically in
+ * two passes.
+ * A sum of Gaussians isn't separable, so that's an approximation of the
+ * cascade; CompareSeparable measures how close it gets.
+ *
+ * With a reduction of 2 or 4 (SetReduction), the levels whose Gaussians are
+ * at least SSSREFERENCE_REDUCED_MIN_WIDTH wide run at half or a quarter of
+ * the resolution, as sssPass does in its reduced quality modes. The image
+ * going into the first of them is shrunk (Downsample), along with the depth,
+ * and each of their results is brought back up to full resolution with a
+ * bilateral filter that leaves out texels across a jump in depth (Upsample),
+ * for the accumulation. CompareReduced measures what that loses.
+ *
+ * With the packed blur on (SetPackedBlur), the full resolution levels read
+ * their taps' depths from the alpha the pass before packed them into, as
+ * packedBlurFrag.glsl does; ComparePacked measures what that changes.
+ *
+ * Images are row major, bottom row first like glReadPixels, with colours
+ * as RGBA floats. Each pass is split into tiles of rows across the JobPool,
+ * and each pixel's RGBA goes through the blur in one SSE register.
+ */
+#include <vector>
+
+#include "DiffusionLibrary.h"
+#include "../Framework/Vector4.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define SSSREFERENCE_USE_SSE
+#endif
+
+// Rows per tile handed to the JobPool
+#define SSSREFERENCE_TILE_ROWS	16
+
+// Most blur levels the accumulation takes
+#define SSSREFERENCE_MAX_BLURS	DIFFUSIONLIBRARY_MAX_LEVELS
+
+// Renderer's depth correction
+#define SSSREFERENCE_CORRECTION	800.0f
+
+// Largest difference from the GPU that should be put down to filtering and rounding
+#define SSSREFERENCE_TOLERANCE	(4.0f / 255.0f)
+
+// Taps in the single separable kernel, and the most separableBlurFrag.glsl takes
+#define SSSREFERENCE_KERNEL_TAPS		17
+#define SSSREFERENCE_MAX_KERNEL_TAPS	33
+
+// Texture fetches a pixel of a blur pass makes: blurFrag.glsl's colour and depth for the centre and six taps,
+// and packedBlurFrag.glsl's from a packed source, one for each tap and the centre, and the centre's strength
+#define SSSREFERENCE_BLUR_FETCHES			14
+#define SSSREFERENCE_PACKED_BLUR_FETCHES	8
+
+// Lowest PSNR, in dB over the pixels with SSS, of the packed blur against blurFrag.glsl's
+#define SSSREFERENCE_PACKED_PSNR	45.0f
+
+// Narrowest Gaussian whose blur level can run at a reduced resolution
+#define SSSREFERENCE_REDUCED_MIN_WIDTH	0.45f
+
+// Lowest PSNR, in dB over the pixels with SSS, of the reduced resolution cascade against the full one
+#define SSSREFERENCE_REDUCED_PSNR	45.0f
+
+/*
+ * Largest root mean square difference between the separable kernel and the
+ * cascade, over the pixels whose blurs stay clear of the stencil's edges.
+ * Most of it is the cascade's: its seven taps are a long way apart on the
+ * widest Gaussians, and alias fine detail in a way the kernel doesn't.
+ */
+#define SSSREFERENCE_KERNEL_TOLERANCE	(6.0f / 255.0f)
+
+class SSSReference
+{
+public:
+	SSSReference(unsigned int width, unsigned int height);
+
+	unsigned int GetWidth() const	{ return width; }
+	unsigned int GetHeight() const	{ return height; }
+
+	// The inputs, to be filled in before Render
+	float *			GetColour()		{ return &colour[0]; }
+	float *			GetDepth()		{ return &depth[0]; }
+	unsigned char *	GetMaterials()	{ return &materials[0]; }	// SSSMaterials, all SSS_SKIN to begin with
+	unsigned char *	GetStencil()	{ return &stencil[0]; }
+
+	void SetCorrection(float c)		{ correction = c; }
+
+	// Rounds every pass's output to 8 bits a channel, as the GPU's targets do. On by default
+	void SetQuantise(bool q)		{ quantise = q; }
+
+	// 1 for the whole cascade at full resolution, the default, or 2 or 4 to run the wide levels smaller
+	void SetReduction(unsigned int r)	{ reduction = r; }
+
+	/*
+	 * Blurs the full resolution levels as packedBlurFrag.glsl does, taking
+	 * the taps' depths from what the pass before wrote, which is 0 outside
+	 * the stencil, rather than from the depth buffer. Off by default
+	 */
+	void SetPackedBlur(bool p)		{ packedBlur = p; }
+
+	/*
+	 * Runs the blurs and the accumulation for a material, drawn everywhere.
+	 * Without SSS the final image is just the colour buffer, as in
+	 * accumulationPass.
+	 */
+	void Render(SSSMaterial material, bool useSSS = true, bool threaded = true, bool vectorised = true);
+
+	/*
+	 * The same with the materials image as it's been filled in, for a frame
+	 * drawing the set of materials given, bit m for SSSMaterial m: as many
+	 * levels as the one with the most has, each pixel blurred and added up
+	 * with its own material's, as sssPass and accumulationPass do
+	 */
+	void RenderMaterials(unsigned int materialMask, bool useSSS = true, bool threaded = true, bool vectorised = true);
+
+	/*
+	 * Renders with the single separable kernel instead: a horizontal pass
+	 * into the temporary image and a vertical one into the final image, with
+	 * the colour buffer copied outside the stencil
+	 */
+	void RenderSeparable(SSSMaterial material, bool threaded = true, bool vectorised = true);
+
+	// The same with the materials image as it's been filled in, each pixel with its material's kernel
+	void RenderSeparableMaterials(bool threaded = true, bool vectorised = true);
+
+	// Blur level i of the last Render, and what the accumulation made of them
+	const float * GetBlurred(unsigned int i) const	{ return &blurred[i][0]; }
+	const float * GetFinal() const					{ return &final[0]; }
+
+	/*
+	 * One of blurPass's two halves: blurs source horizontally or vertically
+	 * into target, over the pixels with a stencil of 1, each with the width
+	 * in gaussianWidths of its material.
+	 */
+	void BlurPass(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+				  bool threaded = true, bool vectorised = true);
+
+	/*
+	 * One of RenderSeparable's passes: blurs source along dir with each
+	 * pixel's material's kernel in kernels, of per channel weights in xyz and
+	 * offsets in w, the centre tap first. Offsets are in the same units as
+	 * blurFrag.glsl's steps with a gaussianWidth of 1. The last pass puts an
+	 * alpha of 1 out, as the accumulation does; the first keeps the SSS
+	 * strength for the next one.
+	 */
+	void KernelPass(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+					bool lastPass, bool threaded = true, bool vectorised = true);
+
+	/*
+	 * Folds a material's Gaussians and accumulation weights into numTaps taps
+	 * (odd, and no more than SSSREFERENCE_MAX_KERNEL_TAPS), for KernelPass and
+	 * separableBlurFrag.glsl. The taps are packed closer together towards
+	 * the centre, where the narrow Gaussians are.
+	 */
+	static void BuildSeparableKernel(SSSMaterial material, unsigned int numTaps, std::vector<Vector4> &kernel);
+
+	// A material's blur levels, as the DiffusionLibrary has them
+	static const std::vector<Gaussian> & GetGaussians(SSSMaterial material);
+
+	// The first level run at a reduction, or the number of levels if none are
+	static unsigned int GetFirstReducedLevel(const std::vector<Gaussian> &gaussians, unsigned int reduction);
+
+	/*
+	 * The same for a frame drawing a set of materials: the last of theirs,
+	 * so none of them has a level under SSSREFERENCE_REDUCED_MIN_WIDTH wide
+	 * reduced, and the levels past a material's own blur it by nothing
+	 */
+	static unsigned int GetFirstReducedLevel(unsigned int materialMask, unsigned int reduction);
+
+	// Size of a reduced image, rounded up
+	static unsigned int GetReducedSize(unsigned int size, unsigned int reduction)	{ return (size + reduction - 1) / reduction; }
+
+	/*
+	 * downsampleFrag.glsl: averages the colour and depth of each block of
+	 * pixels, the reduction's size across, into a texel of reduced, over
+	 * the pixels in it with a depth, which is all of them but the
+	 * background's, and gives it the first of their materials. A block
+	 * without any is black at no depth. Every texel of reduced is
+	 * stencilled, as the reduced passes have no stencil buffer.
+	 */
+	void Downsample(const float *source, SSSReference &reduced, bool threaded = true) const;
+
+	/*
+	 * upsampleFrag.glsl: fills in the stencilled pixels of target from a
+	 * reduced image, with the four nearest texels' bilinear weights scaled
+	 * down by the same depth rule as blurFrag.glsl's, so a pixel doesn't
+	 * pick up what's across an edge. If that leaves nothing, it takes the
+	 * texel nearest it in depth.
+	 */
+	void Upsample(const SSSReference &reduced, const float *source, float *target, bool threaded = true) const;
+
+	// Per channel weight of each of the accumulation's taps, the unblurred colour first
+	static unsigned int GetNumAccumulationTaps(SSSMaterial material);
+	static const float * GetAccumulationWeights(SSSMaterial material);
+
+	/*
+	 * Texture fetches each pixel with SSS makes in numLevels blur levels at
+	 * full resolution, through blurFrag.glsl or packedBlurFrag.glsl, whose
+	 * first pass reads the unpacked colour buffer and depth as blurFrag.glsl does
+	 */
+	static unsigned int GetBlurFetches(unsigned int numLevels, bool packed);
+
+	// Largest difference between any channel of two RGBA images
+	static float MaxDifference(const float *a, const float *b, unsigned int numPixels);
+
+	// Root mean square difference of the RGB channels of two RGBA images, over the pixels a stencil is 1 at
+	static float RMSDifference(const float *a, const float *b, const unsigned char *stencil, unsigned int numPixels);
+
+	// Peak signal to noise ratio, in dB, of the same, taking 1 as the peak. Identical images give 100
+	static float PSNR(const float *a, const float *b, const unsigned char *stencil, unsigned int numPixels);
+
+	/*
+	 * Renders a made up scene - a shaded, striped blob with SSS in front of
+	 * one without - with the scalar path, the SSE path on one thread, and the
+	 * SSE path on the JobPool, and prints the time each took, and how much a
+	 * frame's blurs would cost per pixel. Also checks that the three agree,
+	 * and that a flat colour at a flat depth comes out of the blurs the same.
+	 * Returns false if anything didn't match.
+	 */
+	static bool Benchmark(unsigned int width = 1900, unsigned int height = 1024, int iterations = 5);
+
+	/*
+	 * Renders Benchmark's scene with both materials, through the cascade
+	 * and through the separable kernel, and prints how far apart they are
+	 * and how long each took. Near silhouettes and occluders the two differ
+	 * by design: each pass of either lerps towards whatever is across the
+	 * edge, and there are more passes in the cascade. So the tolerance is
+	 * checked against the pixels far enough inside the stencil for neither
+	 * to reach an edge, and the difference over every pixel is only printed.
+	 * Returns false if the kernel's root mean square difference from the
+	 * cascade is over tolerance.
+	 */
+	static bool CompareSeparable(unsigned int width = 1900, unsigned int height = 1024,
+								 unsigned int numTaps = SSSREFERENCE_KERNEL_TAPS,
+								 float tolerance = SSSREFERENCE_KERNEL_TOLERANCE);
+
+	/*
+	 * Renders Benchmark's scene with both materials at full resolution and
+	 * at each reduction, and prints the PSNR of each reduction against full
+	 * resolution, which levels it reduced, and how long each took. Returns
+	 * false if any PSNR is under threshold.
+	 */
+	static bool CompareReduced(unsigned int width = 1900, unsigned int height = 1024,
+							   float threshold = SSSREFERENCE_REDUCED_PSNR);
+
+	/*
+	 * Renders Benchmark's scene with both materials through blurFrag.glsl's
+	 * blurs and packedBlurFrag.glsl's, and prints how far apart they are, how
+	 * long each took, and the fetches each makes. They only differ where a
+	 * tap lands on a pixel without SSS that has a depth, such as the light's.
+	 * Returns false if any PSNR is under threshold.
+	 */
+	static bool ComparePacked(unsigned int width = 1900, unsigned int height = 1024,
+							  float threshold = SSSREFERENCE_PACKED_PSNR);
+
+	/*
+	 * Renders Benchmark's scene with both materials drawn with the sums
+	 * they're shipped with, then with fits of their profiles of 2 Gaussians
+	 * up to DIFFUSIONLIBRARY_MAX_FIT, and prints how long each took, its PSNR
+	 * against the shipped sum, and its errors against the profile. Leaves the
+	 * DiffusionLibrary drawing them as it was. Returns false if a fit failed.
+	 */
+	static bool CompareFits(unsigned int width = 1900, unsigned int height = 1024);
+
+	/*
+	 * Adds made up materials to the DiffusionLibrary up to
+	 * DIFFUSIONLIBRARY_MAX_MATERIALS, and renders a grid of all of them,
+	 * each square a material, through the cascade at full resolution and at
+	 * half, and through the separable kernels. Each material's pixels far
+	 * enough inside its square for no blur to reach another have to come
+	 * out exactly as they do with the whole image drawn with that material,
+	 * and a frame of all of them has to run the same levels, passes and
+	 * fetches as one of marble alone. Prints how long both took, and drops
+	 * the made up materials again. Returns false if anything didn't hold.
+	 */
+	static bool CompareMaterials(unsigned int width = 1900, unsigned int height = 1024);
+
+protected:
+	void BlurRows(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+				  unsigned int begin, unsigned int end) const;
+	void BlurRowsScalar(const float *source, float *target, const float *gaussianWidths, bool horizontal,
+						unsigned int begin, unsigned int end) const;
+	void KernelRows(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+					bool lastPass, unsigned int begin, unsigned int end) const;
+	void KernelRowsScalar(const float *source, float *target, const std::vector<Vector4> *kernels, bool horizontal,
+						  bool lastPass, unsigned int begin, unsigned int end) const;
+
+	// Fills in the made up scene Benchmark and CompareSeparable render
+	void MakeTestScene();
+
+	// weights has numTaps per channel weights for each material, 0 for the levels past its own
+	void Accumulate(const float *weights, unsigned int numTaps, bool useSSS, unsigned int begin, unsigned int end);
+
+	unsigned int				width;
+	unsigned int				height;
+	float						correction;
+	bool						quantise;
+	unsigned int				reduction;
+	bool						packedBlur;
+
+	std::vector<float>			colour;
+	std::vector<float>			depth;
+	std::vector<unsigned char>	materials;
+	std::vector<unsigned char>	stencil;
+	std::vector<float>			packedDepth;	// The depth under the stencil, and 0 elsewhere, as the packed blur reads it
+
+	std::vector<float>			temp;		// Horizontally blurred, as in blurTempTex
+	std::vector<float>			blurred[SSSREFERENCE_MAX_BLURS];
+	std::vector<float>			final;
+};
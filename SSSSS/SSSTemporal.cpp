@@ -0,0 +1,356 @@
+#include "SSSTemporal.h"
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+#include "../Framework/Common.h"
+
+// blurFrag.glsl's weights for each pair of taps, nearest first, and their offsets in steps
+static const float pairWeights[3] = { 0.242f, 0.061f, 0.006f };
+static const float pairOffsets[3] = { 0.3333f, 0.6667f, 1.0f };
+
+SSSTemporal::SSSTemporal(float zNear, float zFar)
+{
+	this->zNear = zNear;
+	this->zFar = zFar;
+
+	reprojection.ToIdentity();
+	previousProj.ToIdentity();
+	unproject = Vector2(1.0f, 1.0f);
+}
+
+void SSSTemporal::SetCameras(const Matrix4 &proj, const Matrix4 &view, const Matrix4 &previousProj, const Matrix4 &previousView)
+{
+	reprojection = previousView * RigidInverse(view);
+	this->previousProj = previousProj;
+
+	// Perspective only puts anything in 0 and 5 off the depth rows
+	unproject = Vector2(1.0f / proj.values[0], 1.0f / proj.values[5]);
+}
+
+bool SSSTemporal::Reproject(const Vector2 &uv, float depth, Vector2 &previousUV, float &previousDepth) const
+{
+	// Out along the pixel's ray to its depth
+	float z = depth * (zFar - zNear) + zNear;
+	Vector4 viewPos((uv.x * 2.0f - 1.0f) * unproject.x * z, (uv.y * 2.0f - 1.0f) * unproject.y * z, -z, 1.0f);
+
+	Vector4 previousPos = reprojection * viewPos;
+	Vector4 previousClip = previousProj * previousPos;
+
+	if (previousClip.w <= 0.0f)
+	{
+		return false;
+	}
+
+	previousUV = Vector2(previousClip.x / previousClip.w * 0.5f + 0.5f, previousClip.y / previousClip.w * 0.5f + 0.5f);
+	previousDepth = (-previousPos.z - zNear) / (zFar - zNear);
+
+	return previousUV.x >= 0.0f && previousUV.x <= 1.0f && previousUV.y >= 0.0f && previousUV.y <= 1.0f;
+}
+
+bool SSSTemporal::AcceptHistory(float previousDepth, float historyDepth)
+{
+	return historyDepth > 0.0f && fabs(previousDepth - historyDepth) <= SSSTEMPORAL_DEPTH_TOLERANCE;
+}
+
+void SSSTemporal::GetTapOffsets(unsigned int frame, float &horizontal, float &vertical)
+{
+	// A 2D low discrepancy sequence (the plastic number's), so every pairing turns up evenly, and soon
+	double u[2];
+	u[0] = fmod(0.5 + frame * 0.7548776662466927, 1.0);
+	u[1] = fmod(0.5 + frame * 0.5698402909980532, 1.0);
+
+	float total = pairWeights[0] + pairWeights[1] + pairWeights[2];
+	float offsets[2];
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		float cumulative = 0.0f;
+		offsets[pass] = pairOffsets[2];
+
+		for (int i = 0; i < 3; ++i)
+		{
+			cumulative += pairWeights[i] / total;
+
+			if (u[pass] < cumulative)
+			{
+				offsets[pass] = pairOffsets[i];
+				break;
+			}
+		}
+	}
+
+	horizontal = offsets[0];
+	vertical = offsets[1];
+}
+
+Matrix4 SSSTemporal::RigidInverse(const Matrix4 &m)
+{
+	Matrix4 out;
+
+	// The rotation's transpose, then the translation taken back through it
+	for (int r = 0; r < 3; ++r)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			out.values[c * 4 + r] = m.values[r * 4 + c];
+		}
+
+		out.values[12 + r] = -(m.values[r * 4] * m.values[12] + m.values[r * 4 + 1] * m.values[13] +
+							   m.values[r * 4 + 2] * m.values[14]);
+	}
+
+	out.values[3] = out.values[7] = out.values[11] = 0.0f;
+	out.values[15] = 1.0f;
+
+	return out;
+}
+
+namespace
+{
+	struct Sphere
+	{
+		Vector3	centre;
+		float	radius;
+		bool	sss;
+	};
+
+	// Distance along dir (not normalised) to the nearest sphere in front of from, and which it is, or -1
+	int trace(const std::vector<Sphere> &spheres, const Vector3 &from, const Vector3 &dir, float &t)
+	{
+		int hit = -1;
+		t = 0.0f;
+
+		for (unsigned int s = 0; s < spheres.size(); ++s)
+		{
+			Vector3 o = from - spheres[s].centre;
+			float a = Vector3::Dot(dir, dir);
+			float b = Vector3::Dot(o, dir);
+			float c = Vector3::Dot(o, o) - spheres[s].radius * spheres[s].radius;
+			float d = b * b - a * c;
+
+			if (d < 0.0f)
+			{
+				continue;
+			}
+
+			float first = (-b - sqrt(d)) / a;
+
+			if (first > 0.0f && (hit < 0 || first < t))
+			{
+				hit = (int)s;
+				t = first;
+			}
+		}
+		return hit;
+	}
+
+	float quantise(float v)
+	{
+		return floor(v * 255.0f + 0.5f) / 255.0f;
+	}
+
+	// As GL_LINEAR filters a texture clamped to its edges
+	float sampleBilinear(const std::vector<float> &image, unsigned int width, unsigned int height, const Vector2 &uv)
+	{
+		float x = uv.x * width - 0.5f;
+		float y = uv.y * height - 0.5f;
+		int x0 = (int)floor(x);
+		int y0 = (int)floor(y);
+		float fx = x - x0;
+		float fy = y - y0;
+
+		int xs[2] = { max(min(x0, (int)width - 1), 0), max(min(x0 + 1, (int)width - 1), 0) };
+		int ys[2] = { max(min(y0, (int)height - 1), 0), max(min(y0 + 1, (int)height - 1), 0) };
+
+		return (1.0f - fy) * ((1.0f - fx) * image[ys[0] * width + xs[0]] + fx * image[ys[0] * width + xs[1]]) +
+			   fy * ((1.0f - fx) * image[ys[1] * width + xs[0]] + fx * image[ys[1] * width + xs[1]]);
+	}
+}
+
+bool SSSTemporal::Check(unsigned int width, unsigned int height)
+{
+	bool passed = true;
+
+	const float zNear = 0.1f;
+	const float zFar = 10.0f;
+	Matrix4 proj = Matrix4::Perspective(zNear, zFar, (float)width / (float)height, 25.0f);
+
+	// A turntable, a frame apart (a big one, so the pixels have somewhere to go)
+	Vector3 target(0.0f, 0.0f, 0.0f);
+	Vector3 cameras[2] = { Vector3(0.0f, 0.2f, 2.5f), Vector3(2.5f * sin(2.0f * PI / 180.0f), 0.2f, 2.5f * cos(2.0f * PI / 180.0f)) };
+	Matrix4 views[2] = { Matrix4::BuildViewMatrix(cameras[0], target), Matrix4::BuildViewMatrix(cameras[1], target) };
+
+	// The mesh with SSS; something with SSS in front of it, gone by the second frame; and something without SSS, like the light
+	std::vector<Sphere> scenes[2];
+	Sphere mesh = { Vector3(0.0f, 0.0f, 0.0f), 0.35f, true };
+	Sphere moved = { Vector3(0.12f, 0.05f, 1.0f), 0.06f, true };
+	Sphere light = { Vector3(-0.15f, -0.05f, 1.1f), 0.05f, false };
+
+	scenes[0].push_back(mesh);
+	scenes[0].push_back(moved);
+	scenes[0].push_back(light);
+	scenes[1].push_back(mesh);
+	scenes[1].push_back(light);
+
+	SSSTemporal temporal(zNear, zFar);
+
+	// The first frame's depth, kept only under the stencil, quantised as it is in its RGBA8 target
+	std::vector<float> history(width * height);
+	std::vector<float> depth(width * height);
+
+	for (int frame = 0; frame < 2; ++frame)
+	{
+		temporal.SetCameras(proj, views[frame], proj, views[frame]);
+		Matrix4 toWorld = RigidInverse(views[frame]);
+
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				float u = (x + 0.5f) / width * 2.0f - 1.0f;
+				float v = (y + 0.5f) / height * 2.0f - 1.0f;
+
+				// A view space ray 1 deep, so the distance along it is the view depth
+				Vector4 ray = toWorld * Vector4(u * temporal.GetUnproject().x, v * temporal.GetUnproject().y, -1.0f, 0.0f);
+
+				float t;
+				int hit = trace(scenes[frame], cameras[frame], Vector3(ray.x, ray.y, ray.z), t);
+				bool sss = hit >= 0 && scenes[frame][hit].sss;
+				float linear = sss ? quantise((t - zNear) / (zFar - zNear)) : 0.0f;
+
+				if (frame == 0)
+				{
+					history[y * width + x] = linear;
+				}
+				else
+				{
+					depth[y * width + x] = linear;
+				}
+			}
+		}
+	}
+
+	// Every SSS pixel of the second frame, taken back into the first
+	temporal.SetCameras(proj, views[1], proj, views[0]);
+	Matrix4 toWorld = RigidInverse(views[1]);
+	Matrix4 previousViewProj = proj * views[0];
+
+	unsigned int visible = 0, kept = 0;
+	unsigned int hidden = 0, keptHidden = 0;
+	float worstError = 0.0f;
+
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			if (depth[y * width + x] <= 0.0f)
+			{
+				continue;
+			}
+
+			Vector2 uv((x + 0.5f) / width, (y + 0.5f) / height);
+			Vector2 previousUV;
+			float previousDepth;
+
+			bool keep = temporal.Reproject(uv, depth[y * width + x], previousUV, previousDepth) &&
+						AcceptHistory(previousDepth, sampleBilinear(history, width, height, previousUV));
+
+			// Where the pixel really was, from the exact point the ray hits
+			Vector4 ray = toWorld * Vector4((uv.x * 2.0f - 1.0f) * temporal.GetUnproject().x,
+											(uv.y * 2.0f - 1.0f) * temporal.GetUnproject().y, -1.0f, 0.0f);
+			float t;
+			trace(scenes[1], cameras[1], Vector3(ray.x, ray.y, ray.z), t);
+			Vector3 point = cameras[1] + Vector3(ray.x, ray.y, ray.z) * t;
+
+			Vector4 clip = previousViewProj * Vector4(point.x, point.y, point.z, 1.0f);
+			Vector2 exactUV(clip.x / clip.w * 0.5f + 0.5f, clip.y / clip.w * 0.5f + 0.5f);
+
+			// In view of the first frame if nothing's in front of it from there, and it's on the screen
+			float nearest;
+			trace(scenes[0], cameras[0], point - cameras[0], nearest);
+			bool inView = nearest > 1.0f - 0.0001f &&
+						  exactUV.x >= 0.0f && exactUV.x <= 1.0f && exactUV.y >= 0.0f && exactUV.y <= 1.0f;
+
+			if (inView)
+			{
+				++visible;
+				kept += keep ? 1 : 0;
+
+				if (keep)
+				{
+					worstError = max(worstError, max(fabs(previousUV.x - exactUV.x) * width,
+													 fabs(previousUV.y - exactUV.y) * height));
+				}
+			}
+			else
+			{
+				++hidden;
+				keptHidden += keep ? 1 : 0;
+			}
+		}
+	}
+
+	float keptFraction = visible > 0 ? (float)kept / visible : 0.0f;
+	float keptHiddenFraction = hidden > 0 ? (float)keptHidden / hidden : 1.0f;
+
+	std::cout << "SSSTemporal::Check " << width << "x" << height << ": " << kept << " of " << visible
+			  << " pixels in view a frame ago kept their history (" << 100.0f * keptFraction << "%), "
+			  << keptHidden << " of " << hidden << " that weren't, " << worstError << " pixels out at most" << std::endl;
+
+	// Those turned away in view are at the silhouette, where the depth filters across the edge;
+	// the hidden ones kept are along the edges of what hid them, where most of the filter was in view
+	if (keptFraction < 0.95f || hidden == 0 || keptHiddenFraction > 0.02f || worstError > 0.5f)
+	{
+		std::cout << "SSSTemporal::Check: Reprojection or rejection out" << std::endl;
+		passed = false;
+	}
+
+	// The pairs of taps, on their own and together
+	const unsigned int frames = 5000;
+	unsigned int counts[3][3] = { { 0 } };
+
+	for (unsigned int frame = 0; frame < frames; ++frame)
+	{
+		float offsets[2];
+		GetTapOffsets(frame, offsets[0], offsets[1]);
+
+		int pair[2] = { 0, 0 };
+
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				pair[pass] = offsets[pass] == pairOffsets[i] ? i : pair[pass];
+			}
+		}
+
+		++counts[pair[0]][pair[1]];
+	}
+
+	float total = pairWeights[0] + pairWeights[1] + pairWeights[2];
+	float worstPairing = 0.0f;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			float expected = pairWeights[i] / total * pairWeights[j] / total;
+			worstPairing = max(worstPairing, fabs((float)counts[i][j] / frames - expected));
+		}
+	}
+
+	std::cout << "SSSTemporal::Check: Tap pairings within " << 100.0f * worstPairing << "% of their weights over "
+			  << frames << " frames" << std::endl;
+
+	if (worstPairing > 0.005f)
+	{
+		std::cout << "SSSTemporal::Check: Tap offsets out of proportion" << std::endl;
+		passed = false;
+	}
+
+	std::cout << "SSSTemporal::Check: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+/*
+ * The maths of sssPass's temporal mode, which keeps each blur level from the
+ * frame before and blends it into this frame's, done the same way as
+ * temporalBlurFrag.glsl does it, so it can be checked without a GL context.
+ *
+ * A pixel is taken back to where it was in the last frame from its linear
+ * depth and the two frames' cameras: out along its ray to that depth, from
+ * this frame's view space into the last one's, and through the last frame's
+ * projection. The level kept there is only used if the depth kept with it
+ * (bilinearly filtered, as the GPU samples it) is within
+ * SSSTEMPORAL_DEPTH_TOLERANCE of the depth the pixel should have had then.
+ * That depth is only kept under the stencil, and is 0 everywhere else, so a
+ * pixel that wasn't on a mesh with SSS in the last frame is turned away too,
+ * as is one that was hidden behind something, or off the screen.
+ *
+ * Only the camera is followed from frame to frame. Anything that moves on
+ * its own is left to the depth test to turn away.
+ *
+ * Where the history is used, each pass of the blur takes the centre and just
+ * one of blurFrag.glsl's three pairs of taps, with the weight of all three.
+ * Which pair is picked each frame in proportion to their weights, so over
+ * the frames the history averages, the pairs come out weighted as they are
+ * in the full blur.
+ */
+#include "../Framework/Matrix4.h"
+#include "../Framework/Vector2.h"
+
+// Furthest, in linear depth, the history's depth can be from what a pixel's should have been: about 2.5 steps of its RGBA8 target
+#define SSSTEMPORAL_DEPTH_TOLERANCE	0.01f
+
+// How much of each level comes from the history where it's used
+#define SSSTEMPORAL_HISTORY_WEIGHT	0.8f
+
+class SSSTemporal
+{
+public:
+	SSSTemporal(float zNear, float zFar);
+
+	// This frame's camera, and the one the history was drawn with
+	void SetCameras(const Matrix4 &proj, const Matrix4 &view, const Matrix4 &previousProj, const Matrix4 &previousView);
+
+	// temporalBlurFrag.glsl's uniforms
+	const Matrix4 &	GetReprojection() const		{ return reprojection; }	// this frame's view space to the last one's
+	const Matrix4 &	GetPreviousProj() const		{ return previousProj; }
+	const Vector2 &	GetUnproject() const		{ return unproject; }		// NDC to a view space ray, 1 deep
+
+	/*
+	 * Where the pixel at uv (0 to 1 across the screen, as the quad's texture
+	 * coordinates) with a linear depth was in the last frame, and the linear
+	 * depth it should have had there. False if it was behind the last camera
+	 * or off its screen.
+	 */
+	bool Reproject(const Vector2 &uv, float depth, Vector2 &previousUV, float &previousDepth) const;
+
+	// Whether the history's filtered depth at a pixel's last place is the depth it should have had
+	static bool AcceptHistory(float previousDepth, float historyDepth);
+
+	/*
+	 * The offsets, in blurFrag.glsl's steps, of the pair of taps the
+	 * horizontal and the vertical passes take in a frame. They're picked
+	 * independently, so both passes come out averaged over all nine pairings.
+	 */
+	static void GetTapOffsets(unsigned int frame, float &horizontal, float &vertical);
+
+	// The inverse of a matrix of only rotations and translations, which a view matrix is
+	static Matrix4 RigidInverse(const Matrix4 &m);
+
+	/*
+	 * Ray traces the linear depth of a made up scene from a camera turning
+	 * around it, a frame apart, with one thing in front moving out of the way
+	 * and another without SSS, quantised as the GPU's target would, and
+	 * reprojects every pixel of the second frame into the first. Checks that
+	 * the pixels land within a pixel of where they were, that nearly all the
+	 * ones that were in view keep their history, and that none that were
+	 * hidden, off the screen or not on a mesh with SSS do. Then checks the
+	 * tap offsets come out in proportion to the weights.
+	 */
+	static bool Check(unsigned int width = 320, unsigned int height = 180);
+
+protected:
+	float	zNear;
+	float	zFar;
+
+	Matrix4	reprojection;
+	Matrix4	previousProj;
+	Vector2	unproject;
+};
@@ -0,0 +1,290 @@
+#include "SSSTiles.h"
+
+#include <cmath>
+#include <iostream>
+
+#include "../Framework/Common.h"
+
+SSSTiles::SSSTiles(unsigned int samples) : samples(samples)
+{
+	tilesAcross = tilesDown = 0;
+	lastTiles = 0;
+
+	ResetCounters();
+}
+
+void SSSTiles::BuildTileList(const unsigned char *mask, unsigned int width, unsigned int height, unsigned int margin,
+							 std::vector<unsigned int> &tiles)
+{
+	tiles.clear();
+
+	int across = (int)GetTilesAcross(width);
+	int down = (int)GetTilesAcross(height);
+
+	// Each tile on its own, as the GPU runs one vertex per tile, stopping at the first SSS pixel
+	for (int tile = 0; tile < across * down; ++tile)
+	{
+		int tileX = tile % across;
+		int tileY = tile / across;
+
+		int firstX = max(tileX * SSS_TILE_SIZE - (int)margin, 0);
+		int firstY = max(tileY * SSS_TILE_SIZE - (int)margin, 0);
+		int lastX = min((tileX + 1) * SSS_TILE_SIZE + (int)margin, (int)width);
+		int lastY = min((tileY + 1) * SSS_TILE_SIZE + (int)margin, (int)height);
+
+		bool found = false;
+
+		for (int y = firstY; y < lastY && !found; ++y)
+		{
+			for (int x = firstX; x < lastX && !found; ++x)
+			{
+				found = mask[y * width + x] != 0;
+			}
+		}
+
+		if (found)
+		{
+			tiles.push_back((unsigned int)tile);
+		}
+	}
+}
+
+void SSSTiles::GetTileCorners(unsigned int tile, unsigned int width, unsigned int height,
+							  Vector2 &firstTexCoord, Vector2 &lastTexCoord, Vector2 &firstPosition, Vector2 &lastPosition)
+{
+	unsigned int across = GetTilesAcross(width);
+	unsigned int tileX = tile % across;
+	unsigned int tileY = tile / across;
+
+	firstTexCoord = Vector2((float)(tileX * SSS_TILE_SIZE) / width, (float)(tileY * SSS_TILE_SIZE) / height);
+	lastTexCoord = Vector2((float)min((tileX + 1) * SSS_TILE_SIZE, width) / width,
+						   (float)min((tileY + 1) * SSS_TILE_SIZE, height) / height);
+
+	firstPosition = Vector2(firstTexCoord.x * 2.0f - 1.0f, 1.0f - firstTexCoord.y * 2.0f);
+	lastPosition = Vector2(lastTexCoord.x * 2.0f - 1.0f, 1.0f - lastTexCoord.y * 2.0f);
+}
+
+void SSSTiles::SetScreen(unsigned int width, unsigned int height)
+{
+	unsigned int across = GetTilesAcross(width);
+	unsigned int down = GetTilesAcross(height);
+
+	if (across != tilesAcross || down != tilesDown)
+	{
+		tilesAcross = across;
+		tilesDown = down;
+		ResetCounters();
+	}
+}
+
+void SSSTiles::Record(unsigned int tiles)
+{
+	lastTiles = tiles;
+
+	++frames;
+	totalTiles += tiles;
+	fewestTiles = min(fewestTiles, tiles);
+	mostTiles = max(mostTiles, tiles);
+
+	if (frames == samples && GetNumTiles() > 0)
+	{
+		float all = (float)GetNumTiles();
+
+		std::cout << "SSS tiles: " << 100.0f * totalTiles / frames / all << "% of the screen's " << GetNumTiles()
+				  << " drawn a frame on average, " << 100.0f * fewestTiles / all << "% to " << 100.0f * mostTiles / all
+				  << "%, over " << frames << " frames" << std::endl;
+
+		ResetCounters();
+	}
+}
+
+void SSSTiles::ResetCounters()
+{
+	frames = 0;
+	totalTiles = 0;
+	fewestTiles = ~0u;
+	mostTiles = 0;
+}
+
+void SSSTiles::PrintStats(const std::string &name) const
+{
+	std::cout << name << " SSS tiles: " << lastTiles << " of " << GetNumTiles() << " drawn last frame";
+
+	if (GetNumTiles() > 0)
+	{
+		std::cout << " (" << 100.0f * lastTiles / GetNumTiles() << "% of the screen)";
+	}
+	std::cout << std::endl;
+}
+
+bool SSSTiles::Check(unsigned int width, unsigned int height)
+{
+	bool passed = true;
+
+	unsigned int across = GetTilesAcross(width);
+	unsigned int down = GetTilesAcross(height);
+	unsigned int numTiles = across * down;
+
+	// The pixels each tile's triangles cover, from where the projection puts their corners:
+	// a pixel's drawn if its centre's inside. Every pixel has to be in exactly one tile
+	std::vector<int> owner(width * height, -1);
+
+	for (unsigned int tile = 0; tile < numTiles; ++tile)
+	{
+		Vector2 firstTexCoord, lastTexCoord, firstPosition, lastPosition;
+		GetTileCorners(tile, width, height, firstTexCoord, lastTexCoord, firstPosition, lastPosition);
+
+		// Orthographic(-1, 1, 1, -1, -1, 1) keeps x and turns y over; the texture coordinates have to agree
+		Vector2 first((firstPosition.x + 1.0f) * 0.5f * width, (1.0f - firstPosition.y) * 0.5f * height);
+		Vector2 last((lastPosition.x + 1.0f) * 0.5f * width, (1.0f - lastPosition.y) * 0.5f * height);
+
+		if (fabs(first.x - firstTexCoord.x * width) > 0.001f || fabs(first.y - firstTexCoord.y * height) > 0.001f ||
+			fabs(last.x - lastTexCoord.x * width) > 0.001f || fabs(last.y - lastTexCoord.y * height) > 0.001f)
+		{
+			std::cout << "SSSTiles::Check: Tile " << tile << "'s texture coordinates aren't where it's drawn" << std::endl;
+			passed = false;
+		}
+
+		unsigned int tileX = tile % across;
+		unsigned int tileY = tile / across;
+
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				bool covered = x + 0.5f > first.x && x + 0.5f < last.x && y + 0.5f > first.y && y + 0.5f < last.y;
+				bool inTile = x / SSS_TILE_SIZE == tileX && y / SSS_TILE_SIZE == tileY;
+
+				if (covered != inTile || (covered && owner[y * width + x] >= 0))
+				{
+					std::cout << "SSSTiles::Check: Tile " << tile << " covers pixel " << x << ", " << y << " wrongly" << std::endl;
+					passed = false;
+				}
+
+				if (covered)
+				{
+					owner[y * width + x] = (int)tile;
+				}
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < width * height; ++i)
+	{
+		if (owner[i] < 0)
+		{
+			std::cout << "SSSTiles::Check: Pixel " << i % width << ", " << i / width << " isn't in any tile" << std::endl;
+			passed = false;
+			break;
+		}
+	}
+
+	// The masks, as the stencil would leave them
+	const char *names[6] = { "empty", "full", "corners", "close up", "far away", "both" };
+	std::vector<unsigned char> mask(width * height);
+
+	for (int m = 0; m < 6; ++m)
+	{
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				float dx = x + 0.5f - width * 0.5f;
+				float dy = y + 0.5f - height * 0.5f;
+				float farX = x + 0.5f - width * 0.88f;
+				float farY = y + 0.5f - height * 0.15f;
+
+				bool closeUp = dx * dx + dy * dy < (height * 0.45f) * (height * 0.45f);
+				bool farAway = farX * farX + farY * farY < (height * 0.06f) * (height * 0.06f);
+				bool corner = (x == 0 || x == width - 1) && (y == 0 || y == height - 1);
+
+				bool sss = m == 1 || (m == 2 && corner) || (m == 3 && closeUp) || (m == 4 && farAway) || (m == 5 && (closeUp || farAway));
+				mask[y * width + x] = sss ? 1 : 0;
+			}
+		}
+
+		for (unsigned int margin = 0; margin <= 20; margin += 20)
+		{
+			std::vector<unsigned int> tiles;
+			BuildTileList(&mask[0], width, height, margin, tiles);
+
+			// The other way round: out from every SSS pixel to the tiles it's within margin of
+			std::vector<bool> expected(numTiles, false);
+
+			for (unsigned int y = 0; y < height; ++y)
+			{
+				for (unsigned int x = 0; x < width; ++x)
+				{
+					if (!mask[y * width + x])
+					{
+						continue;
+					}
+
+					int firstX = max((int)x - (int)margin, 0) / SSS_TILE_SIZE;
+					int lastX = min(x + margin, width - 1) / SSS_TILE_SIZE;
+					int firstY = max((int)y - (int)margin, 0) / SSS_TILE_SIZE;
+					int lastY = min(y + margin, height - 1) / SSS_TILE_SIZE;
+
+					for (int tileY = firstY; tileY <= lastY; ++tileY)
+					{
+						for (int tileX = firstX; tileX <= lastX; ++tileX)
+						{
+							expected[tileY * across + tileX] = true;
+						}
+					}
+				}
+			}
+
+			std::vector<bool> listed(numTiles, false);
+			bool ordered = true;
+
+			for (unsigned int i = 0; i < tiles.size(); ++i)
+			{
+				ordered = ordered && tiles[i] < numTiles && (i == 0 || tiles[i] > tiles[i - 1]);
+
+				if (tiles[i] < numTiles)
+				{
+					listed[tiles[i]] = true;
+				}
+			}
+
+			// and every SSS pixel drawn, by the tile whose triangles cover it
+			unsigned int missed = 0;
+
+			for (unsigned int i = 0; i < width * height; ++i)
+			{
+				missed += mask[i] && !listed[owner[i]] ? 1 : 0;
+			}
+
+			if (!ordered || listed != expected || missed > 0)
+			{
+				std::cout << "SSSTiles::Check: The " << names[m] << " mask with a margin of " << margin << " listed the wrong tiles ("
+						  << missed << " SSS pixels left out)" << std::endl;
+				passed = false;
+			}
+
+			if (margin == SSS_TILE_MARGIN)
+			{
+				std::cout << "SSSTiles::Check " << width << "x" << height << ", " << names[m] << ": " << tiles.size() << " of "
+						  << numTiles << " tiles (" << 100.0f * tiles.size() / numTiles << "% of the screen)" << std::endl;
+			}
+		}
+	}
+
+	// The record of them
+	SSSTiles record(4);
+	record.SetScreen(width, height);
+	record.Record(0);
+	record.Record(numTiles / 2);
+
+	if (record.frames != 2 || record.totalTiles != numTiles / 2 || record.fewestTiles != 0 || record.mostTiles != numTiles / 2)
+	{
+		std::cout << "SSSTiles::Check: The frames weren't recorded" << std::endl;
+		passed = false;
+	}
+
+	record.PrintStats("SSSTiles::Check");
+	std::cout << "SSSTiles::Check: " << (passed ? "passed" : "FAILED") << std::endl;
+
+	return passed;
+}
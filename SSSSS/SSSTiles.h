@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+ * The list of screen tiles sssPass draws its blurs over, worked out the same
+ * way tileClassifyVert.glsl and tileClassifyGeom.glsl work it out, so it can
+ * be checked without a GL context, and the record of how much of the screen
+ * they cover from frame to frame.
+ *
+ * The screen is cut into SSS_TILE_SIZE square tiles, from the bottom left as
+ * GL counts its pixels, the last row and column cut short by the screen's
+ * edges. A tile is listed if any pixel of the mask (the stencil's SSS pixels)
+ * is within the margin of it, and the list comes out in tile order: along
+ * the rows, bottom row first, as transform feedback keeps the order the
+ * tiles went in. Each is drawn as two triangles in the quad's space, so every
+ * blur shader draws the list as it draws the quad.
+ */
+#include <string>
+#include <vector>
+
+#include "../Framework/Vector2.h"
+
+// Pixels across a tile
+#define SSS_TILE_SIZE	16
+
+/*
+ * Pixels around a tile in which an SSS pixel still has it listed. Every pass
+ * drawn over the tiles only writes under the stencil, and a pass's taps read
+ * the textures the one before left, not what this one draws, so a tile with
+ * no SSS pixel of its own has nothing to draw however close the blur brings
+ * one, and the blurs' widest reach needs no margin. The levels at a reduced
+ * resolution are the exception, and still draw every texel
+ */
+#define SSS_TILE_MARGIN	0
+
+// Triangles, and vertices, each tile is drawn with
+#define SSS_TILE_TRIANGLES	2
+#define SSS_TILE_VERTICES	6
+
+class SSSTiles
+{
+public:
+	SSSTiles(unsigned int samples);
+
+	// Tiles across a size of the screen
+	static unsigned int GetTilesAcross(unsigned int size)	{ return (size + SSS_TILE_SIZE - 1) / SSS_TILE_SIZE; }
+
+	/*
+	 * Lists the tiles of a width by height mask (non zero where there's SSS,
+	 * bottom row first) with an SSS pixel within margin of them
+	 */
+	static void BuildTileList(const unsigned char *mask, unsigned int width, unsigned int height, unsigned int margin,
+							  std::vector<unsigned int> &tiles);
+
+	/*
+	 * The corners of a tile in the quad's texture coordinates (0 to 1 across
+	 * the screen, 0 at the bottom), and in its space, which sssPass's
+	 * orthographic projection turns upside down
+	 */
+	static void GetTileCorners(unsigned int tile, unsigned int width, unsigned int height,
+							   Vector2 &firstTexCoord, Vector2 &lastTexCoord, Vector2 &firstPosition, Vector2 &lastPosition);
+
+	// The screen the next frames' tiles are from, which throws away the frames recorded at another size
+	void SetScreen(unsigned int width, unsigned int height);
+	unsigned int GetNumTiles() const		{ return tilesAcross * tilesDown; }
+
+	// A frame's listed tiles; every samples frames, the coverage averaged over them is printed
+	void Record(unsigned int tiles);
+	void ResetCounters();
+
+	// The last frame's coverage
+	void PrintStats(const std::string &name) const;
+
+	/*
+	 * Lists the tiles of made up masks, an empty and a full screen, single
+	 * pixels in the corners of a screen the tiles don't fit, and a head sized
+	 * disc close up and far away, with and without a margin, and checks each
+	 * list against every pixel of its mask: that the pixels the listed tiles'
+	 * triangles cover are every pixel of the tiles, that those cover every
+	 * SSS pixel, and that no tile is listed without one within the margin.
+	 */
+	static bool Check(unsigned int width = 333, unsigned int height = 187);
+
+protected:
+	unsigned int	samples;
+	unsigned int	tilesAcross;
+	unsigned int	tilesDown;
+
+	unsigned int	lastTiles;
+	unsigned int	frames;
+	unsigned int	totalTiles;
+	unsigned int	fewestTiles;
+	unsigned int	mostTiles;
+};
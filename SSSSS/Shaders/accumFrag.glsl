@@ -0,0 +1,60 @@
+#version 150 core
+
+// Adds the unblurred colour and the frame's blur levels up with the weights of the pixel's material's profile, which
+// are 0 for the levels past its own, so a frame with any number of materials makes the same fetches
+uniform sampler2D diffuseTex;
+uniform sampler2D depthTex;		// the material in green
+
+uniform sampler2D blurredTex1;
+uniform sampler2D blurredTex2;
+uniform sampler2D blurredTex3;
+uniform sampler2D blurredTex4;
+uniform sampler2D blurredTex5;
+
+uniform bool useSSS;
+uniform int numLevels;			// the most any material drawn has
+
+// The DiffusionLibrary's profiles, laid out as DiffusionLibrary.h describes
+#define MAX_MATERIALS 16
+
+struct DiffusionProfile {
+	vec4 gaussians[6];
+	ivec4 count;
+};
+
+layout(std140) uniform DiffusionProfiles {
+	DiffusionProfile profiles[MAX_MATERIALS + 1];
+};
+
+in Vertex {
+	vec2 texCoord;
+} IN;
+
+out vec4 fragColor;
+
+void main(void) {
+	if (!useSSS) {
+		vec4 diffuse = texture(diffuseTex, IN.texCoord);
+		fragColor = diffuse;
+	}
+	else {
+		// Total diffuse; the weights are normalised to white
+		int material = int(texture(depthTex, IN.texCoord).g * 255.0 + 0.5);
+		vec3 diffuseLight = profiles[material].gaussians[0].rgb * texture(blurredTex1, IN.texCoord).rgb;
+
+		if (numLevels > 0) {
+			diffuseLight += profiles[material].gaussians[1].rgb * texture(blurredTex2, IN.texCoord).rgb;
+		}
+		if (numLevels > 1) {
+			diffuseLight += profiles[material].gaussians[2].rgb * texture(blurredTex3, IN.texCoord).rgb;
+		}
+		if (numLevels > 2) {
+			diffuseLight += profiles[material].gaussians[3].rgb * texture(blurredTex4, IN.texCoord).rgb;
+		}
+		if (numLevels > 3) {
+			diffuseLight += profiles[material].gaussians[4].rgb * texture(blurredTex5, IN.texCoord).rgb;
+		}
+
+		fragColor = vec4(diffuseLight, 1.0);
+	}
+}
\ No newline at end of file
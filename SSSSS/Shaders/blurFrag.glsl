@@ -5,9 +5,22 @@ uniform sampler2D depthTex;
 
 uniform vec2 pixelSize;
 uniform vec2 dir;
-uniform float gaussianWidth;
+uniform int level;			// blurred from the level before, by the difference of their variances
+uniform float widthScale;	// what a reduced resolution shrinks the widths by
 uniform float correction;
 
+// The DiffusionLibrary's profiles, laid out as DiffusionLibrary.h describes
+#define MAX_MATERIALS 16
+
+struct DiffusionProfile {
+	vec4 gaussians[6];
+	ivec4 count;
+};
+
+layout(std140) uniform DiffusionProfiles {
+	DiffusionProfile profiles[MAX_MATERIALS + 1];
+};
+
 in Vertex {
 	vec2 texCoord;
 } IN;
@@ -21,14 +34,25 @@ void main(void) {
 	float w[6] = float[](  0.006,  0.0610,  0.2420, 0.2420, 0.0610, 0.006 );
 	float o[6] = float[]( -1.000, -0.6667, -0.3333, 0.3333, 0.6667, 1.000 );
 
-	// Fetch color and linear depth for current pixel:
+	// Fetch color, and linear depth and material for current pixel:
 	vec4 colourM = texture(diffuseTex, IN.texCoord);
-	float depthM = texture(depthTex, IN.texCoord).r;
+	vec2 depthMaterial = texture(depthTex, IN.texCoord).rg;
+	float depthM = depthMaterial.r;
+	int material = int(depthMaterial.g * 255.0 + 0.5);
+
+	// Nothing was drawn here; only reached at a reduced resolution, where there's no stencil to keep it out
+	if (depthM <= 0.0) {
+		fragColor = colourM;
+		return;
+	}
 
 	// Accumulate center sample, multiplying it with its gaussian weight:
 	vec4 colourBlurred = colourM;
 	colourBlurred.rgb *= 0.382;
 
+	// This level's width, from the pixel's material's profile
+	float gaussianWidth = sqrt(profiles[material].gaussians[level + 1].a - profiles[material].gaussians[level].a) * widthScale;
+
 	// Calculate: step = sssStrength * gaussianWidth * pixelSize * dir
 	vec2 step = gaussianWidth * pixelSize * dir;
 	vec2 finalStep = colourM.a * step / depthM;
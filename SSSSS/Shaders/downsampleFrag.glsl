@@ -0,0 +1,52 @@
+#version 150 core
+
+// Averages each factor by factor block of the colour and linear depth buffers into one texel, over
+// the pixels in it that have a depth, with the first of their materials; a block with none is left
+// black at no depth (SSSReference::Downsample)
+uniform sampler2D diffuseTex;
+uniform sampler2D depthTex;
+
+uniform int factor;
+
+out vec4 fragColor[2];
+
+void main(void) {
+	ivec2 size = textureSize(depthTex, 0);
+	ivec2 corner = ivec2(gl_FragCoord.xy) * factor;
+
+	vec4 colourSum = vec4(0.0);
+	float depthSum = 0.0;
+	float material = 0.0;
+	float count = 0.0;
+
+	for (int j = 0; j < factor; ++j) {
+		for (int i = 0; i < factor; ++i) {
+			ivec2 p = corner + ivec2(i, j);
+
+			if (p.x >= size.x || p.y >= size.y) {
+				continue;
+			}
+
+			vec2 depthMaterial = texelFetch(depthTex, p, 0).rg;
+
+			if (depthMaterial.r > 0.0) {
+				if (count == 0.0) {
+					material = depthMaterial.g;
+				}
+
+				colourSum += texelFetch(diffuseTex, p, 0);
+				depthSum += depthMaterial.r;
+				count += 1.0;
+			}
+		}
+	}
+
+	if (count > 0.0) {
+		fragColor[0] = colourSum / count;
+		fragColor[1] = vec4(depthSum / count, material, 0.0, 0.0);
+	}
+	else {
+		fragColor[0] = vec4(0.0, 0.0, 0.0, 1.0);
+		fragColor[1] = vec4(0.0);
+	}
+}
\ No newline at end of file
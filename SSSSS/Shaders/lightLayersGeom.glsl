@@ -0,0 +1,38 @@
+#version 150 core
+
+// Every triangle goes into the shadow map layer, and then into the front or
+// the back depth map layer depending on which way it faces, just as the
+// separate passes' face culling would have sorted it
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 6) out;
+
+// 1 for only the shadow map, 3 for the depth maps as well
+uniform int numLayers;
+
+in float vertexDepth[];
+out float depth;
+
+void emitTriangle(int layer) {
+	for (int i = 0; i < 3; ++i) {
+		gl_Layer = layer;
+		gl_Position = gl_in[i].gl_Position;
+		depth = vertexDepth[i];
+		EmitVertex();
+	}
+	EndPrimitive();
+}
+
+void main(void) {
+	emitTriangle(0);
+
+	if (numLayers > 1) {
+		// counter clockwise on screen is front facing, as glFrontFace's default
+		vec2 a = gl_in[0].gl_Position.xy / gl_in[0].gl_Position.w;
+		vec2 b = gl_in[1].gl_Position.xy / gl_in[1].gl_Position.w;
+		vec2 c = gl_in[2].gl_Position.xy / gl_in[2].gl_Position.w;
+
+		float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+
+		emitTriangle(area > 0.0 ? 1 : 2);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 150 core
+
+uniform mat4 modelMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 projMatrix;
+
+uniform float zNear;
+uniform float zFar;
+
+uniform bool useInstancing;		// instanceMatrix in place of modelMatrix, see InstanceBuffer.h
+
+in vec3 position;
+in mat4 instanceMatrix;
+out float vertexDepth;
+
+void main(void) {
+	mat4 model = useInstancing ? instanceMatrix : modelMatrix;
+	mat4 mvp = projMatrix * viewMatrix * model;
+
+	// linear depth
+	vec4 viewPos = (viewMatrix * model) * vec4(position, 1.0);
+	vertexDepth = (-viewPos.z - zNear) / (zFar - zNear);
+
+	gl_Position = mvp * vec4(position, 1.0);
+}
\ No newline at end of file
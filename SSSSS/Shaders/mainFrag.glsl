@@ -2,12 +2,14 @@
 
 uniform sampler2D diffuseTex;
 uniform sampler2D bumpTex;
-uniform sampler2DShadow shadowMapTex;
-uniform sampler2D linearShadowMapTex;
 uniform sampler2D beckmannTex;
 
-uniform sampler2D frontDepthTex;
-uniform sampler2D backDepthTex;
+// The light's depth targets, with the shadow map in layer 0, and the depth of
+// the front and back faces in layers 1 and 2. lightDepthTex is the same depth
+// as shadowMapTex, read without the comparison
+uniform sampler2DArrayShadow shadowMapTex;
+uniform sampler2DArray linearShadowMapTex;
+uniform sampler2DArray lightDepthTex;
 
 uniform vec3 cameraPos;
 uniform vec3 lightPos;
@@ -16,6 +18,18 @@ uniform float lightRadius;
 
 uniform bool useTransmittance;
 
+// The DiffusionLibrary's profiles, laid out as DiffusionLibrary.h describes
+#define MAX_MATERIALS 16
+
+struct DiffusionProfile {
+	vec4 gaussians[6];
+	ivec4 count;
+};
+
+layout(std140) uniform DiffusionProfiles {
+	DiffusionProfile profiles[MAX_MATERIALS + 1];
+};
+
 // Average recommended value for specular term on skin
 const float m = 0.3;
 
@@ -28,6 +42,7 @@ in Vertex {
 	vec4 shadowProj;
 	float depth;
 	mat4 lightViewProj;
+	flat int material;
 } IN;
 
 out vec4 fragColor[2];
@@ -60,7 +75,7 @@ vec3 transmittance(	float translucency,			// control the transmittance effect. R
 					vec3 worldPosition,			// Position in world space
 					vec3 worldNormal,			// Normal in world space
 					vec3 light,					// Light vector: lightWorldPosition - worldPosition
-					sampler2D shadowMapTex,		// Linear 0..1 shadow map
+					sampler2DArray shadowMapTex,	// Linear 0..1 shadow map, in layer 0
 					mat4 lightViewProjection,	// Regular world to light space matrix
 					float lightFarPlane			// Far plane distance used in the light projection matrix
 					) {
@@ -72,7 +87,7 @@ vec3 transmittance(	float translucency,			// control the transmittance effect. R
 
 	// Calculate the thickness from the light point of view:
 	vec4 shadowPosition = lightViewProjection * shrinkedPos;
-	float d1 = texture(shadowMapTex, shadowPosition.xy / shadowPosition.w).r;	// 'd1' has a range of 0..1
+	float d1 = texture(shadowMapTex, vec3(shadowPosition.xy / shadowPosition.w, 0.0)).r;	// 'd1' has a range of 0..1
 	float d2 = shadowPosition.z;												// 'd2' has a range of 0..'lightFarPlane'
 	d1 *= lightFarPlane;														// So we scale 'd1' accordingly:
 	float d = scale * abs(d1 - d2);
@@ -87,8 +102,8 @@ vec3 transmittance(	float translucency,			// control the transmittance effect. R
 	//depthMapCoords   = depthMapCoords / 2.0 + 0.5;
 	//depthMapCoords.y = 1.0 - depthMapCoords.y;
 
-	float dist1 = texture(backDepthTex, depthMapCoords).r;
-	float dist2 = texture(frontDepthTex, depthMapCoords).r;
+	float dist1 = texture(lightDepthTex, vec3(depthMapCoords, 2.0)).r;
+	float dist2 = texture(lightDepthTex, vec3(depthMapCoords, 1.0)).r;
 
 	float diff = scale * abs(dist1 - dist2);
 
@@ -99,12 +114,11 @@ vec3 transmittance(	float translucency,			// control the transmittance effect. R
 	// With the thickness, calculate the color using the precalculated transmittance profile:
 	float dd = -d * d;
 
-	vec3 profile =  vec3(0.233, 0.455, 0.649) * exp(dd / 0.0064) +
-					vec3(0.1,   0.336, 0.344) * exp(dd / 0.0484) +
-					vec3(0.118, 0.198, 0.0)   * exp(dd / 0.187) +
-					vec3(0.113, 0.007, 0.007) * exp(dd / 0.567) +
-					vec3(0.358, 0.004, 0.0)   * exp(dd / 1.99) +
-					vec3(0.078, 0.0,   0.0)   * exp(dd / 7.41);
+	vec3 profile = vec3(0.0);
+
+	for (int i = 0; i < profiles[MAX_MATERIALS].count.x; ++i) {
+		profile += profiles[MAX_MATERIALS].gaussians[i].rgb * exp(dd / profiles[MAX_MATERIALS].gaussians[i].a);
+	}
 
     // Using the profile, approximate the transmitted lighting from the back of the object:
     return profile * clamp(0.0 + dot(light, -worldNormal), 0.0, 1.0);
@@ -144,7 +158,8 @@ void main(void) {
 	// Calculate shadows:
 	float shadow = 1.0;
 	if (IN.shadowProj.w > 0.0) {
-		shadow = textureProj(shadowMapTex, IN.shadowProj);
+		vec3 shadowCoords = IN.shadowProj.xyz / IN.shadowProj.w;
+		shadow = texture(shadowMapTex, vec4(shadowCoords.xy, 0.0, shadowCoords.z));
 	}
 
 	// Add the diffuse and specular components:
@@ -164,6 +179,6 @@ void main(void) {
 	//fragColor[0] = vec4(pow(colour.rgb, vec3(1.0 / 2.2)), 1.0);
 */
 
-	// Store the depth value:
-	fragColor[1] = vec4(vec3(IN.depth), 1.0);
+	// Store the depth value, the SSS material, and the strength for the packed blur, whose levels' alphas hold the depth:
+	fragColor[1] = vec4(IN.depth, float(IN.material) / 255.0, colour.a, 1.0);
 }
\ No newline at end of file
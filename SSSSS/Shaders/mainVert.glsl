@@ -3,7 +3,7 @@
 uniform mat4 modelMatrix;
 uniform mat4 viewMatrix;
 uniform mat4 projMatrix;
-uniform mat4 shadowMatrix;
+uniform mat4 shadowMatrix;		// The light's, without the model matrix
 uniform mat4 shadowMatrix2;
 uniform mat4 lightView;
 uniform mat4 lightView2;
@@ -11,11 +11,22 @@ uniform mat4 lightView2;
 uniform float zNear;
 uniform float zFar;
 
+// The quantised positions' scale (Mesh::GetDequantScale), which the model matrix already has
+uniform float dequantScale;
+
+uniform bool useInstancing;		// instanceMatrix in place of modelMatrix, see InstanceBuffer.h
+
+// The copy's SSS material, or for instanced draws the first's; mixed, copy i's is i on from it, round numMaterials
+uniform int material;
+uniform bool mixMaterials;
+uniform int numMaterials;
+
 in vec3 position;
 in vec4 colour;
 in vec2 texCoord;
 in vec3 normal;
 in vec3 tangent;
+in mat4 instanceMatrix;
 
 out Vertex {
 	vec2 texCoord;
@@ -26,25 +37,29 @@ out Vertex {
 	vec4 shadowProj;
 	float depth;
 	mat4 lightViewProj;
+	flat int material;
 } OUT;
 
 void main(void) {
-	mat3 normalMatrix = transpose(inverse(mat3(modelMatrix)));
-	mat4 mvp = projMatrix * viewMatrix * modelMatrix;
+	mat4 model = useInstancing ? instanceMatrix : modelMatrix;
+	mat3 normalMatrix = transpose(inverse(mat3(model)));
+	mat4 mvp = projMatrix * viewMatrix * model;
 
 	OUT.texCoord = texCoord;
 	OUT.normal = normalize(normalMatrix * normalize(normal));
 	OUT.tangent = normalize(normalMatrix * normalize(tangent));
 	OUT.binormal = normalize(normalMatrix * normalize(cross(normal, tangent)));
-	OUT.worldPos = (modelMatrix * vec4(position, 1.0)).xyz;
-	OUT.shadowProj = shadowMatrix * vec4(position + (normal * 1.5), 1.0);
+	OUT.worldPos = (model * vec4(position, 1.0)).xyz;
+	OUT.shadowProj = shadowMatrix * model * vec4(position + (normal * (1.5 / dequantScale)), 1.0);
 
 	// linear depth:
-	vec4 viewPos = (viewMatrix * modelMatrix) * vec4(position, 1.0);
+	vec4 viewPos = (viewMatrix * model) * vec4(position, 1.0);
 	OUT.depth = (-viewPos.z - zNear) / (zFar - zNear);
 
 	// light view projection matrix:
 	OUT.lightViewProj = lightView;
 
+	OUT.material = useInstancing && mixMaterials ? (material + gl_InstanceID) % numMaterials : material;
+
 	gl_Position = mvp * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#version 150 core
+
+// blurFrag.glsl with the depth packed into the alpha of what it writes, so the next pass takes a tap's colour and
+// depth in one fetch. The centre's depth, material and SSS strength all come from the linear depth target, which
+// mainPass writes the strength into as well as the colour's alpha, so where the source is packed the strength the
+// alpha held is still one fetch away; every level's is the colour buffer's, as each blur keeps its centre's. What's
+// outside the stencil is cleared to an alpha of 0, the background's depth, so the taps there read what depthTex would
+uniform sampler2D diffuseTex;
+uniform sampler2D depthTex;
+
+uniform vec2 pixelSize;
+uniform vec2 dir;
+uniform int level;			// blurred from the level before, by the difference of their variances
+uniform float correction;
+
+uniform bool packedSource;		// diffuseTex's alpha is the depth, not the strength
+uniform bool packOutput;		// false for the level the reduced levels are shrunk from, which needs the strength
+
+// The DiffusionLibrary's profiles, laid out as DiffusionLibrary.h describes
+#define MAX_MATERIALS 16
+
+struct DiffusionProfile {
+	vec4 gaussians[6];
+	ivec4 count;
+};
+
+layout(std140) uniform DiffusionProfiles {
+	DiffusionProfile profiles[MAX_MATERIALS + 1];
+};
+
+in Vertex {
+	vec2 texCoord;
+} IN;
+
+out vec4 fragColor;
+
+void main(void) {
+	// -3 -2 -1 +1 +2 +3
+	float w[6] = float[](  0.006,  0.0610,  0.2420, 0.2420, 0.0610, 0.006 );
+	float o[6] = float[]( -1.000, -0.6667, -0.3333, 0.3333, 0.6667, 1.000 );
+
+	// Colour, linear depth, material and strength for the current pixel, in two fetches either way
+	vec4 colourM = texture(diffuseTex, IN.texCoord);
+	vec3 centre = texture(depthTex, IN.texCoord).rgb;
+	float depthM = centre.r;
+	int material = int(centre.g * 255.0 + 0.5);
+
+	if (packedSource) {
+		colourM.a = centre.b;
+	}
+
+	vec3 colourBlurred = colourM.rgb * 0.382;
+
+	// This level's width, from the pixel's material's profile
+	float gaussianWidth = sqrt(profiles[material].gaussians[level + 1].a - profiles[material].gaussians[level].a);
+
+	// Calculate: step = sssStrength * gaussianWidth * pixelSize * dir
+	vec2 step = gaussianWidth * pixelSize * dir;
+	vec2 finalStep = colourM.a * step / depthM;
+
+	for (int i = 0; i < 6; ++i) {
+		// One fetch for both from a packed source, two from the colour buffer
+		vec2 offset = IN.texCoord + o[i] * finalStep;
+		vec4 tap = texture(diffuseTex, offset);
+		float depth = packedSource ? tap.a : texture(depthTex, offset).r;
+
+		// If the difference in depth is huge, lerp color back to "colorM":
+		float s = min(0.0125 * correction * abs(depthM - depth), 1.0);
+		vec3 colour = mix(tap.rgb, colourM.rgb, s);
+
+		colourBlurred += w[i] * colour;
+	}
+
+	fragColor = vec4(colourBlurred, packOutput ? depthM : colourM.a);
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#version 150 core
+
+// Most taps Renderer's kernels can have (SSSREFERENCE_MAX_KERNEL_TAPS), and most materials (DIFFUSIONLIBRARY_MAX_MATERIALS)
+#define MAX_TAPS 33
+#define MAX_MATERIALS 16
+
+uniform sampler2D diffuseTex;
+uniform sampler2D depthTex;
+
+uniform vec2 pixelSize;
+uniform vec2 dir;
+uniform float correction;
+
+// Each material's whole sum of gaussians in one kernel, MAX_TAPS apart: weights per channel in xyz, offsets in w,
+// centre tap first. Every material's has the same number of taps
+uniform int kernelTaps;
+
+layout(std140) uniform SeparableKernels {
+	vec4 kernels[MAX_MATERIALS * MAX_TAPS];
+};
+
+// The vertical pass is the last, and writes an alpha of 1 like the accumulation does
+uniform bool finalPass;
+
+in Vertex {
+	vec2 texCoord;
+} IN;
+
+out vec4 fragColor;
+
+void main(void) {
+	// Fetch color, and linear depth and material for current pixel:
+	vec4 colourM = texture(diffuseTex, IN.texCoord);
+	vec2 depthMaterial = texture(depthTex, IN.texCoord).rg;
+	float depthM = depthMaterial.r;
+	int kernel = int(depthMaterial.g * 255.0 + 0.5) * MAX_TAPS;
+
+	// Accumulate center sample, multiplying it with its weights:
+	vec4 colourBlurred = colourM;
+	colourBlurred.rgb *= kernels[kernel].rgb;
+
+	// Calculate: step = sssStrength * pixelSize * dir
+	vec2 finalStep = colourM.a * pixelSize * dir / depthM;
+
+	// Accumulate the other samples:
+	for (int i = 1; i < kernelTaps; ++i) {
+		// Fetch color and depth for current sample:
+		vec2 offset = IN.texCoord + kernels[kernel + i].a * finalStep;
+		vec3 colour = texture(diffuseTex, offset).rgb;
+		float depth = texture(depthTex, offset).r;
+
+		// If the difference in depth is huge, lerp color back to "colorM":
+		float s = min(0.0125 * correction * abs(depthM - depth), 1.0);
+		colour = mix(colour, colourM.rgb, s);
+
+		// Accumulate:
+		colourBlurred.rgb += kernels[kernel + i].rgb * colour;
+	}
+
+	if (finalPass) {
+		colourBlurred.a = 1.0;
+	}
+
+	fragColor = colourBlurred;
+}
@@ -7,14 +7,18 @@ uniform mat4 projMatrix;
 uniform float zNear;
 uniform float zFar;
 
+uniform bool useInstancing;		// instanceMatrix in place of modelMatrix, see InstanceBuffer.h
+
 in vec3 position;
+in mat4 instanceMatrix;
 out float depth;
 
 void main(void) {
-	mat4 mvp = projMatrix * viewMatrix * modelMatrix;
+	mat4 model = useInstancing ? instanceMatrix : modelMatrix;
+	mat4 mvp = projMatrix * viewMatrix * model;
 
 	// linear depth
-	vec4 viewPos = (viewMatrix * modelMatrix) * vec4(position, 1.0);
+	vec4 viewPos = (viewMatrix * model) * vec4(position, 1.0);
 	depth = (-viewPos.z - zNear) / (zFar - zNear);
 
 	gl_Position = mvp * vec4(position, 1.0);
@@ -0,0 +1,91 @@
+#version 150 core
+
+uniform mat4 modelMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 projMatrix;
+uniform mat4 shadowMatrix;		// The light's, without the model matrix
+uniform mat4 shadowMatrix2;
+uniform mat4 lightView;
+uniform mat4 lightView2;
+
+uniform float zNear;
+uniform float zFar;
+
+uniform bool useInstancing;		// instanceMatrix in place of modelMatrix, see InstanceBuffer.h
+
+// The copy's SSS material, as in mainVert.glsl
+uniform int material;
+uniform bool mixMaterials;
+uniform int numMaterials;
+
+// Three rows of a 3x4 matrix per joint, for up to 256 joints (MD5SKINNING_GPU_JOINTS)
+layout(std140) uniform JointPalette {
+	vec4 jointRows[768];
+};
+
+in vec2 texCoord;
+in vec3 normal;
+in vec3 tangent;
+
+// Bind pose anchors, already multiplied by their weight, with the weight in w
+in uvec4 jointIndices;
+in vec4 jointAnchors[4];
+
+in mat4 instanceMatrix;
+
+out Vertex {
+	vec2 texCoord;
+	vec3 normal;
+	vec3 tangent;
+	vec3 binormal;
+	vec3 worldPos;
+	vec4 shadowProj;
+	float depth;
+	mat4 lightViewProj;
+	flat int material;
+} OUT;
+
+void main(void) {
+	vec3 position = vec3(0.0);
+	vec3 skinnedNormal = vec3(0.0);
+	vec3 skinnedTangent = vec3(0.0);
+
+	// Same sums as MD5Skinning::SkinGPUVertices; unused weights are zero
+	for (int i = 0; i < 4; ++i) {
+		int joint = int(jointIndices[i]) * 3;
+		vec4 anchor = jointAnchors[i];
+
+		vec4 x = jointRows[joint];
+		vec4 y = jointRows[joint + 1];
+		vec4 z = jointRows[joint + 2];
+
+		position += vec3(dot(x, anchor), dot(y, anchor), dot(z, anchor));
+		skinnedNormal += vec3(dot(x.xyz, normal), dot(y.xyz, normal), dot(z.xyz, normal)) * anchor.w;
+		skinnedTangent += vec3(dot(x.xyz, tangent), dot(y.xyz, tangent), dot(z.xyz, tangent)) * anchor.w;
+	}
+
+	skinnedNormal = normalize(skinnedNormal);
+	skinnedTangent = normalize(skinnedTangent);
+
+	mat4 model = useInstancing ? instanceMatrix : modelMatrix;
+	mat3 normalMatrix = transpose(inverse(mat3(model)));
+	mat4 mvp = projMatrix * viewMatrix * model;
+
+	OUT.texCoord = texCoord;
+	OUT.normal = normalize(normalMatrix * skinnedNormal);
+	OUT.tangent = normalize(normalMatrix * skinnedTangent);
+	OUT.binormal = normalize(normalMatrix * normalize(cross(skinnedNormal, skinnedTangent)));
+	OUT.worldPos = (model * vec4(position, 1.0)).xyz;
+	OUT.shadowProj = shadowMatrix * model * vec4(position + (skinnedNormal * 1.5), 1.0);
+
+	// linear depth:
+	vec4 viewPos = (viewMatrix * model) * vec4(position, 1.0);
+	OUT.depth = (-viewPos.z - zNear) / (zFar - zNear);
+
+	// light view projection matrix:
+	OUT.lightViewProj = lightView;
+
+	OUT.material = useInstancing && mixMaterials ? (material + gl_InstanceID) % numMaterials : material;
+
+	gl_Position = mvp * vec4(position, 1.0);
+}
\ No newline at end of file
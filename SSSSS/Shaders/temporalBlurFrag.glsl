@@ -0,0 +1,129 @@
+#version 150 core
+
+// blurFrag.glsl for sssPass's temporal mode. Where the level kept from the last frame is this pixel's
+// (SSSTemporal::Reproject and AcceptHistory), it takes the centre and one pair of taps, and the vertical
+// pass blends that into the history; everywhere else it's blurFrag.glsl's full blur
+uniform sampler2D diffuseTex;
+uniform sampler2D depthTex;
+uniform sampler2D historyTex;
+uniform sampler2D historyDepthTex;
+
+uniform vec2 pixelSize;
+uniform vec2 dir;
+uniform int level;			// blurred from the level before, by the difference of their variances
+uniform float correction;
+
+uniform bool useHistory;			// false until a level's been kept
+uniform mat4 reprojectMatrix;		// this frame's view space to the last one's
+uniform mat4 previousProjMatrix;
+uniform vec2 unproject;
+uniform float zNear;
+uniform float zFar;
+uniform float depthTolerance;
+uniform float historyWeight;
+uniform vec2 tapOffsets;			// the pair's offset in steps, for the horizontal pass then the vertical
+
+// The DiffusionLibrary's profiles, laid out as DiffusionLibrary.h describes
+#define MAX_MATERIALS 16
+
+struct DiffusionProfile {
+	vec4 gaussians[6];
+	ivec4 count;
+};
+
+layout(std140) uniform DiffusionProfiles {
+	DiffusionProfile profiles[MAX_MATERIALS + 1];
+};
+
+in Vertex {
+	vec2 texCoord;
+} IN;
+
+out vec4 fragColor;
+
+// Where this pixel was in the last frame, if what was kept there is its own
+bool reproject(float depthM, out vec2 previousUV) {
+	float z = depthM * (zFar - zNear) + zNear;
+	vec4 viewPos = vec4((IN.texCoord * 2.0 - 1.0) * unproject * z, -z, 1.0);
+
+	vec4 previousPos = reprojectMatrix * viewPos;
+	vec4 previousClip = previousProjMatrix * previousPos;
+
+	previousUV = previousClip.xy / previousClip.w * 0.5 + 0.5;
+
+	if (previousClip.w <= 0.0 || any(lessThan(previousUV, vec2(0.0))) || any(greaterThan(previousUV, vec2(1.0)))) {
+		return false;
+	}
+
+	// Only kept under the stencil, so 0 where there was no SSS
+	float previousDepth = (-previousPos.z - zNear) / (zFar - zNear);
+	float historyDepth = texture(historyDepthTex, previousUV).r;
+
+	return historyDepth > 0.0 && abs(previousDepth - historyDepth) <= depthTolerance;
+}
+
+void main(void) {
+	// Gaussian weights for the six samples around the current pixel:
+	// -3 -2 -1 +1 +2 +3
+	float w[6] = float[](  0.006,  0.0610,  0.2420, 0.2420, 0.0610, 0.006 );
+	float o[6] = float[]( -1.000, -0.6667, -0.3333, 0.3333, 0.6667, 1.000 );
+
+	// Fetch color, and linear depth and material for current pixel:
+	vec4 colourM = texture(diffuseTex, IN.texCoord);
+	vec2 depthMaterial = texture(depthTex, IN.texCoord).rg;
+	float depthM = depthMaterial.r;
+	int material = int(depthMaterial.g * 255.0 + 0.5);
+
+	vec2 previousUV = vec2(0.0);
+	bool history = useHistory && reproject(depthM, previousUV);
+
+	// Accumulate center sample, multiplying it with its gaussian weight:
+	vec4 colourBlurred = colourM;
+	colourBlurred.rgb *= 0.382;
+
+	// This level's width, from the pixel's material's profile
+	float gaussianWidth = sqrt(profiles[material].gaussians[level + 1].a - profiles[material].gaussians[level].a);
+
+	// Calculate: step = sssStrength * gaussianWidth * pixelSize * dir
+	vec2 step = gaussianWidth * pixelSize * dir;
+	vec2 finalStep = colourM.a * step / depthM;
+
+	if (history) {
+		// One pair, with the weight of all three (0.242 + 0.061 + 0.006)
+		float offset = dir.x > 0.5 ? tapOffsets.x : tapOffsets.y;
+
+		for (int i = -1; i <= 1; i += 2) {
+			vec2 tap = IN.texCoord + float(i) * offset * finalStep;
+			vec3 colour = texture(diffuseTex, tap).rgb;
+			float depth = texture(depthTex, tap).r;
+
+			float s = min(0.0125 * correction * abs(depthM - depth), 1.0);
+			colour = mix(colour, colourM.rgb, s);
+
+			colourBlurred.rgb += 0.309 * colour;
+		}
+
+		// The vertical pass is the level's last, so it's what's blended with the level kept
+		if (dir.y > 0.5) {
+			colourBlurred.rgb = mix(colourBlurred.rgb, texture(historyTex, previousUV).rgb, historyWeight);
+		}
+	}
+	else {
+		// Accumulate the other samples:
+		for (int i = 0; i < 6; ++i) {
+			// Fetch color and depth for current sample:
+			vec2 offset = IN.texCoord + o[i] * finalStep;
+			vec3 colour = texture(diffuseTex, offset).rgb;
+			float depth = texture(depthTex, offset).r;
+
+			// If the difference in depth is huge, lerp color back to "colorM":
+			float s = min(0.0125 * correction * abs(depthM - depth), 1.0);
+			colour = mix(colour, colourM.rgb, s);
+
+			// Accumulate:
+			colourBlurred.rgb += w[i] * colour;
+		}
+	}
+
+	fragColor = colourBlurred;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 150 core
+
+// The tiles with SSS as two triangles each, in the quad's space with the
+// texture coordinates to match, as SSSTiles::GetTileCorners puts them. Only
+// captured, into sssPass's FeedbackMesh, in the order the tiles came in
+layout(points) in;
+layout(triangle_strip, max_vertices = 4) out;
+
+uniform vec2 screenSize;
+uniform int tileSize;
+
+in Tile {
+	vec2 tile;
+	float sss;
+} IN[];
+
+out vec3 feedbackPosition;
+out vec2 feedbackTexCoord;
+
+void emitCorner(vec2 texCoord) {
+	// sssPass's orthographic projection turns the quad's y over
+	feedbackPosition = vec3(texCoord.x * 2.0 - 1.0, 1.0 - texCoord.y * 2.0, 0.0);
+	feedbackTexCoord = texCoord;
+	EmitVertex();
+}
+
+void main(void) {
+	if (IN[0].sss < 0.5) {
+		return;
+	}
+
+	vec2 first = IN[0].tile * float(tileSize) / screenSize;
+	vec2 last = min((IN[0].tile + 1.0) * float(tileSize), screenSize) / screenSize;
+
+	emitCorner(first);
+	emitCorner(vec2(last.x, first.y));
+	emitCorner(vec2(first.x, last.y));
+	emitCorner(last);
+	EndPrimitive();
+}
\ No newline at end of file
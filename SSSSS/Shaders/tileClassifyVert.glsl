@@ -0,0 +1,34 @@
+#version 150 core
+
+// One vertex for each of the screen's tiles, drawn as points with no
+// attributes: whether any pixel of the SSS mask is within margin of it,
+// stopping at the first, as SSSTiles::BuildTileList does
+uniform sampler2D maskTex;
+
+uniform int tilesAcross;
+uniform int tileSize;
+uniform int margin;
+
+out Tile {
+	vec2 tile;
+	float sss;
+} OUT;
+
+void main(void) {
+	ivec2 tile = ivec2(gl_VertexID % tilesAcross, gl_VertexID / tilesAcross);
+	ivec2 size = textureSize(maskTex, 0);
+
+	ivec2 first = max(tile * tileSize - margin, ivec2(0));
+	ivec2 last = min((tile + 1) * tileSize + margin, size);
+
+	bool found = false;
+
+	for (int y = first.y; y < last.y && !found; ++y) {
+		for (int x = first.x; x < last.x && !found; ++x) {
+			found = texelFetch(maskTex, ivec2(x, y), 0).r > 0.5;
+		}
+	}
+
+	OUT.tile = vec2(tile);
+	OUT.sss = found ? 1.0 : 0.0;
+}
\ No newline at end of file
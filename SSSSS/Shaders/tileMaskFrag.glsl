@@ -0,0 +1,8 @@
+#version 150 core
+
+// Marks every pixel it's drawn over; sssPass draws it under the stencil, for tileClassifyVert.glsl
+out vec4 fragColor;
+
+void main(void) {
+	fragColor = vec4(1.0);
+}
\ No newline at end of file
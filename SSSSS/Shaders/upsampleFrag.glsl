@@ -0,0 +1,50 @@
+#version 150 core
+
+// Brings a blur level run at a reduced resolution back up, with the four nearest texels' bilinear
+// weights scaled down by blurFrag.glsl's depth rule, so nothing bleeds across an edge (SSSReference::Upsample)
+uniform sampler2D diffuseTex;
+uniform sampler2D depthTex;
+uniform sampler2D reducedDepthTex;
+
+uniform int factor;
+uniform float correction;
+
+out vec4 fragColor;
+
+void main(void) {
+	ivec2 size = textureSize(diffuseTex, 0);
+	float depthM = texelFetch(depthTex, ivec2(gl_FragCoord.xy), 0).r;
+
+	// Where this pixel's centre falls among the reduced texels' centres
+	vec2 uv = gl_FragCoord.xy / float(factor) - 0.5;
+	vec2 f = fract(uv);
+	ivec2 first = ivec2(floor(uv));
+
+	vec4 sum = vec4(0.0);
+	float total = 0.0;
+	vec4 nearest = vec4(0.0);
+	float nearestDifference = 0.0;
+
+	for (int t = 0; t < 4; ++t) {
+		ivec2 offset = ivec2(t % 2, t / 2);
+		ivec2 p = clamp(first + offset, ivec2(0), size - 1);
+
+		vec4 colour = texelFetch(diffuseTex, p, 0);
+		float depth = texelFetch(reducedDepthTex, p, 0).r;
+		float difference = abs(depthM - depth);
+
+		// The bilinear weight, less the further the texel's depth is from the pixel's
+		float w = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+		w *= depth > 0.0 ? 1.0 - min(0.0125 * correction * difference, 1.0) : 0.0;
+
+		sum += w * colour;
+		total += w;
+
+		if (t == 0 || difference < nearestDifference) {
+			nearest = colour;
+			nearestDifference = difference;
+		}
+	}
+
+	fragColor = total > 0.0001 ? sum / total : nearest;
+}
\ No newline at end of file